@@ -9,10 +9,12 @@
 */
 
 #include "kra.h"
+#include "util_p.h"
 
 #include <QFile>
 #include <QIODevice>
 #include <QImage>
+#include <QImageReader>
 
 #include <quazip/quazip.h>
 #include <quazip/quazipfile.h>
@@ -40,6 +42,15 @@ bool KraHandler::read(QImage *image)
 		return false;
 	}
 
+	// Small images are served from the embedded preview, if it is large enough
+	if (m_scaledSize.isValid()) {
+		auto preview = scaledPreview(readZippedImage<QuaZipFile>(zip, QStringLiteral("preview.png")), m_scaledSize);
+		if (!preview.isNull()) {
+			*image = preview;
+			return true;
+		}
+	}
+
 	zip.setCurrentFile("mergedimage.png");
 
 	if(!zip.hasCurrentFile()) {
@@ -51,9 +62,48 @@ bool KraHandler::read(QImage *image)
 		return false;
 	}
 
-	image->loadFromData(file.readAll(), "PNG");
+	// Decode straight from the compressed stream instead of inflating the
+	// whole PNG into memory first
+	QImageReader reader(&file, "PNG");
+	if (m_scaledSize.isValid()) {
+		reader.setScaledSize(m_scaledSize);
+	}
+	return reader.read(image);
+}
+
+bool KraHandler::supportsOption(ImageOption option) const
+{
+    return option == QImageIOHandler::Size || option == QImageIOHandler::ScaledSize;
+}
+
+QVariant KraHandler::option(ImageOption option) const
+{
+    QVariant v;
+
+    if (option == QImageIOHandler::Size) {
+        auto d = device();
+        if (d && !d->isSequential()) {
+            const auto pos = d->pos();
+            const auto size = mergedImageSize<QuaZip, QuaZipFile>(d);
+            d->seek(pos);
+
+            if (size.isValid())
+                v = QVariant::fromValue(size);
+        }
+    }
+
+    if (option == QImageIOHandler::ScaledSize) {
+        v = QVariant::fromValue(m_scaledSize);
+    }
 
-	return true;
+    return v;
+}
+
+void KraHandler::setOption(ImageOption option, const QVariant &value)
+{
+    if (option == QImageIOHandler::ScaledSize) {
+        m_scaledSize = value.toSize();
+    }
 }
 
 bool KraHandler::canRead(QIODevice *device)
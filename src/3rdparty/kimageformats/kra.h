@@ -18,7 +18,14 @@ public:
     bool canRead() const override;
     bool read(QImage *image) override;
 
+    bool supportsOption(QImageIOHandler::ImageOption option) const override;
+    QVariant option(QImageIOHandler::ImageOption option) const override;
+    void setOption(QImageIOHandler::ImageOption option, const QVariant &value) override;
+
     static bool canRead(QIODevice *device);
+
+private:
+    QSize m_scaledSize;
 };
 
 class KraPlugin : public QImageIOPlugin
@@ -9,9 +9,10 @@
 */
 
 #include "ora.h"
+#include "util_p.h"
 
 #include <QImage>
-#include <QScopedPointer>
+#include <QImageReader>
 
 #include <quazip/quazip.h>
 #include <quazip/quazipfile.h>
@@ -39,6 +40,15 @@ bool OraHandler::read(QImage *image)
         return false;
     }
 
+	// Small images are served from the embedded preview, if it is large enough
+	if (m_scaledSize.isValid()) {
+		auto preview = scaledPreview(readZippedImage<QuaZipFile>(zip, QStringLiteral("Thumbnails/thumbnail.png")), m_scaledSize);
+		if (!preview.isNull()) {
+			*image = preview;
+			return true;
+		}
+	}
+
 	zip.setCurrentFile("mergedimage.png");
 
 	if(!zip.hasCurrentFile()) {
@@ -50,9 +60,48 @@ bool OraHandler::read(QImage *image)
 		return false;
 	}
 
-	image->loadFromData(file.readAll(), "PNG");
+	// Decode straight from the compressed stream instead of inflating the
+	// whole PNG into memory first
+	QImageReader reader(&file, "PNG");
+	if (m_scaledSize.isValid()) {
+		reader.setScaledSize(m_scaledSize);
+	}
+	return reader.read(image);
+}
+
+bool OraHandler::supportsOption(ImageOption option) const
+{
+    return option == QImageIOHandler::Size || option == QImageIOHandler::ScaledSize;
+}
+
+QVariant OraHandler::option(ImageOption option) const
+{
+    QVariant v;
+
+    if (option == QImageIOHandler::Size) {
+        auto d = device();
+        if (d && !d->isSequential()) {
+            const auto pos = d->pos();
+            const auto size = mergedImageSize<QuaZip, QuaZipFile>(d);
+            d->seek(pos);
+
+            if (size.isValid())
+                v = QVariant::fromValue(size);
+        }
+    }
+
+    if (option == QImageIOHandler::ScaledSize) {
+        v = QVariant::fromValue(m_scaledSize);
+    }
 
-	return true;
+    return v;
+}
+
+void OraHandler::setOption(ImageOption option, const QVariant &value)
+{
+    if (option == QImageIOHandler::ScaledSize) {
+        m_scaledSize = value.toSize();
+    }
 }
 
 bool OraHandler::canRead(QIODevice *device)
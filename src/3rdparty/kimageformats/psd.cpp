@@ -32,8 +32,8 @@
  *   color management engine (e.g. LittleCMS).
  */
 
-#include "fastmath_p.h"
 #include "psd_p.h"
+#include "psdconversion_p.h"
 #include "util_p.h"
 
 #include <QDataStream>
@@ -41,6 +41,7 @@
 #include <QImage>
 #include <QColorSpace>
 
+#include <atomic>
 #include <cmath>
 #include <cstring>
 
@@ -48,18 +49,6 @@ typedef quint32 uint;
 typedef quint16 ushort;
 typedef quint8 uchar;
 
-/* The fast LAB conversion converts the image to linear sRgb instead to sRgb.
- * This should not be a problem because the Qt's QColorSpace supports the linear
- * sRgb colorspace.
- *
- * Using linear conversion, the loading speed is slightly improved. Anyway, if you are using
- * an software that discard color info, you should comment it.
- *
- * At the time I'm writing (07/2022), Gwenview and Krita supports linear sRgb but KDE
- * preview creator does not. This is the why, for now, it is disabled.
- */
-//#define PSD_FAST_LAB_CONVERSION
-
 namespace // Private.
 {
 
@@ -83,6 +72,8 @@ enum ColorMode : quint16 {
 
 enum ImageResourceId : quint16 {
     IRI_RESOLUTIONINFO = 0x03ED,
+    IRI_THUMBNAIL_PS4 = 0x0409,
+    IRI_THUMBNAIL = 0x040C,
     IRI_ICCPROFILE = 0x040F,
     IRI_TRANSPARENCYINDEX = 0x0417,
     IRI_VERSIONINFO = 0x0421,
@@ -559,6 +550,44 @@ static bool setResolution(QImage& img, const PSDImageResourceSection& irs)
     return true;
 }
 
+/*!
+ * \brief readThumbnail
+ * Reads the JPEG thumbnail stored in the image resources by Photoshop 4.0 and later.
+ * \param irs The image resource section.
+ * \return The thumbnail, or a null image if there is none.
+ */
+static QImage readThumbnail(const PSDImageResourceSection& irs)
+{
+    auto id = irs.contains(IRI_THUMBNAIL) ? IRI_THUMBNAIL : IRI_THUMBNAIL_PS4;
+    if (!irs.contains(id))
+        return {};
+
+    // Length      Description
+    // -------------------------------------------------------------------
+    // 4           Format: 1 = kJpegRGB, 0 = kRawRGB
+    // 4           Width of thumbnail in pixels
+    // 4           Height of thumbnail in pixels
+    // 4           Widthbytes: padded row bytes
+    // 4           Total size
+    // 4           Size after compression
+    // 2           Bits per pixel (24)
+    // 2           Number of planes (1)
+    // Variable    JFIF data in RGB format (BGR for Photoshop 4.0)
+    auto data = irs.value(id).data;
+    QDataStream s(data);
+    s.setByteOrder(QDataStream::BigEndian);
+
+    quint32 format;
+    s >> format;
+    if (s.status() != QDataStream::Ok || format != 1)
+        return {};
+
+    auto thumbnail = QImage::fromData(data.mid(28), "JPEG");
+    if (id == IRI_THUMBNAIL_PS4)
+        thumbnail = thumbnail.rgbSwapped();
+    return thumbnail;
+}
+
 /*!
  * \brief setTransparencyIndex
  * Search for transparency index block and, if found, changes the alpha of the value at the given index.
@@ -915,108 +944,25 @@ inline void rawChannelsCopy(uchar *target, qint32 targetChannels, const char *so
     }
 }
 
-template<class T>
-inline void cmykToRgb(uchar *target, qint32 targetChannels, const char *source, qint32 sourceChannels, qint32 width, bool alpha = false)
-{
-    auto s = reinterpret_cast<const T*>(source);
-    auto t = reinterpret_cast<T*>(target);
-    auto max = double(std::numeric_limits<T>::max());
-    auto invmax = 1.0 / max; // speed improvements by ~10%
-
-    if (sourceChannels < 3) {
-        qDebug() << "cmykToRgb: image is not a valid CMY/CMYK!";
-        return;
-    }
-
-    for (qint32 w = 0; w < width; ++w) {
-        auto ps = s + sourceChannels * w;
-        auto C = 1 - *(ps + 0) * invmax;
-        auto M = 1 - *(ps + 1) * invmax;
-        auto Y = 1 - *(ps + 2) * invmax;
-        auto K = sourceChannels > 3 ? 1 - *(ps + 3) * invmax : 0.0;
-
-        auto pt = t + targetChannels * w;
-        *(pt + 0) = T(std::min(max - (C * (1 - K) + K) * max + 0.5, max));
-        *(pt + 1) = T(std::min(max - (M * (1 - K) + K) * max + 0.5, max));
-        *(pt + 2) = T(std::min(max - (Y * (1 - K) + K) * max + 0.5, max));
-        if (targetChannels == 4) {
-            if (sourceChannels >= 5 && alpha)
-                *(pt + 3) = *(ps + 4);
-            else
-                *(pt + 3) = std::numeric_limits<T>::max();
-        }
-    }
-}
-
-inline double finv(double v)
-{
-    return (v > 6.0 / 29.0 ? v * v * v : (v - 16.0 / 116.0) / 7.787);
-}
-
-inline double gammaCorrection(double linear)
-{
-#ifdef PSD_FAST_LAB_CONVERSION
-    return linear;
-#else
-    // Replacing fastPow with std::pow the conversion time is 2/3 times longer: using fastPow
-    // there are minimal differences in the conversion that are not visually noticeable.
-    return (linear > 0.0031308 ? 1.055 * fastPow(linear, 1.0 / 2.4) - 0.055 : 12.92 * linear);
-#endif
-}
-
-template<class T>
-inline void labToRgb(uchar *target, qint32 targetChannels, const char *source, qint32 sourceChannels, qint32 width, bool alpha = false)
-{
-    auto s = reinterpret_cast<const T*>(source);
-    auto t = reinterpret_cast<T*>(target);
-    auto max = double(std::numeric_limits<T>::max());
-    auto invmax = 1.0 / max;
-
-    if (sourceChannels < 3) {
-        qDebug() << "labToRgb: image is not a valid LAB!";
-        return;
-    }
-
-    for (qint32 w = 0; w < width; ++w) {
-        auto ps = s + sourceChannels * w;
-        auto L = (*(ps + 0) * invmax) * 100.0;
-        auto A = (*(ps + 1) * invmax) * 255.0 - 128.0;
-        auto B = (*(ps + 2) * invmax) * 255.0 - 128.0;
-
-        // converting LAB to XYZ (D65 illuminant)
-        auto Y = (L + 16.0) * (1.0 / 116.0);
-        auto X = A * (1.0 / 500.0) + Y;
-        auto Z = Y - B * (1.0 / 200.0);
-
-        // NOTE: use the constants of the illuminant of the target RGB color space
-        X = finv(X) * 0.9504;   // D50: * 0.9642
-        Y = finv(Y) * 1.0000;   // D50: * 1.0000
-        Z = finv(Z) * 1.0888;   // D50: * 0.8251
-
-        // converting XYZ to sRGB (sRGB illuminant is D65)
-        auto r = gammaCorrection(  3.24071   * X - 1.53726  * Y - 0.498571  * Z);
-        auto g = gammaCorrection(- 0.969258  * X + 1.87599  * Y + 0.0415557 * Z);
-        auto b = gammaCorrection(  0.0556352 * X - 0.203996 * Y + 1.05707   * Z);
-
-        auto pt = t + targetChannels * w;
-        *(pt + 0) = T(std::max(std::min(r * max + 0.5, max), 0.0));
-        *(pt + 1) = T(std::max(std::min(g * max + 0.5, max), 0.0));
-        *(pt + 2) = T(std::max(std::min(b * max + 0.5, max), 0.0));
-        if (targetChannels == 4) {
-            if (sourceChannels >= 4 && alpha)
-                *(pt + 3) = *(ps + 3);
-            else
-                *(pt + 3) = std::numeric_limits<T>::max();
-        }
-    }
-}
-
-bool readChannel(QByteArray& target, QDataStream &stream, quint32 compressedSize, quint16 compression)
+/*!
+ * \brief readChannel
+ * Reads a (possibly compressed) stride into \a target. If the file is memory
+ * mapped, compressed data is decompressed straight from \a mapping.
+ */
+bool readChannel(QByteArray& target, QDataStream &stream, quint32 compressedSize, quint16 compression, const DeviceMapping *mapping)
 {
     if (compression) {
         if (compressedSize > kMaxQVectorSize) {
             return false;
         }
+        if (mapping) {
+            if (auto data = mapping->data(stream.device()->pos(), compressedSize)) {
+                if (decompress(reinterpret_cast<const char *>(data), compressedSize, target.data(), target.size()) < 0) {
+                    return false;
+                }
+                return stream.skipRawData(compressedSize) == qint64(compressedSize);
+            }
+        }
         QByteArray tmp;
         tmp.resize(compressedSize);
         if (stream.readRawData(tmp.data(), tmp.size()) != tmp.size()) {
@@ -1033,8 +979,86 @@ bool readChannel(QByteArray& target, QDataStream &stream, quint32 compressedSize
     return stream.status() == QDataStream::Ok;
 }
 
+/*!
+ * \brief interleaveChannel
+ * Copies the stride of channel \a c into an interleaved PSD scanline.
+ */
+static void interleaveChannel(char *psdScanline, const char *stride, const PSDHeader &header, qint32 c)
+{
+    auto scanLine = reinterpret_cast<unsigned char*>(psdScanline);
+    if (header.depth == 8) {
+        planarToChunchy<quint8>(scanLine, stride, header.width, c, header.channel_count);
+    }
+    else if (header.depth == 16) {
+        planarToChunchy<quint16>(scanLine, stride, header.width, c, header.channel_count);
+    }
+    else if (header.depth == 32) {
+        planarToChunchy<float>(scanLine, stride, header.width, c, header.channel_count);
+    }
+}
+
+/*!
+ * \brief convertScanline
+ * Converts an interleaved PSD scanline to the format of the image.
+ * \param target The scanline of the image.
+ * \param psdScanline The interleaved PSD scanline (modified in place when it has to be unpremultiplied).
+ * \param imageAlpha True if the image has an alpha channel.
+ * \param alpha True if the PSD scanline has an alpha channel.
+ */
+static void convertScanline(uchar *target, char *psdScanline, const PSDHeader &header, qint32 imgChannels, bool imageAlpha, bool alpha)
+{
+    // Convert premultiplied data to unassociated data
+    if (imageAlpha) {
+        if (header.color_mode == CM_CMYK) {
+            if (header.depth == 8)
+                premulConversion<quint8>(psdScanline, header.width, 4, header.channel_count, PremulConversion::PS2A);
+            else if (header.depth == 16)
+                premulConversion<quint16>(psdScanline, header.width, 4, header.channel_count, PremulConversion::PS2A);
+        }
+        if (header.color_mode == CM_LABCOLOR) {
+            if (header.depth == 8)
+                premulConversion<quint8>(psdScanline, header.width, 3, header.channel_count, PremulConversion::PSLab2A);
+            else if (header.depth == 16)
+                premulConversion<quint16>(psdScanline, header.width, 3, header.channel_count, PremulConversion::PSLab2A);
+        }
+        if (header.color_mode == CM_RGB) {
+            if (header.depth == 8)
+                premulConversion<quint8>(psdScanline, header.width, 3, header.channel_count, PremulConversion::PS2P);
+            else if (header.depth == 16)
+                premulConversion<quint16>(psdScanline, header.width, 3, header.channel_count, PremulConversion::PS2P);
+            else if (header.depth == 32)
+                premulConversion<float>(psdScanline, header.width, 3, header.channel_count, PremulConversion::PS2P);
+        }
+    }
+
+    // Conversion to RGB
+    if (header.color_mode == CM_CMYK || header.color_mode == CM_MULTICHANNEL) {
+        if (header.depth == 8)
+            cmykToRgb<quint8>(target, imgChannels, psdScanline, header.channel_count, header.width, alpha);
+        else if (header.depth == 16)
+            cmykToRgb<quint16>(target, imgChannels, psdScanline, header.channel_count, header.width, alpha);
+    }
+    if (header.color_mode == CM_LABCOLOR) {
+        if (header.depth == 8)
+            labToRgb<quint8>(target, imgChannels, psdScanline, header.channel_count, header.width, alpha);
+        else if (header.depth == 16)
+            labToRgb<quint16>(target, imgChannels, psdScanline, header.channel_count, header.width, alpha);
+    }
+    if (header.color_mode == CM_RGB) {
+        if (header.depth == 8)
+            rawChannelsCopy<quint8>(target, imgChannels, psdScanline, header.channel_count, header.width);
+        else if (header.depth == 16)
+            rawChannelsCopy<quint16>(target, imgChannels, psdScanline, header.channel_count, header.width);
+        else if (header.depth == 32)
+            rawChannelsCopy<float>(target, imgChannels, psdScanline, header.channel_count, header.width);
+    }
+}
+
+// Largest channel planes that LoadPSD() reads into memory at once (see psdSetMaxPlanesSize()).
+static std::atomic<qint64> maxPlanesSize = kMaxQVectorSize;
+
 // Load the PSD image.
-static bool LoadPSD(QDataStream &stream, const PSDHeader &header, QImage &img)
+static bool LoadPSD(QDataStream &stream, const PSDHeader &header, QImage &img, const DeviceMapping *mapping, const QSize &scaledSize)
 {
     // Checking for PSB
     auto isPsb = header.version == 2;
@@ -1053,6 +1077,12 @@ static bool LoadPSD(QDataStream &stream, const PSDHeader &header, QImage &img)
         qDebug() << "Error while reading Image Resources Section";
         return false;
     }
+    // Small images are served from the embedded thumbnail, if it is large enough
+    if (scaledSize.isValid()) {
+        img = scaledPreview(readThumbnail(irs), scaledSize);
+        if (!img.isNull())
+            return true;
+    }
     // Checking for merged image (Photoshop compatibility data)
     if (!hasMergedData(irs)) {
         qDebug() << "No merged data found";
@@ -1144,10 +1174,78 @@ static bool LoadPSD(QDataStream &stream, const PSDHeader &header, QImage &img)
                         (header.color_mode != CM_INDEXED && img.hasAlphaChannel());
     // clang-format on
 
-    if (randomAccess) {
-        // In order to make a colorspace transformation, we need all channels of a scanline
+    // In order to make a colorspace transformation, we need all channels of a scanline.
+    // Instead of seeking back and forth between the channel planes for each scanline,
+    // all planes are read in one pass (or used in place, if the file is memory mapped)
+    // and bands of scanlines are then decompressed and converted in parallel.
+    const qint64 planesOffset = stridePositions.isEmpty() ? device->pos() : qint64(stridePositions.first());
+    const qint64 planesSize = stridePositions.isEmpty() ? 0 : qint64(stridePositions.last() + strides.last()) - planesOffset;
+    QByteArray planes;
+    const char *planesData = nullptr;
+    qint64 planesAvailable = 0;
+    if (randomAccess && mapping) {
+        planesData = reinterpret_cast<const char *>(mapping->data(planesOffset, planesSize));
+        planesAvailable = planesSize;
+    }
+    if (randomAccess && planesData == nullptr && planesSize <= maxPlanesSize) {
+        planes = device->read(planesSize);
+        planesData = planes.constData();
+        planesAvailable = planes.size();
+    }
+
+    const qsizetype psdScanlineSize = qsizetype(header.width * header.depth * header.channel_count + 7) / 8;
+
+    if (randomAccess && planesData != nullptr) {
+        constexpr qint32 bandHeight = 16;
+        const qint32 h = header.height;
+        const bool imageAlpha = img.hasAlphaChannel();
+        const qsizetype bytesPerLine = img.bytesPerLine();
+        uchar *bits = img.bits();
+
+        std::atomic<bool> ok = true;
+        parallelFor((h + bandHeight - 1) / bandHeight, [&](qsizetype band, QByteArray &scratch) {
+            // The scratch buffer holds a stride followed by an interleaved scanline
+            if (scratch.size() < raw_count + psdScanlineSize) {
+                scratch.resize(raw_count + psdScanlineSize);
+            }
+            auto stride = scratch.data();
+            auto psdScanline = stride + raw_count;
+
+            for (qint32 y = qint32(band) * bandHeight, yEnd = std::min(y + bandHeight, h); y < yEnd && ok; ++y) {
+                for (qint32 c = 0; c < header.channel_count; ++c) {
+                    auto strideNumber = c * qsizetype(h) + y;
+                    auto strideOffset = qint64(stridePositions.at(strideNumber)) - planesOffset;
+                    auto strideSize = strides.at(strideNumber);
+                    if (strideOffset + strideSize > planesAvailable) {
+                        qDebug() << "Error while reading the stream of channel" << c << "line" << y;
+                        ok = false;
+                        return;
+                    }
+                    if (compression) {
+                        if (decompress(planesData + strideOffset, strideSize, stride, raw_count) < 0) {
+                            qDebug() << "Error while decompressing the stream of channel" << c << "line" << y;
+                            ok = false;
+                            return;
+                        }
+                    }
+                    else {
+                        memcpy(stride, planesData + strideOffset, raw_count);
+                    }
+
+                    interleaveChannel(psdScanline, stride, header, c);
+                }
+
+                convertScanline(bits + y * bytesPerLine, psdScanline, header, imgChannels, imageAlpha, alpha);
+            }
+        });
+        if (!ok) {
+            return false;
+        }
+    }
+    else if (randomAccess) {
+        // Planes too large to be read at once: seek to each stride
         QByteArray psdScanline;
-        psdScanline.resize(qsizetype(header.width * header.depth * header.channel_count + 7) / 8);
+        psdScanline.resize(psdScanlineSize);
         for (qint32 y = 0, h = header.height; y < h; ++y) {
             for (qint32 c = 0; c < header.channel_count; ++c) {
                 auto strideNumber = c * qsizetype(h) + y;
@@ -1156,69 +1254,15 @@ static bool LoadPSD(QDataStream &stream, const PSDHeader &header, QImage &img)
                     return false;
                 }
                 auto&& strideSize = strides.at(strideNumber);
-                if (!readChannel(rawStride, stream, strideSize, compression)) {
+                if (!readChannel(rawStride, stream, strideSize, compression, mapping)) {
                     qDebug() << "Error while reading the stream of channel" << c << "line" << y;
                     return false;
                 }
 
-                auto scanLine = reinterpret_cast<unsigned char*>(psdScanline.data());
-                if (header.depth == 8) {
-                    planarToChunchy<quint8>(scanLine, rawStride.data(), header.width, c, header.channel_count);
-                }
-                else if (header.depth == 16) {
-                    planarToChunchy<quint16>(scanLine, rawStride.data(), header.width, c, header.channel_count);
-                }
-                else if (header.depth == 32) {
-                    planarToChunchy<float>(scanLine, rawStride.data(), header.width, c, header.channel_count);
-                }
+                interleaveChannel(psdScanline.data(), rawStride.constData(), header, c);
             }
 
-            // Convert premultiplied data to unassociated data
-            if (img.hasAlphaChannel()) {
-                auto scanLine = reinterpret_cast<char*>(psdScanline.data());
-                if (header.color_mode == CM_CMYK) {
-                    if (header.depth == 8)
-                        premulConversion<quint8>(scanLine, header.width, 4, header.channel_count, PremulConversion::PS2A);
-                    else if (header.depth == 16)
-                        premulConversion<quint16>(scanLine, header.width, 4, header.channel_count, PremulConversion::PS2A);
-                }
-                if (header.color_mode == CM_LABCOLOR) {
-                    if (header.depth == 8)
-                        premulConversion<quint8>(scanLine, header.width, 3, header.channel_count, PremulConversion::PSLab2A);
-                    else if (header.depth == 16)
-                        premulConversion<quint16>(scanLine, header.width, 3, header.channel_count, PremulConversion::PSLab2A);
-                }
-                if (header.color_mode == CM_RGB) {
-                    if (header.depth == 8)
-                        premulConversion<quint8>(scanLine, header.width, 3, header.channel_count, PremulConversion::PS2P);
-                    else if (header.depth == 16)
-                        premulConversion<quint16>(scanLine, header.width, 3, header.channel_count, PremulConversion::PS2P);
-                    else if (header.depth == 32)
-                        premulConversion<float>(scanLine, header.width, 3, header.channel_count, PremulConversion::PS2P);
-                }
-            }
-
-            // Conversion to RGB
-            if (header.color_mode == CM_CMYK || header.color_mode == CM_MULTICHANNEL) {
-                if (header.depth == 8)
-                    cmykToRgb<quint8>(img.scanLine(y), imgChannels, psdScanline.data(), header.channel_count, header.width, alpha);
-                else if (header.depth == 16)
-                    cmykToRgb<quint16>(img.scanLine(y), imgChannels, psdScanline.data(), header.channel_count, header.width, alpha);
-            }
-            if (header.color_mode == CM_LABCOLOR) {
-                if (header.depth == 8)
-                    labToRgb<quint8>(img.scanLine(y), imgChannels, psdScanline.data(), header.channel_count, header.width, alpha);
-                else if (header.depth == 16)
-                    labToRgb<quint16>(img.scanLine(y), imgChannels, psdScanline.data(), header.channel_count, header.width, alpha);
-            }
-            if (header.color_mode == CM_RGB) {
-                if (header.depth == 8)
-                    rawChannelsCopy<quint8>(img.scanLine(y), imgChannels, psdScanline.data(), header.channel_count, header.width);
-                else if (header.depth == 16)
-                    rawChannelsCopy<quint16>(img.scanLine(y), imgChannels, psdScanline.data(), header.channel_count, header.width);
-                else if (header.depth == 32)
-                    rawChannelsCopy<float>(img.scanLine(y), imgChannels, psdScanline.data(), header.channel_count, header.width);
-            }
+            convertScanline(img.scanLine(y), psdScanline.data(), header, imgChannels, img.hasAlphaChannel(), alpha);
         }
     }
     else {
@@ -1226,7 +1270,7 @@ static bool LoadPSD(QDataStream &stream, const PSDHeader &header, QImage &img)
         for (qint32 c = 0; c < channel_num; ++c) {
             for (qint32 y = 0, h = header.height; y < h; ++y) {
                 auto&& strideSize = strides.at(c * qsizetype(h) + y);
-                if (!readChannel(rawStride, stream, strideSize, compression)) {
+                if (!readChannel(rawStride, stream, strideSize, compression, mapping)) {
                     qDebug() << "Error while reading the stream of channel" << c << "line" << y;
                     return false;
                 }
@@ -1287,6 +1331,11 @@ static bool LoadPSD(QDataStream &stream, const PSDHeader &header, QImage &img)
 
 } // Private
 
+void psdSetMaxPlanesSize(qint64 size)
+{
+    maxPlanesSize = size < 0 ? kMaxQVectorSize : size;
+}
+
 PSDHandler::PSDHandler()
 {
 }
@@ -1302,7 +1351,8 @@ bool PSDHandler::canRead() const
 
 bool PSDHandler::read(QImage *image)
 {
-    QDataStream s(device());
+    DeviceMapping mapping(device());
+    QDataStream s(mapping.device());
     s.setByteOrder(QDataStream::BigEndian);
 
     PSDHeader header;
@@ -1321,11 +1371,15 @@ bool PSDHandler::read(QImage *image)
     }
 
     QImage img;
-    if (!LoadPSD(s, header, img)) {
+    if (!LoadPSD(s, header, img, mapping.data() ? &mapping : nullptr, m_scaledSize)) {
         //         qDebug() << "Error loading PSD file.";
         return false;
     }
 
+    if (m_scaledSize.isValid() && img.size() != m_scaledSize) {
+        img = img.scaled(m_scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
     *image = img;
     return true;
 }
@@ -1334,6 +1388,8 @@ bool PSDHandler::supportsOption(ImageOption option) const
 {
     if (option == QImageIOHandler::Size)
         return true;
+    if (option == QImageIOHandler::ScaledSize)
+        return true;
     return false;
 }
 
@@ -1359,9 +1415,20 @@ QVariant PSDHandler::option(ImageOption option) const
         }
     }
 
+    if (option == QImageIOHandler::ScaledSize) {
+        v = QVariant::fromValue(m_scaledSize);
+    }
+
     return v;
 }
 
+void PSDHandler::setOption(ImageOption option, const QVariant &value)
+{
+    if (option == QImageIOHandler::ScaledSize) {
+        m_scaledSize = value.toSize();
+    }
+}
+
 bool PSDHandler::canRead(QIODevice *device)
 {
     if (!device) {
@@ -10,6 +10,15 @@
 
 #include <QImageIOPlugin>
 
+/*!
+ * Sets the largest size of the channel planes that are read into memory at
+ * once when the device is not memory mapped. Larger planes are read one
+ * stride at a time instead. A negative \a size restores the default.
+ *
+ * Only meant for the Wespal test suite, to exercise both code paths.
+ */
+void psdSetMaxPlanesSize(qint64 size);
+
 class PSDHandler : public QImageIOHandler
 {
 public:
@@ -20,8 +29,12 @@ public:
 
     bool supportsOption(QImageIOHandler::ImageOption option) const override;
     QVariant option(QImageIOHandler::ImageOption option) const override;
+    void setOption(QImageIOHandler::ImageOption option, const QVariant &value) override;
 
     static bool canRead(QIODevice *device);
+
+private:
+    QSize m_scaledSize;
 };
 
 class PSDPlugin : public QImageIOPlugin
@@ -0,0 +1,237 @@
+/*
+    Color conversions used by the PSD plugin.
+
+    SPDX-FileCopyrightText: 2003 Ignacio Castaño <castano@ludicon.com>
+    SPDX-FileCopyrightText: 2015 Alex Merry <alex.merry@kde.org>
+    SPDX-FileCopyrightText: 2022-2023 Mirco Miranda <mircomir@outlook.com>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef KIMG_PSDCONVERSION_P_H
+#define KIMG_PSDCONVERSION_P_H
+
+#include "fastmath_p.h"
+
+#include <QDebug>
+#include <QtGlobal>
+
+#include <algorithm>
+#include <limits>
+
+/* The fast LAB conversion converts the image to linear sRgb instead to sRgb.
+ * This should not be a problem because the Qt's QColorSpace supports the linear
+ * sRgb colorspace.
+ *
+ * Using linear conversion, the loading speed is slightly improved. Anyway, if you are using
+ * an software that discard color info, you should comment it.
+ *
+ * At the time I'm writing (07/2022), Gwenview and Krita supports linear sRgb but KDE
+ * preview creator does not. This is the why, for now, it is disabled.
+ */
+//#define PSD_FAST_LAB_CONVERSION
+
+/*!
+ * Maximum difference per channel between labToRgb<quint8>() and
+ * labToRgbDouble<quint8>(). cmykToRgb() matches the double precision formula
+ * exactly. These are checked by the Wespal test suite.
+ */
+static constexpr int kLab8Tolerance = 1;
+
+/*!
+ * \brief cmykToRgb
+ * Converts CMY(K) to RGB. PSD stores inverted inks, so with c = max - C (and
+ * so on) the usual R = (1 - C) * (1 - K) becomes c * k / max. That is computed
+ * in 32-bit integers (65535 * 65535 + 32767 still fits) and rounds exactly
+ * like the equivalent floating point formula.
+ */
+template<class T>
+inline void cmykToRgb(uchar *target, qint32 targetChannels, const char *source, qint32 sourceChannels, qint32 width, bool alpha = false)
+{
+    static_assert(std::numeric_limits<T>::is_integer && sizeof(T) <= 2, "cmykToRgb: only 8 and 16-bit channels are supported");
+
+    auto s = reinterpret_cast<const T*>(source);
+    auto t = reinterpret_cast<T*>(target);
+    constexpr quint32 max = std::numeric_limits<T>::max();
+
+    if (sourceChannels < 3) {
+        qDebug() << "cmykToRgb: image is not a valid CMY/CMYK!";
+        return;
+    }
+
+    for (qint32 w = 0; w < width; ++w) {
+        auto ps = s + sourceChannels * w;
+        const quint32 k = sourceChannels > 3 ? *(ps + 3) : max;
+
+        auto pt = t + targetChannels * w;
+        *(pt + 0) = T((*(ps + 0) * k + max / 2) / max);
+        *(pt + 1) = T((*(ps + 1) * k + max / 2) / max);
+        *(pt + 2) = T((*(ps + 2) * k + max / 2) / max);
+        if (targetChannels == 4) {
+            if (sourceChannels >= 5 && alpha)
+                *(pt + 3) = *(ps + 4);
+            else
+                *(pt + 3) = std::numeric_limits<T>::max();
+        }
+    }
+}
+
+inline double finv(double v)
+{
+    return (v > 6.0 / 29.0 ? v * v * v : (v - 16.0 / 116.0) / 7.787);
+}
+
+inline double gammaCorrection(double linear)
+{
+#ifdef PSD_FAST_LAB_CONVERSION
+    return linear;
+#else
+    // Replacing fastPow with std::pow the conversion time is 2/3 times longer: using fastPow
+    // there are minimal differences in the conversion that are not visually noticeable.
+    return (linear > 0.0031308 ? 1.055 * fastPow(linear, 1.0 / 2.4) - 0.055 : 12.92 * linear);
+#endif
+}
+
+/*!
+ * \brief labToRgbDouble
+ * Converts Lab to sRGB in double precision. This is what labToRgb() uses for
+ * 16-bit channels, and the reference its 8-bit version is checked against.
+ */
+template<class T>
+inline void labToRgbDouble(uchar *target, qint32 targetChannels, const char *source, qint32 sourceChannels, qint32 width, bool alpha = false)
+{
+    auto s = reinterpret_cast<const T*>(source);
+    auto t = reinterpret_cast<T*>(target);
+    auto max = double(std::numeric_limits<T>::max());
+    auto invmax = 1.0 / max;
+
+    if (sourceChannels < 3) {
+        qDebug() << "labToRgb: image is not a valid LAB!";
+        return;
+    }
+
+    for (qint32 w = 0; w < width; ++w) {
+        auto ps = s + sourceChannels * w;
+        auto L = (*(ps + 0) * invmax) * 100.0;
+        auto A = (*(ps + 1) * invmax) * 255.0 - 128.0;
+        auto B = (*(ps + 2) * invmax) * 255.0 - 128.0;
+
+        // converting LAB to XYZ (D65 illuminant)
+        auto Y = (L + 16.0) * (1.0 / 116.0);
+        auto X = A * (1.0 / 500.0) + Y;
+        auto Z = Y - B * (1.0 / 200.0);
+
+        // NOTE: use the constants of the illuminant of the target RGB color space
+        X = finv(X) * 0.9504;   // D50: * 0.9642
+        Y = finv(Y) * 1.0000;   // D50: * 1.0000
+        Z = finv(Z) * 1.0888;   // D50: * 0.8251
+
+        // converting XYZ to sRGB (sRGB illuminant is D65)
+        auto r = gammaCorrection(  3.24071   * X - 1.53726  * Y - 0.498571  * Z);
+        auto g = gammaCorrection(- 0.969258  * X + 1.87599  * Y + 0.0415557 * Z);
+        auto b = gammaCorrection(  0.0556352 * X - 0.203996 * Y + 1.05707   * Z);
+
+        auto pt = t + targetChannels * w;
+        *(pt + 0) = T(std::max(std::min(r * max + 0.5, max), 0.0));
+        *(pt + 1) = T(std::max(std::min(g * max + 0.5, max), 0.0));
+        *(pt + 2) = T(std::max(std::min(b * max + 0.5, max), 0.0));
+        if (targetChannels == 4) {
+            if (sourceChannels >= 4 && alpha)
+                *(pt + 3) = *(ps + 3);
+            else
+                *(pt + 3) = std::numeric_limits<T>::max();
+        }
+    }
+}
+
+template<class T>
+inline void labToRgb(uchar *target, qint32 targetChannels, const char *source, qint32 sourceChannels, qint32 width, bool alpha = false)
+{
+    labToRgbDouble<T>(target, targetChannels, source, sourceChannels, width, alpha);
+}
+
+/*!
+ * \brief The Gamma8Table class
+ * gammaCorrection() tabulated for 8-bit output. The table covers linear values
+ * up to 2 since, using fastPow(), the corrected value only reaches 1 at about
+ * 1.08.
+ */
+class Gamma8Table
+{
+public:
+    static constexpr qint32 size = 16384;
+    static constexpr float range = 2.0f;
+
+    Gamma8Table()
+    {
+        for (qint32 i = 0; i <= size; ++i) {
+            auto v = gammaCorrection(i * double(range) / size);
+            table[i] = quint8(std::max(std::min(v * 255.0 + 0.5, 255.0), 0.0));
+        }
+    }
+
+    quint8 operator()(float linear) const
+    {
+        return table[qint32(std::max(std::min(linear * (size / range) + 0.5f, float(size)), 0.0f))];
+    }
+
+private:
+    quint8 table[size + 1];
+};
+
+inline float finv(float v)
+{
+    // both branches are computed so that the compiler can use a conditional move
+    auto cube = v * v * v;
+    auto linear = (v - 16.0f / 116.0f) * (1.0f / 7.787f);
+    return v > 6.0f / 29.0f ? cube : linear;
+}
+
+/*!
+ * \brief labToRgb
+ * 8-bit version of labToRgb() using single precision and a gamma correction
+ * table. The result is within kLab8Tolerance of labToRgbDouble() for every
+ * possible Lab input (less than 1% of the channels differ at all).
+ */
+template<>
+inline void labToRgb<quint8>(uchar *target, qint32 targetChannels, const char *source, qint32 sourceChannels, qint32 width, bool alpha)
+{
+    static const Gamma8Table gammaTable;
+    auto s = reinterpret_cast<const quint8*>(source);
+    auto t = target;
+
+    if (sourceChannels < 3) {
+        qDebug() << "labToRgb: image is not a valid LAB!";
+        return;
+    }
+
+    for (qint32 w = 0; w < width; ++w) {
+        auto ps = s + sourceChannels * w;
+        auto L = *(ps + 0) * (100.0f / 255.0f);
+        auto A = *(ps + 1) - 128.0f;
+        auto B = *(ps + 2) - 128.0f;
+
+        // converting LAB to XYZ (D65 illuminant)
+        auto Y = (L + 16.0f) * (1.0f / 116.0f);
+        auto X = A * (1.0f / 500.0f) + Y;
+        auto Z = Y - B * (1.0f / 200.0f);
+
+        X = finv(X) * 0.9504f;
+        Y = finv(Y);
+        Z = finv(Z) * 1.0888f;
+
+        // converting XYZ to sRGB (sRGB illuminant is D65)
+        auto pt = t + targetChannels * w;
+        *(pt + 0) = gammaTable(  3.24071f   * X - 1.53726f  * Y - 0.498571f  * Z);
+        *(pt + 1) = gammaTable(- 0.969258f  * X + 1.87599f  * Y + 0.0415557f * Z);
+        *(pt + 2) = gammaTable(  0.0556352f * X - 0.203996f * Y + 1.05707f   * Z);
+        if (targetChannels == 4) {
+            if (sourceChannels >= 4 && alpha)
+                *(pt + 3) = *(ps + 3);
+            else
+                *(pt + 3) = std::numeric_limits<quint8>::max();
+        }
+    }
+}
+
+#endif // KIMG_PSDCONVERSION_P_H
@@ -8,10 +8,22 @@
 #ifndef UTIL_P_H
 #define UTIL_P_H
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <limits>
+#include <memory>
 
+#include <QBuffer>
+#include <QByteArray>
+#include <QDateTime>
+#include <QFileDevice>
 #include <QImage>
 #include <QImageIOHandler>
+#include <QImageReader>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
 
 // QList uses some extra space for stuff, hence the 32 here suggested by Thiago Macieira
 static constexpr int kMaxQVectorSize = std::numeric_limits<int>::max() - 32;
@@ -32,4 +44,266 @@ inline QImage imageAlloc(qint32 width, qint32 height, const QImage::Format &form
     return imageAlloc(QSize(width, height), format);
 }
 
+/*!
+ * Returns an embedded preview scaled to the size requested through
+ * QImageIOHandler::ScaledSize, or a null image if the preview is missing or
+ * smaller than that size (in which case the full image must be decoded).
+ */
+inline QImage scaledPreview(const QImage &preview, const QSize &scaledSize)
+{
+    if (preview.isNull() || preview.width() < scaledSize.width() || preview.height() < scaledSize.height()) {
+        return {};
+    }
+    return preview.scaled(scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
+
+/*!
+ * Returns the size of the merged image of a zipped document (ORA or KRA) from
+ * its PNG header, without inflating any pixel data.
+ *
+ * This and readZippedImage() are templates over the QuaZip classes so that
+ * plugins that do not use QuaZip do not need its headers.
+ */
+template<typename Zip, typename ZipFile>
+QSize mergedImageSize(QIODevice *device)
+{
+    Zip zip(device);
+    if (!zip.open(Zip::mdUnzip) || !zip.setCurrentFile(QStringLiteral("mergedimage.png"))) {
+        return {};
+    }
+
+    ZipFile file(&zip);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    return QImageReader(&file, "PNG").size();
+}
+
+/*!
+ * Reads a PNG image stored in a zipped document, or returns a null image if
+ * there is none.
+ */
+template<typename ZipFile, typename Zip>
+QImage readZippedImage(Zip &zip, const QString &fileName)
+{
+    if (!zip.setCurrentFile(fileName)) {
+        return {};
+    }
+
+    ZipFile file(&zip);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    return QImageReader(&file, "PNG").read();
+}
+
+/*!
+ * Memory maps the file behind a QIODevice, if possible, so that it can be
+ * parsed without a system call per read and compressed data can be decoded
+ * straight from the mapping.
+ *
+ * Reading a mapping past the end of a file that was truncated after mapping
+ * it raises SIGBUS instead of failing gracefully. As a best-effort measure
+ * against that, files modified less than kMinMappedFileAge ms ago (e.g.
+ * reloaded as soon as an editor saved them, and thus possibly still being
+ * written), or whose size or modification time changes while mapping them,
+ * are read into memory in one go instead, at the cost of holding a copy of
+ * the whole file. This only narrows the window: a mapped file that another
+ * process truncates while it is being decoded still crashes the reader, so
+ * mapping is only worthwhile for files that are not expected to change.
+ *
+ * device() returns a QBuffer over the file contents, positioned like the
+ * original device, or the original device itself if the contents could not
+ * be loaded (e.g. it is not a file or it is sequential). data() returns the
+ * contents of the whole file, or nullptr if they are not loaded. On
+ * destruction, the original device is moved to the current position of the
+ * buffer.
+ */
+class DeviceMapping
+{
+public:
+    static constexpr qint64 kMinMappedFileAge = 2000;
+
+    explicit DeviceMapping(QIODevice *device)
+        : m_device(device)
+    {
+        auto file = qobject_cast<QFileDevice *>(device);
+        if (file == nullptr || file->isSequential() || file->size() <= 0) {
+            return;
+        }
+
+        const qint64 pos = file->pos();
+        const qint64 size = file->size();
+        const QDateTime modified = file->fileTime(QFileDevice::FileModificationTime);
+
+        if (modified.isValid() && modified.msecsTo(QDateTime::currentDateTimeUtc()) >= kMinMappedFileAge) {
+            m_mapped = file->map(0, size);
+            if (m_mapped != nullptr && (file->size() != size || file->fileTime(QFileDevice::FileModificationTime) != modified)) {
+                file->unmap(m_mapped);
+                m_mapped = nullptr;
+            }
+        }
+
+        if (m_mapped != nullptr) {
+            m_data = m_mapped;
+        } else {
+            if (!file->seek(0)) {
+                return;
+            }
+            m_contents = file->read(size);
+            if (m_contents.size() != size) {
+                m_contents.clear();
+                file->seek(pos);
+                return;
+            }
+            m_data = reinterpret_cast<const uchar *>(m_contents.constData());
+        }
+
+        m_file = file;
+        m_size = size;
+        m_buffer.setData(QByteArray::fromRawData(reinterpret_cast<const char *>(m_data), m_size));
+        if (!m_buffer.open(QIODevice::ReadOnly) || !m_buffer.seek(pos)) {
+            m_file->seek(pos);
+            release();
+        }
+    }
+
+    ~DeviceMapping()
+    {
+        if (m_file != nullptr) {
+            m_file->seek(m_buffer.pos());
+            release();
+        }
+    }
+
+    DeviceMapping(const DeviceMapping &) = delete;
+    DeviceMapping &operator=(const DeviceMapping &) = delete;
+
+    QIODevice *device()
+    {
+        return m_file != nullptr ? static_cast<QIODevice *>(&m_buffer) : m_device;
+    }
+
+    const uchar *data() const
+    {
+        return m_data;
+    }
+
+    qint64 size() const
+    {
+        return m_size;
+    }
+
+    /*!
+     * Returns a pointer to \a length bytes of the file at \a offset, or
+     * nullptr if the file is not loaded or the range is not inside it.
+     */
+    const uchar *data(qint64 offset, qint64 length) const
+    {
+        if (m_data == nullptr || offset < 0 || length < 0 || offset > m_size - length) {
+            return nullptr;
+        }
+        return m_data + offset;
+    }
+
+private:
+    void release()
+    {
+        m_buffer.close();
+        m_buffer.setData(QByteArray());
+        if (m_mapped != nullptr) {
+            m_file->unmap(m_mapped);
+        }
+        m_contents.clear();
+        m_file = nullptr;
+        m_mapped = nullptr;
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    QIODevice *m_device;
+    QFileDevice *m_file = nullptr;
+    uchar *m_mapped = nullptr;
+    QByteArray m_contents;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    QBuffer m_buffer;
+};
+
+namespace ParallelForPrivate
+{
+struct State {
+    std::function<void(qsizetype, QByteArray &)> body;
+    qsizetype count = 0;
+    std::atomic<qsizetype> next{0};
+    QMutex mutex;
+    QWaitCondition finished;
+    int active = 0;
+    bool closed = false;
+
+    void work()
+    {
+        QByteArray scratch;
+        for (qsizetype index = next++; index < count; index = next++) {
+            body(index, scratch);
+        }
+    }
+};
+} // namespace ParallelForPrivate
+
+/*!
+ * Calls \a body for every index in [0, \a count), spreading the calls over the
+ * calling thread and the global thread pool. Indices are handed out one at a
+ * time, so unevenly sized items still balance well.
+ *
+ * Each thread passes its own scratch buffer to \a body, which may be used to
+ * avoid reallocating temporary buffers for every item.
+ *
+ * The calling thread always takes part in the work and helpers that only get
+ * to run after it is done return without doing anything, so this completes
+ * even if the pool is busy (e.g. when called from a pool thread itself).
+ */
+inline void parallelFor(qsizetype count, std::function<void(qsizetype, QByteArray &)> body)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    auto state = std::make_shared<ParallelForPrivate::State>();
+    state->body = std::move(body);
+    state->count = count;
+
+    auto pool = QThreadPool::globalInstance();
+    const qsizetype helpers = std::min<qsizetype>(pool->maxThreadCount(), count) - 1;
+
+    for (qsizetype i = 0; i < helpers; ++i) {
+        pool->start([state]() {
+            {
+                QMutexLocker locker(&state->mutex);
+                if (state->closed) {
+                    return;
+                }
+                ++state->active;
+            }
+
+            state->work();
+
+            QMutexLocker locker(&state->mutex);
+            if (--state->active == 0) {
+                state->finished.wakeAll();
+            }
+        });
+    }
+
+    state->work();
+
+    QMutexLocker locker(&state->mutex);
+    state->closed = true;
+    while (state->active > 0) {
+        state->finished.wait(&state->mutex);
+    }
+}
+
 #endif // UTIL_P_H
@@ -17,6 +17,7 @@
 #include <QList>
 #include <QLoggingCategory>
 #include <QPainter>
+#include <QScopeGuard>
 #include <QStack>
 #include <QtEndian>
 
@@ -53,6 +54,13 @@ Q_LOGGING_CATEGORY(XCFPLUGIN, "kf.imageformats.plugins.xcf", QtWarningMsg)
 
 const float INCHESPERMETER = (100.0f / 2.54f);
 
+//! Size of the buffer each tile is decoded into.
+#ifdef USE_FLOAT_IMAGES
+const quint64 tileBufferSize = quint64(TILE_WIDTH * TILE_HEIGHT * sizeof(QRgbaFloat32) * 1.5);
+#else
+const quint64 tileBufferSize = quint64(TILE_WIDTH * TILE_HEIGHT * sizeof(QRgba64) * 1.5);
+#endif
+
 namespace
 {
 struct RandomTable {
@@ -107,8 +115,9 @@ struct RandomTable {
  * Each layer in an XCF file is stored as a matrix of
  * 64-pixel by 64-pixel images. The GIMP has a sophisticated
  * method of handling very large images as well as implementing
- * parallel processing on a tile-by-tile basis. Here, though,
- * we just read them in en-masse and store them in a matrix.
+ * parallel processing on a tile-by-tile basis. Here, we read the
+ * compressed tiles one row at a time, decode them in parallel and
+ * store them in a matrix in which only the current row is populated.
  */
 typedef QList<QList<QImage>> Tiles;
 
@@ -294,6 +303,45 @@ public:
     XCFImageFormat();
     bool readXCF(QIODevice *device, QImage *image);
 
+    class Layer;
+
+    /*!
+     * One level of a tile hierarchy, i.e. the image or the mask of a layer.
+     * Only the location of the tiles is read up front; the tiles themselves
+     * are read, decoded and merged into the final QImage one row at a time
+     * (see loadTileRow()), so that only a single row of tiles needs to be
+     * held in memory.
+     */
+    struct Level {
+        //! File position and size of the data of a tile.
+        struct Tile {
+            qint64 offset;
+            int length;
+        };
+
+        //! Location of every tile, in row-major order. Empty if the level
+        //! has no tile data at all.
+        QList<Tile> tiles;
+
+        qint32 bpp = 0; //!< Bytes per pixel in the file
+        bool needConvert = false; //!< Whether the precision needs conversion
+
+        qint64 dataSize = 0; //!< Total size of the tile data in the file
+        qint64 decodedTiles = 0; //!< Number of tiles decoded so far
+        qint64 decodedBytes = 0; //!< Size of the tile data decoded so far
+
+        //! Compressed data of the row being decoded, kept to avoid
+        //! reallocating it for every row.
+        QByteArray rowData;
+
+        //! The data from a decoded tile buffer is copied to the Tile by this
+        //! method.  Depending on the type of the tile (RGB, Grayscale,
+        //! Indexed) and use (image or mask), the bytes in the buffer are
+        //! copied in different ways. This may be called concurrently for
+        //! different tiles.
+        bool (*assignBytes)(Layer &layer, uint i, uint j, const GimpPrecision &precision, const uchar *tile) = nullptr;
+    };
+
     /*!
      * Each GIMP image is composed of one or more layers. A layer can
      * be one of any three basic types: RGB, grayscale or indexed. With an
@@ -315,12 +363,17 @@ public:
         uint nrows; //!< Number of rows of tiles (y direction)
         uint ncols; //!< Number of columns of tiles (x direction)
 
+        //! The tile matrices below have nrows rows, but only the row being
+        //! merged into the final QImage is populated at any given time.
         Tiles image_tiles; //!< The basic image
         //! For Grayscale and Indexed images, the alpha channel is stored
         //! separately (in this data structure, anyway).
         Tiles alpha_tiles;
         Tiles mask_tiles; //!< The layer mask (optional)
 
+        Level image_level; //!< Location of the image tiles in the file
+        Level mask_level; //!< Location of the mask tiles in the file
+
         //! Additional information about a layer mask.
         struct {
             quint32 opacity;
@@ -353,19 +406,6 @@ public:
         GimpColorSpace compositeSpace = RgbLinearSpace; //!< What colorspace to use when compositing
         GimpCompositeMode compositeMode = CompositeUnion; //!< How to composite layer (union, clip, etc.)
 
-        //! As each tile is read from the file, it is buffered here.
-#ifdef USE_FLOAT_IMAGES
-        uchar tile[quint64(TILE_WIDTH * TILE_HEIGHT * sizeof(QRgbaFloat32) * 1.5)];
-#else
-        uchar tile[quint64(TILE_WIDTH * TILE_HEIGHT * sizeof(QRgba64) * 1.5)];
-#endif
-
-        //! The data from tile buffer is copied to the Tile by this
-        //! method.  Depending on the type of the tile (RGB, Grayscale,
-        //! Indexed) and use (image or mask), the bytes in the buffer are
-        //! copied in different ways.
-        bool (*assignBytes)(Layer &layer, uint i, uint j, const GimpPrecision &precision);
-
         Layer(void)
             : name(nullptr)
         {
@@ -378,6 +418,18 @@ public:
         Layer(const Layer &) = delete;
         Layer &operator=(const Layer &) = delete;
 
+        //! Width of the tiles in column \a i.
+        uint tileWidth(uint i) const
+        {
+            return (i + 1) * TILE_WIDTH <= width ? TILE_WIDTH : width - i * TILE_WIDTH;
+        }
+
+        //! Height of the tiles in row \a j.
+        uint tileHeight(uint j) const
+        {
+            return (j + 1) * TILE_HEIGHT <= height ? TILE_HEIGHT : height - j * TILE_HEIGHT;
+        }
+
         QImage::Format qimageFormat(const GimpPrecision precision, uint num_colors = 0, bool legacyMode = false) const
         {
             int bpc = bytesPerChannel(precision);
@@ -502,6 +554,9 @@ public:
 
         QHash<QString,QByteArray> parasites;    //!< parasites data
 
+        qint64 skipped_tiles = 0; //!< Tiles not decoded since they do not affect the QImage
+        qint64 skipped_bytes = 0; //!< Size of the data of the skipped tiles
+
         XCFImage(void)
             : initialized(false)
         {
@@ -551,6 +606,10 @@ private:
     // static int add_lut[256][256]; - this is so lame waste of 256k of memory
     static int add_lut(int, int);
 
+    //! The file being read, if it could be memory mapped. Tile data is
+    //! then decoded straight from the mapping instead of being copied.
+    const DeviceMapping *mapping = nullptr;
+
     //! The bottom-most layer is copied into the final QImage by this
     //! routine.
     typedef void (*PixelCopyOperation)(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
@@ -558,6 +617,11 @@ private:
     //! Higher layers are merged into the final QImage by this routine.
     typedef bool (*PixelMergeOperation)(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
 
+    //! For the most common cases, whole rows of 8-bit RGBA tile pixels are
+    //! copied or merged into the final QImage at once by this routine
+    //! instead. \a mask may be null.
+    typedef void (*SpanOperation)(const uchar *src, const uchar *mask, uchar *dst, int count, int opacity);
+
     static bool modeAffectsSourceAlpha(const quint32 type);
 
     bool loadImageProperties(QDataStream &xcf_io, XCFImage &image);
@@ -565,19 +629,28 @@ private:
     bool loadLayer(QDataStream &xcf_io, XCFImage &xcf_image);
     bool loadLayerProperties(QDataStream &xcf_io, Layer &layer);
     bool composeTiles(XCFImage &xcf_image);
+    bool composeTileRow(XCFImage &xcf_image, uint j);
     void setGrayPalette(QImage &image);
     void setPalette(XCFImage &xcf_image, QImage &image);
     void setImageParasites(const XCFImage &xcf_image, QImage &image);
-    static bool assignImageBytes(Layer &layer, uint i, uint j, const GimpPrecision &precision);
-    bool loadHierarchy(QDataStream &xcf_io, Layer &layer, const GimpPrecision precision);
-    bool loadLevel(QDataStream &xcf_io, Layer &layer, qint32 bpp, const GimpPrecision precision);
-    static bool assignMaskBytes(Layer &layer, uint i, uint j, const GimpPrecision &precision);
+    static bool assignImageBytes(Layer &layer, uint i, uint j, const GimpPrecision &precision, const uchar *tile);
+    bool loadHierarchy(QDataStream &xcf_io, Layer &layer, Level &level, const GimpPrecision precision);
+    bool loadLevel(QDataStream &xcf_io, Layer &layer, Level &level, qint32 bpp, const GimpPrecision precision);
+    bool loadLevelRow(QDataStream &xcf_io, Layer &layer, Level &level, uint j, uint iBegin, uint iEnd, const GimpPrecision precision);
+    bool loadTileRow(QDataStream &xcf_io, XCFImage &xcf_image, uint j);
+    static bool layerOnCanvas(const XCFImage &xcf_image);
+    static bool tileRowOnCanvas(const XCFImage &xcf_image, uint j);
+    void skipLayer(QDataStream &xcf_io, XCFImage &xcf_image, const char *reason);
+    static void countSkippedTiles(XCFImage &xcf_image, const char *reason);
+    static bool assignMaskBytes(Layer &layer, uint i, uint j, const GimpPrecision &precision, const uchar *tile);
     bool loadMask(QDataStream &xcf_io, Layer &layer, const GimpPrecision precision);
     bool loadChannelProperties(QDataStream &xcf_io, Layer &layer);
     bool initializeImage(XCFImage &xcf_image);
-    bool loadTileRLE(QDataStream &xcf_io, uchar *tile, int size, int data_length, qint32 bpp, qint64 *bytesParsed);
+    static int rleTileStep(qint32 bpp);
+    static bool decodeTileRLE(const uchar *xcfodata, int data_length, uchar *tile, int image_size, qint32 bpp, qint64 *bytesParsed);
 
-    static void copyLayerToImage(XCFImage &xcf_image);
+    bool copyLayerToImage(QDataStream &xcf_io, XCFImage &xcf_image);
+    static SpanOperation copySpanOperation(const Layer &layer, const QImage &image);
     static void copyRGBToRGB(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
     static void copyGrayToGray(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
     static void copyGrayToRGB(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
@@ -586,7 +659,9 @@ private:
     static void copyIndexedAToIndexed(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
     static void copyIndexedAToRGB(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
 
-    static void mergeLayerIntoImage(XCFImage &xcf_image);
+    bool mergeLayerIntoImage(QDataStream &xcf_io, XCFImage &xcf_image);
+    static SpanOperation mergeSpanOperation(const Layer &layer, const QImage &image);
+    static bool applySpanOperation(const Layer &layer, uint i, uint j, QImage &image, int x, int y, SpanOperation operation);
     static bool mergeRGBToRGB(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
     static bool mergeGrayToGray(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
     static bool mergeGrayAToGray(const Layer &layer, uint i, uint j, int k, int l, QImage &image, int m, int n);
@@ -855,7 +930,13 @@ bool XCFImageFormat::readXCFHeader(QDataStream &xcf_io, XCFImage::Header *header
 bool XCFImageFormat::readXCF(QIODevice *device, QImage *outImage)
 {
     XCFImage xcf_image;
-    QDataStream xcf_io(device);
+    DeviceMapping deviceMapping(device);
+    QDataStream xcf_io(deviceMapping.device());
+
+    mapping = deviceMapping.data() ? &deviceMapping : nullptr;
+    const auto mappingGuard = qScopeGuard([this] {
+        mapping = nullptr;
+    });
 
     if (!readXCFHeader(xcf_io, &xcf_image.header)) {
         return false;
@@ -912,6 +993,10 @@ bool XCFImageFormat::readXCF(QIODevice *device, QImage *outImage)
         return false;
     }
 
+    if (xcf_image.skipped_tiles > 0) {
+        qCDebug(XCFPLUGIN) << "Skipped" << xcf_image.skipped_tiles << "tiles," << xcf_image.skipped_bytes << "bytes not affecting the image";
+    }
+
     // The image was created: now I can set metadata and ICC color profile inside it.
     setImageParasites(xcf_image, xcf_image.image);
 
@@ -1137,18 +1222,34 @@ bool XCFImageFormat::loadLayer(QDataStream &xcf_io, XCFImage &xcf_image)
                        << ", mode: " << layer.mode << ", opacity: " << layer.opacity << ", visible: " << layer.visible << ", offset: " << layer.x_offset << ", "
                        << layer.y_offset << ", compression" << layer.compression;
 
+    layer.hierarchy_offset = readOffsetPtr(xcf_io);
+    layer.mask_offset = readOffsetPtr(xcf_io);
+
     // Skip reading the rest of it if it is not visible. Typically, when
     // you export an image from the The GIMP it flattens (or merges) only
     // the visible layers into the output image.
 
     if (layer.visible == 0) {
+        skipLayer(xcf_io, xcf_image, "invisible");
         return true;
     }
 
-    // If there are any more layers, merge them into the final QImage.
+    // Layers which are fully transparent or entirely outside the canvas
+    // don't contribute to the final QImage either, but the first visible
+    // layer still determines its attributes.
 
-    layer.hierarchy_offset = readOffsetPtr(xcf_io);
-    layer.mask_offset = readOffsetPtr(xcf_io);
+    if ((xcf_image.initialized && layer.opacity == 0) || !layerOnCanvas(xcf_image)) {
+        if (!xcf_image.initialized) {
+            if (!initializeImage(xcf_image)) {
+                return false;
+            }
+            xcf_image.initialized = true;
+        }
+        skipLayer(xcf_io, xcf_image, layerOnCanvas(xcf_image) ? "transparent" : "off-canvas");
+        return true;
+    }
+
+    // If there are any more layers, merge them into the final QImage.
 
     if (layer.hierarchy_offset < 0) {
         qCDebug(XCFPLUGIN) << "XCF: negative layer hierarchy_offset";
@@ -1160,8 +1261,8 @@ bool XCFImageFormat::loadLayer(QDataStream &xcf_io, XCFImage &xcf_image)
         return false;
     }
 
-    // Allocate the individual tile QImages based on the size and type
-    // of this layer.
+    // Check the size and type of this layer. The individual tile QImages
+    // are only allocated one row at a time, as the layer is merged.
 
     if (!composeTiles(xcf_image)) {
         return false;
@@ -1172,9 +1273,9 @@ bool XCFImageFormat::loadLayer(QDataStream &xcf_io, XCFImage &xcf_image)
     // this routine. (loadMask(), below, uses a slightly different
     // version of assignBytes().)
 
-    layer.assignBytes = assignImageBytes;
+    layer.image_level.assignBytes = assignImageBytes;
 
-    if (!loadHierarchy(xcf_io, layer, xcf_image.header.precision)) {
+    if (!loadHierarchy(xcf_io, layer, layer.image_level, xcf_image.header.precision)) {
         return false;
     }
 
@@ -1196,26 +1297,121 @@ bool XCFImageFormat::loadLayer(QDataStream &xcf_io, XCFImage &xcf_image)
 
     // Now we should have enough information to initialize the final
     // QImage. The first visible layer determines the attributes
-    // of the QImage.
+    // of the QImage. The tiles are read and decoded as they are merged.
 
     if (!xcf_image.initialized) {
         if (!initializeImage(xcf_image)) {
             return false;
         }
-        copyLayerToImage(xcf_image);
+        if (!copyLayerToImage(xcf_io, xcf_image)) {
+            return false;
+        }
         xcf_image.initialized = true;
     } else {
         const QColorSpace colorspaceBefore = xcf_image.image.colorSpace();
-        mergeLayerIntoImage(xcf_image);
+        if (!mergeLayerIntoImage(xcf_io, xcf_image)) {
+            return false;
+        }
         if (xcf_image.image.colorSpace() != colorspaceBefore) {
             qCDebug(XCFPLUGIN) << "Converting color space back to" << colorspaceBefore << "after layer composition";
             xcf_image.image.convertToColorSpace(colorspaceBefore);
         }
     }
 
+    countSkippedTiles(xcf_image, "partially visible");
+
     return true;
 }
 
+/*!
+ * Check whether any part of the current layer is inside the canvas.
+ * \param xcf_image contains the current layer.
+ */
+bool XCFImageFormat::layerOnCanvas(const XCFImage &xcf_image)
+{
+    const Layer &layer(xcf_image.layer);
+
+    return layer.width > 0 && layer.height > 0 && qint64(layer.x_offset) + layer.width > 0 && qint64(layer.y_offset) + layer.height > 0
+        && layer.x_offset < qint64(xcf_image.header.width) && layer.y_offset < qint64(xcf_image.header.height);
+}
+
+/*!
+ * Check whether any part of a row of tiles of the current layer is inside
+ * the canvas. Rows which are not don't need to be loaded at all.
+ * \param xcf_image contains the current layer.
+ * \param j the row of tiles.
+ */
+bool XCFImageFormat::tileRowOnCanvas(const XCFImage &xcf_image, uint j)
+{
+    const Layer &layer(xcf_image.layer);
+    const qint64 y = qint64(j) * TILE_HEIGHT + layer.y_offset;
+
+    return y + layer.tileHeight(j) > 0 && y < qint64(xcf_image.header.height);
+}
+
+/*!
+ * Skip a layer which cannot affect the final QImage. Only if debug output
+ * is enabled, the tile offsets of the layer are read to report how much
+ * data was skipped; otherwise none of its tile data is accessed at all.
+ * \param xcf_io the data stream connected to the XCF image.
+ * \param xcf_image contains the current layer.
+ * \param reason why the layer is skipped, for debug output.
+ */
+void XCFImageFormat::skipLayer(QDataStream &xcf_io, XCFImage &xcf_image, const char *reason)
+{
+    Layer &layer(xcf_image.layer);
+
+    if (!XCFPLUGIN().isDebugEnabled()) {
+        return;
+    }
+
+    layer.nrows = (layer.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    layer.ncols = (layer.width + TILE_WIDTH - 1) / TILE_WIDTH;
+
+    layer.image_level.tiles.clear();
+    layer.mask_level.tiles.clear();
+
+    if (layer.hierarchy_offset > 0) {
+        xcf_io.device()->seek(layer.hierarchy_offset);
+        layer.image_level.assignBytes = assignImageBytes;
+
+        if (loadHierarchy(xcf_io, layer, layer.image_level, xcf_image.header.precision) && layer.mask_offset > 0) {
+            xcf_io.device()->seek(layer.mask_offset);
+            loadMask(xcf_io, layer, xcf_image.header.precision);
+        }
+    }
+
+    countSkippedTiles(xcf_image, reason);
+}
+
+/*!
+ * Add the tiles of the current layer which were not decoded to the skipped
+ * tile statistics.
+ * \param xcf_image contains the current layer.
+ * \param reason why the tiles were skipped, for debug output.
+ */
+void XCFImageFormat::countSkippedTiles(XCFImage &xcf_image, const char *reason)
+{
+    const Layer &layer(xcf_image.layer);
+
+    qint64 tiles = layer.image_level.tiles.size() - layer.image_level.decodedTiles;
+    qint64 bytes = layer.image_level.dataSize - layer.image_level.decodedBytes;
+
+    if (layer.mask_offset > 0) {
+        tiles += layer.mask_level.tiles.size() - layer.mask_level.decodedTiles;
+        bytes += layer.mask_level.dataSize - layer.mask_level.decodedBytes;
+    }
+
+    if (tiles <= 0) {
+        return;
+    }
+
+    qCDebug(XCFPLUGIN) << "Skipped" << tiles << "tiles," << bytes << "bytes of" << reason << "layer" << layer.name;
+
+    xcf_image.skipped_tiles += tiles;
+    xcf_image.skipped_bytes += bytes;
+}
+
 /*!
  * An XCF file can contain an arbitrary number of properties associated
  * with a layer.
@@ -1339,8 +1535,9 @@ bool XCFImageFormat::loadLayerProperties(QDataStream &xcf_io, Layer &layer)
 }
 
 /*!
- * Compute the number of tiles in the current layer and allocate
- * QImage structures for each of them.
+ * Compute the number of tiles in the current layer and check that it can
+ * be loaded. The QImage structures for the tiles are allocated one row at
+ * a time by composeTileRow().
  * \param xcf_image contains the current layer.
  */
 bool XCFImageFormat::composeTiles(XCFImage &xcf_image)
@@ -1380,9 +1577,8 @@ bool XCFImageFormat::composeTiles(XCFImage &xcf_image)
 
 #ifndef XCF_QT5_SUPPORT
     // Qt 6 image allocation limit calculation: we have to check the limit here because the image is splitted in
-    // tiles of 64x64 pixels. The required memory to build the image is at least doubled because tiles are loaded
-    // and then the final image is created by copying the tiles inside it.
-    // NOTE: on Windows to open a 10GiB image the plugin uses 28GiB of RAM
+    // tiles of 64x64 pixels. Only one row of tiles is held in memory at a time, so the memory required is close to
+    // that of the final image, but the limit is kept as it was when every tile of a layer was loaded up front.
     qint64 channels = 1 + (layer.type == RGB_GIMAGE ? 2 : 0) + (layer.type == RGBA_GIMAGE ? 3 : 0);
     if (qint64(layer.width) * qint64(layer.height) * channels * 2ll / 1024ll / 1024ll > QImageReader::allocationLimit()) {
         qCDebug(XCFPLUGIN) << "Rejecting image as it exceeds the current allocation limit of" << QImageReader::allocationLimit() << "megabytes";
@@ -1390,6 +1586,10 @@ bool XCFImageFormat::composeTiles(XCFImage &xcf_image)
     }
 #endif
 
+    layer.image_tiles.clear();
+    layer.alpha_tiles.clear();
+    layer.mask_tiles.clear();
+
     layer.image_tiles.resize(layer.nrows);
 
     if (layer.type == GRAYA_GIMAGE || layer.type == INDEXEDA_GIMAGE) {
@@ -1400,29 +1600,56 @@ bool XCFImageFormat::composeTiles(XCFImage &xcf_image)
         layer.mask_tiles.resize(layer.nrows);
     }
 
-    for (uint j = 0; j < layer.nrows; j++) {
-        layer.image_tiles[j].resize(layer.ncols);
+    return true;
+}
+
+/*!
+ * Allocate the QImage structures for a row of tiles of the current layer.
+ * The tiles of the previous row are moved to this row and reused whenever
+ * they have the right size, so that a layer only needs a single row of
+ * tiles no matter how tall it is.
+ * \param xcf_image contains the current layer.
+ * \param j the row of tiles.
+ */
+bool XCFImageFormat::composeTileRow(XCFImage &xcf_image, uint j)
+{
+    Layer &layer(xcf_image.layer);
+
+    if (j > 0) {
+        layer.image_tiles[j].swap(layer.image_tiles[j - 1]);
 
         if (layer.type == GRAYA_GIMAGE || layer.type == INDEXEDA_GIMAGE) {
-            layer.alpha_tiles[j].resize(layer.ncols);
+            layer.alpha_tiles[j].swap(layer.alpha_tiles[j - 1]);
         }
 
         if (layer.mask_offset != 0) {
-            layer.mask_tiles[j].resize(layer.ncols);
+            layer.mask_tiles[j].swap(layer.mask_tiles[j - 1]);
         }
     }
 
+    layer.image_tiles[j].resize(layer.ncols);
+
+    if (layer.type == GRAYA_GIMAGE || layer.type == INDEXEDA_GIMAGE) {
+        layer.alpha_tiles[j].resize(layer.ncols);
+    }
+
+    if (layer.mask_offset != 0) {
+        layer.mask_tiles[j].resize(layer.ncols);
+    }
+
     const QImage::Format format = layer.qimageFormat(xcf_image.header.precision);
+    const uint tile_height = layer.tileHeight(j);
 
-    for (uint j = 0; j < layer.nrows; j++) {
-        for (uint i = 0; i < layer.ncols; i++) {
-            uint tile_width = (i + 1) * TILE_WIDTH <= layer.width ? TILE_WIDTH : layer.width - i * TILE_WIDTH;
+    for (uint i = 0; i < layer.ncols; i++) {
+        const uint tile_width = layer.tileWidth(i);
 
-            uint tile_height = (j + 1) * TILE_HEIGHT <= layer.height ? TILE_HEIGHT : layer.height - j * TILE_HEIGHT;
+        const QImage &previous = layer.image_tiles[j][i];
+        const bool reuse = !previous.isNull() && uint(previous.width()) == tile_width && uint(previous.height()) == tile_height;
 
-            // Try to create the most appropriate QImage (each GIMP layer
-            // type is treated slightly differently)
+        // Try to create the most appropriate QImage (each GIMP layer
+        // type is treated slightly differently)
 
+        if (!reuse) {
             switch (layer.type) {
             case RGB_GIMAGE:
             case RGBA_GIMAGE:
@@ -1486,36 +1713,40 @@ bool XCFImageFormat::composeTiles(XCFImage &xcf_image)
                 qCWarning(XCFPLUGIN) << "Selected wrong tile format" << layer.image_tiles[j][i].format() << "expected" << format;
                 return false;
             }
+        }
 
 #ifndef DISABLE_TILE_PROFILE
-            switch (xcf_image.header.precision) {
-            case XCFImageFormat::GIMP_PRECISION_HALF_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_FLOAT_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_DOUBLE_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_U8_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_U16_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_U32_LINEAR:
-                layer.image_tiles[j][i].setColorSpace(QColorSpace::SRgbLinear);
-                break;
-            case XCFImageFormat::GIMP_PRECISION_HALF_NON_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_FLOAT_NON_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_DOUBLE_NON_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_U8_NON_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_U16_NON_LINEAR:
-            case XCFImageFormat::GIMP_PRECISION_U32_NON_LINEAR:
-                layer.image_tiles[j][i].setColorSpace(QColorSpace::SRgb);
-                break;
-            case XCFImageFormat::GIMP_PRECISION_HALF_PERCEPTUAL:
-            case XCFImageFormat::GIMP_PRECISION_FLOAT_PERCEPTUAL:
-            case XCFImageFormat::GIMP_PRECISION_DOUBLE_PERCEPTUAL:
-            case XCFImageFormat::GIMP_PRECISION_U8_PERCEPTUAL:
-            case XCFImageFormat::GIMP_PRECISION_U16_PERCEPTUAL:
-            case XCFImageFormat::GIMP_PRECISION_U32_PERCEPTUAL:
-                layer.image_tiles[j][i].setColorSpace(QColorSpace::SRgb);
-                break;
-            }
+        // NOTE: this is also done for reused tiles since merging may have converted them.
+        switch (xcf_image.header.precision) {
+        case XCFImageFormat::GIMP_PRECISION_HALF_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_FLOAT_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_DOUBLE_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_U8_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_U16_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_U32_LINEAR:
+            layer.image_tiles[j][i].setColorSpace(QColorSpace::SRgbLinear);
+            break;
+        case XCFImageFormat::GIMP_PRECISION_HALF_NON_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_FLOAT_NON_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_DOUBLE_NON_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_U8_NON_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_U16_NON_LINEAR:
+        case XCFImageFormat::GIMP_PRECISION_U32_NON_LINEAR:
+            layer.image_tiles[j][i].setColorSpace(QColorSpace::SRgb);
+            break;
+        case XCFImageFormat::GIMP_PRECISION_HALF_PERCEPTUAL:
+        case XCFImageFormat::GIMP_PRECISION_FLOAT_PERCEPTUAL:
+        case XCFImageFormat::GIMP_PRECISION_DOUBLE_PERCEPTUAL:
+        case XCFImageFormat::GIMP_PRECISION_U8_PERCEPTUAL:
+        case XCFImageFormat::GIMP_PRECISION_U16_PERCEPTUAL:
+        case XCFImageFormat::GIMP_PRECISION_U32_PERCEPTUAL:
+            layer.image_tiles[j][i].setColorSpace(QColorSpace::SRgb);
+            break;
+        }
 #endif
-            if (layer.mask_offset != 0) {
+        if (layer.mask_offset != 0) {
+            const QImage &previousMask = layer.mask_tiles[j][i];
+            if (previousMask.isNull() || uint(previousMask.width()) != tile_width || uint(previousMask.height()) != tile_height) {
                 layer.mask_tiles[j][i] = QImage(tile_width, tile_height, QImage::Format_Indexed8);
                 layer.mask_tiles[j][i].setColorCount(256);
                 if (layer.mask_tiles[j][i].isNull()) {
@@ -1654,11 +1885,10 @@ void XCFImageFormat::setImageParasites(const XCFImage &xcf_image, QImage &image)
  * \param i column index of current tile.
  * \param j row index of current tile.
  */
-bool XCFImageFormat::assignImageBytes(Layer &layer, uint i, uint j, const GimpPrecision &precision)
+bool XCFImageFormat::assignImageBytes(Layer &layer, uint i, uint j, const GimpPrecision &precision, const uchar *tile)
 {
     QImage &image = layer.image_tiles[j][i];
 
-    const uchar *tile = layer.tile;
     const int width = image.width();
     const int height = image.height();
     const int bytesPerLine = image.bytesPerLine();
@@ -1848,7 +2078,7 @@ bool XCFImageFormat::assignImageBytes(Layer &layer, uint i, uint j, const GimpPr
  * \param layer the layer to collect the image.
  * \return true if there were no I/O errors.
  */
-bool XCFImageFormat::loadHierarchy(QDataStream &xcf_io, Layer &layer, const GimpPrecision precision)
+bool XCFImageFormat::loadHierarchy(QDataStream &xcf_io, Layer &layer, Level &level, const GimpPrecision precision)
 {
     qint32 width;
     qint32 height;
@@ -1864,7 +2094,7 @@ bool XCFImageFormat::loadHierarchy(QDataStream &xcf_io, Layer &layer, const Gimp
         return false;
     }
 
-    const bool isMask = layer.assignBytes == assignMaskBytes;
+    const bool isMask = level.assignBytes == assignMaskBytes;
 
     // make sure bpp is correct and complain if it is not
     switch (layer.type) {
@@ -1940,7 +2170,7 @@ bool XCFImageFormat::loadHierarchy(QDataStream &xcf_io, Layer &layer, const Gimp
     qint64 saved_pos = xcf_io.device()->pos();
 
     xcf_io.device()->seek(offset);
-    if (!loadLevel(xcf_io, layer, bpp, precision)) {
+    if (!loadLevel(xcf_io, layer, level, bpp, precision)) {
         return false;
     }
 
@@ -1960,13 +2190,15 @@ static bool convertFloatTo16Bit(uchar *output, quint64 outputSize, uchar *input)
 
 /*!
  * Load one level of the image hierarchy (but only the top level is ever used).
+ * Only the location of the tiles is collected here, the tile data is read by
+ * loadLevelRow().
  * \param xcf_io the data stream connected to the XCF image.
  * \param layer the layer to collect the image.
+ * \param level the level to collect the tile locations.
  * \param bpp the number of bytes in a pixel.
  * \return true if there were no I/O errors.
- * \sa loadTileRLE().
  */
-bool XCFImageFormat::loadLevel(QDataStream &xcf_io, Layer &layer, qint32 bpp, const GimpPrecision precision)
+bool XCFImageFormat::loadLevel(QDataStream &xcf_io, Layer &layer, Level &level, qint32 bpp, const GimpPrecision precision)
 {
     qint32 width;
     qint32 height;
@@ -1974,6 +2206,12 @@ bool XCFImageFormat::loadLevel(QDataStream &xcf_io, Layer &layer, qint32 bpp, co
     xcf_io >> width >> height;
     qint64 offset = readOffsetPtr(xcf_io);
 
+    level.tiles.clear();
+    level.bpp = bpp;
+    level.dataSize = 0;
+    level.decodedTiles = 0;
+    level.decodedBytes = 0;
+
     if (offset < 0) {
         qCDebug(XCFPLUGIN) << "XCF: negative level offset";
         return false;
@@ -1982,18 +2220,10 @@ bool XCFImageFormat::loadLevel(QDataStream &xcf_io, Layer &layer, qint32 bpp, co
     if (offset == 0) {
         // offset 0 with rowsxcols != 0 is probably an error since it means we have tiles
         // without data but just clear the bits for now instead of returning false
-        for (uint j = 0; j < layer.nrows; j++) {
-            for (uint i = 0; i < layer.ncols; i++) {
-                layer.image_tiles[j][i].fill(Qt::transparent);
-                if (layer.type == GRAYA_GIMAGE || layer.type == INDEXEDA_GIMAGE) {
-                    layer.alpha_tiles[j][i].fill(Qt::transparent);
-                }
-            }
-        }
         return true;
     }
 
-    bool needConvert = true;
+    level.needConvert = true;
     switch (precision) {
 #ifdef USE_FLOAT_IMAGES
     case GIMP_PRECISION_HALF_LINEAR:
@@ -2009,18 +2239,17 @@ bool XCFImageFormat::loadLevel(QDataStream &xcf_io, Layer &layer, qint32 bpp, co
     case GIMP_PRECISION_U16_LINEAR:
     case GIMP_PRECISION_U16_NON_LINEAR:
     case GIMP_PRECISION_U16_PERCEPTUAL:
-        needConvert = false;
+        level.needConvert = false;
         break;
     default:
         break;
     }
 
     const uint blockSize = TILE_WIDTH * TILE_HEIGHT * bpp * 1.5;
+    const qsizetype bufferSize = level.needConvert ? blockSize * (bpp == 2 ? 2 : 1) : 0;
+
+    level.tiles.reserve(qsizetype(layer.nrows) * layer.ncols);
 
-    QList<uchar> buffer;
-    if (needConvert) {
-        buffer.resize(blockSize * (bpp == 2 ? 2 : 1));
-    }
     for (uint j = 0; j < layer.nrows; j++) {
         for (uint i = 0; i < layer.ncols; i++) {
             if (offset == 0) {
@@ -2028,21 +2257,17 @@ bool XCFImageFormat::loadLevel(QDataStream &xcf_io, Layer &layer, qint32 bpp, co
                 return false;
             }
 
-            qint64 saved_pos = xcf_io.device()->pos();
-            qint64 offset2 = readOffsetPtr(xcf_io);
+            const qint64 next = readOffsetPtr(xcf_io);
 
-            if (offset2 < 0) {
+            if (next < 0) {
                 qCDebug(XCFPLUGIN) << "XCF: negative level offset";
                 return false;
             }
 
             // Evidently, RLE can occasionally expand a tile instead of compressing it!
-            if (offset2 == 0) {
-                offset2 = offset + blockSize;
-            }
+            const qint64 offset2 = next == 0 ? offset + blockSize : next;
 
-            xcf_io.device()->seek(offset);
-            qint64 bytesParsed = 0;
+            int data_length = 0;
 
             switch (layer.compression) {
             case COMPRESS_NONE: {
@@ -2052,39 +2277,45 @@ bool XCFImageFormat::loadLevel(QDataStream &xcf_io, Layer &layer, qint32 bpp, co
                 }
                 const int data_size = bpp * TILE_WIDTH * TILE_HEIGHT;
                 if (data_size > int(blockSize)) {
-                    qCDebug(XCFPLUGIN) << "Tile data too big, we can only fit" << sizeof(layer.tile) << "but need" << data_size;
-                    return false;
-                }
-                int dataRead = xcf_io.readRawData(reinterpret_cast<char *>(layer.tile), data_size);
-                if (dataRead < data_size) {
-                    qCDebug(XCFPLUGIN) << "short read, expected" << data_size << "got" << dataRead;
+                    qCDebug(XCFPLUGIN) << "Tile data too big, we can only fit" << tileBufferSize << "but need" << data_size;
                     return false;
                 }
-                bytesParsed = dataRead;
+                data_length = data_size;
                 break;
             }
             case COMPRESS_RLE: {
-                int size = layer.image_tiles[j][i].width() * layer.image_tiles[j][i].height();
+                int size = layer.tileWidth(i) * layer.tileHeight(j);
                 const uint data_size = size * bpp;
-                if (needConvert) {
-                    if (data_size >= unsigned(buffer.size())) {
-                        qCDebug(XCFPLUGIN) << "Tile data too big, we can only fit" << buffer.size() << "but need" << data_size;
+                if (level.needConvert) {
+                    if (data_size >= unsigned(bufferSize)) {
+                        qCDebug(XCFPLUGIN) << "Tile data too big, we can only fit" << bufferSize << "but need" << data_size;
                         return false;
                     }
                 } else {
-                    if (data_size > sizeof(layer.tile)) {
-                        qCDebug(XCFPLUGIN) << "Tile data too big, we can only fit" << sizeof(layer.tile) << "but need" << data_size;
+                    if (data_size > tileBufferSize) {
+                        qCDebug(XCFPLUGIN) << "Tile data too big, we can only fit" << tileBufferSize << "but need" << data_size;
                         return false;
                     }
-                    if (blockSize > sizeof(layer.tile)) {
-                        qCWarning(XCFPLUGIN) << "Too small tiles" << sizeof(layer.tile) << "this image requires" << blockSize << sizeof(QRgba64) << bpp;
+                    if (blockSize > tileBufferSize) {
+                        qCWarning(XCFPLUGIN) << "Too small tiles" << tileBufferSize << "this image requires" << blockSize << sizeof(QRgba64) << bpp;
                         return false;
                     }
                 }
-                if (!loadTileRLE(xcf_io, needConvert ? buffer.data() : layer.tile, size, offset2 - offset, bpp, &bytesParsed)) {
-                    qCDebug(XCFPLUGIN) << "Failed to read RLE";
+
+                const qint64 length = offset2 - offset;
+                const int step = rleTileStep(bpp);
+
+                if (step == 0) {
+                    qCDebug(XCFPLUGIN) << "XCF: unhandled bit depth" << bpp;
                     return false;
                 }
+
+                if (length < 0 || length > int(TILE_WIDTH * TILE_HEIGHT * step * 1.5)) {
+                    qCDebug(XCFPLUGIN) << "XCF: invalid tile data length" << length;
+                    return false;
+                }
+
+                data_length = int(length);
                 break;
             }
             default:
@@ -2092,70 +2323,232 @@ bool XCFImageFormat::loadLevel(QDataStream &xcf_io, Layer &layer, qint32 bpp, co
                 return false;
             }
 
-            if (needConvert) {
-                if (bytesParsed > buffer.size()) {
-                    qCDebug(XCFPLUGIN) << "Invalid number of bytes parsed" << bytesParsed << buffer.size();
-                    return false;
-                }
+            level.tiles.append(Level::Tile{offset, data_length});
+            level.dataSize += data_length;
 
-                switch (precision) {
-                case GIMP_PRECISION_U32_LINEAR:
-                case GIMP_PRECISION_U32_NON_LINEAR:
-                case GIMP_PRECISION_U32_PERCEPTUAL: {
-                    quint32 *source = (quint32 *)(buffer.data());
-                    for (quint64 offset = 0, len = buffer.size() / sizeof(quint32); offset < len; ++offset) {
-                        ((quint16 *)layer.tile)[offset] = qToBigEndian<quint16>(qFromBigEndian(source[offset]) / 65537);
-                    }
-                    break;
+            offset = next;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * Read and decode one row of tiles of a level into the layer tiles.
+ * The tiles are read sequentially, then decompressed and converted on all
+ * available cores, since each tile is independent of the others.
+ * \param xcf_io the data stream connected to the XCF image.
+ * \param layer the layer to collect the image.
+ * \param level the level previously loaded by loadLevel().
+ * \param j the row of tiles.
+ * \param iBegin the first column of tiles to load.
+ * \param iEnd the column of tiles after the last one to load.
+ * \return true if there were no I/O errors.
+ * \sa decodeTileRLE().
+ */
+bool XCFImageFormat::loadLevelRow(QDataStream &xcf_io, Layer &layer, Level &level, uint j, uint iBegin, uint iEnd, const GimpPrecision precision)
+{
+    if (level.tiles.isEmpty()) {
+        Tiles &tiles = level.assignBytes == assignMaskBytes ? layer.mask_tiles : layer.image_tiles;
+        for (uint i = iBegin; i < iEnd; i++) {
+            tiles[j][i].fill(Qt::transparent);
+            if (&tiles == &layer.image_tiles && (layer.type == GRAYA_GIMAGE || layer.type == INDEXEDA_GIMAGE)) {
+                layer.alpha_tiles[j][i].fill(Qt::transparent);
+            }
+        }
+        return true;
+    }
+
+    const qint32 bpp = level.bpp;
+    const bool needConvert = level.needConvert;
+    const uint blockSize = TILE_WIDTH * TILE_HEIGHT * bpp * 1.5;
+    const qsizetype bufferSize = needConvert ? blockSize * (bpp == 2 ? 2 : 1) : 0;
+    const qsizetype first = qsizetype(j) * layer.ncols;
+
+    QList<const uchar *> sources(iEnd - iBegin);
+    QList<qsizetype> starts(iEnd - iBegin, -1);
+    QByteArray &data = level.rowData;
+    data.resize(0);
+
+    for (uint i = iBegin; i < iEnd; i++) {
+        const Level::Tile &tileData = level.tiles.at(first + i);
+        level.decodedBytes += tileData.length;
+
+        // Tiles of a memory mapped file are decoded in place. Truncated
+        // tiles still take the slow path below.
+        if (mapping) {
+            if (const uchar *mapped = mapping->data(tileData.offset, tileData.length)) {
+                sources[i - iBegin] = mapped;
+                continue;
+            }
+        }
+
+        xcf_io.device()->seek(tileData.offset);
+
+        const qsizetype start = data.size();
+        data.resize(start + tileData.length);
+        starts[i - iBegin] = start;
+
+        const int dataRead = xcf_io.readRawData(data.data() + start, tileData.length);
+
+        if (layer.compression == COMPRESS_RLE) {
+            if (dataRead <= 0 || !xcf_io.device()->isOpen()) {
+                qCDebug(XCFPLUGIN) << "XCF: read failure on tile" << dataRead;
+                return false;
+            }
+            if (dataRead < tileData.length) {
+                memset(data.data() + start + dataRead, 0, tileData.length - dataRead);
+            }
+        } else if (dataRead < tileData.length) {
+            qCDebug(XCFPLUGIN) << "short read, expected" << tileData.length << "got" << dataRead;
+            return false;
+        }
+    }
+
+    for (qsizetype index = 0; index < starts.size(); ++index) {
+        if (starts.at(index) >= 0) {
+            sources[index] = reinterpret_cast<const uchar *>(data.constData()) + starts.at(index);
+        }
+    }
+
+    level.decodedTiles += iEnd - iBegin;
+
+    std::atomic<bool> ok = true;
+
+    parallelFor(iEnd - iBegin, [&](qsizetype index, QByteArray &scratch) {
+        if (!ok) {
+            return;
+        }
+
+        const uint i = iBegin + uint(index);
+        const int length = level.tiles.at(first + i).length;
+        const uchar *compressed = sources.at(index);
+
+        // The scratch buffer holds the tile buffer followed by the
+        // conversion buffer, if required.
+        if (scratch.size() < qsizetype(tileBufferSize) + bufferSize) {
+            scratch.resize(tileBufferSize + bufferSize);
+        }
+
+        uchar *tile = reinterpret_cast<uchar *>(scratch.data());
+        uchar *buffer = needConvert ? tile + tileBufferSize : nullptr;
+        qint64 bytesParsed = 0;
+
+        switch (layer.compression) {
+        case COMPRESS_NONE:
+            memcpy(tile, compressed, length);
+            bytesParsed = length;
+            break;
+        case COMPRESS_RLE: {
+            const int size = layer.tileWidth(i) * layer.tileHeight(j);
+            if (!decodeTileRLE(compressed, length, needConvert ? buffer : tile, size, bpp, &bytesParsed)) {
+                qCDebug(XCFPLUGIN) << "Failed to read RLE";
+                ok = false;
+                return;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+        if (needConvert) {
+            if (bytesParsed > bufferSize) {
+                qCDebug(XCFPLUGIN) << "Invalid number of bytes parsed" << bytesParsed << bufferSize;
+                ok = false;
+                return;
+            }
+
+            switch (precision) {
+            case GIMP_PRECISION_U32_LINEAR:
+            case GIMP_PRECISION_U32_NON_LINEAR:
+            case GIMP_PRECISION_U32_PERCEPTUAL: {
+                quint32 *source = (quint32 *)(buffer);
+                for (quint64 offset = 0, len = bufferSize / sizeof(quint32); offset < len; ++offset) {
+                    ((quint16 *)tile)[offset] = qToBigEndian<quint16>(qFromBigEndian(source[offset]) / 65537);
                 }
+                break;
+            }
 #ifndef USE_FLOAT_IMAGES
-                case GIMP_PRECISION_HALF_LINEAR:
-                case GIMP_PRECISION_HALF_NON_LINEAR:
-                case GIMP_PRECISION_HALF_PERCEPTUAL:
-                    convertFloatTo16Bit<qfloat16>(layer.tile, buffer.size() / sizeof(qfloat16), buffer.data());
-                    break;
-                case GIMP_PRECISION_FLOAT_LINEAR:
-                case GIMP_PRECISION_FLOAT_NON_LINEAR:
-                case GIMP_PRECISION_FLOAT_PERCEPTUAL:
-                    convertFloatTo16Bit<float>(layer.tile, buffer.size() / sizeof(float), buffer.data());
-                    break;
-                case GIMP_PRECISION_DOUBLE_LINEAR:
-                case GIMP_PRECISION_DOUBLE_NON_LINEAR:
-                case GIMP_PRECISION_DOUBLE_PERCEPTUAL:
-                    convertFloatTo16Bit<double>(layer.tile, buffer.size() / sizeof(double), buffer.data());
-                    break;
+            case GIMP_PRECISION_HALF_LINEAR:
+            case GIMP_PRECISION_HALF_NON_LINEAR:
+            case GIMP_PRECISION_HALF_PERCEPTUAL:
+                convertFloatTo16Bit<qfloat16>(tile, bufferSize / sizeof(qfloat16), buffer);
+                break;
+            case GIMP_PRECISION_FLOAT_LINEAR:
+            case GIMP_PRECISION_FLOAT_NON_LINEAR:
+            case GIMP_PRECISION_FLOAT_PERCEPTUAL:
+                convertFloatTo16Bit<float>(tile, bufferSize / sizeof(float), buffer);
+                break;
+            case GIMP_PRECISION_DOUBLE_LINEAR:
+            case GIMP_PRECISION_DOUBLE_NON_LINEAR:
+            case GIMP_PRECISION_DOUBLE_PERCEPTUAL:
+                convertFloatTo16Bit<double>(tile, bufferSize / sizeof(double), buffer);
+                break;
 #else
-                case GIMP_PRECISION_DOUBLE_LINEAR:
-                case GIMP_PRECISION_DOUBLE_NON_LINEAR:
-                case GIMP_PRECISION_DOUBLE_PERCEPTUAL: {
-                    double *source = (double *)(buffer.data());
-                    for (quint64 offset = 0, len = buffer.size() / sizeof(double); offset < len; ++offset) {
-                        ((float *)layer.tile)[offset] = qToBigEndian<float>(float(qFromBigEndian(source[offset])));
-                    }
-                    break;
+            case GIMP_PRECISION_DOUBLE_LINEAR:
+            case GIMP_PRECISION_DOUBLE_NON_LINEAR:
+            case GIMP_PRECISION_DOUBLE_PERCEPTUAL: {
+                double *source = (double *)(buffer);
+                for (quint64 offset = 0, len = bufferSize / sizeof(double); offset < len; ++offset) {
+                    ((float *)tile)[offset] = qToBigEndian<float>(float(qFromBigEndian(source[offset])));
                 }
+                break;
+            }
 #endif
-                default:
-                    qCWarning(XCFPLUGIN) << "Unsupported precision" << precision;
-                    return false;
-                }
+            default:
+                qCWarning(XCFPLUGIN) << "Unsupported precision" << precision;
+                ok = false;
+                return;
             }
+        }
 
-            // The bytes in the layer tile are juggled differently depending on
-            // the target QImage. The caller has set layer.assignBytes to the
-            // appropriate routine.
-            if (!layer.assignBytes(layer, i, j, precision)) {
-                return false;
-            }
+        // The bytes in the layer tile are juggled differently depending on
+        // the target QImage. The caller has set level.assignBytes to the
+        // appropriate routine. Each tile is only ever touched by one thread.
+        if (!level.assignBytes(layer, i, j, precision, tile)) {
+            ok = false;
+        }
+    });
 
-            xcf_io.device()->seek(saved_pos);
-            offset = readOffsetPtr(xcf_io);
+    return ok;
+}
 
-            if (offset < 0) {
-                qCDebug(XCFPLUGIN) << "XCF: negative level offset";
-                return false;
-            }
-        }
+/*!
+ * Read and decode one row of tiles of the current layer and its mask, if
+ * any, reusing the QImage structures of the previous row.
+ * \param xcf_io the data stream connected to the XCF image.
+ * \param xcf_image contains the current layer.
+ * \param j the row of tiles.
+ * \return true if there were no I/O errors.
+ */
+bool XCFImageFormat::loadTileRow(QDataStream &xcf_io, XCFImage &xcf_image, uint j)
+{
+    Layer &layer(xcf_image.layer);
+
+    if (!composeTileRow(xcf_image, j)) {
+        return false;
+    }
+
+    // Tiles entirely outside the canvas are not decoded. Since they are
+    // clipped when merged, it doesn't matter what they contain.
+
+    uint iBegin = 0;
+    uint iEnd = layer.ncols;
+
+    while (iBegin < iEnd && qint64(iBegin) * TILE_WIDTH + layer.tileWidth(iBegin) + layer.x_offset <= 0) {
+        iBegin++;
+    }
+    while (iEnd > iBegin && qint64(iEnd - 1) * TILE_WIDTH + layer.x_offset >= qint64(xcf_image.header.width)) {
+        iEnd--;
+    }
+
+    if (!loadLevelRow(xcf_io, layer, layer.image_level, j, iBegin, iEnd, xcf_image.header.precision)) {
+        return false;
+    }
+
+    if (layer.mask_offset != 0 && !loadLevelRow(xcf_io, layer, layer.mask_level, j, iBegin, iEnd, xcf_image.header.precision)) {
+        return false;
     }
 
     return true;
@@ -2189,19 +2582,42 @@ bool XCFImageFormat::loadMask(QDataStream &xcf_io, Layer &layer, const GimpPreci
     }
 
     xcf_io.device()->seek(hierarchy_offset);
-    layer.assignBytes = assignMaskBytes;
+    layer.mask_level.assignBytes = assignMaskBytes;
 
-    if (!loadHierarchy(xcf_io, layer, precision)) {
+    if (!loadHierarchy(xcf_io, layer, layer.mask_level, precision)) {
         return false;
     }
 
     return true;
 }
 
+/*!
+ * Returns the distance in bytes between consecutive pixels in a tile buffer
+ * filled by decodeTileRLE(), or 0 if \a bpp is not supported.
+ */
+int XCFImageFormat::rleTileStep(qint32 bpp)
+{
+    switch (bpp) {
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+        return sizeof(QRgb);
+    case 6:
+    case 8:
+        return sizeof(QRgb) * 2;
+    case 12:
+    case 16:
+        return sizeof(QRgb) * 4;
+    default:
+        return 0;
+    }
+}
+
 /*!
  * This is the routine for which all the other code is simply
- * infrastructure. Read the image bytes out of the file and
- * store them in the tile buffer. This is passed a full 32-bit deep
+ * infrastructure. Expand the compressed image bytes read from the file
+ * and store them in the tile buffer. This is passed a full 32-bit deep
  * buffer, even if bpp is smaller. The caller can figure out what to
  * do with the bytes.
  *
@@ -2213,67 +2629,35 @@ bool XCFImageFormat::loadMask(QDataStream &xcf_io, Layer &layer, const GimpPreci
  * The data is compressed with "run length encoding". Some simple data
  * integrity checks are made.
  *
- * \param xcf_io the data stream connected to the XCF image.
+ * This only works on memory buffers and is safe to call concurrently for
+ * different tiles.
+ *
+ * \param xcfodata the RLE data read from the file.
+ * \param data_length number of bytes in the RLE.
  * \param tile the buffer to expand the RLE into.
  * \param image_size number of bytes expected to be in the image tile.
- * \param data_length number of bytes expected in the RLE.
  * \param bpp number of bytes per pixel.
- * \return true if there were no I/O errors and no obvious corruption of
- * the RLE data.
+ * \return true if there was no obvious corruption of the RLE data.
  */
-bool XCFImageFormat::loadTileRLE(QDataStream &xcf_io, uchar *tile, int image_size, int data_length, qint32 bpp, qint64 *bytesParsed)
+bool XCFImageFormat::decodeTileRLE(const uchar *xcfodata, int data_length, uchar *tile, int image_size, qint32 bpp, qint64 *bytesParsed)
 {
     uchar *data = tile;
 
-    uchar *xcfdata;
-    uchar *xcfodata;
-    uchar *xcfdatalimit;
+    const uchar *xcfdata = xcfodata;
+    const uchar *xcfdatalimit;
 
-    int step = sizeof(QRgb);
-    switch (bpp) {
-    case 1:
-    case 2:
-    case 3:
-    case 4:
-        step = sizeof(QRgb);
-        break;
-    case 6:
-    case 8:
-        step = sizeof(QRgb) * 2;
-        break;
-    case 12:
-    case 16:
-        step = sizeof(QRgb) * 4;
-        break;
-    default:
+    const int step = rleTileStep(bpp);
+
+    if (step == 0) {
         qCDebug(XCFPLUGIN) << "XCF: unhandled bit depth" << bpp;
         return false;
     }
 
-    if (data_length < 0 || data_length > int(TILE_WIDTH * TILE_HEIGHT * step * 1.5)) {
+    if (data_length <= 0 || data_length > int(TILE_WIDTH * TILE_HEIGHT * step * 1.5)) {
         qCDebug(XCFPLUGIN) << "XCF: invalid tile data length" << data_length;
         return false;
     }
 
-    xcfdata = xcfodata = new uchar[data_length];
-
-    const int dataRead = xcf_io.readRawData((char *)xcfdata, data_length);
-    if (dataRead <= 0) {
-        delete[] xcfodata;
-        qCDebug(XCFPLUGIN) << "XCF: read failure on tile" << dataRead;
-        return false;
-    }
-
-    if (dataRead < data_length) {
-        memset(&xcfdata[dataRead], 0, data_length - dataRead);
-    }
-
-    if (!xcf_io.device()->isOpen()) {
-        delete[] xcfodata;
-        qCDebug(XCFPLUGIN) << "XCF: read failure on tile";
-        return false;
-    }
-
     xcfdatalimit = &xcfodata[data_length - 1];
 
     for (int i = 0; i < bpp; ++i) {
@@ -2354,13 +2738,11 @@ bool XCFImageFormat::loadTileRLE(QDataStream &xcf_io, uchar *tile, int image_siz
     }
     *bytesParsed = qintptr(data - tile);
 
-    delete[] xcfodata;
     return true;
 
 bogus_rle:
 
     qCDebug(XCFPLUGIN) << "The run length encoding could not be decoded properly";
-    delete[] xcfodata;
     return false;
 }
 
@@ -2451,7 +2833,7 @@ bool XCFImageFormat::loadChannelProperties(QDataStream &xcf_io, Layer &layer)
  * \param i column index of current tile.
  * \param j row index of current tile.
  */
-bool XCFImageFormat::assignMaskBytes(Layer &layer, uint i, uint j, const GimpPrecision &precision)
+bool XCFImageFormat::assignMaskBytes(Layer &layer, uint i, uint j, const GimpPrecision &precision, const uchar *tile)
 {
     QImage &image = layer.mask_tiles[j][i];
     if (image.depth() != 8) {
@@ -2459,7 +2841,6 @@ bool XCFImageFormat::assignMaskBytes(Layer &layer, uint i, uint j, const GimpPre
         return false;
     }
 
-    uchar *tile = layer.tile;
     const int width = image.width();
     const int height = image.height();
     const int bytesPerLine = image.bytesPerLine();
@@ -2468,7 +2849,7 @@ bool XCFImageFormat::assignMaskBytes(Layer &layer, uint i, uint j, const GimpPre
 
     // mask management is a house of cards: the mask is always treated as 8 bit by the plugin
     // (I don't want to twist the code) so it needs a conversion here.
-    // If previously converted the step is the type size, otherwise is the one set in loadTileRLE().
+    // If previously converted the step is the type size, otherwise is the one set in decodeTileRLE().
     for (int y = 0; y < height; y++) {
         uchar *dataPtr = bits + y * bytesPerLine;
 #ifdef USE_FLOAT_IMAGES
@@ -2476,12 +2857,12 @@ bool XCFImageFormat::assignMaskBytes(Layer &layer, uint i, uint j, const GimpPre
             if (precision < GimpPrecision::GIMP_PRECISION_HALF_LINEAR) {
                 for (int x = 0; x < width; x++) {
                     *dataPtr++ = qFromBigEndian<quint16>(*(const quint16 *)tile) / 257;
-                    tile += sizeof(quint16); // was converted to 16 bits in loadLevel()
+                    tile += sizeof(quint16); // was converted to 16 bits in loadLevelRow()
                 }
             } else {
                 for (int x = 0; x < width; x++) {
                     *dataPtr++ = qFromBigEndian<float>(*(const float *)tile) * 255;
-                    tile += sizeof(QRgb); // yeah! see loadTileRLE()
+                    tile += sizeof(QRgb); // yeah! see decodeTileRLE()
                 }
             }
         } else if (bpc == 2) {
@@ -2489,12 +2870,12 @@ bool XCFImageFormat::assignMaskBytes(Layer &layer, uint i, uint j, const GimpPre
             if (precision < GimpPrecision::GIMP_PRECISION_HALF_LINEAR) {
                 for (int x = 0; x < width; x++) {
                     *dataPtr++ = qFromBigEndian<quint16>(*(const quint16 *)tile) / 257;
-                    tile += sizeof(QRgb); // yeah! see loadTileRLE()
+                    tile += sizeof(QRgb); // yeah! see decodeTileRLE()
                 }
             } else {
                 for (int x = 0; x < width; x++) {
                     *dataPtr++ = qFromBigEndian<qfloat16>(*(const qfloat16 *)tile) * 255;
-                    tile += sizeof(QRgb); // yeah! see loadTileRLE()
+                    tile += sizeof(QRgb); // yeah! see decodeTileRLE()
                 }
             }
         }
@@ -2502,19 +2883,19 @@ bool XCFImageFormat::assignMaskBytes(Layer &layer, uint i, uint j, const GimpPre
         if (bpc == 2) {
             for (int x = 0; x < width; x++) {
                 *dataPtr++ = qFromBigEndian<quint16>(*(const quint16 *)tile) / 257;
-                tile += sizeof(QRgb); // yeah! see loadTileRLE() / loadLevel()
+                tile += sizeof(QRgb); // yeah! see decodeTileRLE() / loadLevelRow()
             }
         } else if (bpc == 4) {
             for (int x = 0; x < width; x++) {
                 *dataPtr++ = qFromBigEndian<quint16>(*(const quint16 *)tile) / 257;
-                tile += sizeof(quint16); // was converted to 16 bits in loadLevel()
+                tile += sizeof(quint16); // was converted to 16 bits in loadLevelRow()
             }
         }
 #endif
         else {
             for (int x = 0; x < width; x++) {
                 *dataPtr++ = tile[0];
-                tile += sizeof(QRgb); // yeah! see loadTileRLE()
+                tile += sizeof(QRgb); // yeah! see decodeTileRLE()
             }
         }
     }
@@ -2709,12 +3090,307 @@ bool XCFImageFormat::initializeImage(XCFImage &xcf_image)
     return true;
 }
 
+namespace
+{
+//! Layer modes with a span kernel. Every other mode is merged pixel by pixel.
+enum class SpanMode {
+    Normal,
+    Multiply,
+    Divide,
+    Screen,
+    Overlay,
+    Difference,
+    Addition,
+    Subtract,
+    DarkenOnly,
+    LightenOnly,
+    GrainExtract,
+    GrainMerge,
+};
+
+/*!
+ * Merge a span of 8-bit RGBA layer pixels into 8-bit RGBA image pixels.
+ * Fully transparent layer pixels are skipped, as in the per-pixel path.
+ * This does the same math as XCFImageFormat::mergeRGBToRGB(), but with the
+ * mode and alpha handling resolved at compile time and direct access to the
+ * scanlines instead of a QImage::pixel() and QImage::setPixel() call pair
+ * per pixel. The loop itself remains scalar.
+ */
+template<SpanMode mode, bool affectsAlpha>
+void mergeRGBASpan(const uchar *src, const uchar *mask, uchar *dst, int count, int opacity)
+{
+    for (int x = 0; x < count; ++x, src += 4, dst += 4) {
+        int src_r = src[0];
+        int src_g = src[1];
+        int src_b = src[2];
+        int src_a = src[3];
+
+        const int dst_r = dst[0];
+        const int dst_g = dst[1];
+        const int dst_b = dst[2];
+        const int dst_a = dst[3];
+
+        if (!src_a) {
+            continue; // nothing to merge
+        }
+
+        switch (mode) {
+        case SpanMode::Normal:
+            break;
+        case SpanMode::Multiply:
+            src_r = INT_MULT(src_r, dst_r);
+            src_g = INT_MULT(src_g, dst_g);
+            src_b = INT_MULT(src_b, dst_b);
+            break;
+        case SpanMode::Divide:
+            src_r = qMin((dst_r * 256) / (1 + src_r), 255);
+            src_g = qMin((dst_g * 256) / (1 + src_g), 255);
+            src_b = qMin((dst_b * 256) / (1 + src_b), 255);
+            break;
+        case SpanMode::Screen:
+            src_r = 255 - INT_MULT(255 - dst_r, 255 - src_r);
+            src_g = 255 - INT_MULT(255 - dst_g, 255 - src_g);
+            src_b = 255 - INT_MULT(255 - dst_b, 255 - src_b);
+            break;
+        case SpanMode::Overlay:
+            src_r = INT_MULT(dst_r, dst_r + INT_MULT(2 * src_r, 255 - dst_r));
+            src_g = INT_MULT(dst_g, dst_g + INT_MULT(2 * src_g, 255 - dst_g));
+            src_b = INT_MULT(dst_b, dst_b + INT_MULT(2 * src_b, 255 - dst_b));
+            break;
+        case SpanMode::Difference:
+            src_r = qAbs(dst_r - src_r);
+            src_g = qAbs(dst_g - src_g);
+            src_b = qAbs(dst_b - src_b);
+            break;
+        case SpanMode::Addition:
+            src_r = qMin(dst_r + src_r, 255);
+            src_g = qMin(dst_g + src_g, 255);
+            src_b = qMin(dst_b + src_b, 255);
+            break;
+        case SpanMode::Subtract:
+            src_r = qMax(dst_r - src_r, 0);
+            src_g = qMax(dst_g - src_g, 0);
+            src_b = qMax(dst_b - src_b, 0);
+            break;
+        case SpanMode::DarkenOnly:
+            src_r = qMin(dst_r, src_r);
+            src_g = qMin(dst_g, src_g);
+            src_b = qMin(dst_b, src_b);
+            break;
+        case SpanMode::LightenOnly:
+            src_r = qMax(dst_r, src_r);
+            src_g = qMax(dst_g, src_g);
+            src_b = qMax(dst_b, src_b);
+            break;
+        case SpanMode::GrainExtract:
+            src_r = qBound(0, dst_r - src_r + 128, 255);
+            src_g = qBound(0, dst_g - src_g + 128, 255);
+            src_b = qBound(0, dst_b - src_b + 128, 255);
+            break;
+        case SpanMode::GrainMerge:
+            src_r = qBound(0, dst_r + src_r - 128, 255);
+            src_g = qBound(0, dst_g + src_g - 128, 255);
+            src_b = qBound(0, dst_b + src_b - 128, 255);
+            break;
+        }
+
+        if (mode != SpanMode::Normal) {
+            src_a = qMin(src_a, dst_a);
+        }
+
+        src_a = INT_MULT(src_a, opacity);
+
+        // Apply the mask (if any)
+
+        if (mask) {
+            src_a = INT_MULT(src_a, mask[x]);
+        }
+
+        const uchar new_a = dst_a + INT_MULT(OPAQUE_OPACITY - dst_a, src_a);
+
+        const float src_ratio = new_a == 0 ? 1.0 : (float)src_a / new_a;
+        const float dst_ratio = 1.0 - src_ratio;
+
+        dst[0] = (uchar)(src_ratio * src_r + dst_ratio * dst_r + EPSILON);
+        dst[1] = (uchar)(src_ratio * src_g + dst_ratio * dst_g + EPSILON);
+        dst[2] = (uchar)(src_ratio * src_b + dst_ratio * dst_b + EPSILON);
+
+        if (affectsAlpha) {
+            dst[3] = new_a;
+        }
+    }
+}
+
+/*!
+ * Copy a span of 8-bit RGBA layer pixels into 8-bit RGBA image pixels.
+ * This does the same math as XCFImageFormat::copyRGBToRGB().
+ */
+template<bool layerAlpha, bool imageAlpha>
+void copyRGBASpan(const uchar *src, const uchar *mask, uchar *dst, int count, int opacity)
+{
+    for (int x = 0; x < count; ++x, src += 4, dst += 4) {
+        int src_a = opacity;
+
+        if (layerAlpha) {
+            src_a = INT_MULT(src_a, src[3]);
+        }
+
+        // Apply the mask (if any)
+
+        if (mask) {
+            src_a = INT_MULT(src_a, mask[x]);
+        }
+
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = imageAlpha ? src_a : OPAQUE_OPACITY;
+    }
+}
+
+bool isRGBA8888(const QImage &image)
+{
+    return image.format() == QImage::Format_RGBA8888 || image.format() == QImage::Format_RGBX8888;
+}
+} // namespace
+
+/*!
+ * Select the span kernel used to copy the bottom-most layer into the final
+ * QImage, if the layer and image formats allow it. Unmasked layers are
+ * drawn with QPainter instead, so in practice this serves masked layers.
+ * \param layer source layer.
+ * \param image destination image.
+ * \return the span kernel or nullptr if pixels must be copied one by one.
+ */
+XCFImageFormat::SpanOperation XCFImageFormat::copySpanOperation(const Layer &layer, const QImage &image)
+{
+    if (!isRGBA8888(image)) {
+        return nullptr;
+    }
+
+    const bool imageAlpha = image.format() == QImage::Format_RGBA8888;
+
+    if (layer.type == RGBA_GIMAGE) {
+        return imageAlpha ? copyRGBASpan<true, true> : copyRGBASpan<true, false>;
+    }
+    return imageAlpha ? copyRGBASpan<false, true> : copyRGBASpan<false, false>;
+}
+
+/*!
+ * Select the span kernel used to merge a layer into the final QImage, if
+ * there is one for its mode and the image format allows it. This covers
+ * masked layers, and unmasked layers in the modes that have no QPainter
+ * composition mode equivalent; other unmasked layers are drawn with QPainter
+ * before getting here.
+ * \param layer source layer.
+ * \param image destination image.
+ * \return the span kernel or nullptr if pixels must be merged one by one.
+ */
+XCFImageFormat::SpanOperation XCFImageFormat::mergeSpanOperation(const Layer &layer, const QImage &image)
+{
+    if (!isRGBA8888(image)) {
+        return nullptr;
+    }
+
+    const bool affectsAlpha = modeAffectsSourceAlpha(layer.mode);
+
+    switch (layer.mode) {
+    case GIMP_LAYER_MODE_NORMAL:
+    case GIMP_LAYER_MODE_NORMAL_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::Normal, true> : mergeRGBASpan<SpanMode::Normal, false>;
+    case GIMP_LAYER_MODE_MULTIPLY:
+    case GIMP_LAYER_MODE_MULTIPLY_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::Multiply, true> : mergeRGBASpan<SpanMode::Multiply, false>;
+    case GIMP_LAYER_MODE_DIVIDE:
+    case GIMP_LAYER_MODE_DIVIDE_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::Divide, true> : mergeRGBASpan<SpanMode::Divide, false>;
+    case GIMP_LAYER_MODE_SCREEN:
+    case GIMP_LAYER_MODE_SCREEN_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::Screen, true> : mergeRGBASpan<SpanMode::Screen, false>;
+    case GIMP_LAYER_MODE_OVERLAY:
+    case GIMP_LAYER_MODE_OVERLAY_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::Overlay, true> : mergeRGBASpan<SpanMode::Overlay, false>;
+    case GIMP_LAYER_MODE_DIFFERENCE:
+    case GIMP_LAYER_MODE_DIFFERENCE_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::Difference, true> : mergeRGBASpan<SpanMode::Difference, false>;
+    case GIMP_LAYER_MODE_ADDITION:
+    case GIMP_LAYER_MODE_ADDITION_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::Addition, true> : mergeRGBASpan<SpanMode::Addition, false>;
+    case GIMP_LAYER_MODE_SUBTRACT:
+    case GIMP_LAYER_MODE_SUBTRACT_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::Subtract, true> : mergeRGBASpan<SpanMode::Subtract, false>;
+    case GIMP_LAYER_MODE_DARKEN_ONLY:
+    case GIMP_LAYER_MODE_DARKEN_ONLY_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::DarkenOnly, true> : mergeRGBASpan<SpanMode::DarkenOnly, false>;
+    case GIMP_LAYER_MODE_LIGHTEN_ONLY:
+    case GIMP_LAYER_MODE_LIGHTEN_ONLY_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::LightenOnly, true> : mergeRGBASpan<SpanMode::LightenOnly, false>;
+    case GIMP_LAYER_MODE_GRAIN_EXTRACT:
+    case GIMP_LAYER_MODE_GRAIN_EXTRACT_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::GrainExtract, true> : mergeRGBASpan<SpanMode::GrainExtract, false>;
+    case GIMP_LAYER_MODE_GRAIN_MERGE:
+    case GIMP_LAYER_MODE_GRAIN_MERGE_LEGACY:
+        return affectsAlpha ? mergeRGBASpan<SpanMode::GrainMerge, true> : mergeRGBASpan<SpanMode::GrainMerge, false>;
+    default:
+        return nullptr;
+    }
+}
+
+/*!
+ * Apply a span kernel to every row of a tile, clipped to the final QImage.
+ * \param layer source layer.
+ * \param i x tile index.
+ * \param j y tile index.
+ * \param image destination image.
+ * \param x x position of the tile in the destination image.
+ * \param y y position of the tile in the destination image.
+ * \param operation the span kernel.
+ * \return false if the tile is not in an 8-bit RGBA format, in which case
+ *         it has to be copied or merged pixel by pixel instead.
+ */
+bool XCFImageFormat::applySpanOperation(const Layer &layer, uint i, uint j, QImage &image, int x, int y, SpanOperation operation)
+{
+    const QImage &tile = layer.image_tiles[j][i];
+
+    if (!isRGBA8888(tile) || !isRGBA8888(image)) {
+        return false;
+    }
+
+    const int kBegin = qMax(0, -x);
+    const int kEnd = qMin(tile.width(), image.width() - x);
+
+    if (kBegin >= kEnd) {
+        return true;
+    }
+
+    const QImage *mask = nullptr;
+    if (layer.apply_mask == 1 && layer.mask_tiles.size() > (int)j && layer.mask_tiles[j].size() > (int)i) {
+        mask = &layer.mask_tiles[j][i];
+    }
+
+    for (int l = 0; l < tile.height(); l++) {
+        const int n = y + l;
+
+        if (n < 0 || n >= image.height()) {
+            continue;
+        }
+
+        const uchar *src = tile.constScanLine(l) + kBegin * 4;
+        const uchar *maskLine = mask ? mask->constScanLine(l) + kBegin : nullptr;
+        uchar *dst = image.scanLine(n) + (x + kBegin) * 4;
+
+        operation(src, maskLine, dst, kEnd - kBegin, layer.opacity);
+    }
+
+    return true;
+}
+
 /*!
  * Copy a layer into an image, taking account of the manifold modes. The
  * contents of the image are replaced.
  * \param xcf_image contains the layer and image to be replaced.
  */
-void XCFImageFormat::copyLayerToImage(XCFImage &xcf_image)
+bool XCFImageFormat::copyLayerToImage(QDataStream &xcf_io, XCFImage &xcf_image)
 {
     Layer &layer(xcf_image.layer);
     QImage &image(xcf_image.image);
@@ -2747,14 +3423,24 @@ void XCFImageFormat::copyLayerToImage(XCFImage &xcf_image)
     }
 
     if (!copy) {
-        return;
+        return true;
     }
 
-    // For each tile...
+    const SpanOperation copySpan = copy == copyRGBToRGB ? copySpanOperation(layer, image) : nullptr;
+
+    // For each row of tiles...
 
     for (uint j = 0; j < layer.nrows; j++) {
         uint y = j * TILE_HEIGHT;
 
+        if (!tileRowOnCanvas(xcf_image, j)) {
+            continue;
+        }
+
+        if (!loadTileRow(xcf_io, xcf_image, j)) {
+            return false;
+        }
+
         for (uint i = 0; i < layer.ncols; i++) {
             uint x = i * TILE_WIDTH;
 
@@ -2782,13 +3468,17 @@ void XCFImageFormat::copyLayerToImage(XCFImage &xcf_image)
                 QPainter painter(&image);
                 painter.setOpacity(layer.opacity / 255.0);
                 painter.setCompositionMode(QPainter::CompositionMode_Source);
-                if (x + layer.x_offset < MAX_IMAGE_WIDTH &&
-                    y + layer.y_offset < MAX_IMAGE_HEIGHT) {
+                if (qint64(x) + layer.x_offset < MAX_IMAGE_WIDTH &&
+                    qint64(y) + layer.y_offset < MAX_IMAGE_HEIGHT) {
                     painter.drawImage(x + layer.x_offset, y + layer.y_offset, layer.image_tiles[j][i]);
                 }
                 continue;
             }
 
+            if (copySpan && applySpanOperation(layer, i, j, image, x + layer.x_offset, y + layer.y_offset, copySpan)) {
+                continue;
+            }
+
             for (int l = 0; l < layer.image_tiles[j][i].height(); l++) {
                 for (int k = 0; k < layer.image_tiles[j][i].width(); k++) {
                     int m = x + k + layer.x_offset;
@@ -2803,6 +3493,8 @@ void XCFImageFormat::copyLayerToImage(XCFImage &xcf_image)
             }
         }
     }
+
+    return true;
 }
 
 /*!
@@ -3004,7 +3696,7 @@ void XCFImageFormat::copyIndexedAToRGB(const Layer &layer, uint i, uint j, int k
  * Merge a layer into an image, taking account of the manifold modes.
  * \param xcf_image contains the layer and image to merge.
  */
-void XCFImageFormat::mergeLayerIntoImage(XCFImage &xcf_image)
+bool XCFImageFormat::mergeLayerIntoImage(QDataStream &xcf_io, XCFImage &xcf_image)
 {
     Layer &layer(xcf_image.layer);
     QImage &image(xcf_image.image);
@@ -3012,7 +3704,7 @@ void XCFImageFormat::mergeLayerIntoImage(XCFImage &xcf_image)
     PixelMergeOperation merge = nullptr;
 
     if (!layer.opacity) {
-        return; // don't bother doing anything
+        return true; // don't bother doing anything
     }
 
     if (layer.blendSpace == XCFImageFormat::AutoColorSpace) {
@@ -3068,7 +3760,7 @@ void XCFImageFormat::mergeLayerIntoImage(XCFImage &xcf_image)
     }
 
     if (!merge) {
-        return;
+        return true;
     }
 
     if (merge == mergeRGBToRGB && layer.apply_mask != 1) {
@@ -3181,21 +3873,31 @@ void XCFImageFormat::mergeLayerIntoImage(XCFImage &xcf_image)
             for (uint j = 0; j < layer.nrows; j++) {
                 uint y = j * TILE_HEIGHT;
 
+                if (!tileRowOnCanvas(xcf_image, j)) {
+                    continue;
+                }
+
+                if (!loadTileRow(xcf_io, xcf_image, j)) {
+                    return false;
+                }
+
                 for (uint i = 0; i < layer.ncols; i++) {
                     uint x = i * TILE_WIDTH;
 
                     QImage &tile = layer.image_tiles[j][i];
-                    if (x + layer.x_offset < MAX_IMAGE_WIDTH &&
-                        y + layer.y_offset < MAX_IMAGE_HEIGHT) {
+                    if (qint64(x) + layer.x_offset < MAX_IMAGE_WIDTH &&
+                        qint64(y) + layer.y_offset < MAX_IMAGE_HEIGHT) {
                         painter.drawImage(x + layer.x_offset, y + layer.y_offset, tile);
                     }
                 }
             }
 
-            return;
+            return true;
         }
     }
 
+    const SpanOperation mergeSpan = merge == mergeRGBToRGB ? mergeSpanOperation(layer, image) : nullptr;
+
 #ifndef DISABLE_IMAGE_PROFILE_CONV // The final profile should be the one in the Parasite
     if (layer.compositeSpace == XCFImageFormat::RgbPerceptualSpace && image.colorSpace() != QColorSpace::SRgb) {
         qCDebug(XCFPLUGIN) << "Converting to composite color space" << layer.compositeSpace;
@@ -3210,6 +3912,14 @@ void XCFImageFormat::mergeLayerIntoImage(XCFImage &xcf_image)
     for (uint j = 0; j < layer.nrows; j++) {
         uint y = j * TILE_HEIGHT;
 
+        if (!tileRowOnCanvas(xcf_image, j)) {
+            continue;
+        }
+
+        if (!loadTileRow(xcf_io, xcf_image, j)) {
+            return false;
+        }
+
         for (uint i = 0; i < layer.ncols; i++) {
             uint x = i * TILE_WIDTH;
 
@@ -3237,8 +3947,8 @@ void XCFImageFormat::mergeLayerIntoImage(XCFImage &xcf_image)
                 QPainter painter(&image);
                 painter.setOpacity(layer.opacity / 255.0);
                 painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-                if (x + layer.x_offset < MAX_IMAGE_WIDTH &&
-                    y + layer.y_offset < MAX_IMAGE_HEIGHT) {
+                if (qint64(x) + layer.x_offset < MAX_IMAGE_WIDTH &&
+                    qint64(y) + layer.y_offset < MAX_IMAGE_HEIGHT) {
                     painter.drawImage(x + layer.x_offset, y + layer.y_offset, layer.image_tiles[j][i]);
                 }
                 continue;
@@ -3254,6 +3964,10 @@ void XCFImageFormat::mergeLayerIntoImage(XCFImage &xcf_image)
             }
 #endif
 
+            if (mergeSpan && applySpanOperation(layer, i, j, image, x + layer.x_offset, y + layer.y_offset, mergeSpan)) {
+                continue;
+            }
+
             for (int l = 0; l < layer.image_tiles[j][i].height(); l++) {
                 for (int k = 0; k < layer.image_tiles[j][i].width(); k++) {
                     int m = x + k + layer.x_offset;
@@ -3263,13 +3977,17 @@ void XCFImageFormat::mergeLayerIntoImage(XCFImage &xcf_image)
                         continue;
                     }
 
+                    // Only an unhandled layer mode makes this fail, in
+                    // which case the rest of the layer is left out.
                     if (!(*merge)(layer, i, j, k, l, image, m, n)) {
-                        return;
+                        return true;
                     }
                 }
             }
         }
     }
+
+    return true;
 }
 
 /*!
@@ -3301,7 +4019,7 @@ bool XCFImageFormat::mergeRGBToRGB(const Layer &layer, uint i, uint j, int k, in
     uchar dst_a = qAlpha(dst);
 
     if (!src_a) {
-        return false; // nothing to merge
+        return true; // nothing to merge
     }
 
     switch (layer.mode) {
@@ -3686,7 +4404,7 @@ bool XCFImageFormat::mergeGrayAToGray(const Layer &layer, uint i, uint j, int k,
     uchar src_a = layer.alpha_tiles[j][i].pixelIndex(k, l);
 
     if (!src_a) {
-        return false; // nothing to merge
+        return true; // nothing to merge
     }
 
     switch (layer.mode) {
@@ -3847,7 +4565,7 @@ bool XCFImageFormat::mergeGrayAToRGB(const Layer &layer, uint i, uint j, int k,
     uchar dst_a = qAlpha(image.pixel(m, n));
 
     if (!src_a) {
-        return false; // nothing to merge
+        return true; // nothing to merge
     }
 
     switch (layer.mode) {
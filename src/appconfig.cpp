@@ -18,11 +18,20 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+
 #include "appconfig.hpp"
 
-#include <QBuffer>
+#include "trace.hpp"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
 #include <QSettings>
-#include <QMessageBox>
+#include <QStandardPaths>
+
+#include <memory>
 
 namespace MosConfig {
 
@@ -32,44 +41,135 @@ namespace {
 // write alpha values other than 0x00 or 0xFF for the relevant config).
 constexpr unsigned COMPAT_NO_COLOR_RANGE_ICON = 0xDEADCAFEU;
 
+constexpr quint32 COLOR_LIBRARY_MAGIC = 0x5753434CU; // "WSCL"
+
+constexpr quint32 COLOR_LIBRARY_VERSION = 1;
+
+// Enough for previewing images up to about 14000x14000 pixels, while still
+// refusing the largest images rather than running out of memory
+constexpr int DEFAULT_IMAGE_MEMORY_BUDGET = 4096; // MiB
+
+/**
+ * Returns the path to a file in the application config directory.
+ */
+QString configFilePath(const QString& fileName)
+{
+	const auto dir = QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation);
+
+	return QDir{dir}.filePath(fileName);
+}
+
+/**
+ * Returns the path to the recent files thumbnail cache.
+ */
+QString thumbnailCachePath()
+{
+	return configFilePath("recent-thumbnails.cache");
+}
+
+/**
+ * Returns the path to the custom color ranges and palettes file.
+ */
+QString colorLibraryPath()
+{
+	return configFilePath("color-library.dat");
+}
+
 } // end unnamed namespace
 
-Manager::Manager()
-	: imageFilesMru_()
-	, customColorRanges_()
-	, customPalettes_()
-	, rememberMainWindowSize_()
-	, mainWindowSize_()
-	, defaultZoom_()
-	, previewBackgroundColor_()
-	, rememberImageViewMode_()
-	, imageViewMode_()
-	, pngVanityPlate_()
+ColorLibraryStatus readColorLibrary(const QString& filePath,
+									QMap<QString, ColorRange>& colorRanges,
+									QMap<QString, ColorList>& palettes)
 {
-	QSettings qs;
+	QFile file{filePath};
 
-	//
-	// Workspace configuation
-	//
+	if (!file.exists())
+		return ColorLibraryMissing;
 
-	rememberMainWindowSize_ = qs.value("preview/rememberWindowSize", true).toBool();
+	if (!file.open(QIODevice::ReadOnly))
+		return ColorLibraryUnreadable;
 
-	mainWindowSize_ = qs.value("preview/windowSize").toSize();
+	QDataStream in{file.readAll()};
+	quint32 magic = 0, version = 0;
 
-	defaultZoom_ = qs.value("preview/defaultZoom", qreal(1.0)).toReal();
+	in.setVersion(QDataStream::Qt_6_0);
+	in >> magic >> version;
 
-	previewBackgroundColor_ = qs.value("preview/background").toString();
+	if (magic != COLOR_LIBRARY_MAGIC || version != COLOR_LIBRARY_VERSION)
+		return ColorLibraryUnreadable;
 
-	rememberImageViewMode_ = qs.value("preview/rememberMode", true).toBool();
+	QMap<QString, ColorRange> newColorRanges;
+	QMap<QString, ColorList> newPalettes;
+	quint32 count = 0;
 
-	imageViewMode_ = qs.value("preview/mode", ImageViewVSplit).value<ImageViewMode>();
+	in >> count;
 
-	//
-	// Backend configuration
-	//
+	for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+	{
+		QString id;
+		quint32 mid = 0, max = 0, min = 0, rep = 0;
 
-	pngVanityPlate_ = qs.value("fileOptions/pngVanityPlate", true).toBool();
+		in >> id >> mid >> max >> min >> rep;
+		newColorRanges.insert(id, { mid, max, min, rep });
+	}
+
+	in >> count;
+
+	for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+	{
+		QString id;
+		ColorList palette;
+
+		in >> id >> palette;
+		newPalettes.insert(id, palette);
+	}
 
+	// Trailing data means the file was written by something else
+	if (in.status() != QDataStream::Ok || !in.atEnd())
+		return ColorLibraryUnreadable;
+
+	colorRanges = std::move(newColorRanges);
+	palettes = std::move(newPalettes);
+
+	return ColorLibraryOk;
+}
+
+bool writeColorLibrary(const QString& filePath,
+					   const QMap<QString, ColorRange>& colorRanges,
+					   const QMap<QString, ColorList>& palettes)
+{
+	QByteArray data;
+	QDataStream out{&data, QIODevice::WriteOnly};
+
+	out.setVersion(QDataStream::Qt_6_0);
+	out << COLOR_LIBRARY_MAGIC << COLOR_LIBRARY_VERSION;
+
+	out << quint32(colorRanges.size());
+
+	for (const auto& [id, colorRange] : colorRanges.asKeyValueRange())
+	{
+		out << id << quint32(colorRange.mid()) << quint32(colorRange.max())
+			<< quint32(colorRange.min()) << quint32(colorRange.rep());
+	}
+
+	out << quint32(palettes.size());
+
+	for (const auto& [id, palette] : palettes.asKeyValueRange())
+		out << id << palette;
+
+	QDir{}.mkpath(QFileInfo{filePath}.absolutePath());
+
+	QSaveFile file{filePath};
+
+	return file.open(QIODevice::WriteOnly) &&
+		   file.write(data) == data.size() &&
+		   file.commit();
+}
+
+void readLegacyColorLibrary(QSettings& qs,
+							QMap<QString, ColorRange>& colorRanges,
+							QMap<QString, ColorList>& palettes)
+{
 	//
 	// User-defined color ranges
 	//
@@ -93,7 +193,7 @@ Manager::Manager()
 
 		ColorRange colorRange{mid, max, min, rep};
 
-		customColorRanges_.insert(id, colorRange);
+		colorRanges.insert(id, colorRange);
 	}
 
 	qs.endArray();
@@ -108,8 +208,6 @@ Manager::Manager()
 	{
 		qs.setArrayIndex(i);
 
-		// TODO: use QStringList variant instead
-
 		auto id = qs.value("id").toString();
 		auto values = qs.value("values").toString().split(',', Qt::SkipEmptyParts);
 
@@ -119,15 +217,112 @@ Manager::Manager()
 		for (const auto& value : values)
 			palette.emplaceBack(value.toUInt());
 
-		customPalettes_.insert(id, palette);
+		palettes.insert(id, palette);
 	}
 
 	qs.endArray();
+}
+
+QString backUpColorLibrary(const QString& filePath)
+{
+	const auto backupPath = filePath + ".bak";
+
+	if (QFile::exists(backupPath) || QFile::copy(filePath, backupPath))
+		return backupPath;
+
+	return {};
+}
+
+Manager::Manager()
+	: imageFilesMru_()
+	, writerPool_()
+	, pendingChanges_()
+	, transactionDepth_(0)
+	, customColorRanges_()
+	, customPalettes_()
+	, colorLibraryWritable_(true)
+	, rememberMainWindowSize_()
+	, mainWindowSize_()
+	, defaultZoom_()
+	, previewBackgroundColor_()
+	, rememberImageViewMode_()
+	, imageViewMode_()
+	, pngVanityPlate_()
+	, imageMemoryBudget_()
+{
+	QSettings qs;
+
+	writerPool_.setMaxThreadCount(1);
+
+	//
+	// Workspace configuation
+	//
+
+	rememberMainWindowSize_ = qs.value("preview/rememberWindowSize", true).toBool();
+
+	mainWindowSize_ = qs.value("preview/windowSize").toSize();
+
+	defaultZoom_ = qs.value("preview/defaultZoom", qreal(1.0)).toReal();
+
+	previewBackgroundColor_ = qs.value("preview/background").toString();
+
+	rememberImageViewMode_ = qs.value("preview/rememberMode", true).toBool();
+
+	imageViewMode_ = qs.value("preview/mode", ImageViewVSplit).value<ImageViewMode>();
+
+	//
+	// Backend configuration
+	//
+
+	pngVanityPlate_ = qs.value("fileOptions/pngVanityPlate", true).toBool();
+
+	imageMemoryBudget_ = qMax(0, qs.value("fileOptions/imageMemoryBudget", DEFAULT_IMAGE_MEMORY_BUDGET).toInt());
+
+	//
+	// User-defined color ranges and palettes
+	//
+
+	const auto libraryPath = colorLibraryPath();
+
+	switch (readColorLibrary(libraryPath, customColorRanges_, customPalettes_))
+	{
+		case ColorLibraryOk:
+			break;
+		case ColorLibraryMissing:
+			readLegacyColorLibrary(qs, customColorRanges_, customPalettes_);
+
+			// Migrate them right away so that this only happens once
+			if (!customColorRanges_.isEmpty() || !customPalettes_.isEmpty())
+				saveColorLibrary();
+			break;
+		case ColorLibraryUnreadable: {
+			// The file may be corrupted, truncated or written by a newer
+			// version. The settings no longer hold anything worth reading
+			// in that case, and overwriting the file would throw away
+			// whatever can still be salvaged from it, so leave it alone.
+			const auto backupPath = backUpColorLibrary(libraryPath);
+
+			colorLibraryWritable_ = false;
+
+			qWarning("Could not read custom color ranges and palettes from %s, "
+					 "changes to them will not be saved", qPrintable(libraryPath));
+
+			if (!backupPath.isEmpty())
+				qWarning("A copy of the file was saved to %s", qPrintable(backupPath));
+			break;
+		}
+	}
 
 	//
 	// Recent files
 	//
 
+	// Thumbnails are only read from the cache when the UI first needs them.
+	// The loaders share ownership of the cache so that it is released once
+	// every thumbnail has been loaded.
+
+	auto thumbnailCache = std::make_shared<const ThumbnailCache>(thumbnailCachePath());
+
 	const int numRecentFiles = qs.beginReadArray("recent_files");
 
 	for (int i = numRecentFiles - 1; i >= 0; --i)
@@ -135,170 +330,274 @@ Manager::Manager()
 		qs.setArrayIndex(i);
 
 		auto path = qs.value("path").toString();
-		auto thumbnailBase64 = qs.value("thumbnail").toString();
 
-		imageFilesMru_.push(path, thumbnailBase64);
+		if (thumbnailCache->contains(path)) {
+			imageFilesMru_.push(path, MruEntry::ThumbnailLoader{[thumbnailCache, path]() {
+				return thumbnailCache->thumbnail(path);
+			}});
+		} else {
+			// Thumbnails stored by version 0.5.x and earlier
+			auto thumbnailBase64 = qs.value("thumbnail").toByteArray();
+
+			imageFilesMru_.push(path, MruEntry::ThumbnailLoader{[thumbnailBase64]() {
+				return QImage::fromData(QByteArray::fromBase64(thumbnailBase64));
+			}});
+		}
 	}
 
 	qs.endArray();
 }
 
-void Manager::setRememberMainWindowSize(bool remember)
+Manager::~Manager()
 {
-	QSettings qs;
+	sync();
+}
+
+void Manager::beginTransaction()
+{
+	++transactionDepth_;
+}
+
+void Manager::commitTransaction()
+{
+	Q_ASSERT(transactionDepth_ > 0);
+
+	if (--transactionDepth_ == 0)
+		flush();
+}
+
+void Manager::sync()
+{
+	flush();
+	writerPool_.waitForDone();
+}
+
+void Manager::setValue(const QString& key, const QVariant& value)
+{
+	pendingChanges_.values.insert(key, value);
+
+	if (transactionDepth_ == 0)
+		flush();
+}
+
+void Manager::flush()
+{
+	if (pendingChanges_.empty())
+		return;
+
+	writerPool_.start([changes = std::move(pendingChanges_)]() {
+		MOS_TRACE_SPAN("config", "Write settings");
+
+		QSettings qs;
+
+		for (const auto& [key, value] : changes.values.asKeyValueRange())
+			qs.setValue(key, value);
+
+		if (changes.recentFiles) {
+			// Also gets rid of thumbnails stored by older versions
+			qs.remove("recent_files");
+
+			qs.beginWriteArray("recent_files");
+
+			for (int i = 0; i < changes.recentFiles->count(); ++i)
+			{
+				qs.setArrayIndex(i);
+				qs.setValue("path", changes.recentFiles->at(i));
+			}
+
+			qs.endArray();
+		}
+
+		if (changes.colorLibrary &&
+			writeColorLibrary(colorLibraryPath(),
+							  changes.colorLibrary->first,
+							  changes.colorLibrary->second)) {
+			// Forget about the ranges and palettes stored by older versions
+			// only once they are safely stored elsewhere
+			qs.remove("color_ranges");
+			qs.remove("palettes");
+		}
+
+		qs.sync();
+	});
 
+	pendingChanges_ = {};
+}
+
+void Manager::setRememberMainWindowSize(bool remember)
+{
 	rememberMainWindowSize_ = remember;
 
-	qs.setValue("preview/rememberWindowSize", remember);
+	setValue("preview/rememberWindowSize", remember);
 }
 
 void Manager::setMainWindowSize(const QSize& size)
 {
-	QSettings qs;
-
 	mainWindowSize_ = size;
 
-	qs.setValue("preview/windowSize", size);
+	setValue("preview/windowSize", size);
 }
 
 void Manager::setDefaultZoom(qreal zoom)
 {
-	QSettings qs;
-
 	defaultZoom_ = zoom;
 
-	qs.setValue("preview/defaultZoom", zoom);
+	setValue("preview/defaultZoom", zoom);
 }
 
 void Manager::setPreviewBackgroundColor(const QString& previewBackgroundColor)
 {
-	QSettings qs;
-
 	previewBackgroundColor_ = previewBackgroundColor;
 
-	qs.setValue("preview/background", previewBackgroundColor);
+	setValue("preview/background", previewBackgroundColor);
 }
 
 void Manager::setRememberImageViewMode(bool remember)
 {
-	QSettings qs;
-
 	rememberImageViewMode_ = remember;
 
-	qs.setValue("preview/rememberMode", remember);
+	setValue("preview/rememberMode", remember);
 }
 
 void Manager::setImageViewMode(ImageViewMode imageViewMode)
 {
-	QSettings qs;
-
 	imageViewMode_ = imageViewMode;
 
-	qs.setValue("preview/mode", imageViewMode);
+	setValue("preview/mode", imageViewMode);
 }
 
 void Manager::setPngVanityPlate(bool enable)
 {
-	QSettings qs;
-
 	pngVanityPlate_ = enable;
 
-	qs.setValue("fileOptions/pngVanityPlate", enable);
+	setValue("fileOptions/pngVanityPlate", enable);
 }
 
-void Manager::setCustomColorRanges(const QMap<QString, ColorRange>& colorRanges)
+void Manager::setImageMemoryBudget(int budget)
 {
-	QSettings qs;
-	int i = 0;
-
-	customColorRanges_ = colorRanges;
+	imageMemoryBudget_ = qMax(0, budget);
 
-	qs.beginWriteArray("color_ranges");
-
-	for (const auto& [id, colorRange] : customColorRanges_.asKeyValueRange())
-	{
-		qs.setArrayIndex(i);
+	setValue("fileOptions/imageMemoryBudget", imageMemoryBudget_);
+}
 
-		qs.setValue("id", id);
-		qs.setValue("avg", colorRange.mid());
-		qs.setValue("max", colorRange.max());
-		qs.setValue("min", colorRange.min());
-		qs.setValue("rep", colorRange.rep());
+void Manager::setCustomColorRanges(const QMap<QString, ColorRange>& colorRanges)
+{
+	if (colorRanges == customColorRanges_)
+		return;
 
-		++i;
-	}
+	customColorRanges_ = colorRanges;
 
-	qs.endArray();
+	saveColorLibrary();
 }
 
 void Manager::setCustomPalettes(const QMap<QString, ColorList>& palettes)
 {
-	QSettings qs;
-	int i = 0;
+	if (palettes == customPalettes_)
+		return;
 
 	customPalettes_ = palettes;
 
-	qs.beginWriteArray("palettes");
+	saveColorLibrary();
+}
 
-	for (const auto& [id, palette] : customPalettes_.asKeyValueRange())
-	{
-		qs.setArrayIndex(i);
+void Manager::saveColorLibrary()
+{
+	if (!colorLibraryWritable_)
+		return;
 
-		// TODO: use QStringList variant instead
+	// Both maps are implicitly shared, so this is cheap
+	pendingChanges_.colorLibrary = { customColorRanges_, customPalettes_ };
 
-		QString colorList;
+	if (transactionDepth_ == 0)
+		flush();
+}
+void Manager::addRecentFile(const QString& filePath,
+							const QImage& image,
+							const std::function<void()>& onThumbnailReady)
+{
+	// Re-pushing the top entry would only replace its thumbnail
+	if (imageFilesMru_.empty() || imageFilesMru_.front().filePath() != filePath) {
+		QImage previousThumbnail;
 
-		for (auto color : palette)
+		for (const auto& entry : imageFilesMru_)
 		{
-			if (!colorList.isEmpty())
-				colorList += ',';
-			colorList += QString::number(color);
+			if (entry.filePath() == filePath) {
+				previousThumbnail = entry.thumbnail();
+				break;
+			}
 		}
 
-		qs.setValue("id", id);
-		qs.setValue("values", colorList);
-
-		++i;
+		imageFilesMru_.push(filePath, previousThumbnail);
+		saveRecentFiles();
 	}
 
-	qs.endArray();
+	// The image is implicitly shared, so this does not copy any pixel data
+	// unless the caller modifies it before the task is done with it.
+	writerPool_.start([this, filePath, image, onThumbnailReady]() {
+		MOS_TRACE_SPAN("render", "Generate thumbnail");
+
+		const auto thumbnail = MruEntry::generateThumbnail(image);
+		auto* app = QCoreApplication::instance();
+
+		if (!app)
+			return;
+
+		QMetaObject::invokeMethod(app, [this, filePath, thumbnail, onThumbnailReady]() {
+			for (auto& entry : imageFilesMru_)
+			{
+				if (entry.filePath() == filePath) {
+					entry.setThumbnail(thumbnail);
+					saveThumbnails();
+					if (onThumbnailReady)
+						onThumbnailReady();
+					break;
+				}
+			}
+		}, Qt::QueuedConnection);
+	});
 }
 
-void Manager::addRecentFile(const QString& filePath, const QImage& image)
+void Manager::saveRecentFiles()
 {
-	QSettings qs;
-	int i = 0;
+	QStringList paths;
 
-	imageFilesMru_.push(filePath, image);
-
-	qs.beginWriteArray("recent_files");
+	paths.reserve(imageFilesMru_.count());
 
 	for (const auto& entry : imageFilesMru_)
-	{
-		qs.setArrayIndex(i);
+		paths.append(entry.filePath());
 
-		QBuffer thumbnail;
+	pendingChanges_.recentFiles = paths;
 
-		thumbnail.open(QIODevice::WriteOnly);
-		entry.thumbnail().save(&thumbnail, "PNG");
+	if (transactionDepth_ == 0)
+		flush();
+}
 
-		qs.setValue("path", entry.filePath());
-		qs.setValue("thumbnail", thumbnail.data().toBase64());
+void Manager::saveThumbnails()
+{
+	// Load any thumbnails still pending here, which also releases the
+	// current cache file mapping before the worker thread replaces it
+	for (const auto& entry : imageFilesMru_)
+		entry.thumbnail();
 
-		++i;
-	}
+	writerPool_.start([mru = imageFilesMru_]() {
+		MOS_TRACE_SPAN("config", "Write thumbnail cache");
 
-	qs.endArray();
+		const auto cachePath = thumbnailCachePath();
+
+		QDir{}.mkpath(QFileInfo{cachePath}.absolutePath());
+		ThumbnailCache::save(cachePath, mru);
+	});
 }
 
 void Manager::clearRecentFiles()
 {
-	QSettings qs;
-
 	imageFilesMru_.clear();
 
-	qs.beginWriteArray("recent_files");
-	qs.endArray();
+	saveRecentFiles();
+
+	writerPool_.start([]() {
+		QFile::remove(thumbnailCachePath());
+	});
 }
 
 } // end namespace MosConfig
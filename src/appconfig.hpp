@@ -24,6 +24,13 @@
 #include "wesnothrc.hpp"
 
 #include <QSize>
+#include <QThreadPool>
+#include <QVariantMap>
+
+class QSettings;
+
+#include <functional>
+#include <optional>
 
 namespace MosConfig {
 
@@ -40,6 +47,52 @@ enum ImageViewMode
 
 Q_ENUM_NS(ImageViewMode)
 
+/**
+ * Result of reading the color library file.
+ */
+enum ColorLibraryStatus
+{
+	ColorLibraryOk,
+	ColorLibraryMissing,
+	/** The file is corrupted, truncated or from a newer version. */
+	ColorLibraryUnreadable,
+};
+
+/**
+ * Reads custom color ranges and palettes from a color library file.
+ *
+ * The output arguments are only modified if the whole file could be read.
+ */
+ColorLibraryStatus readColorLibrary(const QString& filePath,
+									QMap<QString, ColorRange>& colorRanges,
+									QMap<QString, ColorList>& palettes);
+
+/**
+ * Writes custom color ranges and palettes to a color library file.
+ *
+ * The file is replaced atomically, and its directory is created if needed.
+ */
+bool writeColorLibrary(const QString& filePath,
+					   const QMap<QString, ColorRange>& colorRanges,
+					   const QMap<QString, ColorList>& palettes);
+
+/**
+ * Reads custom color ranges and palettes stored by version 0.5.x and
+ * earlier in the application settings.
+ */
+void readLegacyColorLibrary(QSettings& qs,
+							QMap<QString, ColorRange>& colorRanges,
+							QMap<QString, ColorList>& palettes);
+
+/**
+ * Copies a color library file next to itself with a .bak suffix.
+ *
+ * An existing backup is kept as is instead.
+ *
+ * @return The path to the backup, or an empty string on failure.
+ */
+QString backUpColorLibrary(const QString& filePath);
+
 class Manager
 {
 public:
@@ -58,6 +111,42 @@ public:
 	Manager& operator=(const Manager&) = delete;
 	Manager& operator=(Manager&&) = delete;
 
+	/**
+	 * Groups config changes so that they are written out together.
+	 *
+	 * Changes made through the setters are visible immediately, but are only
+	 * persisted once the outermost transaction ends, in a single write
+	 * performed in the background. Transactions may be nested.
+	 */
+	class Transaction
+	{
+	public:
+		explicit Transaction(Manager& manager = Manager::instance())
+			: manager_(manager)
+		{
+			manager_.beginTransaction();
+		}
+
+		~Transaction()
+		{
+			manager_.commitTransaction();
+		}
+
+		Transaction(const Transaction&) = delete;
+		Transaction& operator=(const Transaction&) = delete;
+
+	private:
+		Manager& manager_;
+	};
+
+	/**
+	 * Blocks until all config changes made so far have been persisted.
+	 *
+	 * Changes made outside of a transaction are persisted in the background
+	 * as soon as they are made, so this is only needed before exiting.
+	 */
+	void sync();
+
 	/**
 	 * Retrieves the current recent files.
 	 */
@@ -69,11 +158,20 @@ public:
 	/**
 	 * Adds a new recent file entry.
 	 *
+	 * The entry is added right away, but its thumbnail is generated and saved
+	 * in the background. Until then, an entry that was already in the list
+	 * keeps its previous thumbnail, and a new entry has none.
+	 *
 	 * @param filePath       File path.
 	 * @param image          Image contents of the file which will be used for
 	 *                       generating a thumbnail.
+	 * @param onThumbnailReady
+	 *                       Function called in the main thread once the new
+	 *                       thumbnail is available through recentFiles().
 	 */
-	void addRecentFile(const QString& filePath, const QImage& image);
+	void addRecentFile(const QString& filePath,
+					   const QImage& image,
+					   const std::function<void()>& onThumbnailReady = {});
 
 	/**
 	 * Clears the recent files list.
@@ -217,12 +315,61 @@ public:
 	 */
 	void setPngVanityPlate(bool enable);
 
+	/**
+	 * Returns the memory budget for images in MiB, or zero if there is none.
+	 */
+	int imageMemoryBudget() const
+	{
+		return imageMemoryBudget_;
+	}
+
+	/**
+	 * Sets the memory budget for images in MiB.
+	 *
+	 * Images that would not fit in the budget are refused, and cached renders
+	 * are discarded as needed to stay within it. Zero disables the budget.
+	 */
+	void setImageMemoryBudget(int budget);
+
 private:
+	/**
+	 * Config changes not yet handed over to the writer thread.
+	 */
+	struct PendingChanges
+	{
+		QVariantMap values;
+		std::optional<QStringList> recentFiles;
+		std::optional<std::pair<QMap<QString, ColorRange>, QMap<QString, ColorList>>> colorLibrary;
+
+		bool empty() const
+		{
+			return values.isEmpty() && !recentFiles && !colorLibrary;
+		}
+	};
+
 	Manager();
 
+	~Manager();
+
+	void beginTransaction();
+	void commitTransaction();
+
+	void setValue(const QString& key, const QVariant& value);
+	void flush();
+
+	void saveRecentFiles();
+	void saveThumbnails();
+	void saveColorLibrary();
+
 	MruList imageFilesMru_;
+	// Single thread so that settings and cache writes happen in order
+	QThreadPool writerPool_;
+	PendingChanges pendingChanges_;
+	int transactionDepth_;
 	QMap<QString, ColorRange> customColorRanges_;
 	QMap<QString, ColorList> customPalettes_;
+	// Unset when the existing color library could not be read
+	bool colorLibraryWritable_;
 	bool rememberMainWindowSize_;
 	QSize mainWindowSize_;
 	qreal defaultZoom_;
@@ -230,6 +377,7 @@ private:
 	bool rememberImageViewMode_;
 	ImageViewMode imageViewMode_;
 	bool pngVanityPlate_;
+	int imageMemoryBudget_;
 };
 
 inline Manager& current()
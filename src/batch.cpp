@@ -0,0 +1,709 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "batch.hpp"
+
+#include "threadpool.hpp"
+#include "trace.hpp"
+#include "version.hpp"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStringBuilder>
+
+namespace MosBatch {
+
+QString colorRangeSuffix(const QString& paletteId,
+						 int ordinal,
+						 const QString& rangeId)
+{
+	return "RC-" % paletteId % '-' % QString::number(ordinal) % '-' % rangeId;
+}
+
+QString paletteSwapSuffix(const QString& paletteId,
+						  const QString& targetPaletteId)
+{
+	return QString{"PAL-%1-%2"}.arg(paletteId, targetPaletteId);
+}
+
+QString colorBlendSuffix(const QColor& color, qreal blendFactor)
+{
+	auto colorName = color.name();
+	colorName.remove(0, 1);
+
+	return QString{"BLEND-%1-%2"}
+		   .arg(colorName)
+		   .arg(blendFactor * 100);
+}
+
+QString colorShiftSuffix(int redShift, int greenShift, int blueShift)
+{
+	return QString{"CS-%1-%2-%3"}
+		   .arg(redShift)
+		   .arg(greenShift)
+		   .arg(blueShift);
+}
+
+QString outputFileName(const QString& sourcePath, const QString& suffix)
+{
+	return QFileInfo(sourcePath).completeBaseName() % '-' % suffix % ".png";
+}
+
+bool isOutputFileName(const QString& fileName, const QStringList& suffixes)
+{
+	for (const auto& suffix : suffixes)
+	{
+		// Needs a non-empty stem in front of the suffix
+		const QString ending = '-' % suffix % ".png";
+
+		if (fileName.size() > ending.size() && fileName.endsWith(ending))
+			return true;
+	}
+
+	return false;
+}
+
+//
+// Options
+//
+
+QStringList Options::outputSuffixes() const
+{
+	QStringList suffixes;
+
+	suffixes.reserve(transforms.count());
+
+	for (const auto& transform : transforms)
+		suffixes.emplaceBack(transform.fileNameSuffix(keyPaletteId));
+
+	return suffixes;
+}
+
+//
+// Transform
+//
+
+Transform Transform::colorRange(const QString& id,
+								int ordinal,
+								const ColorRange& colorRange)
+{
+	Transform t{ColorRangeType};
+
+	t.id_ = id;
+	t.ordinal_ = ordinal;
+	t.colorRange_ = colorRange;
+
+	return t;
+}
+
+Transform Transform::paletteSwap(const QString& id,
+								 const ColorList& palette)
+{
+	Transform t{PaletteSwapType};
+
+	t.id_ = id;
+	t.palette_ = palette;
+
+	return t;
+}
+
+Transform Transform::colorBlend(const QColor& color, qreal blendFactor)
+{
+	Transform t{ColorBlendType};
+
+	t.blendColor_ = color;
+	t.blendFactor_ = qBound(0.0, blendFactor, 1.0);
+
+	return t;
+}
+
+Transform Transform::colorShift(int redShift, int greenShift, int blueShift)
+{
+	Transform t{ColorShiftType};
+
+	t.redShift_ = qBound(-255, redShift, 255);
+	t.greenShift_ = qBound(-255, greenShift, 255);
+	t.blueShift_ = qBound(-255, blueShift, 255);
+
+	return t;
+}
+
+QString Transform::fileNameSuffix(const QString& keyPaletteId) const
+{
+	switch (type_)
+	{
+		case ColorRangeType:
+			return colorRangeSuffix(keyPaletteId, ordinal_, id_);
+		case PaletteSwapType:
+			return paletteSwapSuffix(keyPaletteId, id_);
+		case ColorBlendType:
+			return colorBlendSuffix(blendColor_, blendFactor_);
+		case ColorShiftType:
+			return colorShiftSuffix(redShift_, greenShift_, blueShift_);
+	}
+
+	Q_ASSERT(false);
+	return {};
+}
+
+QByteArray Transform::stampData() const
+{
+	QByteArray data;
+	QDataStream out{&data, QIODevice::WriteOnly};
+
+	out << int(type_);
+
+	switch (type_)
+	{
+		case ColorRangeType:
+			out << colorRange_.mid() << colorRange_.max()
+				<< colorRange_.min() << colorRange_.rep();
+			break;
+		case PaletteSwapType:
+			out << palette_;
+			break;
+		case ColorBlendType:
+			out << blendColor_.rgba() << blendFactor_;
+			break;
+		case ColorShiftType:
+			out << redShift_ << greenShift_ << blueShift_;
+			break;
+	}
+
+	return data;
+}
+
+ColorMap Transform::colorMap(const ColorList& keyPalette) const
+{
+	switch (type_)
+	{
+		case ColorRangeType:
+			return colorRange_.applyToPalette(keyPalette);
+		case PaletteSwapType:
+			return generateColorMap(keyPalette, palette_);
+		default:
+			return {};
+	}
+}
+
+QImage Transform::apply(const QImage& input, const ColorMap& colorMap) const
+{
+	switch (type_)
+	{
+		case ColorRangeType:
+		case PaletteSwapType:
+			return recolorImage(input, colorMap);
+		case ColorBlendType:
+			return colorBlendImage(input, blendColor_, blendFactor_);
+		case ColorShiftType:
+			return colorShiftImage(input, redShift_, greenShift_, blueShift_);
+	}
+
+	Q_ASSERT(false);
+	return {};
+}
+
+//
+// Manifest
+//
+
+const QString Manifest::fileName = QStringLiteral(".wespal-manifest.json");
+
+QString Manifest::filePath() const
+{
+	return QDir{dirPath_}.filePath(fileName);
+}
+
+void Manifest::load()
+{
+	stamps_.clear();
+	dirty_ = false;
+
+	QFile file{filePath()};
+
+	if (!file.open(QIODevice::ReadOnly))
+		return;
+
+	const auto& outputs = QJsonDocument::fromJson(file.readAll())
+						  .object().value("outputs").toObject();
+
+	for (auto it = outputs.constBegin(); it != outputs.constEnd(); ++it)
+	{
+		stamps_.insert(it.key(), QByteArray::fromHex(it.value().toString().toLatin1()));
+	}
+}
+
+bool Manifest::save()
+{
+	if (!dirty_)
+		return true;
+
+	QJsonObject outputs;
+
+	for (auto it = stamps_.constBegin(); it != stamps_.constEnd(); ++it)
+	{
+		outputs.insert(it.key(), QString::fromLatin1(it.value().toHex()));
+	}
+
+	QJsonObject root;
+
+	root.insert("generator", QString{"Wespal %1"}.arg(MOS_VERSION));
+	root.insert("outputs", outputs);
+
+	QSaveFile file{filePath()};
+
+	if (!file.open(QIODevice::WriteOnly) ||
+		file.write(QJsonDocument{root}.toJson()) == -1 ||
+		!file.commit())
+	{
+		return false;
+	}
+
+	dirty_ = false;
+
+	return true;
+}
+
+void Manifest::setStamp(const QString& outputName, const QByteArray& stamp)
+{
+	auto& entry = stamps_[outputName];
+
+	if (entry != stamp) {
+		entry = stamp;
+		dirty_ = true;
+	}
+}
+
+//
+// Source collection
+//
+
+QStringList imageFileNameFilters()
+{
+	QStringList nameFilters;
+
+	for (const auto& format : QImageReader::supportedImageFormats())
+	{
+		nameFilters.emplaceBack(QStringLiteral("*.") % QString::fromLatin1(format));
+	}
+
+	return nameFilters;
+}
+
+bool isInsideDirectory(const QString& path, const QString& dirPath)
+{
+	if (path.size() <= dirPath.size() || !path.startsWith(dirPath))
+		return false;
+
+	return dirPath.endsWith('/') || path.at(dirPath.size()) == '/';
+}
+
+QList<Source> collectSources(const QStringList& inputs,
+							 const QString& outputDir,
+							 const QStringList& outputSuffixes)
+{
+	QList<Source> sources;
+	const auto& nameFilters = imageFileNameFilters();
+
+	const QDir baseOutputDir{outputDir};
+	const auto& absOutputDir = QDir::cleanPath(baseOutputDir.absolutePath());
+
+	for (const auto& input : inputs)
+	{
+		const QFileInfo inputInfo{input};
+
+		if (!inputInfo.isDir()) {
+			sources.emplaceBack(Source{input, outputDir});
+			continue;
+		}
+
+		const QDir inputDir{inputInfo.absoluteFilePath()};
+		// Don't pick up anything from the output directory if it is stored
+		// inside the input tree. If the output directory contains the input
+		// tree instead, only files named like outputs are skipped.
+		const bool skipOutputDir = isInsideDirectory(absOutputDir,
+													 QDir::cleanPath(inputDir.absolutePath()));
+		QDirIterator it{inputDir.path(),
+						nameFilters,
+						QDir::Files | QDir::Readable,
+						QDirIterator::Subdirectories};
+
+		while (it.hasNext())
+		{
+			const auto& fileInfo = it.nextFileInfo();
+			const auto& dirPath = fileInfo.absolutePath();
+
+			if (skipOutputDir &&
+				(dirPath == absOutputDir || isInsideDirectory(dirPath, absOutputDir)))
+			{
+				continue;
+			}
+
+			// Outputs of this job from an earlier run in an overlapping tree
+			if (isOutputFileName(fileInfo.fileName(), outputSuffixes))
+				continue;
+
+			const auto& relativeDir = inputDir.relativeFilePath(dirPath);
+
+			sources.emplaceBack(Source{
+				fileInfo.filePath(),
+				QDir::cleanPath(baseOutputDir.filePath(relativeDir))
+			});
+		}
+	}
+
+	return sources;
+}
+
+//
+// Processor
+//
+
+namespace {
+
+QImage decodeImage(const QString& path, QByteArray& data)
+{
+	MOS_TRACE_SPAN("io", "Decode image");
+
+	QBuffer buffer{&data};
+	QImageReader reader{&buffer, QFileInfo{path}.suffix().toLatin1()};
+
+	return reader.read();
+}
+
+QByteArray imageContentHash(const QImage& image)
+{
+	MOS_TRACE_SPAN("batch", "Hash output");
+
+	QCryptographicHash hash{QCryptographicHash::Sha1};
+
+	const qint32 size[] = { image.width(), image.height(), image.format() };
+
+	hash.addData(QByteArrayView{reinterpret_cast<const char*>(size), sizeof(size)});
+	hash.addData(QByteArrayView{reinterpret_cast<const char*>(image.constBits()),
+								image.sizeInBytes()});
+
+	return hash.result();
+}
+
+} // end unnamed namespace
+
+Processor::Processor(const Options& options)
+	: options_(options)
+	, colorMaps_()
+	, transformStamps_()
+	, manifestMutex_()
+	, manifests_()
+	, dedupeMutex_()
+	, contentWritten_()
+	, outputsByContent_()
+	, contentInProgress_()
+	, resultMutex_()
+	, result_()
+{
+	colorMaps_.reserve(options_.transforms.count());
+	transformStamps_.reserve(options_.transforms.count());
+
+	for (const auto& transform : options_.transforms)
+	{
+		colorMaps_.emplaceBack(transform.colorMap(options_.keyPalette));
+
+		QCryptographicHash hash{QCryptographicHash::Sha1};
+		QByteArray common;
+		QDataStream out{&common, QIODevice::WriteOnly};
+
+		out << MOS_VERSION << options_.vanityPlate << options_.keyPalette;
+
+		hash.addData(common);
+		hash.addData(transform.stampData());
+
+		transformStamps_.emplaceBack(hash.result());
+	}
+}
+
+QString Processor::outputPath(const Source& source, qsizetype transformIndex) const
+{
+	const auto& suffix = options_.transforms[transformIndex].fileNameSuffix(options_.keyPaletteId);
+
+	return source.outputDir % '/' % outputFileName(source.path, suffix);
+}
+
+Result Processor::run(const QList<Source>& sources, WorkStealingPool& pool)
+{
+	{
+		QMutexLocker lock{&resultMutex_};
+		result_ = {};
+	}
+
+	manifests_.clear();
+	outputsByContent_.clear();
+	contentInProgress_.clear();
+
+	for (const auto& source : sources)
+	{
+		pool.submit([this, source, &pool]() {
+			processSource(source, pool);
+		});
+	}
+
+	pool.wait();
+
+	saveManifests();
+
+	QMutexLocker lock{&resultMutex_};
+
+	return result_;
+}
+
+void Processor::processSource(const Source& source, WorkStealingPool& pool)
+{
+	MOS_TRACE_SPAN("batch", "Process source");
+
+	QByteArray data;
+
+	{
+		MOS_TRACE_SPAN("io", "Read source");
+
+		QFile file{source.path};
+
+		if (!file.open(QIODevice::ReadOnly)) {
+			reportFailure(source.path);
+			return;
+		}
+
+		data = file.readAll();
+	}
+
+	QList<qsizetype> pending;
+	QList<QByteArray> stamps(options_.transforms.count());
+
+	if (options_.incremental) {
+		const auto& sourceHash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+
+		for (qsizetype i = 0; i < options_.transforms.count(); ++i)
+		{
+			const auto& filePath = outputPath(source, i);
+
+			stamps[i] = outputStamp(sourceHash, i);
+
+			if (manifestStamp(filePath) == stamps[i] && QFileInfo::exists(filePath)) {
+				reportUpToDate(filePath);
+			} else {
+				pending.emplaceBack(i);
+			}
+		}
+	} else {
+		for (qsizetype i = 0; i < options_.transforms.count(); ++i)
+			pending.emplaceBack(i);
+	}
+
+	// Avoid decoding the source at all if everything is up to date
+	if (pending.isEmpty())
+		return;
+
+	auto image = decodeImage(source.path, data);
+
+	data.clear();
+
+	if (image.isNull()) {
+		reportFailure(source.path);
+		return;
+	}
+
+	// We want to work on actual ARGB data
+	{
+		MOS_TRACE_SPAN("convert", "Convert to ARGB32");
+		image.convertTo(QImage::Format_ARGB32);
+	}
+
+	if (!QDir{}.mkpath(source.outputDir)) {
+		reportFailure(source.outputDir);
+		return;
+	}
+
+	// The decoded image is implicitly shared between the per-output tasks,
+	// none of which ever modify it.
+	for (qsizetype n = 1; n < pending.count(); ++n)
+	{
+		const auto i = pending[n];
+		const auto& stamp = stamps[i];
+
+		pool.submit([this, image, source, i, stamp]() {
+			processOutput(image, source, i, stamp);
+		});
+	}
+
+	processOutput(image, source, pending.first(), stamps[pending.first()]);
+}
+
+void Processor::processOutput(const QImage& image,
+							  const Source& source,
+							  qsizetype transformIndex,
+							  const QByteArray& stamp)
+{
+	MOS_TRACE_SPAN("batch", "Process output");
+
+	const auto& filePath = outputPath(source, transformIndex);
+	auto output = options_.transforms[transformIndex].apply(image, colorMaps_[transformIndex]);
+	const auto& contentHash = imageContentHash(output);
+
+	QString existingPath;
+
+	{
+		QMutexLocker lock{&dedupeMutex_};
+
+		// If another task is encoding an identical image right now, wait for
+		// it to finish instead of encoding the same thing twice. The task we
+		// wait for is already running, so this cannot starve the pool.
+		while (contentInProgress_.contains(contentHash))
+			contentWritten_.wait(&dedupeMutex_);
+
+		existingPath = outputsByContent_.value(contentHash);
+
+		if (existingPath.isEmpty())
+			contentInProgress_.insert(contentHash);
+	}
+
+	bool deduplicated = false;
+
+	if (!existingPath.isEmpty() && existingPath != filePath) {
+		// Encoding is deterministic, so an identical image that was already
+		// written once can simply be copied.
+		QFile::remove(filePath);
+		deduplicated = QFile::copy(existingPath, filePath);
+	}
+
+	if (deduplicated) {
+		reportDeduplicated(filePath);
+	} else {
+		const bool written = MosIO::writePng(output, filePath, options_.vanityPlate);
+
+		if (existingPath.isEmpty()) {
+			QMutexLocker lock{&dedupeMutex_};
+
+			// On failure, whoever is waiting for this content takes over
+			contentInProgress_.remove(contentHash);
+			if (written)
+				outputsByContent_.insert(contentHash, filePath);
+			contentWritten_.wakeAll();
+		}
+
+		if (!written) {
+			reportFailure(filePath);
+			return;
+		}
+	}
+
+	if (options_.incremental)
+		updateManifest(filePath, stamp);
+
+	reportSuccess(filePath);
+}
+
+QByteArray Processor::outputStamp(const QByteArray& sourceHash, qsizetype transformIndex) const
+{
+	QCryptographicHash hash{QCryptographicHash::Sha1};
+
+	hash.addData(sourceHash);
+	hash.addData(transformStamps_[transformIndex]);
+
+	return hash.result();
+}
+
+Manifest& Processor::manifestForDirectory(const QString& dirPath)
+{
+	auto it = manifests_.find(dirPath);
+
+	if (it == manifests_.end()) {
+		it = manifests_.insert(dirPath, Manifest{dirPath});
+		it->load();
+	}
+
+	return *it;
+}
+
+QByteArray Processor::manifestStamp(const QString& outputPath)
+{
+	const QFileInfo info{outputPath};
+
+	QMutexLocker lock{&manifestMutex_};
+
+	return manifestForDirectory(info.path()).stamp(info.fileName());
+}
+
+void Processor::updateManifest(const QString& outputPath, const QByteArray& stamp)
+{
+	const QFileInfo info{outputPath};
+
+	QMutexLocker lock{&manifestMutex_};
+
+	manifestForDirectory(info.path()).setStamp(info.fileName(), stamp);
+}
+
+bool Processor::saveManifests()
+{
+	bool ok = true;
+
+	for (auto& manifest : manifests_)
+	{
+		if (!manifest.save()) {
+			reportFailure(manifest.filePath());
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+void Processor::reportSuccess(const QString& path)
+{
+	QMutexLocker lock{&resultMutex_};
+	result_.succeeded.emplaceBack(path);
+	MOS_TRACE_COUNTER("Outputs written", result_.succeeded.count());
+}
+
+void Processor::reportFailure(const QString& path)
+{
+	QMutexLocker lock{&resultMutex_};
+	result_.failed.emplaceBack(path);
+}
+
+void Processor::reportUpToDate(const QString& path)
+{
+	QMutexLocker lock{&resultMutex_};
+	result_.upToDate.emplaceBack(path);
+}
+
+void Processor::reportDeduplicated(const QString& path)
+{
+	QMutexLocker lock{&resultMutex_};
+	result_.deduplicated.emplaceBack(path);
+}
+
+} // end namespace MosBatch
@@ -0,0 +1,397 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include "wesnothrc.hpp"
+
+#include <QColor>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QWaitCondition>
+
+namespace MosBatch {
+
+class WorkStealingPool;
+
+//
+// Output file naming.
+//
+// These are shared between the GUI and the batch tools so that both produce
+// identical file names for identical jobs.
+//
+
+/**
+ * Returns the output file name suffix for a color range job.
+ *
+ * @param paletteId    Key palette id.
+ * @param ordinal      1-based position of the color range in the UI list.
+ * @param rangeId      Color range id.
+ */
+QString colorRangeSuffix(const QString& paletteId,
+						 int ordinal,
+						 const QString& rangeId);
+
+/**
+ * Returns the output file name suffix for a palette swap job.
+ */
+QString paletteSwapSuffix(const QString& paletteId,
+						  const QString& targetPaletteId);
+
+/**
+ * Returns the output file name suffix for a color blend job.
+ */
+QString colorBlendSuffix(const QColor& color, qreal blendFactor);
+
+/**
+ * Returns the output file name suffix for a color shift job.
+ */
+QString colorShiftSuffix(int redShift, int greenShift, int blueShift);
+
+/**
+ * Returns the output file name for a source file and job suffix.
+ *
+ * @return A file name (without any directory components) of the form
+ *         <tt>&lt;stem&gt;-&lt;suffix&gt;.png</tt>.
+ */
+QString outputFileName(const QString& sourcePath, const QString& suffix);
+
+/**
+ * Returns whether a file name is that of an output for any of the given job
+ * suffixes, as returned by outputFileName().
+ */
+bool isOutputFileName(const QString& fileName, const QStringList& suffixes);
+
+/**
+ * A single image transform to be applied to every source image.
+ */
+class Transform
+{
+public:
+	enum Type
+	{
+		ColorRangeType,
+		PaletteSwapType,
+		ColorBlendType,
+		ColorShiftType,
+	};
+
+	/**
+	 * Creates a color range transform.
+	 *
+	 * @param id           Color range id.
+	 * @param ordinal      1-based position of the color range, used for
+	 *                     output file names.
+	 * @param colorRange   Color range definition.
+	 */
+	static Transform colorRange(const QString& id,
+								int ordinal,
+								const ColorRange& colorRange);
+
+	/**
+	 * Creates a palette swap transform.
+	 *
+	 * @param id           Target palette id.
+	 * @param palette      Target palette definition.
+	 */
+	static Transform paletteSwap(const QString& id,
+								 const ColorList& palette);
+
+	/**
+	 * Creates a color blend transform.
+	 */
+	static Transform colorBlend(const QColor& color, qreal blendFactor);
+
+	/**
+	 * Creates a color shift transform.
+	 */
+	static Transform colorShift(int redShift, int greenShift, int blueShift);
+
+	Type type() const
+	{
+		return type_;
+	}
+
+	const QString& id() const
+	{
+		return id_;
+	}
+
+	/**
+	 * Returns the output file name suffix for this transform.
+	 *
+	 * @param keyPaletteId Key palette id.
+	 */
+	QString fileNameSuffix(const QString& keyPaletteId) const;
+
+	/**
+	 * Returns a serialized form of this transform's parameters.
+	 *
+	 * Two transforms with the same stamp data produce the same output for the
+	 * same input and key palette. Ids and ordinals only affect file names and
+	 * are therefore not included.
+	 */
+	QByteArray stampData() const;
+
+	/**
+	 * Generates the color map used by this transform, if any.
+	 *
+	 * @param keyPalette   Key palette.
+	 */
+	ColorMap colorMap(const ColorList& keyPalette) const;
+
+	/**
+	 * Applies this transform to an image.
+	 *
+	 * @param input        Input image.
+	 * @param colorMap     Color map previously generated by colorMap().
+	 */
+	QImage apply(const QImage& input, const ColorMap& colorMap) const;
+
+private:
+	Transform(Type type)
+		: type_(type)
+		, id_()
+		, ordinal_()
+		, colorRange_()
+		, palette_()
+		, blendColor_()
+		, blendFactor_()
+		, redShift_()
+		, greenShift_()
+		, blueShift_()
+	{
+	}
+
+	Type type_;
+	QString id_;
+	int ordinal_;
+	ColorRange colorRange_;
+	ColorList palette_;
+	QColor blendColor_;
+	qreal blendFactor_;
+	int redShift_, greenShift_, blueShift_;
+};
+
+/**
+ * A source image and the directory its outputs go to.
+ */
+struct Source
+{
+	QString path;
+	QString outputDir;
+};
+
+/**
+ * Batch processing options.
+ */
+struct Options
+{
+	QString keyPaletteId = QStringLiteral("magenta");
+	ColorList keyPalette;
+	QList<Transform> transforms;
+	bool vanityPlate = true;
+	/** Skip outputs whose stamp in the output directory manifest is current. */
+	bool incremental = false;
+
+	/**
+	 * Returns the output file name suffix of every transform.
+	 */
+	QStringList outputSuffixes() const;
+};
+
+/**
+ * Batch processing results.
+ */
+struct Result
+{
+	/** Output files written successfully. */
+	QStringList succeeded;
+	/** Output files (or sources) that could not be processed. */
+	QStringList failed;
+	/** Output files skipped because they were already up to date. */
+	QStringList upToDate;
+	/** Output files copied from an identical output instead of re-encoded. */
+	QStringList deduplicated;
+};
+
+/**
+ * Per-directory record of the stamps of previously generated outputs.
+ *
+ * An output's stamp is a hash of its source file's contents, the parameters
+ * of the transform that generated it, and the Wespal version. The manifest is
+ * stored as a JSON file in the output directory.
+ */
+class Manifest
+{
+public:
+	/** Manifest file name. */
+	static const QString fileName;
+
+	explicit Manifest(const QString& dirPath = {})
+		: dirPath_(dirPath)
+		, stamps_()
+		, dirty_(false)
+	{
+	}
+
+	/**
+	 * Reads the manifest from disk.
+	 *
+	 * A missing or unreadable manifest is treated as empty.
+	 */
+	void load();
+
+	/**
+	 * Writes the manifest to disk if it was modified since loading it.
+	 */
+	bool save();
+
+	QByteArray stamp(const QString& outputName) const
+	{
+		return stamps_.value(outputName);
+	}
+
+	void setStamp(const QString& outputName, const QByteArray& stamp);
+
+	QString filePath() const;
+
+private:
+	QString dirPath_;
+	QHash<QString, QByteArray> stamps_;
+	bool dirty_;
+};
+
+/**
+ * Returns file name filters matching all formats supported by QImageReader.
+ */
+QStringList imageFileNameFilters();
+
+/**
+ * Returns whether a path is located strictly inside a directory.
+ *
+ * Both paths must be absolute and clean. A directory is not considered to be
+ * inside itself.
+ */
+bool isInsideDirectory(const QString& path, const QString& dirPath);
+
+/**
+ * Finds source images in a list of files and directories.
+ *
+ * Directories are searched recursively for files in any format supported by
+ * QImageReader. Outputs for files found inside a directory go to a matching
+ * subdirectory of @a outputDir, so that the input tree's layout is preserved.
+ *
+ * Files found inside a directory whose names match @a outputSuffixes are
+ * never treated as sources. This keeps the outputs of earlier runs from being
+ * recolored again when the output tree overlaps the input tree, e.g. with the
+ * default output directory of the current directory.
+ *
+ * @param inputs       Files and directories to search.
+ * @param outputDir    Base output directory. If it is located inside an input
+ *                     directory, none of the files in it are treated as
+ *                     sources.
+ * @param outputSuffixes
+ *                     Output file name suffixes of the current job, as
+ *                     returned by Options::outputSuffixes().
+ */
+QList<Source> collectSources(const QStringList& inputs,
+							 const QString& outputDir,
+							 const QStringList& outputSuffixes = {});
+
+/**
+ * Runs image transform jobs in bulk.
+ *
+ * Each source image is decoded exactly once, after which every transform is
+ * applied and encoded as a separate task. Color maps are generated once per
+ * processor rather than once per image.
+ *
+ * Outputs whose pixels are identical to those of an output already written
+ * during the same run (e.g. two ranges with identical definitions, or two
+ * identical sources) are copied from the first one instead of re-encoded.
+ *
+ * In incremental mode, sources are only decoded if at least one of their
+ * outputs is missing or has an outdated stamp in its directory's manifest.
+ */
+class Processor
+{
+public:
+	explicit Processor(const Options& options);
+
+	/**
+	 * Processes a list of source images using a thread pool, blocking until
+	 * all of them are done.
+	 */
+	Result run(const QList<Source>& sources, WorkStealingPool& pool);
+
+	/**
+	 * Returns the output path of a transform for a given source.
+	 */
+	QString outputPath(const Source& source, qsizetype transformIndex) const;
+
+	/**
+	 * Returns the number of output files generated per source image.
+	 */
+	qsizetype outputsPerSource() const
+	{
+		return options_.transforms.count();
+	}
+
+private:
+	void processSource(const Source& source, WorkStealingPool& pool);
+	void processOutput(const QImage& image,
+					   const Source& source,
+					   qsizetype transformIndex,
+					   const QByteArray& stamp);
+
+	QByteArray outputStamp(const QByteArray& sourceHash, qsizetype transformIndex) const;
+
+	// Must be called with manifestMutex_ held
+	Manifest& manifestForDirectory(const QString& dirPath);
+
+	QByteArray manifestStamp(const QString& outputPath);
+	void updateManifest(const QString& outputPath, const QByteArray& stamp);
+	bool saveManifests();
+
+	void reportSuccess(const QString& path);
+	void reportFailure(const QString& path);
+	void reportUpToDate(const QString& path);
+	void reportDeduplicated(const QString& path);
+
+	Options options_;
+	QList<ColorMap> colorMaps_;
+	QList<QByteArray> transformStamps_;
+
+	QMutex manifestMutex_;
+	QHash<QString, Manifest> manifests_;
+
+	QMutex dedupeMutex_;
+	QWaitCondition contentWritten_;
+	QHash<QByteArray, QString> outputsByContent_;
+	// Content hashes of outputs currently being encoded
+	QSet<QByteArray> contentInProgress_;
+
+	QMutex resultMutex_;
+	Result result_;
+};
+
+} // end namespace MosBatch
@@ -0,0 +1,394 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+//
+// End-to-end batch throughput benchmark.
+//
+// Runs the same kind of export wespal-cli performs (decode PNG sprites,
+// recolor them with every built-in color range, encode the results as PNG
+// and write them to disk) over a synthetic corpus of unit sprites and
+// animation strips, with varying numbers of threads.
+//
+// Each configuration is run twice: once through MosBatch::Processor exactly
+// as wespal-cli does, which gives the throughput figures, and once through
+// an equivalent pipeline with timers around each stage, which gives the
+// breakdown of where the time goes.
+//
+
+#include "batch.hpp"
+#include "benchutils.hpp"
+#include "defs.hpp"
+#include "spritecorpus.hpp"
+#include "threadpool.hpp"
+#include "wesnothrc.hpp"
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImageReader>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+
+#include <array>
+#include <atomic>
+
+using MosBench::err;
+using MosBench::out;
+
+namespace {
+
+enum Stage
+{
+	StageRead,
+	StageDecode,
+	StageConvert,
+	StageRecolor,
+	StageEncode,
+	StageWrite,
+	StageCount,
+};
+
+const char* const stageNames[StageCount] = {
+	"read",
+	"decode",
+	"convert",
+	"recolor",
+	"encode",
+	"write",
+};
+
+/**
+ * Thread time spent in each stage, that is, the wall clock time measured
+ * around the stage in each thread, summed over all threads.
+ */
+struct StageTimes
+{
+	std::array<std::atomic<qint64>, StageCount> nsecs{};
+	std::atomic<qint64> failures{0};
+};
+
+class StageTimer
+{
+public:
+	StageTimer(StageTimes& times, Stage stage)
+		: times_(times)
+		, stage_(stage)
+		, timer_()
+	{
+		timer_.start();
+	}
+
+	~StageTimer()
+	{
+		times_.nsecs[stage_].fetch_add(timer_.nsecsElapsed(), std::memory_order_relaxed);
+	}
+
+private:
+	StageTimes& times_;
+	Stage stage_;
+	QElapsedTimer timer_;
+};
+
+/**
+ * Staged equivalent of MosBatch::Processor, minus incremental mode and
+ * output deduplication.
+ */
+void runStaged(const QList<MosBatch::Source>& sources,
+			   const MosBatch::Options& options,
+			   const QList<ColorMap>& colorMaps,
+			   MosBatch::WorkStealingPool& pool,
+			   StageTimes& times)
+{
+	for (const auto& source : sources)
+	{
+		pool.submit([&, source]() {
+			QByteArray data;
+
+			{
+				StageTimer timer{times, StageRead};
+				QFile file{source.path};
+
+				if (file.open(QIODevice::ReadOnly))
+					data = file.readAll();
+			}
+
+			QImage image;
+
+			{
+				StageTimer timer{times, StageDecode};
+				QBuffer buffer{&data};
+				QImageReader reader{&buffer, "png"};
+
+				image = reader.read();
+			}
+
+			if (image.isNull()) {
+				++times.failures;
+				return;
+			}
+
+			{
+				StageTimer timer{times, StageConvert};
+				image.convertTo(QImage::Format_ARGB32);
+			}
+
+			for (qsizetype i = 0; i < options.transforms.count(); ++i)
+			{
+				pool.submit([&, source, image, i]() {
+					QImage output;
+
+					{
+						StageTimer timer{times, StageRecolor};
+						output = options.transforms[i].apply(image, colorMaps[i]);
+					}
+
+					QByteArray png;
+
+					{
+						StageTimer timer{times, StageEncode};
+						png = MosIO::writePngData(output, options.vanityPlate);
+					}
+
+					StageTimer timer{times, StageWrite};
+					const auto suffix = options.transforms[i].fileNameSuffix(options.keyPaletteId);
+					QFile file{source.outputDir + '/' + MosBatch::outputFileName(source.path, suffix)};
+
+					if (!file.open(QIODevice::WriteOnly) || file.write(png) != png.size())
+						++times.failures;
+				});
+			}
+		});
+	}
+
+	pool.wait();
+}
+
+QString formatRate(double count, qint64 nsecs)
+{
+	return QString::number(nsecs > 0 ? count * 1e9 / double(nsecs) : 0.0, 'f', 1);
+}
+
+} // end unnamed namespace
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication a{argc, argv};
+
+	QCommandLineParser parser;
+
+	parser.setApplicationDescription(
+		"Measures end-to-end batch recoloring throughput (decode, recolor with "
+		"all built-in color ranges, encode and write) on a synthetic corpus of "
+		"unit sprites and animation strips.");
+	parser.addHelpOption();
+
+	QCommandLineOption corpusOption{"corpus",
+		"Directory to generate the corpus in and keep it afterwards "
+		"(default: a temporary directory).",
+		"dir"};
+	QCommandLineOption spritesOption{"sprites",
+		"Number of single-frame sprites (default: 300).",
+		"count", "300"};
+	QCommandLineOption stripsOption{"strips",
+		"Number of animation strips (default: 30).",
+		"count", "30"};
+	QCommandLineOption threadsOption{"threads",
+		"Comma-separated list of thread counts to test, where 0 means one "
+		"per logical CPU core (default: 1,0).",
+		"counts", "1,0"};
+	QCommandLineOption csvOption{"csv",
+		"Print results in CSV format."};
+
+	parser.addOptions({
+		corpusOption,
+		spritesOption,
+		stripsOption,
+		threadsOption,
+		csvOption,
+	});
+
+	parser.process(a);
+
+	QList<int> threadCounts;
+
+	for (const auto& value : parser.value(threadsOption).split(',', Qt::SkipEmptyParts))
+	{
+		bool ok = false;
+		auto count = value.toInt(&ok);
+
+		if (!ok || count < 0) {
+			err() << "Invalid thread count: " << value << Qt::endl;
+			return 1;
+		}
+
+		threadCounts.append(count ? count : qMax(1, QThread::idealThreadCount()));
+	}
+
+	QTemporaryDir tempDir;
+
+	if (!tempDir.isValid()) {
+		err() << "Could not create temporary directory" << Qt::endl;
+		return 1;
+	}
+
+	QString corpusPath = tempDir.filePath("corpus");
+
+	if (parser.isSet(corpusOption))
+		corpusPath = parser.value(corpusOption);
+
+	if (!QDir{}.mkpath(corpusPath)) {
+		err() << "Could not create corpus directory " << corpusPath << Qt::endl;
+		return 1;
+	}
+
+	err() << "Generating corpus in " << corpusPath << "..." << Qt::endl;
+
+	const auto corpus = MosBench::generateSpriteCorpus(corpusPath,
+													   parser.value(spritesOption).toInt(),
+													   parser.value(stripsOption).toInt());
+
+	if (corpus.isEmpty()) {
+		err() << "No corpus files were generated" << Qt::endl;
+		return 1;
+	}
+
+	qint64 pixels = 0;
+
+	for (const auto& file : corpus)
+		pixels += qint64(file.frameSize.width()) * file.frameSize.height() * file.frames;
+
+	MosBatch::Options options;
+
+	options.keyPalette = wesnoth::builtinPalettes[options.keyPaletteId];
+
+	for (const auto& id : wesnoth::builtinColorRanges.orderedNames())
+	{
+		const auto ordinal = int(options.transforms.count()) + 1;
+		options.transforms.emplaceBack(
+			MosBatch::Transform::colorRange(id, ordinal, wesnoth::builtinColorRanges[id]));
+	}
+
+	QList<ColorMap> colorMaps;
+
+	for (const auto& transform : options.transforms)
+		colorMaps.emplaceBack(transform.colorMap(options.keyPalette));
+
+	const auto outputCount = corpus.count() * options.transforms.count();
+
+	err() << corpus.count() << " files (" << pixels / 1000000.0 << " Mpx), "
+		  << options.transforms.count() << " color ranges, "
+		  << outputCount << " outputs per run" << Qt::endl;
+
+	const bool csv = parser.isSet(csvOption);
+
+	if (csv) {
+		out() << "threads,sources,outputs,wall_ms,sources_per_s,outputs_per_s,mpx_per_s";
+		for (const auto* name : stageNames)
+			out() << ',' << name << "_ms";
+		out() << Qt::endl;
+	} else {
+		out() << qSetFieldWidth(8) << Qt::right << "Threads"
+			  << qSetFieldWidth(11) << "Wall ms"
+			  << qSetFieldWidth(11) << "Sources/s"
+			  << qSetFieldWidth(11) << "Outputs/s"
+			  << qSetFieldWidth(9) << "Mpx/s";
+		for (const auto* name : stageNames)
+			out() << qSetFieldWidth(10) << name;
+		out() << qSetFieldWidth(0) << Qt::left << Qt::endl;
+	}
+
+	int runIndex = 0;
+
+	for (const auto threads : threadCounts)
+	{
+		MosBatch::WorkStealingPool pool{threads};
+
+		auto makeSources = [&](const QString& name) {
+			QList<MosBatch::Source> sources;
+			const auto outputDir = tempDir.filePath(QString{"%1-%2"}.arg(name).arg(runIndex));
+
+			QDir{}.mkpath(outputDir);
+
+			for (const auto& file : corpus)
+				sources.append({file.path, outputDir});
+
+			return sources;
+		};
+
+		// Throughput, as wespal-cli would do it
+		MosBatch::Processor processor{options};
+		QElapsedTimer timer;
+
+		const auto processorSources = makeSources("processor");
+
+		timer.start();
+		const auto result = processor.run(processorSources, pool);
+		const auto wall = timer.nsecsElapsed();
+
+		if (!result.failed.isEmpty()) {
+			err() << result.failed.count() << " outputs failed" << Qt::endl;
+			return 1;
+		}
+
+		// Stage breakdown
+		StageTimes times;
+
+		runStaged(makeSources("staged"), options, colorMaps, pool, times);
+
+		if (times.failures) {
+			err() << times.failures.load() << " outputs failed in the staged pipeline" << Qt::endl;
+			return 1;
+		}
+
+		if (csv) {
+			out() << threads << ',' << corpus.count() << ',' << outputCount << ','
+				  << double(wall) / 1e6 << ','
+				  << formatRate(double(corpus.count()), wall) << ','
+				  << formatRate(double(outputCount), wall) << ','
+				  << formatRate(double(pixels) / 1e6, wall);
+			for (const auto& nsecs : times.nsecs)
+				out() << ',' << double(nsecs) / 1e6;
+			out() << Qt::endl;
+		} else {
+			out() << qSetFieldWidth(8) << Qt::right << threads
+				  << qSetFieldWidth(11) << QString::number(double(wall) / 1e6, 'f', 0)
+				  << qSetFieldWidth(11) << formatRate(double(corpus.count()), wall)
+				  << qSetFieldWidth(11) << formatRate(double(outputCount), wall)
+				  << qSetFieldWidth(9) << formatRate(double(pixels) / 1e6, wall);
+			for (const auto& nsecs : times.nsecs)
+				out() << qSetFieldWidth(10) << QString::number(double(nsecs) / 1e6, 'f', 0);
+			out() << qSetFieldWidth(0) << Qt::left << Qt::endl;
+		}
+
+		++runIndex;
+	}
+
+	if (!csv) {
+		out() << Qt::endl
+			  << "Stage columns are thread time in milliseconds (wall clock time "
+				 "summed over all threads), measured in a separate run." << Qt::endl;
+	}
+
+	return 0;
+}
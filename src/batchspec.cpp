@@ -0,0 +1,211 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "batchspec.hpp"
+
+#include "defs.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace MosBatch {
+
+namespace {
+
+/**
+ * Splits an id=definition argument. If there is no = sign, the definition
+ * part is left empty.
+ */
+QPair<QString, QString> splitDefinition(const QString& value)
+{
+	auto sep = value.indexOf('=');
+
+	if (sep == -1)
+		return { value.trimmed(), {} };
+
+	return { value.left(sep).trimmed(), value.mid(sep + 1) };
+}
+
+bool isHexDigit(QChar c)
+{
+	return (c >= u'0' && c <= u'9') ||
+		   (c >= u'a' && c <= u'f') ||
+		   (c >= u'A' && c <= u'F');
+}
+
+} // end unnamed namespace
+
+QRgb parseColor(const QString& value)
+{
+	auto str = value.trimmed();
+
+	if (str.startsWith('#'))
+		str.remove(0, 1);
+
+	// toUInt() alone would also accept prefixes such as 0x or +
+	if (str.length() != 6 || !std::all_of(str.cbegin(), str.cend(), isHexDigit))
+		throw spec_error{QString{"Invalid color value: %1"}.arg(value)};
+
+	return str.toUInt(nullptr, 16);
+}
+
+ColorList parseColorList(const QString& value)
+{
+	ColorList res;
+
+	for (const auto& item : value.split(',', Qt::SkipEmptyParts))
+		res.emplaceBack(parseColor(item));
+
+	return res;
+}
+
+QPair<QString, ColorList> parsePalette(const QString& value)
+{
+	const auto& [id, definition] = splitDefinition(value);
+
+	if (!definition.isEmpty())
+		return { id, parseColorList(definition) };
+
+	if (!wesnoth::builtinPalettes.hasName(id))
+		throw spec_error{QString{"Unknown palette: %1"}.arg(id)};
+
+	return { id, wesnoth::builtinPalettes[id] };
+}
+
+Transform parseColorRange(const QString& value, int& customOrdinal)
+{
+	const auto& [id, definition] = splitDefinition(value);
+
+	if (definition.isEmpty()) {
+		const auto ordinal = wesnoth::builtinColorRanges.orderedNames().indexOf(id);
+
+		if (ordinal == -1)
+			throw spec_error{QString{"Unknown color range: %1"}.arg(id)};
+
+		return Transform::colorRange(id, ordinal + 1, wesnoth::builtinColorRanges[id]);
+	}
+
+	const auto& colors = parseColorList(definition);
+
+	if (colors.count() < 3 || colors.count() > 4)
+		throw spec_error{QString{"Invalid color range definition: %1"}.arg(value)};
+
+	ColorRange colorRange{colors[0], colors[1], colors[2],
+						  colors.count() > 3 ? colors[3] : colors[0]};
+
+	return Transform::colorRange(id, ++customOrdinal, colorRange);
+}
+
+Transform parseColorBlend(const QString& value)
+{
+	const auto& parts = value.split(',');
+	bool ok = false;
+
+	if (parts.count() != 2)
+		throw spec_error{QString{"Invalid color blend specification: %1"}.arg(value)};
+
+	auto factor = parts[1].toDouble(&ok);
+
+	if (!ok || factor < 0.0 || factor > 1.0)
+		throw spec_error{QString{"Invalid color blend factor: %1"}.arg(parts[1])};
+
+	return Transform::colorBlend(QColor{parseColor(parts[0])}, factor);
+}
+
+Transform parseColorShift(const QString& value)
+{
+	const auto& parts = value.split(',');
+
+	if (parts.count() != 3)
+		throw spec_error{QString{"Invalid color shift specification: %1"}.arg(value)};
+
+	std::array<int, 3> shift;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		bool ok = false;
+		shift[i] = parts[i].toInt(&ok);
+
+		if (!ok || shift[i] < -255 || shift[i] > 255)
+			throw spec_error{QString{"Invalid color shift value: %1"}.arg(parts[i])};
+	}
+
+	return Transform::colorShift(shift[0], shift[1], shift[2]);
+}
+
+int firstCustomRangeOrdinal()
+{
+	return int(wesnoth::builtinColorRanges.objectCount());
+}
+
+QList<Transform> parseTransforms(const QStringList& ranges,
+								 const QStringList& palettes,
+								 const QStringList& blends,
+								 const QStringList& shifts,
+								 bool allRanges)
+{
+	QList<Transform> transforms;
+	int customOrdinal = firstCustomRangeOrdinal();
+
+	// Transforms that would write the same output files, keyed by file name
+	// suffix (which only depends on the key palette otherwise)
+	QHash<QString, QByteArray> stampsBySuffix;
+
+	auto add = [&](const Transform& transform) {
+		const auto& suffix = transform.fileNameSuffix({});
+		const auto& stampData = transform.stampData();
+		const auto it = stampsBySuffix.constFind(suffix);
+
+		if (it == stampsBySuffix.cend()) {
+			stampsBySuffix.insert(suffix, stampData);
+			transforms.emplaceBack(transform);
+		} else if (*it != stampData) {
+			throw spec_error{QString{"Conflicting definitions for %1"}.arg(transform.id())};
+		}
+	};
+
+	if (allRanges) {
+		for (const auto& id : wesnoth::builtinColorRanges.orderedNames())
+			add(parseColorRange(id, customOrdinal));
+	}
+
+	for (const auto& value : ranges)
+		add(parseColorRange(value, customOrdinal));
+
+	for (const auto& value : palettes) {
+		const auto& [id, palette] = parsePalette(value);
+		add(Transform::paletteSwap(id, palette));
+	}
+
+	for (const auto& value : blends)
+		add(parseColorBlend(value));
+
+	for (const auto& value : shifts)
+		add(parseColorShift(value));
+
+	if (transforms.isEmpty()) {
+		for (const auto& id : wesnoth::builtinColorRanges.orderedNames())
+			add(parseColorRange(id, customOrdinal));
+	}
+
+	return transforms;
+}
+
+} // end namespace MosBatch
@@ -0,0 +1,107 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include "batch.hpp"
+
+#include <QPair>
+
+namespace MosBatch {
+
+//
+// Parsing of textual transform specifications.
+//
+// These are used by the wespal-cli command line options as well as by the
+// recolor service protocol, and all throw spec_error on invalid input.
+//
+
+struct spec_error
+{
+	QString message;
+};
+
+/**
+ * Parses a color in RRGGBB or #RRGGBB notation.
+ */
+QRgb parseColor(const QString& value);
+
+/**
+ * Parses a comma-separated color list.
+ */
+ColorList parseColorList(const QString& value);
+
+/**
+ * Parses a palette specification, which is either a built-in palette id or
+ * an id=RRGGBB,RRGGBB,... definition.
+ */
+QPair<QString, ColorList> parsePalette(const QString& value);
+
+/**
+ * Parses a color range specification, which is either a built-in color range
+ * id or an id=AVG,MAX,MIN[,REP] definition.
+ *
+ * Built-in ranges are numbered in the same order used by the GUI, while
+ * custom ranges are numbered after all built-ins in order of appearance.
+ *
+ * @param value        Specification.
+ * @param customOrdinal Last ordinal assigned to a custom range. This is
+ *                     incremented if @a value is a custom range definition.
+ */
+Transform parseColorRange(const QString& value, int& customOrdinal);
+
+/**
+ * Parses a color blend specification of the form RRGGBB,FACTOR.
+ */
+Transform parseColorBlend(const QString& value);
+
+/**
+ * Parses a color shift specification of the form R,G,B.
+ */
+Transform parseColorShift(const QString& value);
+
+/**
+ * Returns the ordinal preceding the first custom color range ordinal.
+ */
+int firstCustomRangeOrdinal();
+
+/**
+ * Parses a complete list of transform specifications.
+ *
+ * Transforms are returned in the order color ranges, palette swaps, color
+ * blends, color shifts. If no transforms are specified at all, every built-in
+ * color range is used. Duplicate transforms (e.g. a built-in color range
+ * that is also selected by @a allRanges) are only included once, while two
+ * different transforms that would write the same output files are an error.
+ *
+ * @param ranges       Color range specifications.
+ * @param palettes     Palette swap target specifications.
+ * @param blends       Color blend specifications.
+ * @param shifts       Color shift specifications.
+ * @param allRanges    Whether to include every built-in color range before
+ *                     those in @a ranges.
+ */
+QList<Transform> parseTransforms(const QStringList& ranges,
+								 const QStringList& palettes,
+								 const QStringList& blends,
+								 const QStringList& shifts,
+								 bool allRanges = false);
+
+} // end namespace MosBatch
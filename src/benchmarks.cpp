@@ -0,0 +1,301 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <QTest>
+
+#include "benchmarks.hpp"
+
+#include "benchutils.hpp"
+#include "defs.hpp"
+#include "wesnothrc.hpp"
+
+#include <QTemporaryDir>
+
+QTEST_MAIN(BenchMorningStar)
+;
+
+namespace {
+
+// From single unit sprites to large campaign maps
+const QList<QSize> imageSizes = {
+	{ 72, 72 },
+	{ 256, 256 },
+	{ 1024, 1024 },
+	{ 3840, 2160 },
+	{ 7680, 4320 },
+};
+
+// Percentage of fully transparent pixels
+const QList<int> transparencyRatios = { 0, 50, 90 };
+
+const QStringList paletteIds = { "magenta", "flag_green", "large" };
+
+constexpr int largePaletteSize = 4096;
+
+/**
+ * Returns a palette by id, including the synthetic "large" palette used to
+ * stand in for big user-defined palettes.
+ */
+ColorList benchPalette(const QString& id)
+{
+	if (id != "large")
+		return wesnoth::builtinPalettes[id];
+
+	ColorList palette;
+	palette.reserve(largePaletteSize);
+
+	for (int i = 0; i < largePaletteSize; ++i)
+		palette.emplaceBack(qRgb((i * 37) & 0xFF, (i * 101) & 0xFF, (i * 7) & 0xFF));
+
+	return palette;
+}
+
+QString sizeTag(const QSize& size)
+{
+	return QString{"%1x%2"}.arg(size.width()).arg(size.height());
+}
+
+/**
+ * Adds size and transparency data rows.
+ */
+void addImageRows()
+{
+	QTest::addColumn<QSize>("size");
+	QTest::addColumn<int>("transparency");
+
+	for (const auto& size : imageSizes)
+	{
+		for (auto transparency : transparencyRatios)
+		{
+			const auto tag = QString{"%1 %2%"}.arg(sizeTag(size)).arg(transparency);
+			QTest::newRow(qPrintable(tag)) << size << transparency;
+		}
+	}
+}
+
+/**
+ * Adds palette data rows.
+ */
+void addPaletteRows()
+{
+	QTest::addColumn<QString>("paletteId");
+
+	for (const auto& paletteId : paletteIds)
+		QTest::newRow(qPrintable(paletteId)) << paletteId;
+}
+
+} // end unnamed namespace
+
+void BenchMorningStar::initTestCase()
+{
+	for (const auto& paletteId : paletteIds)
+		QVERIFY(!benchPalette(paletteId).isEmpty());
+}
+
+void BenchMorningStar::benchRecolorImage_data()
+{
+	QTest::addColumn<QSize>("size");
+	QTest::addColumn<int>("transparency");
+	QTest::addColumn<QString>("paletteId");
+
+	for (const auto& size : imageSizes)
+	{
+		for (auto transparency : transparencyRatios)
+		{
+			for (const auto& paletteId : paletteIds)
+			{
+				const auto tag = QString{"%1 %2% %3"}.arg(sizeTag(size))
+													 .arg(transparency)
+													 .arg(paletteId);
+				QTest::newRow(qPrintable(tag)) << size << transparency << paletteId;
+			}
+		}
+	}
+}
+
+void BenchMorningStar::benchRecolorImage()
+{
+	QFETCH(QSize, size);
+	QFETCH(int, transparency);
+	QFETCH(QString, paletteId);
+
+	const auto& palette = benchPalette(paletteId);
+	const auto& image = MosBench::benchImage(size, transparency, palette);
+	const auto& colorMap = wesnoth::builtinColorRanges["red"].applyToPalette(palette);
+
+	QImage result;
+
+	QBENCHMARK {
+		result = recolorImage(image, colorMap);
+	}
+
+	QCOMPARE(result.size(), size);
+}
+
+void BenchMorningStar::benchApplyToPalette_data()
+{
+	addPaletteRows();
+}
+
+void BenchMorningStar::benchApplyToPalette()
+{
+	QFETCH(QString, paletteId);
+
+	const auto& palette = benchPalette(paletteId);
+	const auto& colorRange = wesnoth::builtinColorRanges["red"];
+
+	ColorMap colorMap;
+
+	QBENCHMARK {
+		colorMap = colorRange.applyToPalette(palette);
+	}
+
+	QVERIFY(!colorMap.isEmpty());
+}
+
+void BenchMorningStar::benchGenerateColorMap_data()
+{
+	addPaletteRows();
+}
+
+void BenchMorningStar::benchGenerateColorMap()
+{
+	QFETCH(QString, paletteId);
+
+	const auto& palette = benchPalette(paletteId);
+	const ColorList newPalette(palette.crbegin(), palette.crend());
+
+	ColorMap colorMap;
+
+	QBENCHMARK {
+		colorMap = generateColorMap(palette, newPalette);
+	}
+
+	QVERIFY(!colorMap.isEmpty());
+}
+
+void BenchMorningStar::benchUniqueColorsFromImage_data()
+{
+	addImageRows();
+}
+
+void BenchMorningStar::benchUniqueColorsFromImage()
+{
+	QFETCH(QSize, size);
+	QFETCH(int, transparency);
+
+	const auto& image = MosBench::benchImage(size, transparency, benchPalette("magenta"));
+
+	ColorSet colors;
+
+	QBENCHMARK {
+		colors = uniqueColorsFromImage(image);
+	}
+
+	QVERIFY(!colors.isEmpty());
+}
+
+void BenchMorningStar::benchColorBlendImage_data()
+{
+	addImageRows();
+}
+
+void BenchMorningStar::benchColorBlendImage()
+{
+	QFETCH(QSize, size);
+	QFETCH(int, transparency);
+
+	const auto& image = MosBench::benchImage(size, transparency, benchPalette("magenta"));
+
+	QImage result;
+
+	QBENCHMARK {
+		result = colorBlendImage(image, QColor{127, 89, 32}, 0.54);
+	}
+
+	QCOMPARE(result.size(), size);
+}
+
+void BenchMorningStar::benchColorShiftImage_data()
+{
+	addImageRows();
+}
+
+void BenchMorningStar::benchColorShiftImage()
+{
+	QFETCH(QSize, size);
+	QFETCH(int, transparency);
+
+	const auto& image = MosBench::benchImage(size, transparency, benchPalette("magenta"));
+
+	QImage result;
+
+	QBENCHMARK {
+		result = colorShiftImage(image, -228, 90, 164);
+	}
+
+	QCOMPARE(result.size(), size);
+}
+
+void BenchMorningStar::benchWritePng_data()
+{
+	addImageRows();
+}
+
+void BenchMorningStar::benchWritePng()
+{
+	QFETCH(QSize, size);
+	QFETCH(int, transparency);
+
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+
+	const auto& filePath = dir.filePath("bench.png");
+	auto image = MosBench::benchImage(size, transparency, benchPalette("magenta"));
+
+	bool ok = false;
+
+	QBENCHMARK {
+		ok = MosIO::writePng(image, filePath);
+	}
+
+	QVERIFY(ok);
+}
+
+void BenchMorningStar::benchWriteBase64Png_data()
+{
+	addImageRows();
+}
+
+void BenchMorningStar::benchWriteBase64Png()
+{
+	QFETCH(QSize, size);
+	QFETCH(int, transparency);
+
+	auto image = MosBench::benchImage(size, transparency, benchPalette("magenta"));
+
+	QString base64;
+
+	QBENCHMARK {
+		base64 = MosIO::writeBase64Png(image);
+	}
+
+	QVERIFY(!base64.isEmpty());
+}
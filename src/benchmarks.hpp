@@ -0,0 +1,56 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QTest>
+
+/**
+ * Performance benchmarks for the recoloring and encoding kernels.
+ *
+ * Every benchmark is data-driven, with data tags of the form
+ * <tt>&lt;width&gt;x&lt;height&gt; &lt;transparency&gt;% &lt;palette&gt;</tt>
+ * (or a subset thereof) so that results can be tracked per parameter set
+ * across releases using QtTest's CSV output (e.g. <tt>wespal_bench -csv</tt>).
+ */
+class BenchMorningStar: public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+
+	void benchRecolorImage_data();
+	void benchRecolorImage();
+	void benchApplyToPalette_data();
+	void benchApplyToPalette();
+	void benchGenerateColorMap_data();
+	void benchGenerateColorMap();
+	void benchUniqueColorsFromImage_data();
+	void benchUniqueColorsFromImage();
+	void benchColorBlendImage_data();
+	void benchColorBlendImage();
+	void benchColorShiftImage_data();
+	void benchColorShiftImage();
+	void benchWritePng_data();
+	void benchWritePng();
+	void benchWriteBase64Png_data();
+	void benchWriteBase64Png();
+};
@@ -0,0 +1,76 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "benchutils.hpp"
+
+namespace MosBench {
+
+namespace {
+
+quint32 hash(int x, int y)
+{
+	auto h = quint32(x) * 0x8da6b343U ^ quint32(y) * 0xd8163841U;
+	h ^= h >> 13;
+	h *= 0x5bd1e995U;
+	h ^= h >> 15;
+	return h;
+}
+
+} // end unnamed namespace
+
+QTextStream& err()
+{
+	static QTextStream stream{stderr};
+	return stream;
+}
+
+QTextStream& out()
+{
+	static QTextStream stream{stdout};
+	return stream;
+}
+
+QImage benchImage(const QSize& size, int transparency, const ColorList& palette)
+{
+	QImage image{size, QImage::Format_ARGB32};
+
+	for (int y = 0; y < size.height(); ++y)
+	{
+		auto* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+
+		for (int x = 0; x < size.width(); ++x)
+		{
+			// Runs of 8 pixels share the same properties
+			const auto h = hash(x / 8, y);
+
+			if (int(h % 100) < transparency) {
+				line[x] = 0;
+			} else if (h & 0x100) {
+				line[x] = palette[(h >> 9) % palette.size()] | 0xFF000000U;
+			} else {
+				line[x] = qRgb(h >> 16, h >> 24, h >> 8);
+			}
+		}
+	}
+
+	return image;
+}
+
+} // end namespace MosBench
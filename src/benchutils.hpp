@@ -0,0 +1,58 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include "colortypes.hpp"
+
+#include <QImage>
+#include <QSize>
+#include <QTextStream>
+
+namespace MosBench {
+
+//
+// Helpers shared by the benchmark programs.
+//
+
+/**
+ * Returns a text stream writing to standard error.
+ */
+QTextStream& err();
+
+/**
+ * Returns a text stream writing to standard output.
+ */
+QTextStream& out();
+
+/**
+ * Generates an ARGB32 image resembling Wesnoth unit artwork.
+ *
+ * Most opaque pixels use colors from the given palette in horizontal runs,
+ * with the rest being unrelated colors that do not get recolored. The
+ * output only depends on the arguments.
+ *
+ * @param size         Image size.
+ * @param transparency Percentage of fully transparent pixels.
+ * @param palette      Key palette, which must not be empty.
+ */
+QImage benchImage(const QSize& size, int transparency, const ColorList& palette);
+
+} // end namespace MosBench
@@ -0,0 +1,381 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "batch.hpp"
+#include "batchspec.hpp"
+#include "recolorservice.hpp"
+#include "sourcewatcher.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+#include "version.hpp"
+
+#include <QCborArray>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QLocalSocket>
+#include <QSet>
+#include <QTextStream>
+
+namespace {
+
+QTextStream& err()
+{
+	static QTextStream stream{stderr};
+	return stream;
+}
+
+QTextStream& out()
+{
+	static QTextStream stream{stdout};
+	return stream;
+}
+
+void printResult(const MosBatch::Result& result,
+				 qsizetype sourceCount,
+				 qint64 elapsed,
+				 int threadCount,
+				 bool quiet)
+{
+	for (const auto& path : result.failed)
+		err() << "Failed: " << path << Qt::endl;
+
+	if (quiet)
+		return;
+
+	const auto seconds = qMax<qint64>(1, elapsed) / 1000.0;
+
+	out() << QString{"Wrote %1 files from %2 sources in %3 s"}
+			 .arg(result.succeeded.count())
+			 .arg(sourceCount)
+			 .arg(seconds, 0, 'f', 2);
+
+	if (threadCount > 0)
+		out() << QString{" using %1 threads"}.arg(threadCount);
+
+	out() << QString{" (%1 images/s)"}
+			 .arg(result.succeeded.count() / seconds, 0, 'f', 1)
+		  << Qt::endl;
+
+	if (!result.upToDate.isEmpty() || !result.deduplicated.isEmpty()) {
+		out() << QString{"%1 files were up to date, %2 were copied from identical outputs"}
+				 .arg(result.upToDate.count())
+				 .arg(result.deduplicated.count())
+			  << Qt::endl;
+	}
+}
+
+int runServer(const QString& serverName, int threadCount, bool quiet)
+{
+	MosBatch::RecolorServer server{threadCount};
+
+	if (!server.listen(serverName)) {
+		err() << QString{"Could not listen on %1: %2"}.arg(serverName, server.errorString()) << Qt::endl;
+		return 1;
+	}
+
+	if (!quiet) {
+		out() << QString{"Listening on %1 using %2 threads. Press Ctrl+C to stop."}
+				 .arg(server.fullServerName())
+				 .arg(server.threadCount())
+			  << Qt::endl;
+	}
+
+	return QCoreApplication::exec();
+}
+
+int runClient(const QString& serverName,
+			  const QList<MosBatch::Source>& sources,
+			  const QCborMap& baseRequest,
+			  bool quiet)
+{
+	QLocalSocket socket;
+
+	socket.connectToServer(serverName);
+
+	if (!socket.waitForConnected(5000)) {
+		err() << QString{"Could not connect to %1: %2"}.arg(serverName, socket.errorString()) << Qt::endl;
+		return 1;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// Requests are pipelined so that the server can work on all of them in
+	// parallel.
+	for (qsizetype i = 0; i < sources.count(); ++i)
+	{
+		auto request = baseRequest;
+
+		request.insert(QStringLiteral("id"), i);
+		request.insert(QStringLiteral("source"), QFileInfo{sources[i].path}.absoluteFilePath());
+		request.insert(QStringLiteral("outputDir"), QDir{sources[i].outputDir}.absolutePath());
+
+		MosBatch::writeMessage(socket, request);
+	}
+
+	socket.flush();
+
+	MosBatch::Result result;
+	QByteArray buffer;
+	auto pending = sources.count();
+
+	while (pending > 0)
+	{
+		if (!socket.waitForReadyRead(-1)) {
+			err() << QString{"Lost connection to %1: %2"}.arg(serverName, socket.errorString()) << Qt::endl;
+			return 1;
+		}
+
+		buffer.append(socket.readAll());
+
+		if (MosBatch::isMessageOversized(buffer)) {
+			err() << QString{"Received an invalid response from %1"}.arg(serverName) << Qt::endl;
+			return 1;
+		}
+
+		QCborMap response;
+
+		while (MosBatch::takeMessage(buffer, response))
+		{
+			--pending;
+
+			for (const auto& file : response.value(QStringLiteral("files")).toArray())
+				result.succeeded.emplaceBack(file.toString());
+
+			if (!response.value(QStringLiteral("ok")).toBool()) {
+				const auto id = response.value(QStringLiteral("id")).toInteger(-1);
+				const auto& path = id >= 0 && id < sources.count() ? sources[id].path : QString{};
+
+				result.failed.emplaceBack(QString{"%1: %2"}.arg(path, response.value(QStringLiteral("error")).toString()));
+			}
+		}
+	}
+
+	printResult(result, sources.count(), timer.elapsed(), 0, quiet);
+
+	return result.failed.isEmpty() ? 0 : 1;
+}
+
+} // end unnamed namespace
+
+int main(int argc, char* argv[])
+{
+	MosTrace::start();
+
+	QCoreApplication a{argc, argv};
+
+	QCoreApplication::setApplicationName("Wespal");
+	QCoreApplication::setOrganizationName("Irydacea");
+	QCoreApplication::setOrganizationDomain("irydacea.me");
+	QCoreApplication::setApplicationVersion(MOS_VERSION);
+
+	QCommandLineParser parser;
+
+	parser.setApplicationDescription(
+		"Applies Wesnoth team color and image path function transforms to "
+		"images in bulk.\n\n"
+		"Output files are named in the same fashion as Wespal's, e.g.:\n"
+		"  <stem>-RC-<palette>-<n>-<range>.png\n"
+		"If no transforms are specified, all built-in color ranges are used.");
+	parser.addHelpOption();
+	parser.addVersionOption();
+
+	parser.addPositionalArgument("inputs", "Image files or directories to process.", "<inputs...>");
+
+	QCommandLineOption outputOption{{"o", "output"},
+		"Output directory (default: current directory). Inputs found inside "
+		"directories are written to matching subdirectories.",
+		"dir", "."};
+	QCommandLineOption keyPaletteOption{{"k", "key-palette"},
+		"Key palette, either a built-in id or id=RRGGBB,RRGGBB,... "
+		"(default: magenta).",
+		"palette", "magenta"};
+	QCommandLineOption rangeOption{{"r", "range"},
+		"Color range to apply, either a built-in id or id=AVG,MAX,MIN[,REP]. "
+		"May be specified multiple times.",
+		"range"};
+	QCommandLineOption allRangesOption{"all-ranges",
+		"Apply all built-in color ranges."};
+	QCommandLineOption paletteOption{{"p", "palette"},
+		"Target palette for a palette swap, either a built-in id or "
+		"id=RRGGBB,RRGGBB,... May be specified multiple times.",
+		"palette"};
+	QCommandLineOption blendOption{"blend",
+		"Color blend to apply, as RRGGBB,FACTOR with FACTOR between 0 and 1. "
+		"May be specified multiple times.",
+		"spec"};
+	QCommandLineOption shiftOption{"shift",
+		"Color shift to apply, as R,G,B with values between -255 and 255. "
+		"May be specified multiple times.",
+		"spec"};
+	QCommandLineOption jobsOption{{"j", "jobs"},
+		"Number of worker threads (default: number of CPU cores).",
+		"count", "0"};
+	QCommandLineOption incrementalOption{{"i", "incremental"},
+		"Only regenerate outputs whose source image, transform parameters or "
+		"Wespal version changed since the last incremental run, as recorded "
+		"in a manifest file in each output directory."};
+	QCommandLineOption watchOption{{"w", "watch"},
+		"After processing all inputs, keep running and regenerate the outputs "
+		"of any source images that are modified or created."};
+	QCommandLineOption serveOption{"serve",
+		"Run as a recolor server for other wespal-cli instances or build "
+		"tools, keeping decoded images and color maps cached between "
+		"requests. No inputs are required in this mode."};
+	QCommandLineOption connectOption{"connect",
+		"Send all jobs to a running recolor server instead of processing "
+		"them in this process."};
+	QCommandLineOption serverNameOption{"server",
+		"Recolor server socket name used by --serve and --connect.",
+		"name", MosBatch::defaultServerName()};
+	QCommandLineOption noVanityPlateOption{"no-vanity-plate",
+		"Do not include the Wespal version in output PNG files."};
+	QCommandLineOption quietOption{{"q", "quiet"},
+		"Only report errors."};
+
+	parser.addOptions({
+		outputOption,
+		keyPaletteOption,
+		rangeOption,
+		allRangesOption,
+		paletteOption,
+		blendOption,
+		shiftOption,
+		jobsOption,
+		incrementalOption,
+		watchOption,
+		serveOption,
+		connectOption,
+		serverNameOption,
+		noVanityPlateOption,
+		quietOption,
+	});
+
+	parser.process(a);
+
+	const bool quiet = parser.isSet(quietOption);
+
+	if (parser.isSet(serveOption)) {
+		return runServer(parser.value(serverNameOption),
+						 parser.value(jobsOption).toInt(),
+						 quiet);
+	}
+
+	const auto& inputs = parser.positionalArguments();
+
+	if (inputs.isEmpty()) {
+		parser.showHelp(1);
+	}
+
+	MosBatch::Options options;
+
+	try {
+		const auto& [keyPaletteId, keyPalette] = MosBatch::parsePalette(parser.value(keyPaletteOption));
+
+		options.keyPaletteId = keyPaletteId;
+		options.keyPalette = keyPalette;
+		options.vanityPlate = !parser.isSet(noVanityPlateOption);
+		options.incremental = parser.isSet(incrementalOption);
+
+		options.transforms = MosBatch::parseTransforms(parser.values(rangeOption),
+													   parser.values(paletteOption),
+													   parser.values(blendOption),
+													   parser.values(shiftOption),
+													   parser.isSet(allRangesOption));
+	} catch (const MosBatch::spec_error& e) {
+		err() << e.message << Qt::endl;
+		return 1;
+	}
+
+	const auto& outputDir = parser.value(outputOption);
+	const auto& outputSuffixes = options.outputSuffixes();
+	const auto& sources = MosBatch::collectSources(inputs, outputDir, outputSuffixes);
+
+	if (sources.isEmpty()) {
+		err() << "No input images found." << Qt::endl;
+		return 1;
+	}
+
+	if (parser.isSet(connectOption)) {
+		if (options.incremental || parser.isSet(watchOption)) {
+			err() << "--incremental and --watch cannot be used with --connect." << Qt::endl;
+			return 1;
+		}
+
+		QCborMap request;
+
+		request.insert(QStringLiteral("keyPalette"), parser.value(keyPaletteOption));
+		request.insert(QStringLiteral("ranges"), QCborArray::fromStringList(parser.values(rangeOption)));
+		request.insert(QStringLiteral("allRanges"), parser.isSet(allRangesOption));
+		request.insert(QStringLiteral("palettes"), QCborArray::fromStringList(parser.values(paletteOption)));
+		request.insert(QStringLiteral("blends"), QCborArray::fromStringList(parser.values(blendOption)));
+		request.insert(QStringLiteral("shifts"), QCborArray::fromStringList(parser.values(shiftOption)));
+		request.insert(QStringLiteral("vanityPlate"), options.vanityPlate);
+
+		return runClient(parser.value(serverNameOption), sources, request, quiet);
+	}
+
+	MosBatch::WorkStealingPool pool{parser.value(jobsOption).toInt()};
+	MosBatch::Processor processor{options};
+
+	QElapsedTimer timer;
+	timer.start();
+
+	const auto& result = processor.run(sources, pool);
+
+	printResult(result, sources.count(), timer.elapsed(), pool.threadCount(), quiet);
+
+	if (!parser.isSet(watchOption))
+		return result.failed.isEmpty() ? 0 : 1;
+
+	MosBatch::SourceWatcher watcher;
+
+	watcher.setExcludedDirectory(outputDir);
+	watcher.setOutputSuffixes(outputSuffixes);
+	watcher.setPaths(inputs);
+
+	QObject::connect(&watcher, &MosBatch::SourceWatcher::changed, [&](const QStringList& files) {
+		const QSet<QString> changedFiles{files.cbegin(), files.cend()};
+		QList<MosBatch::Source> changedSources;
+
+		for (const auto& source : MosBatch::collectSources(inputs, outputDir, outputSuffixes))
+		{
+			if (changedFiles.contains(QFileInfo{source.path}.absoluteFilePath()))
+				changedSources.emplaceBack(source);
+		}
+
+		if (changedSources.isEmpty())
+			return;
+
+		timer.restart();
+
+		const auto& result = processor.run(changedSources, pool);
+
+		printResult(result, changedSources.count(), timer.elapsed(), pool.threadCount(), quiet);
+	});
+
+	if (!quiet)
+		out() << "Watching for changes. Press Ctrl+C to stop." << Qt::endl;
+
+	return a.exec();
+}
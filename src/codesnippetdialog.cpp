@@ -34,6 +34,7 @@ CodeSnippetDialog::CodeSnippetDialog(const QString& contents,
 									 QWidget* parent)
 	: QDialog(parent)
 	, ui(new Ui::CodeSnippetDialog)
+	, rawDataMode_(false)
 {
 	ui->setupUi(this);
 
@@ -60,6 +61,8 @@ CodeSnippetDialog::CodeSnippetDialog(const QString& contents,
 
 	const auto& monoFont = QFontDatabase::systemFont(QFontDatabase::FixedFont);
 	ui->teContents->setFont(monoFont);
+	ui->rawContents->setFont(monoFont);
+	ui->rawContents->setVisible(false);
 
 	connect(ui->codeSelector, SIGNAL(currentIndexChanged(int)), this, SLOT(onCodeSelectionChanged(int)));
 
@@ -101,26 +104,59 @@ void CodeSnippetDialog::setAllowWmlSave(bool value)
 
 void CodeSnippetDialog::setRawDataMode(bool value)
 {
-	ui->teContents->setWordWrapMode(value ? QTextOption::WrapAnywhere : QTextOption::WrapAtWordBoundaryOrAnywhere);
+	// Raw data (Base64 data URIs in particular) can easily take up several
+	// megabytes, which QPlainTextEdit is very slow to lay out. Such snippets
+	// go to a lightweight viewer that only handles the visible portion.
+	rawDataMode_ = value;
+
+	ui->teContents->setVisible(!value);
+	ui->rawContents->setVisible(value);
+
+	onCodeSelectionChanged(ui->codeSelector->currentIndex());
+}
+
+QString CodeSnippetDialog::currentContents() const
+{
+	const auto index = ui->codeSelector->currentIndex();
+
+	return index != -1
+		   ? ui->codeSelector->itemData(index).toString()
+		   : QString{};
 }
 
 void CodeSnippetDialog::onCodeSelectionChanged(int index)
 {
+	ui->boxClipboardMessage->setVisible(false);
+
 	if (index == -1) {
 		ui->teContents->clear();
+		ui->rawContents->clear();
 		return;
 	}
 
 	const auto& contents = ui->codeSelector->itemData(index).toString();
 
-	ui->teContents->setPlainText(contents);
+	if (rawDataMode_) {
+		ui->teContents->clear();
+		ui->rawContents->setContents(contents);
+	} else {
+		ui->rawContents->clear();
+		ui->teContents->setPlainText(contents);
+	}
 }
 
 void CodeSnippetDialog::handleCopy()
 {
-	QApplication::clipboard()->setText(ui->teContents->toPlainText());
+	// Always copy from the snippet buffer rather than the display widget,
+	// which avoids a full extra copy of the text for large snippets.
+	QApplication::clipboard()->setText(currentContents());
 	ui->boxClipboardMessage->setVisible(true);
-	ui->teContents->selectAll();
+
+	if (rawDataMode_) {
+		ui->rawContents->selectAll();
+	} else {
+		ui->teContents->selectAll();
+	}
 }
 
 void CodeSnippetDialog::handleSave()
@@ -141,7 +177,7 @@ void CodeSnippetDialog::handleSave()
 
 	if (f.open(QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
 		QTextStream out{&f};
-		out << ui->teContents->toPlainText();
+		out << currentContents();
 		f.close();
 	}
 
@@ -53,6 +53,13 @@ protected:
 private:
 	Ui::CodeSnippetDialog* ui;
 
+	bool rawDataMode_;
+
+	/**
+	 * Retrieves the currently selected snippet from the snippet store.
+	 */
+	QString currentContents() const;
+
 private slots:
 	void onCodeSelectionChanged(int index);
 
@@ -20,6 +20,9 @@
 
 #include "compositeimagelabel.hpp"
 
+#include "perfmetrics.hpp"
+#include "trace.hpp"
+
 #include <QLayout>
 #include <QPainter>
 #include <QPaintEvent>
@@ -31,13 +34,25 @@ CompositeImageLabel::CompositeImageLabel(QWidget* parent)
 	, displayRatio_(0.5)
 	, leftImage_()
 	, rightImage_()
+	, compositeCache_()
+	, compositeFresh_(false)
 {
 	setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Minimum);
 }
 
+CompositeImageLabel::~CompositeImageLabel()
+{
+	MosMetrics::releaseMemory(&leftImage_);
+	MosMetrics::releaseMemory(&rightImage_);
+	MosMetrics::releaseMemory(&compositeCache_);
+}
+
 void CompositeImageLabel::setLeftImage(const QImage& leftImage)
 {
-	leftImage_ = leftImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	{
+		MosMetrics::StageTimer timer{MosMetrics::StageConversion};
+		leftImage_ = leftImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	}
 
 	buildComposite();
 	updateGeometry();
@@ -46,7 +61,10 @@ void CompositeImageLabel::setLeftImage(const QImage& leftImage)
 
 void CompositeImageLabel::setRightImage(const QImage& rightImage)
 {
-	rightImage_ = rightImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	{
+		MosMetrics::StageTimer timer{MosMetrics::StageConversion};
+		rightImage_ = rightImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	}
 
 	buildComposite();
 	updateGeometry();
@@ -55,8 +73,11 @@ void CompositeImageLabel::setRightImage(const QImage& rightImage)
 
 void CompositeImageLabel::setImages(const QImage& leftImage, const QImage& rightImage)
 {
-	leftImage_ = leftImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
-	rightImage_ = rightImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	{
+		MosMetrics::StageTimer timer{MosMetrics::StageConversion};
+		leftImage_ = leftImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+		rightImage_ = rightImage.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	}
 
 	buildComposite();
 	updateGeometry();
@@ -74,17 +95,26 @@ void CompositeImageLabel::clear()
 
 void CompositeImageLabel::buildComposite()
 {
+	compositeCache_ = renderComposite();
+	compositeFresh_ = true;
+
+	reportImages();
+}
+
+QImage CompositeImageLabel::renderComposite() const
+{
+	MOS_TRACE_SPAN("render", "renderComposite");
+	MosMetrics::StageTimer timer{MosMetrics::StageComposite};
+
 	auto& left = leftImage_;
 	auto& right = rightImage_;
 
 	// Optimise the best case scenarios by referencing a single image.
 
 	if (displayRatio_ == 0.0) {
-		compositeCache_ = left;
-		return;
+		return left;
 	} else if (displayRatio_ == 1.0) {
-		compositeCache_ = right;
-		return;
+		return right;
 	}
 
 	QImage::Format fmt = displayMode_ == CompositeDisplayOnionSkin
@@ -146,7 +176,17 @@ void CompositeImageLabel::buildComposite()
 			Q_ASSERT(false);
 	}
 
-	compositeCache_ = compositeRender;
+	return compositeRender;
+}
+
+void CompositeImageLabel::reportImages()
+{
+	MosMetrics::setImage(&leftImage_, MosMetrics::MemoryWidgetBuffers, leftImage_);
+	MosMetrics::setImage(&rightImage_, MosMetrics::MemoryWidgetBuffers, rightImage_);
+	MosMetrics::setImage(&compositeCache_, MosMetrics::MemoryCaches, compositeCache_, [this]() {
+		compositeCache_ = QImage{};
+		MosMetrics::releaseMemory(&compositeCache_);
+	});
 }
 
 void CompositeImageLabel::paintEvent(QPaintEvent* event)
@@ -154,9 +194,22 @@ void CompositeImageLabel::paintEvent(QPaintEvent* event)
 	if (leftImage_.isNull())
 		return;
 
+	MOS_TRACE_SPAN("paint", "CompositeImageLabel::paintEvent");
+	MosMetrics::StageTimer timer{MosMetrics::StagePaint};
+
+	// Repaints that do not follow a rebuild (e.g. scrolling or exposing
+	// parts of the widget) are served from the cached composite, unless it
+	// was evicted to stay within the memory budget, in which case it is
+	// rendered again just for this repaint
+	const bool evicted = compositeCache_.isNull();
+	const auto& composite = evicted ? renderComposite() : compositeCache_;
+
+	MosMetrics::recordCacheLookup(!compositeFresh_ && !evicted);
+	compositeFresh_ = false;
+
 	QPainter p{this};
 
 	p.setClipRect(event->rect());
 	p.setRenderHint(QPainter::SmoothPixmapTransform, false);
-	p.drawImage(rect(), compositeCache_);
+	p.drawImage(rect(), composite);
 }
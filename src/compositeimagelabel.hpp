@@ -55,6 +55,8 @@ public:
 	 */
 	explicit CompositeImageLabel(QWidget* parent = nullptr);
 
+	~CompositeImageLabel();
+
 	virtual QSize minimumSizeHint() const override
 	{
 		return leftImage_.size();
@@ -165,6 +167,8 @@ protected:
 
 private:
 	void buildComposite();
+	QImage renderComposite() const;
+	void reportImages();
 
 	CompositeDisplayMode displayMode_;
 
@@ -174,4 +178,6 @@ private:
 	QImage rightImage_;
 
 	QImage compositeCache_;
+	// Whether compositeCache_ was rebuilt since it was last painted
+	bool compositeFresh_;
 };
@@ -0,0 +1,398 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+//
+// Decoder benchmark for the bundled image format plugins.
+//
+// Each corpus file is decoded in a separate child process so that peak
+// memory usage figures are not polluted by previous decodes.
+//
+
+#include "benchutils.hpp"
+#include "decodercorpus.hpp"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#if defined(MOS_COUNT_ALLOCATIONS) && defined(__GLIBC__)
+
+//
+// Allocation counting via malloc interposition. glibc exports its own
+// implementation under the __libc_ prefix, so there is no need for dlsym()
+// trickery here.
+//
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+}
+
+namespace {
+
+std::atomic<bool> countAllocations = false;
+std::atomic<quint64> allocationCount = 0;
+std::atomic<quint64> allocationBytes = 0;
+
+void recordAllocation(size_t size)
+{
+	if (countAllocations.load(std::memory_order_relaxed)) {
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+		allocationBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+}
+
+} // end unnamed namespace
+
+extern "C" {
+
+void* malloc(size_t size)
+{
+	recordAllocation(size);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+	recordAllocation(count * size);
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	recordAllocation(size);
+	return __libc_realloc(ptr, size);
+}
+
+}
+
+#define MOS_HAVE_ALLOCATION_COUNTS 1
+
+#endif
+
+using MosBench::err;
+using MosBench::out;
+
+namespace {
+
+/**
+ * Returns the peak resident set size of the current process in bytes.
+ */
+qint64 peakMemoryUsage()
+{
+#if defined(Q_OS_WIN)
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return -1;
+	return qint64(counters.PeakWorkingSetSize);
+#else
+	rusage usage{};
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+#if defined(Q_OS_MACOS)
+	return qint64(usage.ru_maxrss);
+#else
+	return qint64(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+/**
+ * Result of decoding a single file, as reported by the child process.
+ */
+struct DecodeResult
+{
+	bool ok = false;
+	double medianMs = 0;
+	double minMs = 0;
+	qint64 baselineMemory = -1;
+	qint64 peakMemory = -1;
+	qint64 allocations = -1;
+	qint64 allocatedBytes = -1;
+};
+
+/**
+ * Decodes a file repeatedly and prints the results in key=value form.
+ *
+ * This is the child process side of the benchmark.
+ */
+int decodeFile(const QString& path, int iterations)
+{
+	// Make sure the plugins are loaded before taking the baseline
+	QImageReader::supportedImageFormats();
+
+	const auto baseline = peakMemoryUsage();
+
+	QList<double> times;
+	qint64 allocations = -1, allocatedBytes = -1;
+
+	for (int i = 0; i < iterations; ++i) {
+		QImageReader reader{path};
+		QImage image;
+		QElapsedTimer timer;
+
+#ifdef MOS_HAVE_ALLOCATION_COUNTS
+		allocationCount = 0;
+		allocationBytes = 0;
+		countAllocations = true;
+#endif
+
+		timer.start();
+		const auto ok = reader.read(&image);
+		const auto elapsed = timer.nsecsElapsed();
+
+#ifdef MOS_HAVE_ALLOCATION_COUNTS
+		countAllocations = false;
+		allocations = qint64(allocationCount.load());
+		allocatedBytes = qint64(allocationBytes.load());
+#endif
+
+		if (!ok) {
+			err() << path << ": " << reader.errorString() << Qt::endl;
+			return 1;
+		}
+
+		times.append(double(elapsed) / 1e6);
+	}
+
+	std::sort(times.begin(), times.end());
+
+	out() << "median=" << times[times.size() / 2] << '\n'
+		  << "min=" << times.first() << '\n'
+		  << "baseline=" << baseline << '\n'
+		  << "peak=" << peakMemoryUsage() << '\n'
+		  << "allocations=" << allocations << '\n'
+		  << "allocated=" << allocatedBytes << Qt::endl;
+
+	return 0;
+}
+
+DecodeResult runChild(const QString& path, int iterations)
+{
+	DecodeResult result;
+	QProcess child;
+
+	child.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	child.start(QCoreApplication::applicationFilePath(),
+				{"--decode", path, "--iterations", QString::number(iterations)});
+
+	if (!child.waitForFinished(-1) || child.exitStatus() != QProcess::NormalExit
+		|| child.exitCode() != 0) {
+		return result;
+	}
+
+	const auto lines = QString::fromUtf8(child.readAllStandardOutput()).split('\n');
+
+	for (const auto& line : lines) {
+		const auto key = line.section('=', 0, 0);
+		const auto value = line.section('=', 1);
+
+		if (key == "median")
+			result.medianMs = value.toDouble();
+		else if (key == "min")
+			result.minMs = value.toDouble();
+		else if (key == "baseline")
+			result.baselineMemory = value.toLongLong();
+		else if (key == "peak")
+			result.peakMemory = value.toLongLong();
+		else if (key == "allocations")
+			result.allocations = value.toLongLong();
+		else if (key == "allocated")
+			result.allocatedBytes = value.toLongLong();
+	}
+
+	result.ok = true;
+	return result;
+}
+
+QString formatMiB(qint64 bytes)
+{
+	return bytes < 0 ? QString{"n/a"} : QString::number(double(bytes) / (1024 * 1024), 'f', 1);
+}
+
+QString formatCount(qint64 count)
+{
+	return count < 0 ? QString{"n/a"} : QString::number(count);
+}
+
+} // end unnamed namespace
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication a{argc, argv};
+
+	QCommandLineParser parser;
+
+	parser.setApplicationDescription(
+		"Measures decode time and memory usage of the bundled image format "
+		"plugins using a generated corpus of XCF, PSD, ORA and KRA files.");
+	parser.addHelpOption();
+
+	QCommandLineOption corpusOption{"corpus",
+		"Directory to generate the corpus in and keep it afterwards "
+		"(default: a temporary directory).",
+		"dir"};
+	QCommandLineOption sizesOption{"sizes",
+		"Comma-separated list of canvas sizes (default: 512,2048).",
+		"sizes", "512,2048"};
+	QCommandLineOption formatsOption{"formats",
+		"Comma-separated list of formats (default: xcf,psd,ora,kra).",
+		"formats", "xcf,psd,ora,kra"};
+	QCommandLineOption iterationsOption{"iterations",
+		"Number of decodes per file (default: 3).",
+		"count", "3"};
+	QCommandLineOption csvOption{"csv",
+		"Print results in CSV format."};
+	QCommandLineOption decodeOption{"decode",
+		"Internal: decode a single file and report the results.",
+		"file"};
+
+	decodeOption.setFlags(QCommandLineOption::HiddenFromHelp);
+
+	parser.addOptions({
+		corpusOption,
+		sizesOption,
+		formatsOption,
+		iterationsOption,
+		csvOption,
+		decodeOption,
+	});
+
+	parser.process(a);
+
+	const auto iterations = qMax(1, parser.value(iterationsOption).toInt());
+
+	if (parser.isSet(decodeOption))
+		return decodeFile(parser.value(decodeOption), iterations);
+
+	QList<int> sizes;
+	for (const auto& size : parser.value(sizesOption).split(',', Qt::SkipEmptyParts)) {
+		if (size.toInt() <= 0) {
+			err() << "Invalid size: " << size << Qt::endl;
+			return 1;
+		}
+		sizes.append(size.toInt());
+	}
+
+	const auto formats = parser.value(formatsOption).toLower().split(',', Qt::SkipEmptyParts);
+
+	QTemporaryDir tempDir;
+	QString corpusPath;
+
+	if (parser.isSet(corpusOption)) {
+		corpusPath = parser.value(corpusOption);
+		if (!QDir{}.mkpath(corpusPath)) {
+			err() << "Could not create corpus directory " << corpusPath << Qt::endl;
+			return 1;
+		}
+	} else if (tempDir.isValid()) {
+		corpusPath = tempDir.path();
+	} else {
+		err() << "Could not create temporary directory" << Qt::endl;
+		return 1;
+	}
+
+	err() << "Generating corpus in " << corpusPath << "..." << Qt::endl;
+
+	const auto corpus = MosBench::generateDecoderCorpus(corpusPath, sizes, formats);
+
+	if (corpus.isEmpty()) {
+		err() << "No corpus files were generated" << Qt::endl;
+		return 1;
+	}
+
+	const bool csv = parser.isSet(csvOption);
+
+	if (csv) {
+		out() << "format,variant,width,height,file_size,median_ms,min_ms,"
+				 "peak_rss,peak_rss_delta,allocations,allocated_bytes" << Qt::endl;
+	} else {
+		out() << qSetFieldWidth(6) << Qt::left << "Format"
+			  << qSetFieldWidth(22) << "Variant"
+			  << qSetFieldWidth(11) << "Size"
+			  << qSetFieldWidth(10) << Qt::right << "File MiB"
+			  << qSetFieldWidth(12) << "Median ms"
+			  << qSetFieldWidth(12) << "Peak MiB"
+			  << qSetFieldWidth(12) << "Delta MiB"
+			  << qSetFieldWidth(10) << "Allocs"
+			  << qSetFieldWidth(12) << "Alloc MiB"
+			  << qSetFieldWidth(0) << Qt::left << Qt::endl;
+	}
+
+	int failures = 0;
+
+	for (const auto& file : corpus) {
+		const auto result = runChild(file.path, iterations);
+		const auto fileSize = QFileInfo{file.path}.size();
+
+		if (!result.ok) {
+			err() << "Failed to decode " << file.path << Qt::endl;
+			++failures;
+			continue;
+		}
+
+		const auto delta = result.peakMemory >= 0 && result.baselineMemory >= 0
+						   ? result.peakMemory - result.baselineMemory
+						   : -1;
+
+		if (csv) {
+			out() << file.format << ',' << file.variant << ','
+				  << file.size.width() << ',' << file.size.height() << ','
+				  << fileSize << ',' << result.medianMs << ',' << result.minMs << ','
+				  << result.peakMemory << ',' << delta << ','
+				  << result.allocations << ',' << result.allocatedBytes << Qt::endl;
+		} else {
+			const auto dimensions = QString{"%1x%2"}.arg(file.size.width()).arg(file.size.height());
+
+			out() << qSetFieldWidth(6) << Qt::left << file.format
+				  << qSetFieldWidth(22) << file.variant
+				  << qSetFieldWidth(11) << dimensions
+				  << qSetFieldWidth(10) << Qt::right << formatMiB(fileSize)
+				  << qSetFieldWidth(12) << QString::number(result.medianMs, 'f', 2)
+				  << qSetFieldWidth(12) << formatMiB(result.peakMemory)
+				  << qSetFieldWidth(12) << formatMiB(delta)
+				  << qSetFieldWidth(10) << formatCount(result.allocations)
+				  << qSetFieldWidth(12) << formatMiB(result.allocatedBytes)
+				  << qSetFieldWidth(0) << Qt::left << Qt::endl;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
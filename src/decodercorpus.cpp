@@ -0,0 +1,646 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "decodercorpus.hpp"
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QPainter>
+#include <QtEndian>
+
+#include <quazip/quazip.h>
+#include <quazip/quazipfile.h>
+
+#include <cstring>
+
+namespace MosBench {
+
+namespace {
+
+constexpr int xcfTileSize = 64;
+
+// XCF constants, from the GIMP source tree (app/xcf/xcf-private.h)
+enum XcfProperty : quint32
+{
+	XcfPropEnd = 0,
+	XcfPropOpacity = 6,
+	XcfPropMode = 7,
+	XcfPropVisible = 8,
+	XcfPropOffsets = 15,
+	XcfPropCompression = 17,
+};
+
+enum XcfLayerMode : quint32
+{
+	XcfModeNormal = 28,
+	XcfModeMultiply = 30,
+};
+
+enum XcfPrecision : quint32
+{
+	XcfPrecisionU8 = 150,
+	XcfPrecisionU16 = 250,
+	XcfPrecisionFloat = 650,
+};
+
+// PSD color modes, from the Photoshop file format specification
+enum PsdColorMode : quint16
+{
+	PsdRgb = 3,
+	PsdCmyk = 4,
+	PsdLab = 9,
+};
+
+quint32 hash(int x, int y, int seed)
+{
+	auto h = quint32(x) * 0x8da6b343u ^ quint32(y) * 0xd8163841u ^ quint32(seed) * 0xcb1ab31fu;
+	h ^= h >> 13;
+	h *= 0x5bd1e995u;
+	h ^= h >> 15;
+	return h;
+}
+
+/**
+ * Alpha blends a list of layers into a single image.
+ */
+QImage flatten(const QList<QImage>& layers, const QList<QPoint>& offsets)
+{
+	QImage merged{layers.first().size(), QImage::Format_RGBA8888};
+	merged.fill(Qt::transparent);
+
+	QPainter painter{&merged};
+	for (qsizetype i = 0; i < layers.size(); ++i)
+		painter.drawImage(offsets.value(i), layers[i]);
+
+	return merged;
+}
+
+QByteArray encodePng(const QImage& image)
+{
+	QByteArray data;
+	QBuffer buffer{&data};
+	buffer.open(QIODevice::WriteOnly);
+	image.save(&buffer, "PNG");
+	return data;
+}
+
+//
+// XCF
+//
+
+/**
+ * Converts a rectangle of an RGBA8888 image to interleaved XCF pixel data.
+ *
+ * @param channels     3 or 4.
+ * @param depth        Bits per channel (8, 16, or 32 for floating point).
+ */
+QByteArray xcfPixels(const QImage& image, const QRect& rect, int channels, int depth)
+{
+	QByteArray data;
+	data.reserve(qsizetype(rect.width()) * rect.height() * channels * depth / 8);
+
+	for (int y = rect.top(); y <= rect.bottom(); ++y) {
+		auto line = image.constScanLine(y);
+		for (int x = rect.left(); x <= rect.right(); ++x) {
+			for (int c = 0; c < channels; ++c) {
+				const auto v = line[x * 4 + c];
+				if (depth == 8) {
+					data.append(char(v));
+				} else if (depth == 16) {
+					const auto be = qToBigEndian<quint16>(quint16(v * 257));
+					data.append(reinterpret_cast<const char*>(&be), sizeof(be));
+				} else {
+					const auto be = qToBigEndian<float>(v / 255.0f);
+					data.append(reinterpret_cast<const char*>(&be), sizeof(be));
+				}
+			}
+		}
+	}
+
+	return data;
+}
+
+/**
+ * Compresses XCF tile data using GIMP's per-byte-plane RLE scheme.
+ */
+QByteArray xcfRle(const QByteArray& pixels, int bpp)
+{
+	QByteArray out;
+	const auto count = pixels.size() / bpp;
+
+	auto byteAt = [&](qsizetype plane, qsizetype index) {
+		return pixels.at(index * bpp + plane);
+	};
+
+	auto runAt = [&](qsizetype plane, qsizetype index) {
+		qsizetype run = 1;
+		while (index + run < count && run < 0xFFFF
+			   && byteAt(plane, index + run) == byteAt(plane, index))
+			++run;
+		return run;
+	};
+
+	for (int plane = 0; plane < bpp; ++plane) {
+		for (qsizetype i = 0; i < count;) {
+			const auto run = runAt(plane, i);
+
+			if (run >= 3) {
+				if (run <= 127) {
+					out.append(char(run - 1));
+				} else {
+					out.append(char(127));
+					out.append(char(run >> 8));
+					out.append(char(run & 0xFF));
+				}
+				out.append(byteAt(plane, i));
+				i += run;
+				continue;
+			}
+
+			auto end = i;
+			while (end < count && end - i < 0xFFFF && runAt(plane, end) < 3)
+				++end;
+
+			const auto length = end - i;
+			if (length <= 127) {
+				out.append(char(256 - length));
+			} else {
+				out.append(char(128));
+				out.append(char(length >> 8));
+				out.append(char(length & 0xFF));
+			}
+			for (; i < end; ++i)
+				out.append(byteAt(plane, i));
+		}
+	}
+
+	return out;
+}
+
+struct XcfLayer
+{
+	QString name;
+	QImage image;
+	QPoint offset;
+	quint32 mode;
+	quint32 opacity;
+	bool alpha;
+};
+
+bool writeXcf(const QString& path,
+			  const QSize& size,
+			  const QList<XcfLayer>& layers,
+			  int depth,
+			  bool rle)
+{
+	QByteArray xcf;
+	QBuffer buffer{&xcf};
+	buffer.open(QIODevice::WriteOnly);
+	QDataStream s{&buffer};
+
+	// Fills in a previously reserved 64-bit pointer with the current position
+	auto patch = [&](qint64 at) {
+		const auto pos = buffer.pos();
+		buffer.seek(at);
+		s << qint64(pos);
+		buffer.seek(pos);
+	};
+
+	const auto precision = depth == 8 ? XcfPrecisionU8
+						   : depth == 16 ? XcfPrecisionU16
+						   : XcfPrecisionFloat;
+
+	// Version 11 is the first with 64-bit pointers, and the last one whose
+	// uncompressed tiles the plugin can read
+	s.writeRawData("gimp xcf v011", 14);
+	s << quint32(size.width()) << quint32(size.height())
+	  << quint32(0) // RGB
+	  << quint32(precision);
+
+	s << quint32(XcfPropCompression) << quint32(1) << quint8(rle ? 1 : 0);
+	s << quint32(XcfPropEnd) << quint32(0);
+
+	const auto layerTable = buffer.pos();
+	for (qsizetype i = 0; i <= layers.size(); ++i)
+		s << qint64(0);
+	s << qint64(0); // no channels
+
+	for (qsizetype i = 0; i < layers.size(); ++i) {
+		const auto& layer = layers[i];
+		const auto channels = layer.alpha ? 4 : 3;
+		const auto bpp = channels * depth / 8;
+		const auto lw = layer.image.width(), lh = layer.image.height();
+
+		patch(layerTable + i * 8);
+
+		const auto name = layer.name.toUtf8();
+		s << quint32(lw) << quint32(lh) << quint32(layer.alpha ? 1 : 0)
+		  << quint32(name.size() + 1);
+		s.writeRawData(name.constData(), name.size() + 1);
+
+		s << quint32(XcfPropOpacity) << quint32(4) << layer.opacity;
+		s << quint32(XcfPropVisible) << quint32(4) << quint32(1);
+		s << quint32(XcfPropMode) << quint32(4) << layer.mode;
+		s << quint32(XcfPropOffsets) << quint32(8)
+		  << qint32(layer.offset.x()) << qint32(layer.offset.y());
+		s << quint32(XcfPropEnd) << quint32(0);
+
+		const auto hierarchyPointer = buffer.pos();
+		s << qint64(0) << qint64(0); // hierarchy, mask
+
+		patch(hierarchyPointer);
+		s << quint32(lw) << quint32(lh) << quint32(bpp);
+		const auto levelPointer = buffer.pos();
+		s << qint64(0) << qint64(0); // first level, end of levels
+
+		patch(levelPointer);
+		s << quint32(lw) << quint32(lh);
+
+		const auto cols = (lw + xcfTileSize - 1) / xcfTileSize;
+		const auto rows = (lh + xcfTileSize - 1) / xcfTileSize;
+		const auto tileTable = buffer.pos();
+		for (int tile = 0; tile <= rows * cols; ++tile)
+			s << qint64(0);
+
+		for (int row = 0; row < rows; ++row) {
+			for (int col = 0; col < cols; ++col) {
+				const QRect rect{col * xcfTileSize, row * xcfTileSize,
+								 qMin(xcfTileSize, lw - col * xcfTileSize),
+								 qMin(xcfTileSize, lh - row * xcfTileSize)};
+				auto pixels = xcfPixels(layer.image, rect, channels, depth);
+
+				if (rle) {
+					pixels = xcfRle(pixels, bpp);
+				} else {
+					// The plugin always reads whole uncompressed tiles
+					pixels.resize(xcfTileSize * xcfTileSize * bpp, '\0');
+				}
+
+				patch(tileTable + (row * cols + col) * 8);
+				s.writeRawData(pixels.constData(), int(pixels.size()));
+			}
+		}
+	}
+
+	QFile file{path};
+	return file.open(QIODevice::WriteOnly) && file.write(xcf) == xcf.size();
+}
+
+//
+// PSD
+//
+
+/**
+ * Compresses a PSD scanline using PackBits.
+ */
+QByteArray packBits(const QByteArray& row)
+{
+	QByteArray out;
+	const auto count = row.size();
+
+	for (qsizetype i = 0; i < count;) {
+		qsizetype run = 1;
+		while (i + run < count && run < 128 && row.at(i + run) == row.at(i))
+			++run;
+
+		if (run >= 2) {
+			out.append(char(1 - run));
+			out.append(row.at(i));
+			i += run;
+			continue;
+		}
+
+		const auto start = i;
+		while (i < count && i - start < 128) {
+			if (i + 1 < count && row.at(i + 1) == row.at(i))
+				break;
+			++i;
+		}
+
+		out.append(char(i - start - 1));
+		out.append(row.constData() + start, i - start);
+	}
+
+	return out;
+}
+
+/**
+ * Returns the value of a PSD channel for an RGBA8888 pixel.
+ */
+quint8 psdChannel(PsdColorMode mode, const uchar* p, int channel)
+{
+	const int r = p[0], g = p[1], b = p[2];
+
+	switch (mode) {
+	case PsdCmyk: {
+		// Inks are stored inverted, so 255 means no ink
+		const auto k = qMax(1, qMax(r, qMax(g, b)));
+		switch (channel) {
+		case 0: return quint8(r * 255 / k);
+		case 1: return quint8(g * 255 / k);
+		case 2: return quint8(b * 255 / k);
+		default: return quint8(k);
+		}
+	}
+	case PsdLab:
+		switch (channel) {
+		case 0: return quint8((r * 77 + g * 150 + b * 29) >> 8);
+		case 1: return quint8(128 + (r - g) / 2);
+		default: return quint8(128 + (g - b) / 2);
+		}
+	default:
+		return p[channel];
+	}
+}
+
+bool writePsd(const QString& path,
+			  const QImage& image,
+			  PsdColorMode mode,
+			  int depth,
+			  bool packbits)
+{
+	const auto w = image.width(), h = image.height();
+	const auto channels = mode == PsdLab ? 3 : 4;
+
+	QByteArray psd;
+	QBuffer buffer{&psd};
+	buffer.open(QIODevice::WriteOnly);
+	QDataStream s{&buffer};
+
+	s.writeRawData("8BPS", 4);
+	s << quint16(1);
+	s.writeRawData("\0\0\0\0\0\0", 6);
+	s << quint16(channels) << quint32(h) << quint32(w)
+	  << quint16(depth) << quint16(mode);
+
+	// Color mode data, image resources, layer and mask information
+	s << quint32(0) << quint32(0) << quint32(0);
+
+	s << quint16(packbits ? 1 : 0);
+
+	QList<QByteArray> rows;
+	rows.reserve(qsizetype(channels) * h);
+
+	for (int c = 0; c < channels; ++c) {
+		for (int y = 0; y < h; ++y) {
+			auto line = image.constScanLine(y);
+			QByteArray row;
+			row.reserve(qsizetype(w) * depth / 8);
+			for (int x = 0; x < w; ++x) {
+				const auto v = psdChannel(mode, line + x * 4, c);
+				row.append(char(v));
+				if (depth == 16)
+					row.append(char(v));
+			}
+			rows.append(packbits ? packBits(row) : row);
+		}
+	}
+
+	if (packbits) {
+		for (const auto& row : rows)
+			s << quint16(row.size());
+	}
+
+	for (const auto& row : rows)
+		s.writeRawData(row.constData(), int(row.size()));
+
+	QFile file{path};
+	return file.open(QIODevice::WriteOnly) && file.write(psd) == psd.size();
+}
+
+//
+// ORA/KRA
+//
+
+bool addZipEntry(QuaZip& zip, const QString& name, const QByteArray& data, bool compress = true)
+{
+	QuaZipFile file{&zip};
+
+	if (!file.open(QIODevice::WriteOnly, QuaZipNewInfo{name}, nullptr, 0,
+				   compress ? Z_DEFLATED : 0)) {
+		return false;
+	}
+
+	file.write(data);
+	file.close();
+
+	return file.getZipError() == ZIP_OK;
+}
+
+/**
+ * Writes an OpenRaster or Krita archive.
+ *
+ * Both formats are ZIP files starting with an uncompressed mimetype entry
+ * followed by a merged rendition of the image and a small preview, which
+ * is all the plugins ever read. Layer data is included for realism, but in
+ * Krita's case it is not in Krita's native tiled format.
+ */
+bool writeZipImage(const QString& path,
+				   const QByteArray& mimeType,
+				   const QString& previewName,
+				   const QList<QImage>& layers,
+				   const QList<QPoint>& offsets)
+{
+	const auto merged = flatten(layers, offsets);
+	const auto preview = merged.scaled(256, 256, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+	QuaZip zip{path};
+	if (!zip.open(QuaZip::mdCreate))
+		return false;
+
+	QByteArray stack =
+		"<?xml version='1.0' encoding='UTF-8'?>\n"
+		"<image w=\"" + QByteArray::number(merged.width()) +
+		"\" h=\"" + QByteArray::number(merged.height()) + "\">\n<stack>\n";
+	for (qsizetype i = layers.size() - 1; i >= 0; --i) {
+		stack += "<layer src=\"data/layer" + QByteArray::number(i) +
+				 ".png\" x=\"" + QByteArray::number(offsets.value(i).x()) +
+				 "\" y=\"" + QByteArray::number(offsets.value(i).y()) + "\"/>\n";
+	}
+	stack += "</stack>\n</image>\n";
+
+	auto ok = addZipEntry(zip, "mimetype", mimeType, false)
+			  && addZipEntry(zip, mimeType == "image/openraster" ? "stack.xml" : "maindoc.xml", stack);
+
+	for (qsizetype i = 0; ok && i < layers.size(); ++i)
+		ok = addZipEntry(zip, QString{"data/layer%1.png"}.arg(i), encodePng(layers[i]));
+
+	ok = ok && addZipEntry(zip, "mergedimage.png", encodePng(merged))
+			&& addZipEntry(zip, previewName, encodePng(preview));
+
+	zip.close();
+
+	return ok && zip.getZipError() == ZIP_OK;
+}
+
+} // end unnamed namespace
+
+QImage syntheticLayer(const QSize& size, int seed)
+{
+	QImage image{size, QImage::Format_RGBA8888};
+	const auto w = size.width(), h = size.height();
+	const auto cell = qMax(32, w / 8);
+
+	for (int y = 0; y < h; ++y) {
+		auto line = image.scanLine(y);
+		for (int x = 0; x < w; ++x) {
+			auto p = line + x * 4;
+			const auto cellHash = hash(x / cell, y / cell, seed);
+
+			if (seed == 0) {
+				// Background: flat cells and noisy gradient cells
+				if (cellHash & 1) {
+					p[0] = uchar(cellHash >> 8);
+					p[1] = uchar(cellHash >> 16);
+					p[2] = uchar(cellHash >> 24);
+				} else {
+					const auto noise = hash(x, y, seed) & 7;
+					p[0] = uchar(40 + 150 * y / h + noise);
+					p[1] = uchar(80 + 100 * x / w + noise);
+					p[2] = uchar(160 + noise);
+				}
+				p[3] = 255;
+			} else if (seed == 1) {
+				// Shading: soft blobs, one per cell
+				const auto cx = (x / cell) * cell + cell / 2;
+				const auto cy = (y / cell) * cell + cell / 2;
+				const auto d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+				const auto r2 = (cell / 3) * (cell / 3);
+				const auto a = (cellHash & 3) && d2 < r2 ? 160 - 160 * d2 / r2 : 0;
+				p[0] = 60;
+				p[1] = 30;
+				p[2] = 90;
+				p[3] = uchar(a);
+			} else {
+				// Line art: thin diagonal strokes
+				const auto stroke = ((x * 3 + y * 5 + seed * 17) % 97) < 2;
+				p[0] = p[1] = p[2] = 16;
+				p[3] = stroke ? 255 : 0;
+			}
+		}
+	}
+
+	return image;
+}
+
+QList<CorpusFile> generateDecoderCorpus(const QString& dirPath,
+										const QList<int>& sizes,
+										const QStringList& formats)
+{
+	QList<CorpusFile> corpus;
+	const QDir dir{dirPath};
+
+	auto add = [&](bool ok, const QString& fileName, const QString& format,
+				   const QString& variant, int size) {
+		if (ok)
+			corpus.append({dir.filePath(fileName), format, variant, {size, size}});
+	};
+
+	for (auto size : sizes) {
+		const QSize canvas{size, size};
+		const QSize shadingSize = canvas * 3 / 4;
+
+		const QList<QImage> layers{
+			syntheticLayer(canvas, 0),
+			syntheticLayer(shadingSize, 1),
+			syntheticLayer(canvas, 2),
+		};
+		const QList<QPoint> offsets{
+			{},
+			{size / 8, size / 8},
+			{},
+		};
+
+		if (formats.contains("xcf")) {
+			// Layers are stored top to bottom
+			const QList<XcfLayer> xcfLayers{
+				{"Lines", layers[2], offsets[2], XcfModeNormal, 200, true},
+				{"Shading", layers[1], offsets[1], XcfModeMultiply, 255, true},
+				{"Background", layers[0], offsets[0], XcfModeNormal, 255, false},
+			};
+
+			for (auto depth : {8, 16, 32}) {
+				for (auto rle : {true, false}) {
+					// Uncompressed tiles with more than 8 bytes per pixel are
+					// not supported by the plugin
+					if (!rle && depth == 32)
+						continue;
+
+					const auto variant = QString{"%1 %2-bit"}
+										 .arg(rle ? "RLE" : "raw")
+										 .arg(depth);
+					const auto fileName = QString{"xcf-%1-%2bit-%3.xcf"}
+										  .arg(rle ? "rle" : "raw")
+										  .arg(depth)
+										  .arg(size);
+					add(writeXcf(dir.filePath(fileName), canvas, xcfLayers, depth, rle),
+						fileName, "xcf", variant, size);
+				}
+			}
+		}
+
+		if (formats.contains("psd")) {
+			const auto merged = flatten(layers, offsets);
+			const QList<QPair<PsdColorMode, QString>> modes{
+				{PsdRgb, "RGBA"},
+				{PsdCmyk, "CMYK"},
+				{PsdLab, "Lab"},
+			};
+
+			for (const auto& [mode, modeName] : modes) {
+				for (auto depth : {8, 16}) {
+					for (auto packbits : {true, false}) {
+						const auto variant = QString{"%1 %2 %3-bit"}
+											 .arg(modeName)
+											 .arg(packbits ? "PackBits" : "raw")
+											 .arg(depth);
+						const auto fileName = QString{"psd-%1-%2-%3bit-%4.psd"}
+											  .arg(modeName.toLower())
+											  .arg(packbits ? "packbits" : "raw")
+											  .arg(depth)
+											  .arg(size);
+						add(writePsd(dir.filePath(fileName), merged, mode, depth, packbits),
+							fileName, "psd", variant, size);
+					}
+				}
+			}
+		}
+
+		if (formats.contains("ora")) {
+			const auto fileName = QString{"ora-%1.ora"}.arg(size);
+			add(writeZipImage(dir.filePath(fileName), "image/openraster",
+							  "Thumbnails/thumbnail.png", layers, offsets),
+				fileName, "ora", "PNG", size);
+		}
+
+		if (formats.contains("kra")) {
+			const auto fileName = QString{"kra-%1.kra"}.arg(size);
+			add(writeZipImage(dir.filePath(fileName), "application/x-krita",
+							  "preview.png", layers, offsets),
+				fileName, "kra", "PNG", size);
+		}
+	}
+
+	return corpus;
+}
+
+} // end namespace MosBench
@@ -0,0 +1,75 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QList>
+#include <QSize>
+#include <QStringList>
+
+namespace MosBench {
+
+//
+// Synthetic image corpus for the bundled image format plugins.
+//
+// Files are generated from scratch so that benchmark results do not depend on
+// (large, and often copyrighted) sample artwork. Every file contains the same
+// kind of content that artists typically produce: flat fills, gradients, and
+// mostly transparent line art layers on top.
+//
+
+/**
+ * A generated corpus file.
+ */
+struct CorpusFile
+{
+	QString path;
+	/** Format name, as used by QImageReader (e.g. "xcf"). */
+	QString format;
+	/** Human-readable description of the encoding (e.g. "RLE 16-bit"). */
+	QString variant;
+	QSize size;
+};
+
+/**
+ * Generates the decoder benchmark corpus.
+ *
+ * @param dirPath      Output directory, which must exist.
+ * @param sizes        Canvas sizes (square) to generate.
+ * @param formats      Formats to generate, out of xcf, psd, ora and kra.
+ *
+ * @return The generated files. Files that could not be written are omitted.
+ */
+QList<CorpusFile> generateDecoderCorpus(const QString& dirPath,
+										const QList<int>& sizes,
+										const QStringList& formats);
+
+/**
+ * Returns a synthetic RGBA image to be used as a layer.
+ *
+ * @param size         Image size.
+ * @param seed         Selects the layer contents. Seed 0 is an opaque
+ *                     background, other seeds produce mostly transparent
+ *                     overlays.
+ */
+QImage syntheticLayer(const QSize& size, int seed);
+
+} // end namespace MosBench
@@ -0,0 +1,316 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+//
+// Interactive latency benchmark for the main window.
+//
+// This drives a real MainWindow on the offscreen platform, performing the
+// same kind of interactions users perform with the preview widgets, and
+// reports how long each one takes until the event loop goes idle again
+// (which includes re-rendering the preview and repainting the window).
+//
+
+#include "appconfig.hpp"
+#include "benchutils.hpp"
+#include "defs.hpp"
+#include "mainwindow.hpp"
+
+#include <QAbstractButton>
+#include <QApplication>
+#include <QComboBox>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QListWidget>
+#include <QSlider>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QTextStream>
+#include <QWheelEvent>
+
+#include <algorithm>
+#include <functional>
+
+using MosBench::err;
+using MosBench::out;
+
+namespace {
+
+/**
+ * Processes events until there is nothing left to do, including repaints.
+ */
+void waitForIdle()
+{
+	QCoreApplication::sendPostedEvents();
+	QCoreApplication::processEvents();
+}
+
+template<typename WidgetT>
+WidgetT* widget(QWidget& window, const QString& name)
+{
+	auto* child = window.findChild<WidgetT*>(name);
+
+	if (!child) {
+		err() << "Widget " << name << " not found" << Qt::endl;
+		std::exit(1);
+	}
+
+	return child;
+}
+
+/**
+ * An interaction scenario.
+ */
+struct Interaction
+{
+	QString name;
+	/** Puts the window in the right state for this interaction. */
+	std::function<void(QWidget&)> setup;
+	/** Performs one step of the interaction. */
+	std::function<void(QWidget&, int step)> step;
+};
+
+void setViewMode(QWidget& window, MosConfig::ImageViewMode mode)
+{
+	widget<QComboBox>(window, "cbxViewMode")->setCurrentIndex(mode);
+}
+
+/**
+ * Simulates dragging a slider's handle back and forth.
+ */
+void dragSlider(QSlider* slider, int step)
+{
+	const auto range = slider->maximum() - slider->minimum();
+	const auto phase = step % (2 * range);
+	const auto position = slider->minimum() + (phase < range ? phase : 2 * range - phase);
+
+	slider->setSliderDown(true);
+	slider->setSliderPosition(position);
+	slider->setSliderDown(false);
+}
+
+QList<Interaction> interactions()
+{
+	return {
+		{
+			"Swipe slider drag",
+			[](QWidget& window) {
+				setViewMode(window, MosConfig::ImageViewSwipe);
+			},
+			[](QWidget& window, int step) {
+				dragSlider(widget<QSlider>(window, "viewSlider"), step);
+			},
+		},
+		{
+			"Onion skin slider drag",
+			[](QWidget& window) {
+				setViewMode(window, MosConfig::ImageViewOnionSkin);
+			},
+			[](QWidget& window, int step) {
+				dragSlider(widget<QSlider>(window, "viewSlider"), step);
+			},
+		},
+		{
+			"Ctrl+wheel zoom",
+			[](QWidget& window) {
+				setViewMode(window, MosConfig::ImageViewVSplit);
+			},
+			[](QWidget& window, int step) {
+				// In, in, out, out, so the zoom level stays bounded
+				const auto delta = step % 4 < 2 ? 120 : -120;
+				const QPointF pos{window.width() / 2.0, window.height() / 2.0};
+				QWheelEvent event{pos, window.mapToGlobal(pos), {}, {0, delta},
+								  Qt::NoButton, Qt::ControlModifier, Qt::NoScrollPhase, false};
+				QApplication::sendEvent(&window, &event);
+			},
+		},
+		{
+			"Color range switch",
+			[](QWidget& window) {
+				setViewMode(window, MosConfig::ImageViewVSplit);
+				widget<QAbstractButton>(window, "radRc")->click();
+			},
+			[](QWidget& window, int step) {
+				auto* list = widget<QListWidget>(window, "listRanges");
+				list->setCurrentRow(step % list->count());
+			},
+		},
+		{
+			"Blend slider drag",
+			[](QWidget& window) {
+				setViewMode(window, MosConfig::ImageViewVSplit);
+				widget<QAbstractButton>(window, "radBlend")->click();
+			},
+			[](QWidget& window, int step) {
+				dragSlider(widget<QSlider>(window, "sliderBlendFactor"), step);
+			},
+		},
+	};
+}
+
+/**
+ * Returns the p-th percentile of a sorted list using the nearest-rank method.
+ */
+double percentile(const QList<qint64>& sorted, int p)
+{
+	const auto rank = qMax<qsizetype>(1, (sorted.size() * p + 99) / 100);
+	return double(sorted[rank - 1]) / 1e6;
+}
+
+} // end unnamed namespace
+
+int main(int argc, char* argv[])
+{
+	// Default to running headless
+	if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+
+	// Keep the user's settings and recent files list out of this
+	QStandardPaths::setTestModeEnabled(true);
+
+	QApplication a{argc, argv};
+
+	QCoreApplication::setApplicationName("WespalGuiBench");
+	QCoreApplication::setOrganizationName("Irydacea");
+
+	QCommandLineParser parser;
+
+	parser.setApplicationDescription(
+		"Measures the latency of common interactions with the Wespal main "
+		"window, from input to the end of the resulting repaint.");
+	parser.addHelpOption();
+
+	QCommandLineOption sizesOption{"sizes",
+		"Comma-separated list of image sizes (default: 256,1024,2048).",
+		"sizes", "256,1024,2048"};
+	QCommandLineOption iterationsOption{"iterations",
+		"Number of steps measured per interaction (default: 50).",
+		"count", "50"};
+	QCommandLineOption csvOption{"csv",
+		"Print results in CSV format."};
+
+	parser.addOptions({
+		sizesOption,
+		iterationsOption,
+		csvOption,
+	});
+
+	parser.process(a);
+
+	const auto iterations = qMax(1, parser.value(iterationsOption).toInt());
+	const bool csv = parser.isSet(csvOption);
+
+	QTemporaryDir dir;
+
+	if (!dir.isValid()) {
+		err() << "Could not create temporary directory" << Qt::endl;
+		return 1;
+	}
+
+	if (csv) {
+		out() << "interaction,size,iterations,p50_ms,p95_ms,p99_ms,max_ms" << Qt::endl;
+	} else {
+		out() << qSetFieldWidth(26) << Qt::left << "Interaction"
+			  << qSetFieldWidth(11) << "Size"
+			  << qSetFieldWidth(10) << Qt::right << "p50 ms"
+			  << qSetFieldWidth(10) << "p95 ms"
+			  << qSetFieldWidth(10) << "p99 ms"
+			  << qSetFieldWidth(10) << "max ms"
+			  << qSetFieldWidth(0) << Qt::left << Qt::endl;
+	}
+
+	for (const auto& sizeValue : parser.value(sizesOption).split(',', Qt::SkipEmptyParts))
+	{
+		const auto size = sizeValue.toInt();
+
+		if (size <= 0) {
+			err() << "Invalid size: " << sizeValue << Qt::endl;
+			return 1;
+		}
+
+		const auto imagePath = dir.filePath(QString{"bench-%1.png"}.arg(size));
+
+		const auto image = MosBench::benchImage({size, size}, 25,
+												wesnoth::builtinPalettes["magenta"]);
+
+		if (!image.save(imagePath)) {
+			err() << "Could not write " << imagePath << Qt::endl;
+			return 1;
+		}
+
+		for (const auto& interaction : interactions())
+		{
+			MainWindow window;
+
+			window.resize(1280, 800);
+			window.show();
+			window.openFile(imagePath);
+
+			if (!QTest::qWaitForWindowExposed(&window)) {
+				err() << "Main window was not exposed" << Qt::endl;
+				return 1;
+			}
+
+			interaction.setup(window);
+			waitForIdle();
+
+			// One unmeasured step to warm up caches
+			interaction.step(window, 0);
+			waitForIdle();
+
+			QList<qint64> latencies;
+			latencies.reserve(iterations);
+
+			for (int i = 1; i <= iterations; ++i)
+			{
+				QElapsedTimer timer;
+				timer.start();
+
+				interaction.step(window, i);
+				waitForIdle();
+
+				latencies.append(timer.nsecsElapsed());
+			}
+
+			std::sort(latencies.begin(), latencies.end());
+
+			const auto dimensions = QString{"%1x%1"}.arg(size);
+
+			if (csv) {
+				out() << interaction.name << ',' << dimensions << ',' << iterations << ','
+					  << percentile(latencies, 50) << ','
+					  << percentile(latencies, 95) << ','
+					  << percentile(latencies, 99) << ','
+					  << double(latencies.last()) / 1e6 << Qt::endl;
+			} else {
+				out() << qSetFieldWidth(26) << Qt::left << interaction.name
+					  << qSetFieldWidth(11) << dimensions
+					  << qSetFieldWidth(10) << Qt::right << Qt::fixed << qSetRealNumberPrecision(2)
+					  << percentile(latencies, 50)
+					  << percentile(latencies, 95)
+					  << percentile(latencies, 99)
+					  << double(latencies.last()) / 1e6
+					  << qSetFieldWidth(0) << Qt::left << Qt::endl;
+			}
+		}
+	}
+
+	return 0;
+}
@@ -20,6 +20,9 @@
 
 #include "imagelabel.hpp"
 
+#include "perfmetrics.hpp"
+#include "trace.hpp"
+
 #include <qmath.h>
 #include <QPainter>
 #include <QPaintEvent>
@@ -30,15 +33,26 @@ ImageLabel::ImageLabel(QWidget* parent) :
 {
 }
 
+ImageLabel::~ImageLabel()
+{
+	MosMetrics::releaseMemory(&image_);
+}
+
 void ImageLabel::setImage(const QImage& image)
 {
-	image_ = image.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	{
+		MosMetrics::StageTimer timer{MosMetrics::StageConversion};
+		image_ = image.convertedTo(QImage::Format_ARGB32_Premultiplied);
+	}
+
+	MosMetrics::setImage(&image_, MosMetrics::MemoryWidgetBuffers, image_);
 	update();
 }
 
 void ImageLabel::clear()
 {
 	image_ = QImage{};
+	MosMetrics::releaseMemory(&image_);
 	update();
 }
 
@@ -47,6 +61,9 @@ void ImageLabel::paintEvent(QPaintEvent* event)
 	if (image_.isNull())
 		return;
 
+	MOS_TRACE_SPAN("paint", "ImageLabel::paintEvent");
+	MosMetrics::StageTimer timer{MosMetrics::StagePaint};
+
 	QPainter p{this};
 
 	p.setClipRect(event->rect());
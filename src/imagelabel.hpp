@@ -37,6 +37,8 @@ public:
 	 */
 	explicit ImageLabel(QWidget* parent = nullptr);
 
+	~ImageLabel();
+
 	virtual QSize minimumSizeHint() const override
 	{
 		return image_.size();
@@ -18,7 +18,10 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include "appconfig.hpp"
 #include "mainwindow.hpp"
+#include "startuptimeline.hpp"
+#include "trace.hpp"
 #include "version.hpp"
 
 #include <QApplication>
@@ -26,6 +29,9 @@
 
 int main(int argc, char *argv[])
 {
+	MosStartup::start(argc, argv);
+	MosTrace::start();
+
 #if defined(Q_OS_WINDOWS) && QT_VERSION >= QT_VERSION_CHECK(6, 7, 0)
 	// Avoid the icky Windows 11 style being enabled by default
 	QApplication::setStyle("WindowsVista");
@@ -35,6 +41,10 @@ int main(int argc, char *argv[])
 	QString initialFile;
 	QStringList argvq = a.arguments();
 
+	MosStartup::mark("Application initialized");
+
+	argvq.removeAll(MosStartup::timelineOption);
+
 	if (argvq.count() > 1) {
 		initialFile = argvq.last();
 	}
@@ -53,12 +63,29 @@ int main(int argc, char *argv[])
 	// Required on Wayland
 	QGuiApplication::setDesktopFileName("me.irydacea.Wespal");
 
+	MosCurrentConfig();
+
+	MosStartup::mark("Configuration loaded");
+
 	MainWindow w;
 
-	if (!initialFile.isEmpty())
+	MosStartup::mark("Main window created");
+
+	if (!initialFile.isEmpty()) {
 		w.openFile(initialFile);
+		MosStartup::mark("Initial file opened");
+	}
+
+	MosStartup::reportAfterFirstFrame(&w);
 
 	w.show();
 
-	return a.exec();
+	MosStartup::mark("Main window shown");
+
+	const auto ret = a.exec();
+
+	// Settings are written in the background, make sure nothing is lost
+	MosCurrentConfig().sync();
+
+	return ret;
 }
@@ -19,11 +19,17 @@
  */
 
 #include "appconfig.hpp"
+#include "batch.hpp"
 #include "codesnippetdialog.hpp"
 #include "defs.hpp"
 #include "mainwindow.hpp"
 #include "paletteitem.hpp"
+#include "perfhud.hpp"
+#include "perfmetrics.hpp"
 #include "settingsdialog.hpp"
+#include "sourcewatcher.hpp"
+#include "startuptimeline.hpp"
+#include "trace.hpp"
 #include "ui_mainwindow.h"
 #include "util.hpp"
 
@@ -36,9 +42,12 @@
 #include <QDragEnterEvent>
 #include <QDropEvent>
 #include <QFileDialog>
+#include <QImageReader>
+#include <QLocale>
 #include <QPainter>
 #include <QMessageBox>
 #include <QMimeData>
+#include <QPointer>
 #include <QScrollBar>
 #include <QSplitter>
 #include <QStringBuilder>
@@ -61,6 +70,11 @@ enum WorkAreaPage {
 	WorkAreaCompositeRc,
 };
 
+// Number of full-size ARGB32 buffers needed for previewing an image: the
+// original and transformed images, plus up to three buffers for the preview
+// widgets (the left and right images and the composite in composite views).
+constexpr qint64 PREVIEW_BUFFER_COUNT = 5;
+
 } // end unnamed namespace
 
 MainWindow::MainWindow(QWidget* parent)
@@ -78,6 +92,12 @@ MainWindow::MainWindow(QWidget* parent)
 	, searchDirPath_()
 	, saveDirPath_()
 
+	, watchFilePath_()
+	, exportDirPath_()
+
+	, fileWatcher_(new MosBatch::SourceWatcher(this))
+	, autoOverwrite_(false)
+
 	, originalImage_()
 	, transformedImage_()
 
@@ -107,7 +127,10 @@ MainWindow::MainWindow(QWidget* parent)
 
 	, compositeShortcutsGroup_(nullptr)
 
-	, supportedImageFileFormats_(MosPlatform::supportedImageFileFormats())
+	, perfHudRc_(nullptr)
+	, perfHudComposite_(nullptr)
+
+	, supportedImageFileFormats_()
 {
 	//
 	// Window initialisation
@@ -115,6 +138,8 @@ MainWindow::MainWindow(QWidget* parent)
 
 	ui->setupUi(this);
 
+	MosStartup::mark("Main window UI set up");
+
 #ifdef Q_OS_MACOS
 	// smol sliders c:
 	ui->viewSlider->setAttribute(Qt::WA_MacMiniSize);
@@ -158,6 +183,10 @@ MainWindow::MainWindow(QWidget* parent)
 
 	processRcDefinitions();
 
+	MosStartup::mark("Color ranges and palettes set up");
+
+	applyMemoryBudget();
+
 	//
 	// General menu setup
 	//
@@ -172,6 +201,9 @@ MainWindow::MainWindow(QWidget* parent)
 	ui->menu_Help->insertAction(firstHelpAction, whatsThisAction);
 	ui->menu_Help->insertSeparator(firstHelpAction);
 
+	connect(fileWatcher_, &MosBatch::SourceWatcher::changed,
+			this, &MainWindow::onWatchedFileChanged);
+
 	connect(ui->actionChangeLog, &QAction::triggered, this, []() {
 		MosUi::openReleaseNotes();
 	});
@@ -253,7 +285,16 @@ MainWindow::MainWindow(QWidget* parent)
 
 	connect(ui->listMru, SIGNAL(itemDoubleClicked(QListWidgetItem*)), this, SLOT(handleRecent()));
 
-	updateRecentFilesMenu();
+	// Reading the thumbnails from the cache can wait until the event loop
+	// is running, so that it does not hold up showing the window
+	updateRecentFilesMenu(false);
+
+	QMetaObject::invokeMethod(this, [this]() {
+		updateRecentFilesMenu();
+		MosStartup::mark("Recent file thumbnails loaded");
+	}, Qt::QueuedConnection);
+
+	MosStartup::mark("Recent files set up");
 
 	//
 	// Color range options page
@@ -502,6 +543,9 @@ MainWindow::MainWindow(QWidget* parent)
 	if (viewMode == MosConfig::ImageViewVSplit || viewMode == MosConfig::ImageViewHSplit)
 		ui->compositeShortcutsPanel->setVisible(false);
 
+	perfHudRc_ = new PerfHud(ui->previewRcContainer, ui->previewRc);
+	perfHudComposite_ = new PerfHud(ui->previewCompositeContainer, ui->previewComposite);
+
 	//
 	// Finalise initial workarea setup
 	//
@@ -518,6 +562,10 @@ MainWindow::MainWindow(QWidget* parent)
 
 MainWindow::~MainWindow()
 {
+	MosMetrics::releaseMemory(&originalImage_);
+	MosMetrics::releaseMemory(&transformedImage_);
+	MosMetrics::releaseMemory(ui->listMru);
+
     delete ui;
 }
 
@@ -672,9 +720,10 @@ void MainWindow::handleRecent()
 	}
 }
 
-void MainWindow::updateRecentFilesMenu()
+void MainWindow::updateRecentFilesMenu(bool loadThumbnails)
 {
 	int k = 0;
+	qint64 thumbnailBytes = 0;
 
 	ui->listMru->clear();
 
@@ -689,13 +738,9 @@ void MainWindow::updateRecentFilesMenu()
 		const auto& fileName = QFileInfo(filePath).fileName();
 		const auto& label =
 				QString("&%1 %2").arg(k + 1).arg(fileName);
-		const auto& thumbnail =
-				QPixmap::fromImage(entry.thumbnail());
-		const auto& miniThumbnail =
-				QPixmap::fromImage(entry.miniThumbnail());
 
 		act.setText(label);
-		act.setIcon(miniThumbnail);
+		act.setIcon(loadThumbnails ? QPixmap::fromImage(entry.miniThumbnail()) : QPixmap{});
 		act.setData(filePath);
 
 		act.setEnabled(true);
@@ -706,9 +751,13 @@ void MainWindow::updateRecentFilesMenu()
 		listItem->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled);
 		listItem->setText(fileName);
 		listItem->setToolTip(filePath);
-		listItem->setIcon(thumbnail);
 		listItem->setData(Qt::UserRole, filePath);
 
+		if (loadThumbnails) {
+			listItem->setIcon(QPixmap::fromImage(entry.thumbnail()));
+			thumbnailBytes += entry.thumbnail().sizeInBytes() + entry.miniThumbnail().sizeInBytes();
+		}
+
 		++k;
 	}
 
@@ -730,6 +779,8 @@ void MainWindow::updateRecentFilesMenu()
 	// The MRU panel gets fully hidden to avoid confusion due to its styling.
 
 	ui->panelMru->setVisible(!MosCurrentConfig().recentFiles().empty());
+
+	MosMetrics::setMemory(ui->listMru, MosMetrics::MemoryThumbnails, thumbnailBytes);
 }
 
 void MainWindow::changeEvent(QEvent* event)
@@ -931,14 +982,25 @@ void MainWindow::dropEvent(QDropEvent* event)
 		newimg = qvariant_cast<QImage>(event->mimeData()->imageData());
 	} else if (event->mimeData()->hasUrls()) {
 		newpath = event->mimeData()->urls().front().path();
+
+		const QImageReader reader{newpath};
+
+		if (!checkImageMemoryBudget(newpath, reader.size(), reader.imageFormat()))
+			return;
+
 		newimg.load(newpath);
 	}
 
-	if (newimg.isNull()) {
+	if (newimg.isNull() ||
+		!checkImageMemoryBudget(newpath.isEmpty() ? tr("Dropped image") : newpath,
+								newimg.size(), newimg.format())) {
 		return;
 	}
 
-	originalImage_ = newimg.convertToFormat(QImage::Format_ARGB32);
+	{
+		MosMetrics::StageTimer timer{MosMetrics::StageConversion};
+		originalImage_ = newimg.convertToFormat(QImage::Format_ARGB32);
+	}
 
 	// Refresh UI
 	if (newpath.isEmpty() != true) {
@@ -949,6 +1011,8 @@ void MainWindow::dropEvent(QDropEvent* event)
 		updateWindowTitle(true, {}, ImageOriginDrop);
 	}
 
+	setWatchFilePath(newpath);
+
 	refreshPreviews();
 	enableWorkArea(true);
 }
@@ -1014,6 +1078,64 @@ void MainWindow::on_action_Reload_triggered()
 	doReloadFile();
 }
 
+void MainWindow::on_actionPerfHud_toggled(bool checked)
+{
+	perfHudRc_->setVisible(checked);
+	perfHudComposite_->setVisible(checked);
+}
+
+void MainWindow::on_actionWatchFile_toggled(bool /*checked*/)
+{
+	updateFileWatch();
+}
+
+void MainWindow::onWatchedFileChanged()
+{
+	if (!hasImage() || watchFilePath_.isEmpty())
+		return;
+
+	// The editor may still be in the middle of writing the file, in which
+	// case we will get another notification once it is done.
+	if (!doReloadFile(true))
+		return;
+
+	if (exportDirPath_.isEmpty())
+		return;
+
+	// These are the same files we wrote for this image before, so there is
+	// no point in asking for confirmation every time.
+	autoOverwrite_ = true;
+
+	try {
+		doSaveOutputs(exportDirPath_);
+	} catch (const canceled_job&) {
+		;
+	} catch (const QStringList& failed) {
+		MosUi::error(this, tr("Some files could not be saved correctly."), failed);
+	}
+
+	autoOverwrite_ = false;
+}
+
+void MainWindow::setWatchFilePath(const QString& filePath)
+{
+	if (filePath != watchFilePath_) {
+		watchFilePath_ = filePath;
+		exportDirPath_.clear();
+	}
+
+	updateFileWatch();
+}
+
+void MainWindow::updateFileWatch()
+{
+	if (ui->actionWatchFile->isChecked() && !watchFilePath_.isEmpty()) {
+		fileWatcher_->setPaths({watchFilePath_});
+	} else {
+		fileWatcher_->clear();
+	}
+}
+
 void MainWindow::openFile(const QString& fileName)
 {
 	QString selectedPath;
@@ -1033,6 +1155,13 @@ void MainWindow::openFile(const QString& fileName)
 			}
 		}
 
+		// Enumerating the image format plugins can be slow, so this only
+		// happens once it is actually needed
+		if (supportedImageFileFormats_.isEmpty()) {
+			supportedImageFileFormats_ = MosPlatform::supportedImageFileFormats();
+			MosStartup::mark("Image format plugins enumerated");
+		}
+
 		selectedPath = QFileDialog::getOpenFileName(
 			this,
 			tr("Choose source image"),
@@ -1045,7 +1174,23 @@ void MainWindow::openFile(const QString& fileName)
 		return;
 	}
 
-	QImage selectedImage{selectedPath};
+	MOS_TRACE_SPAN("ui", "MainWindow::openFile");
+
+	// Refuse images that are too large before decoding them if their size
+	// is known in advance; otherwise this is checked after decoding.
+	{
+		const QImageReader reader{selectedPath};
+
+		if (!checkImageMemoryBudget(selectedPath, reader.size(), reader.imageFormat()))
+			return;
+	}
+
+	QImage selectedImage;
+
+	{
+		MOS_TRACE_SPAN("io", "Decode image");
+		selectedImage.load(selectedPath);
+	}
 
 	if (selectedImage.isNull()) {
 		if (!selectedPath.isEmpty()) {
@@ -1059,6 +1204,9 @@ void MainWindow::openFile(const QString& fileName)
 		return;
 	}
 
+	if (!checkImageMemoryBudget(selectedPath, selectedImage.size(), selectedImage.format()))
+		return;
+
 	imagePath_ = selectedPath;
 
 	// Persist the parent dir path as the search path for future file
@@ -1066,29 +1214,64 @@ void MainWindow::openFile(const QString& fileName)
 	searchDirPath_ = QFileInfo{selectedPath}.absolutePath();
 
 	// We want to work on actual ARGB data
-	originalImage_ = selectedImage.convertToFormat(QImage::Format_ARGB32);
+	{
+		MOS_TRACE_SPAN("convert", "Convert to ARGB32");
+		MosMetrics::StageTimer timer{MosMetrics::StageConversion};
+		originalImage_ = selectedImage.convertToFormat(QImage::Format_ARGB32);
+	}
 
 	// Refresh UI
-	MosCurrentConfig().addRecentFile(imagePath_, originalImage_);
+	MosCurrentConfig().addRecentFile(imagePath_, originalImage_,
+		[window = QPointer<MainWindow>{this}]() {
+			if (window)
+				window->updateRecentFilesMenu();
+		});
 	updateRecentFilesMenu();
 	updateWindowTitle(true, imagePath_);
 	refreshPreviews();
 
 	enableWorkArea(true);
+
+	setWatchFilePath(imagePath_);
 }
 
-void MainWindow::doReloadFile()
+bool MainWindow::doReloadFile(bool quiet)
 {
-	QImage img{imagePath_};
+	MOS_TRACE_SPAN("ui", "MainWindow::doReloadFile");
+
+	{
+		const QImageReader reader{imagePath_};
+
+		if (!checkImageMemoryBudget(imagePath_, reader.size(), reader.imageFormat(), quiet))
+			return false;
+	}
+
+	QImage img;
+
+	{
+		MOS_TRACE_SPAN("io", "Decode image");
+		img.load(imagePath_);
+	}
+
 	if (img.isNull()) {
-		MosUi::error(this, tr("Could not reload %1.").arg(imagePath_));
-		return;
+		if (!quiet)
+			MosUi::error(this, tr("Could not reload %1.").arg(imagePath_));
+		return false;
 	}
 
-	originalImage_ = img.convertToFormat(QImage::Format_ARGB32);
+	if (!checkImageMemoryBudget(imagePath_, img.size(), img.format(), quiet))
+		return false;
+
+	{
+		MOS_TRACE_SPAN("convert", "Convert to ARGB32");
+		MosMetrics::StageTimer timer{MosMetrics::StageConversion};
+		originalImage_ = img.convertToFormat(QImage::Format_ARGB32);
+	}
 
 	// Refresh UI
 	refreshPreviews();
+
+	return true;
 }
 
 void MainWindow::refreshPreviews(bool skipRerender)
@@ -1096,7 +1279,11 @@ void MainWindow::refreshPreviews(bool skipRerender)
 	if (!hasImage() || signalsBlocked())
 		return;
 
+	MOS_TRACE_SPAN("ui", "MainWindow::refreshPreviews");
+
 	if (!skipRerender) {
+		MosMetrics::StageTimer timer{MosMetrics::StageTransform};
+
 		switch (rcMode_)
 		{
 			case RcPaletteSwap:
@@ -1148,6 +1335,68 @@ void MainWindow::refreshPreviews(bool skipRerender)
 			resetPreviewLayout(ui->previewOriginalContainer, ui->previewOriginal);
 			resetPreviewLayout(ui->previewRcContainer, ui->previewRc);
 	}
+
+	reportImageMetrics();
+}
+
+void MainWindow::reportImageMetrics()
+{
+	MosMetrics::setImage(&originalImage_, MosMetrics::MemorySourceImages, originalImage_);
+	MosMetrics::setImage(&transformedImage_, MosMetrics::MemoryTransformedImages, transformedImage_);
+}
+
+void MainWindow::applyMemoryBudget()
+{
+	const auto budget = MosCurrentConfig().imageMemoryBudget();
+
+	// Qt's own limit, read before it is first changed here
+	static const int defaultAllocationLimit = QImageReader::allocationLimit();
+
+	MosMetrics::setMemoryBudget(qint64(budget) * 1024 * 1024);
+
+	// Also keep image decoders from allocating more than a single preview
+	// buffer's share of the budget. Without a budget, Qt's default limit
+	// still applies.
+	QImageReader::setAllocationLimit(budget > 0
+									 ? qMax(1, int(budget / PREVIEW_BUFFER_COUNT))
+									 : defaultAllocationLimit);
+}
+
+bool MainWindow::checkImageMemoryBudget(const QString& name,
+										const QSize& size,
+										QImage::Format format,
+										bool quiet)
+{
+	const auto budget = MosMetrics::memoryBudget();
+
+	if (budget <= 0 || !size.isValid())
+		return true;
+
+	// Images with more than 8 bits per channel (e.g. 16-bit PSD and XCF
+	// files) take up more space while decoding. Counting every buffer at
+	// that size keeps this consistent with the decoder allocation limit.
+	const int bytesPerPixel = qMax(4, QImage::toPixelFormat(format).bitsPerPixel() / 8);
+	const auto required = qint64(size.width()) * size.height() * bytesPerPixel * PREVIEW_BUFFER_COUNT;
+
+	if (required <= budget)
+		return true;
+
+	if (quiet)
+		return false;
+
+	const QLocale locale;
+
+	MosUi::error(this,
+		tr("%1 is too large to open.").arg(QFileInfo{name}.fileName()),
+		tr("Previewing an image of %1x%2 pixels requires about %3 of memory, "
+		   "which exceeds the image memory budget of %4. The budget can be "
+		   "changed in the Settings dialog.")
+			.arg(size.width())
+			.arg(size.height())
+			.arg(locale.formattedDataSize(required))
+			.arg(locale.formattedDataSize(budget)));
+
+	return false;
 }
 
 void MainWindow::resetPreviewLayout(QAbstractScrollArea* scrollArea,
@@ -1186,26 +1435,14 @@ void MainWindow::doSaveFile()
 	if (base.isEmpty())
 		return;
 
-	QStringList succeeded;
-
 	try {
-		switch (rcMode_) {
-			case RcColorBlend:
-				succeeded = doSaveColorBlend(base);
-				break;
-			case RcColorShift:
-				succeeded = doSaveColorShift(base);
-				break;
-			case RcPaletteSwap:
-				succeeded = doSaveSingleRecolor(base);
-				break;
-			default:
-				succeeded = doSaveColorRanges(base);
-				break;
-		}
+		const auto& succeeded = doSaveOutputs(base);
 
 		saveDirPath_ = base;
 
+		if (!watchFilePath_.isEmpty())
+			exportDirPath_ = base;
+
 		MosUi::message(this, tr("The output files have been saved successfully."), succeeded);
 	} catch (const canceled_job&) {
 		;
@@ -1214,11 +1451,28 @@ void MainWindow::doSaveFile()
 	}
 }
 
+QStringList MainWindow::doSaveOutputs(const QString& base)
+{
+	switch (rcMode_) {
+		case RcColorBlend:
+			return doSaveColorBlend(base);
+		case RcColorShift:
+			return doSaveColorShift(base);
+		case RcPaletteSwap:
+			return doSaveSingleRecolor(base);
+		default:
+			return doSaveColorRanges(base);
+	}
+}
+
 void MainWindow::doCloseFile()
 {
 	enableWorkArea(false);
 
+	setWatchFilePath({});
+
 	originalImage_ = transformedImage_ = QImage{};
+	reportImageMetrics();
 
 	ui->previewOriginal->clear();
 	ui->previewComposite->clear();
@@ -1405,14 +1659,15 @@ ColorList MainWindow::currentPalette(bool paletteSwitchMode) const
 
 bool MainWindow::confirmFileOverwrite(const QStringList& paths)
 {
+	if (autoOverwrite_)
+		return true;
+
 	return MosUi::prompt(this, tr("The chosen directory already contains files with the same names required for output. Do you wish to overwrite them and continue?"), paths);
 }
 
 QStringList MainWindow::doSaveCurrentTransform(const QString& dirPath, const QString& suffix)
 {
-	const auto& nameStem = QFileInfo(imagePath_).completeBaseName();
-
-	QString fileName = nameStem % '-' % suffix % ".png";
+	QString fileName = MosBatch::outputFileName(imagePath_, suffix);
 	QString filePath = dirPath % '/' % fileName;
 
 	if (QFileInfo::exists(filePath) && !confirmFileOverwrite({filePath})) {
@@ -1449,9 +1704,8 @@ QStringList MainWindow::doSaveColorRanges(const QString &base)
 		if (itemw->checkState() == Qt::Checked) {
 			const QString& rangeId = itemw->data(Qt::UserRole).toString();
 
-			const QString& filePath = base + "/" + QFileInfo(imagePath_).completeBaseName() +
-					"-RC-" + palId + "-" + QString::number(k + 1) +
-					"-" + rangeId + ".png";
+			const auto& suffix = MosBatch::colorRangeSuffix(palId, k + 1, rangeId);
+			const QString& filePath = base % '/' % MosBatch::outputFileName(imagePath_, suffix);
 
 			const auto& colorRange = colorRanges_.value(rangeId);
 			jobs[filePath] = colorRange.applyToPalette(palData);
@@ -1474,36 +1728,31 @@ QStringList MainWindow::doSaveSingleRecolor(const QString& dirPath)
 	const auto& palId = currentPaletteName();
 	const auto& targetPalId = currentPaletteName(true);
 
-	QString suffix = QString{"PAL-%1-%2"}
-					 .arg(palId, targetPalId);
+	QString suffix = MosBatch::paletteSwapSuffix(palId, targetPalId);
 
 	return doSaveCurrentTransform(dirPath, suffix);
 }
 
 QStringList MainWindow::doSaveColorBlend(const QString& dirPath)
 {
-	auto colorName = blendColor_.name();
-	colorName.remove(0, 1);
-
-	QString suffix = QString{"BLEND-%1-%2"}
-					 .arg(colorName)
-					 .arg(blendFactor_ * 100);
+	QString suffix = MosBatch::colorBlendSuffix(blendColor_, blendFactor_);
 
 	return doSaveCurrentTransform(dirPath, suffix);
 }
 
 QStringList MainWindow::doSaveColorShift(const QString& dirPath)
 {
-	QString suffix = QString{"CS-%1-%2-%3"}
-					   .arg(colorShiftRed_)
-					   .arg(colorShiftGreen_)
-					   .arg(colorShiftBlue_);
+	QString suffix = MosBatch::colorShiftSuffix(colorShiftRed_,
+												colorShiftGreen_,
+												colorShiftBlue_);
 
 	return doSaveCurrentTransform(dirPath, suffix);
 }
 
 QStringList MainWindow::doRunJobs(const QMap<QString, ColorMap>& jobs)
 {
+	MOS_TRACE_SPAN("ui", "MainWindow::doRunJobs");
+
 	QStringList failed, succeeded;
 
 	ScopedCursor sc{*this, {Qt::WaitCursor}};
@@ -1733,6 +1982,8 @@ void MainWindow::on_actionAppSettings_triggered()
 	userColorRanges_ = MosCurrentConfig().customColorRanges();
 	userPalettes_ = MosCurrentConfig().customPalettes();
 
+	applyMemoryBudget();
+
 	{
 		ObjectLock l{this};
 		generateMergedRcDefinitions();
@@ -1765,6 +2016,9 @@ void MainWindow::on_actionBase64_triggered()
 	const auto& ogBase64 = MosIO::writeBase64Png(originalImage_, true);
 	const auto& rcBase64 = MosIO::writeBase64Png(transformedImage_, true);
 
+	MosMetrics::setMemory(&ogBase64, MosMetrics::MemoryEncodedData, ogBase64.size() * qint64(sizeof(QChar)));
+	MosMetrics::setMemory(&rcBase64, MosMetrics::MemoryEncodedData, rcBase64.size() * qint64(sizeof(QChar)));
+
 	CodeSnippetDialog dlg{this};
 
 	dlg.setAllowWmlSave(false);
@@ -1775,6 +2029,9 @@ void MainWindow::on_actionBase64_triggered()
 	dlg.addSnippet(tr("Original Image"), ogBase64);
 
 	dlg.exec();
+
+	MosMetrics::releaseMemory(&ogBase64);
+	MosMetrics::releaseMemory(&rcBase64);
 }
 
 void MainWindow::on_cmdGenerateWml_clicked()
@@ -1916,13 +2173,23 @@ void MainWindow::on_actionPaste_triggered()
 	if (!clipboard || clipboard->image().isNull())
 		return;
 
+	const auto& clipboardImage = clipboard->image();
+
+	if (!checkImageMemoryBudget(tr("Clipboard image"), clipboardImage.size(), clipboardImage.format()))
+		return;
+
 	// Normalize image format from unknown source
-	originalImage_ = clipboard->image().convertToFormat(QImage::Format_ARGB32);
+	{
+		MosMetrics::StageTimer timer{MosMetrics::StageConversion};
+		originalImage_ = clipboardImage.convertToFormat(QImage::Format_ARGB32);
+	}
 
 	// Refresh UI
 	imagePath_ = tr("Clipboard image") % ".png";
 	updateWindowTitle(true, {}, ImageOriginClipboard);
 
+	setWatchFilePath({});
+
 	refreshPreviews();
 	enableWorkArea(true);
 }
@@ -31,11 +31,16 @@ namespace Ui {
     class MainWindow;
 }
 
+namespace MosBatch {
+	class SourceWatcher;
+}
+
 class QAbstractButton;
 class QAbstractScrollArea;
 class QButtonGroup;
 class QDragEnterEvent;
 class QDropEvent;
+class PerfHud;
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -117,6 +122,14 @@ private:
 	QString searchDirPath_;
 	QString saveDirPath_;
 
+	// Path of the file backing the current image, if any
+	QString watchFilePath_;
+	// Last output directory used for the current image, if any
+	QString exportDirPath_;
+
+	MosBatch::SourceWatcher* fileWatcher_;
+	bool autoOverwrite_;
+
 	QImage originalImage_;
 	QImage transformedImage_;
 
@@ -146,6 +159,9 @@ private:
 
 	QButtonGroup* compositeShortcutsGroup_;
 
+	PerfHud* perfHudRc_;
+	PerfHud* perfHudComposite_;
+
 	QString supportedImageFileFormats_;
 
 	bool hasImage() const
@@ -166,7 +182,13 @@ private:
 
 	void insertRangeListItem(const QString& id, const QString& display_name, const ColorRange& colorRange);
 
-	void updateRecentFilesMenu();
+	/**
+	 * Updates the recent files menu and panel.
+	 *
+	 * If @a loadThumbnails is @a false, the entries are shown without their
+	 * thumbnails, which avoids reading them from the cache.
+	 */
+	void updateRecentFilesMenu(bool loadThumbnails = true);
 
 	void updateWindowTitle(bool hasImage,
 						   const QString& filename = {},
@@ -174,15 +196,24 @@ private:
 
 	void doSaveFile();
 	void doCloseFile();
-	void doReloadFile();
+	bool doReloadFile(bool quiet = false);
 	void doAboutDialog();
 
 	void setViewMode(ViewMode newViewMode);
 	void setRcMode(RcMode rcMode);
 	void enableWorkArea(bool enable);
 
+	/**
+	 * Sets the file that backs the current image and is monitored for
+	 * changes when watch mode is enabled.
+	 */
+	void setWatchFilePath(const QString& filePath);
+	void updateFileWatch();
+
 	bool confirmFileOverwrite(const QStringList& paths);
 
+	QStringList doSaveOutputs(const QString& base);
+
 	QStringList doSaveCurrentTransform(const QString& dirPath, const QString& suffix);
 
 	QStringList doSaveColorRanges(const QString& base);
@@ -193,6 +224,28 @@ private:
 
 	void refreshPreviews(bool skipRerender = false);
 
+	/** Reports the memory held by the current images to MosMetrics. */
+	void reportImageMetrics();
+
+	/** Applies the configured image memory budget. */
+	void applyMemoryBudget();
+
+	/**
+	 * Checks whether an image can be previewed within the memory budget.
+	 *
+	 * An error message is displayed if it cannot, unless @a quiet is set.
+	 *
+	 * @param name         Name of the image to use in the error message.
+	 * @param size         Image dimensions. If not valid, the check passes.
+	 * @param format       Decoded image format, or QImage::Format_Invalid
+	 *                     if not known in advance.
+	 * @param quiet        Whether to skip the error message.
+	 */
+	bool checkImageMemoryBudget(const QString& name,
+								const QSize& size,
+								QImage::Format format,
+								bool quiet = false);
+
 	QString currentPaletteName(bool paletteSwitchMode = false) const;
 	ColorList currentPalette(bool paletteSwitchMode = false) const;
 
@@ -210,6 +263,9 @@ private:
 
 private slots:
 	void on_action_Reload_triggered();
+	void on_actionWatchFile_toggled(bool checked);
+	void on_actionPerfHud_toggled(bool checked);
+	void onWatchedFileChanged();
 	void on_listRanges_currentRowChanged(int currentRow);
 	void on_cbxNewPal_currentIndexChanged(int index);
 	void on_cbxKeyPal_currentIndexChanged(int index);
@@ -20,10 +20,13 @@
 
 #include "paletteitem.hpp"
 
-#include <QGuiApplication>
+#include <QApplication>
 #include <QColorDialog>
 #include <QEvent>
+#include <QIconEngine>
 #include <QPainter>
+#include <QStyle>
+#include <QStyleOption>
 
 namespace {
 
@@ -49,44 +52,142 @@ inline qreal pixelRatioFallback(const QWidget* target)
 	return target ? target->devicePixelRatio() : qGuiApp->devicePixelRatio();
 }
 
-} // end unnamed namespace
-
-QIcon createColorIconPrivate(const QColor& color,
-							 const QSize& size,
-							 const QWidget* target,
-							 bool drawSlash)
+/**
+ * Icon engine drawing color icons on demand.
+ *
+ * Lists and dropdowns may hold thousands of color icons for user-defined
+ * palettes and color ranges, most of which are never displayed. Rather than
+ * rendering a pixmap for each one up front, this only stores the color and
+ * renders it at the right size and pixel ratio the first time it is painted.
+ */
+class ColorIconEngine : public QIconEngine
 {
-	static constexpr qreal borderWidth = 1.0;
-	static constexpr qreal outerMargin = 2.0;
-	static constexpr QMarginsF innerMargin = {
-		outerMargin, outerMargin,
-		outerMargin, outerMargin
-	};
+public:
+	ColorIconEngine(const QColor& color,
+					const QSize& size,
+					qreal defaultScale,
+					bool drawSlash)
+		: color_(color)
+		, size_(size)
+		, defaultScale_(defaultScale)
+		, drawSlash_(drawSlash)
+	{
+	}
 
-	const auto pixelRatio = pixelRatioFallback(target);
+	virtual void paint(QPainter* painter,
+					   const QRect& rect,
+					   QIcon::Mode mode,
+					   QIcon::State state) override
+	{
+		// Let the style decide what disabled icons look like, same as it
+		// does for pixmap-based icons
+		if (mode == QIcon::Disabled) {
+			painter->drawPixmap(rect, scaledPixmap(rect.size(), mode, state,
+												   painter->device()->devicePixelRatioF()));
+			return;
+		}
+
+		paintIcon(painter, rect);
+	}
 
-	QPixmap base{size * pixelRatio};
+	virtual QPixmap pixmap(const QSize& size,
+						   QIcon::Mode mode,
+						   QIcon::State state) override
+	{
+		return scaledPixmap(size, mode, state, defaultScale_);
+	}
+
+	virtual QPixmap scaledPixmap(const QSize& size,
+								 QIcon::Mode mode,
+								 QIcon::State /*state*/,
+								 qreal scale) override
+	{
+		QPixmap base{size * scale};
+
+		base.setDevicePixelRatio(scale);
+		base.fill(Qt::transparent);
+
+		{
+			QPainter painter{&base};
+			paintIcon(&painter, QRect{QPoint{}, size});
+		}
 
-	base.setDevicePixelRatio(pixelRatio);
-	base.fill(Qt::transparent);
+		if (mode == QIcon::Disabled) {
+			QStyleOption option;
+			option.palette = QApplication::palette();
 
-	QPainter painter{&base};
-	QBrush brush{color};
-	QPen pen{Qt::black, borderWidth};
-	QRectF borderRect{QPointF{outerMargin, outerMargin},
-					  QSizeF{size}.shrunkBy(innerMargin)};
+			auto disabled = QApplication::style()->generatedIconPixmap(mode, base, &option);
+			disabled.setDevicePixelRatio(scale);
 
-	painter.setBrush(brush);
-	painter.setPen(pen);
+			return disabled;
+		}
 
-	if (drawSlash) {
-		QLineF slash{borderRect.topRight(), borderRect.bottomLeft()};
-		painter.drawLine(slash);
+		return base;
 	}
 
-	painter.drawRect(borderRect);
+	virtual QSize actualSize(const QSize& size,
+							 QIcon::Mode /*mode*/,
+							 QIcon::State /*state*/) override
+	{
+		return size_.scaled(size, Qt::KeepAspectRatio).boundedTo(size_);
+	}
+
+	virtual QIconEngine* clone() const override
+	{
+		return new ColorIconEngine{*this};
+	}
 
-	return base;
+	virtual QString key() const override
+	{
+		return QStringLiteral("wespal-color");
+	}
+
+private:
+	void paintIcon(QPainter* painter, const QRect& rect) const
+	{
+		static constexpr qreal borderWidth = 1.0;
+		static constexpr qreal outerMargin = 2.0;
+		static constexpr QMarginsF innerMargin = {
+			outerMargin, outerMargin,
+			outerMargin, outerMargin
+		};
+
+		PainterRestorer restorer{painter};
+
+		painter->translate(rect.topLeft());
+		painter->scale(qreal(rect.width()) / size_.width(),
+					   qreal(rect.height()) / size_.height());
+
+		QBrush brush{color_};
+		QPen pen{Qt::black, borderWidth};
+		QRectF borderRect{QPointF{outerMargin, outerMargin},
+						  QSizeF{size_}.shrunkBy(innerMargin)};
+
+		painter->setBrush(brush);
+		painter->setPen(pen);
+
+		if (drawSlash_) {
+			QLineF slash{borderRect.topRight(), borderRect.bottomLeft()};
+			painter->drawLine(slash);
+		}
+
+		painter->drawRect(borderRect);
+	}
+
+	QColor color_;
+	QSize size_;
+	qreal defaultScale_;
+	bool drawSlash_;
+};
+
+} // end unnamed namespace
+
+QIcon createColorIconPrivate(const QColor& color,
+							 const QSize& size,
+							 const QWidget* target,
+							 bool drawSlash)
+{
+	return QIcon{new ColorIconEngine{color, size, pixelRatioFallback(target), drawSlash}};
 }
 
 QIcon createColorIcon(const QColor& color,
@@ -0,0 +1,174 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "perfhud.hpp"
+
+#include "perfmetrics.hpp"
+
+#include <QAbstractScrollArea>
+#include <QEvent>
+#include <QFontDatabase>
+#include <QLocale>
+#include <QPaintEvent>
+#include <QStringBuilder>
+#include <QTimer>
+
+namespace {
+
+// How often the overlay contents are updated
+constexpr int refreshInterval = 250;
+
+// Time window used for calculating the frame rate
+constexpr qint64 frameRateWindow = 1000;
+
+QString formatStageTime(MosMetrics::Stage stage)
+{
+	const auto nsecs = MosMetrics::lastStageTime(stage);
+
+	if (nsecs < 0)
+		return QStringLiteral("-");
+
+	return QString::number(double(nsecs) / 1e6, 'f', 2) % QStringLiteral(" ms");
+}
+
+QString formatMemory(MosMetrics::MemoryCategory category)
+{
+	return QLocale{}.formattedDataSize(MosMetrics::memoryUsage(category));
+}
+
+} // end unnamed namespace
+
+PerfHud::PerfHud(QAbstractScrollArea* scrollArea, QWidget* preview)
+	: QLabel(scrollArea)
+	, preview_(preview)
+	, refreshTimer_(new QTimer(this))
+	, clock_()
+	, frameTimes_()
+{
+	setAttribute(Qt::WA_TransparentForMouseEvents);
+	setTextFormat(Qt::RichText);
+	setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+	setStyleSheet(QStringLiteral(
+		"PerfHud { background: rgba(0, 0, 0, 160); color: white; "
+		"padding: 6px; border-radius: 4px; }"));
+	move(8, 8);
+	hide();
+
+	clock_.start();
+
+	preview_->installEventFilter(this);
+
+	refreshTimer_->setInterval(refreshInterval);
+	connect(refreshTimer_, &QTimer::timeout, this, &PerfHud::refresh);
+}
+
+bool PerfHud::eventFilter(QObject* object, QEvent* event)
+{
+	if (object != preview_ || event->type() != QEvent::Paint || !isVisible())
+		return QLabel::eventFilter(object, event);
+
+	const auto& region = static_cast<QPaintEvent*>(event)->region();
+	const QRect hudRect{preview_->mapFrom(parentWidget(), pos()), size()};
+
+	// Refreshing the overlay also repaints the part of the preview beneath
+	// it. That is not a frame, and its paint time and cache lookup must not
+	// replace those of the last actual frame either, so it is delivered here
+	// with metrics recording paused.
+	if (region.subtracted(hudRect).isEmpty()) {
+		const MosMetrics::RecordingPause pause;
+		static_cast<QObject*>(preview_)->event(event);
+		return true;
+	}
+
+	frameTimes_.append(clock_.elapsed());
+
+	return QLabel::eventFilter(object, event);
+}
+
+void PerfHud::showEvent(QShowEvent* event)
+{
+	refresh();
+	raise();
+	refreshTimer_->start();
+
+	QLabel::showEvent(event);
+}
+
+void PerfHud::hideEvent(QHideEvent* event)
+{
+	refreshTimer_->stop();
+	frameTimes_.clear();
+
+	QLabel::hideEvent(event);
+}
+
+qreal PerfHud::framesPerSecond()
+{
+	const auto now = clock_.elapsed();
+
+	while (!frameTimes_.isEmpty() && now - frameTimes_.front() > frameRateWindow)
+		frameTimes_.removeFirst();
+
+	return frameTimes_.count() * 1000.0 / frameRateWindow;
+}
+
+void PerfHud::refresh()
+{
+	using namespace MosMetrics;
+
+	const auto hitRate = cacheHitRate();
+	const auto budget = memoryBudget();
+	const QLocale locale;
+
+	const QList<std::pair<QString, QString>> rows = {
+		{ tr("Transform"),   formatStageTime(StageTransform) },
+		{ tr("Conversion"),  formatStageTime(StageConversion) },
+		{ tr("Composite"),   formatStageTime(StageComposite) },
+		{ tr("Paint"),       formatStageTime(StagePaint) },
+		{ tr("Frame rate"),  tr("%1 fps").arg(framesPerSecond(), 0, 'f', 0) },
+		{ tr("Cache hits"),  hitRate < 0 ? QStringLiteral("-")
+										 : tr("%1%").arg(hitRate * 100, 0, 'f', 0) },
+		{ tr("Source"),      formatMemory(MemorySourceImages) },
+		{ tr("Transformed"), formatMemory(MemoryTransformedImages) },
+		{ tr("Widgets"),     formatMemory(MemoryWidgetBuffers) },
+		{ tr("Caches"),      formatMemory(MemoryCaches) },
+		{ tr("Thumbnails"),  formatMemory(MemoryThumbnails) },
+		{ tr("Encoded"),     formatMemory(MemoryEncodedData) },
+		{ tr("Total"),       budget > 0
+							 ? tr("%1 of %2").arg(locale.formattedDataSize(totalMemoryUsage()),
+												  locale.formattedDataSize(budget))
+							 : locale.formattedDataSize(totalMemoryUsage()) },
+		{ tr("Evictions"),   QString::number(evictionCount()) },
+	};
+
+	QString html = QStringLiteral("<table cellspacing=\"0\" cellpadding=\"0\">");
+
+	for (const auto& [label, value] : rows)
+	{
+		html += QStringLiteral("<tr><td>") % label.toHtmlEscaped()
+				% QStringLiteral("</td><td align=\"right\">&nbsp;&nbsp;")
+				% value.toHtmlEscaped() % QStringLiteral("</td></tr>");
+	}
+
+	html += QStringLiteral("</table>");
+
+	setText(html);
+	adjustSize();
+}
@@ -0,0 +1,66 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QLabel>
+
+class QAbstractScrollArea;
+class QTimer;
+
+/**
+ * Overlay displaying live performance metrics for a preview widget.
+ *
+ * The overlay is placed in the top left corner of the scroll area containing
+ * the preview widget, and shows the metrics reported to MosMetrics along with
+ * the rate at which the preview widget is being repainted. Repaints of the
+ * preview widget that only cover the overlay, which happen whenever the
+ * overlay is refreshed, are neither counted nor measured.
+ */
+class PerfHud : public QLabel
+{
+	Q_OBJECT
+
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param scrollArea   Scroll area containing the preview widget.
+	 * @param preview      Preview widget whose frame rate is displayed.
+	 */
+	PerfHud(QAbstractScrollArea* scrollArea, QWidget* preview);
+
+protected:
+	virtual bool eventFilter(QObject* object, QEvent* event) override;
+
+	virtual void showEvent(QShowEvent* event) override;
+	virtual void hideEvent(QHideEvent* event) override;
+
+private:
+	void refresh();
+
+	qreal framesPerSecond();
+
+	QWidget* preview_;
+	QTimer* refreshTimer_;
+	QElapsedTimer clock_;
+	QList<qint64> frameTimes_;
+};
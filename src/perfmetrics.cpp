@@ -0,0 +1,205 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "perfmetrics.hpp"
+
+#include <QHash>
+#include <QSet>
+
+#include <array>
+
+namespace MosMetrics {
+
+namespace {
+
+struct MemoryRecord
+{
+	MemoryCategory category;
+	/** Identifies the pixel data so that shared images are counted once. */
+	const void* data;
+	qint64 size;
+	Evictor evictor;
+};
+
+std::array<qint64, StageCount> stageTimes = [] {
+	std::array<qint64, StageCount> res;
+	res.fill(-1);
+	return res;
+}();
+
+qint64 cacheHits = 0;
+qint64 cacheMisses = 0;
+
+// Nesting depth of RecordingPause objects
+int pauseDepth = 0;
+
+QHash<const void*, MemoryRecord> records;
+
+qint64 budget = 0;
+qint64 evictions = 0;
+
+qint64 usage(int lastCategory, bool onlyLast)
+{
+	QSet<const void*> seen;
+	qint64 total = 0;
+
+	// Claim shared data for the earliest category it appears in first
+	for (int pass = 0; pass <= lastCategory; ++pass)
+	{
+		for (const auto& record : std::as_const(records))
+		{
+			if (record.category != pass || seen.contains(record.data))
+				continue;
+
+			seen.insert(record.data);
+
+			if (!onlyLast || pass == lastCategory)
+				total += record.size;
+		}
+	}
+
+	return total;
+}
+
+void enforceBudget()
+{
+	if (budget <= 0 || totalMemoryUsage() <= budget)
+		return;
+
+	// Evictors remove their own records, so they cannot be called while
+	// iterating over them
+	QList<Evictor> evictors;
+
+	for (const auto& record : std::as_const(records))
+	{
+		if (record.evictor)
+			evictors.append(record.evictor);
+	}
+
+	for (const auto& evict : evictors)
+	{
+		evict();
+		++evictions;
+
+		if (totalMemoryUsage() <= budget)
+			break;
+	}
+}
+
+} // end unnamed namespace
+
+void recordStageTime(Stage stage, qint64 nsecs)
+{
+	if (pauseDepth > 0)
+		return;
+
+	stageTimes[stage] = nsecs;
+}
+
+qint64 lastStageTime(Stage stage)
+{
+	return stageTimes[stage];
+}
+
+void setRecordingPaused(bool paused)
+{
+	pauseDepth += paused ? 1 : -1;
+
+	Q_ASSERT(pauseDepth >= 0);
+}
+
+void recordCacheLookup(bool hit)
+{
+	if (pauseDepth > 0)
+		return;
+
+	if (hit)
+		++cacheHits;
+	else
+		++cacheMisses;
+}
+
+qreal cacheHitRate()
+{
+	const auto lookups = cacheHits + cacheMisses;
+
+	return lookups ? qreal(cacheHits) / qreal(lookups) : -1.0;
+}
+
+void setImage(const QImage* owner,
+			  MemoryCategory category,
+			  const QImage& image,
+			  const Evictor& evictor)
+{
+	if (image.isNull()) {
+		records.remove(owner);
+		return;
+	}
+
+	records.insert(owner, {category, image.constBits(), image.sizeInBytes(), evictor});
+
+	enforceBudget();
+}
+
+void setMemory(const void* owner, MemoryCategory category, qint64 bytes)
+{
+	if (bytes <= 0) {
+		records.remove(owner);
+		return;
+	}
+
+	records.insert(owner, {category, owner, bytes, {}});
+
+	enforceBudget();
+}
+
+void releaseMemory(const void* owner)
+{
+	records.remove(owner);
+}
+
+qint64 memoryUsage(MemoryCategory category)
+{
+	return usage(category, true);
+}
+
+qint64 totalMemoryUsage()
+{
+	return usage(MemoryCategoryCount - 1, false);
+}
+
+void setMemoryBudget(qint64 bytes)
+{
+	budget = qMax<qint64>(0, bytes);
+
+	enforceBudget();
+}
+
+qint64 memoryBudget()
+{
+	return budget;
+}
+
+qint64 evictionCount()
+{
+	return evictions;
+}
+
+} // end namespace MosMetrics
@@ -0,0 +1,223 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QImage>
+
+#include <functional>
+
+/**
+ * Performance metrics registry and image memory accountant.
+ *
+ * Image processing steps and preview widgets report their timings, cache
+ * usage and image buffers here so they can be displayed in the performance
+ * HUD. Reporting is cheap enough to be left enabled at all times, but it is
+ * not thread-safe; all functions must be called from the GUI thread.
+ *
+ * When a memory budget is set, cached images are evicted whenever the total
+ * memory held by all reported images exceeds it.
+ */
+namespace MosMetrics {
+
+/**
+ * Preview rendering stages.
+ */
+enum Stage
+{
+	/** Recoloring or other image transform. */
+	StageTransform,
+	/** Pixel format conversion. */
+	StageConversion,
+	/** Composite image rendering for the swipe and onion skin views. */
+	StageComposite,
+	/** Widget painting. */
+	StagePaint,
+	StageCount,
+};
+
+/**
+ * Categories of memory held by images.
+ */
+enum MemoryCategory
+{
+	/** Source images as loaded. */
+	MemorySourceImages,
+	/** Transformed images. */
+	MemoryTransformedImages,
+	/** Per-widget image buffers. */
+	MemoryWidgetBuffers,
+	/** Cached renders. */
+	MemoryCaches,
+	/** Recent file thumbnails. */
+	MemoryThumbnails,
+	/** Encoded image data, e.g. Base64 strings. */
+	MemoryEncodedData,
+	MemoryCategoryCount,
+};
+
+/**
+ * Function releasing a cached image when the memory budget is exceeded.
+ *
+ * Evictors are expected to call releaseMemory() on their image.
+ */
+typedef std::function<void()> Evictor;
+
+/**
+ * Records the time taken by the latest run of a rendering stage.
+ */
+void recordStageTime(Stage stage, qint64 nsecs);
+
+/**
+ * Returns the time taken by the latest run of a rendering stage in
+ * nanoseconds, or -1 if it has not run yet.
+ */
+qint64 lastStageTime(Stage stage);
+
+/**
+ * Records a cache lookup.
+ */
+void recordCacheLookup(bool hit);
+
+/**
+ * Returns the ratio of cache lookups that were hits, or -1 if there have not
+ * been any lookups.
+ */
+qreal cacheHitRate();
+
+/**
+ * Sets whether stage times and cache lookups are currently ignored.
+ *
+ * Use RecordingPause rather than calling this directly.
+ */
+void setRecordingPaused(bool paused);
+
+/**
+ * Records the image currently held by a given variable.
+ *
+ * @param owner        Address of the image variable, used as a key.
+ * @param category     Memory category.
+ * @param image        Image held by the variable. A null image removes the
+ *                     variable from the registry.
+ * @param evictor      Function releasing the image if the memory budget is
+ *                     exceeded. Only images that can be regenerated on demand
+ *                     should have one.
+ */
+void setImage(const QImage* owner,
+			  MemoryCategory category,
+			  const QImage& image,
+			  const Evictor& evictor = {});
+
+/**
+ * Records memory held by something other than an image.
+ *
+ * @param owner        Address of the object holding the memory, used as a
+ *                     key.
+ * @param category     Memory category.
+ * @param bytes        Number of bytes held. Zero removes the object from the
+ *                     registry.
+ */
+void setMemory(const void* owner, MemoryCategory category, qint64 bytes);
+
+/**
+ * Removes an image variable or other object from the registry.
+ */
+void releaseMemory(const void* owner);
+
+/**
+ * Returns the number of bytes held by images in a memory category.
+ *
+ * Images sharing their pixel data with an image in an earlier category, or
+ * with another image in the same category, are only counted once.
+ */
+qint64 memoryUsage(MemoryCategory category);
+
+/**
+ * Returns the number of bytes held by all images.
+ */
+qint64 totalMemoryUsage();
+
+/**
+ * Sets the memory budget in bytes.
+ *
+ * Zero means there is no budget.
+ */
+void setMemoryBudget(qint64 bytes);
+
+/**
+ * Returns the memory budget in bytes, or zero if there is no budget.
+ */
+qint64 memoryBudget();
+
+/**
+ * Returns the number of cached images evicted to stay within the budget.
+ */
+qint64 evictionCount();
+
+/**
+ * Records the time taken by a rendering stage during the lifetime of this
+ * object.
+ */
+class StageTimer
+{
+public:
+	explicit StageTimer(Stage stage)
+		: stage_(stage)
+		, timer_()
+	{
+		timer_.start();
+	}
+
+	~StageTimer()
+	{
+		recordStageTime(stage_, timer_.nsecsElapsed());
+	}
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+	Stage stage_;
+	QElapsedTimer timer_;
+};
+
+/**
+ * Ignores stage times and cache lookups reported during the lifetime of this
+ * object, e.g. for work done on behalf of the performance HUD itself.
+ */
+class RecordingPause
+{
+public:
+	RecordingPause()
+	{
+		setRecordingPaused(true);
+	}
+
+	~RecordingPause()
+	{
+		setRecordingPaused(false);
+	}
+
+	RecordingPause(const RecordingPause&) = delete;
+	RecordingPause& operator=(const RecordingPause&) = delete;
+};
+
+} // end namespace MosMetrics
@@ -0,0 +1,235 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "rawdataview.hpp"
+
+#include <QApplication>
+#include <QClipboard>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QScrollBar>
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+constexpr int TEXT_MARGIN = 4;
+
+} // end unnamed namespace
+
+RawDataView::RawDataView(QWidget* parent)
+	: QAbstractScrollArea(parent)
+	, contents_()
+	, lineStarts_()
+	, rowStarts_()
+	, rowCount_(0)
+	, columns_(1)
+	, allSelected_(false)
+{
+	setFocusPolicy(Qt::StrongFocus);
+	setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+	viewport()->setBackgroundRole(QPalette::Base);
+	viewport()->setAutoFillBackground(true);
+	viewport()->setCursor(Qt::IBeamCursor);
+}
+
+void RawDataView::setContents(const QString& contents)
+{
+	contents_ = contents;
+	allSelected_ = false;
+
+	lineStarts_.clear();
+	lineStarts_.emplaceBack(0);
+
+	// A single pass over the data to find hard line breaks. Base64 payloads
+	// have none, so this is all the indexing they will ever need.
+	for (qsizetype pos = contents_.indexOf('\n');
+		 pos != -1;
+		 pos = contents_.indexOf('\n', pos + 1))
+	{
+		lineStarts_.emplaceBack(pos + 1);
+	}
+
+	relayout();
+	verticalScrollBar()->setValue(0);
+	viewport()->update();
+}
+
+void RawDataView::clear()
+{
+	setContents({});
+}
+
+void RawDataView::selectAll()
+{
+	allSelected_ = true;
+	viewport()->update();
+}
+
+void RawDataView::deselect()
+{
+	allSelected_ = false;
+	viewport()->update();
+}
+
+void RawDataView::copy()
+{
+	QApplication::clipboard()->setText(contents_);
+}
+
+qsizetype RawDataView::lineLength(qsizetype line) const
+{
+	const auto start = lineStarts_[line];
+	const auto end = line + 1 < lineStarts_.count()
+					 ? lineStarts_[line + 1] - 1
+					 : contents_.size();
+
+	return end - start;
+}
+
+qsizetype RawDataView::rowsForLine(qsizetype line) const
+{
+	const auto length = lineLength(line);
+
+	return length ? (length + columns_ - 1) / columns_ : 1;
+}
+
+void RawDataView::relayout()
+{
+	const auto charWidth = qMax(1, fontMetrics().horizontalAdvance(QLatin1Char('0')));
+	const auto lineHeight = qMax(1, fontMetrics().lineSpacing());
+
+	columns_ = qMax(1, (viewport()->width() - 2 * TEXT_MARGIN) / charWidth);
+
+	rowStarts_.resize(lineStarts_.count());
+	rowCount_ = 0;
+
+	for (qsizetype line = 0; line < lineStarts_.count(); ++line)
+	{
+		rowStarts_[line] = rowCount_;
+		rowCount_ += rowsForLine(line);
+	}
+
+	const auto visibleRows = qMax(1, (viewport()->height() - 2 * TEXT_MARGIN) / lineHeight);
+	const auto maxRow = qMax<qsizetype>(0, rowCount_ - visibleRows);
+
+	auto* vScroll = verticalScrollBar();
+
+	vScroll->setRange(0, int(qMin<qsizetype>(maxRow, std::numeric_limits<int>::max())));
+	vScroll->setPageStep(visibleRows);
+	vScroll->setSingleStep(1);
+}
+
+void RawDataView::paintEvent(QPaintEvent* event)
+{
+	QPainter p{viewport()};
+
+	p.setClipRect(event->rect());
+
+	if (lineStarts_.isEmpty() || contents_.isEmpty())
+		return;
+
+	const auto lineHeight = qMax(1, fontMetrics().lineSpacing());
+	const auto ascent = fontMetrics().ascent();
+	const auto& pal = palette();
+
+	const qsizetype firstRow = verticalScrollBar()->value();
+	const qsizetype visibleRows = (viewport()->height() - TEXT_MARGIN) / lineHeight + 1;
+
+	// Locate the logical line containing the first visible row.
+	auto it = std::upper_bound(rowStarts_.cbegin(), rowStarts_.cend(), firstRow);
+	qsizetype line = qMax<qsizetype>(0, std::distance(rowStarts_.cbegin(), it) - 1);
+	qsizetype subRow = firstRow - rowStarts_[line];
+
+	if (allSelected_) {
+		p.fillRect(viewport()->rect(), pal.brush(QPalette::Highlight));
+		p.setPen(pal.color(QPalette::HighlightedText));
+	} else {
+		p.setPen(pal.color(QPalette::Text));
+	}
+
+	int y = TEXT_MARGIN;
+
+	for (qsizetype row = 0; row < visibleRows && line < lineStarts_.count(); ++row)
+	{
+		const auto length = lineLength(line);
+		const auto offset = subRow * columns_;
+		const auto count = qMin<qsizetype>(columns_, length - offset);
+
+		if (count > 0) {
+			const QStringView segment{contents_.constData() + lineStarts_[line] + offset, count};
+			p.drawText(TEXT_MARGIN, y + ascent, segment.toString());
+		}
+
+		y += lineHeight;
+
+		if (++subRow >= rowsForLine(line)) {
+			subRow = 0;
+			++line;
+		}
+	}
+}
+
+void RawDataView::resizeEvent(QResizeEvent* event)
+{
+	QAbstractScrollArea::resizeEvent(event);
+
+	// Keep roughly the same portion of the data in view after rewrapping.
+	const auto oldColumns = columns_;
+	const auto oldFirstChar = qsizetype(verticalScrollBar()->value()) * oldColumns;
+
+	relayout();
+
+	if (oldColumns != columns_ && lineStarts_.count() == 1) {
+		verticalScrollBar()->setValue(int(oldFirstChar / columns_));
+	}
+}
+
+void RawDataView::changeEvent(QEvent* event)
+{
+	QAbstractScrollArea::changeEvent(event);
+
+	if (event->type() == QEvent::FontChange) {
+		relayout();
+		viewport()->update();
+	}
+}
+
+void RawDataView::keyPressEvent(QKeyEvent* event)
+{
+	if (event == QKeySequence::SelectAll) {
+		selectAll();
+		event->accept();
+	} else if (event == QKeySequence::Copy) {
+		if (allSelected_)
+			copy();
+		event->accept();
+	} else {
+		QAbstractScrollArea::keyPressEvent(event);
+	}
+}
+
+void RawDataView::mousePressEvent(QMouseEvent* event)
+{
+	deselect();
+	QAbstractScrollArea::mousePressEvent(event);
+}
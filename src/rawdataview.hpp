@@ -0,0 +1,134 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QAbstractScrollArea>
+
+/**
+ * Read-only viewer for large blocks of fixed-width text (e.g. Base64 data).
+ *
+ * Unlike QPlainTextEdit, this widget does not build a text document or lay
+ * out its contents ahead of time. The contents are kept in a single
+ * implicitly-shared QString, and only the rows currently visible in the
+ * viewport are ever measured or painted. Lines are hard-wrapped at the
+ * column count that fits in the viewport, on the assumption that the font
+ * used is monospaced.
+ *
+ * Multi-megabyte data URIs can thus be displayed immediately and with
+ * negligible memory overhead compared to the source string.
+ */
+class RawDataView : public QAbstractScrollArea
+{
+	Q_OBJECT
+
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param parent Sets the parent of this widget.
+	 */
+	explicit RawDataView(QWidget* parent = nullptr);
+
+	/**
+	 * Retrieves the displayed contents.
+	 */
+	const QString& contents() const
+	{
+		return contents_;
+	}
+
+	/**
+	 * Sets the displayed contents.
+	 *
+	 * @note The string is shared rather than copied.
+	 */
+	void setContents(const QString& contents);
+
+	/**
+	 * Removes the displayed contents.
+	 */
+	void clear();
+
+	/**
+	 * Returns whether the entire contents are displayed as selected.
+	 */
+	bool isAllSelected() const
+	{
+		return allSelected_;
+	}
+
+public slots:
+	/**
+	 * Displays the entire contents as selected.
+	 */
+	void selectAll();
+
+	/**
+	 * Removes the selection highlight, if any.
+	 */
+	void deselect();
+
+	/**
+	 * Copies the entire contents to the system clipboard.
+	 */
+	void copy();
+
+protected:
+	virtual void paintEvent(QPaintEvent* event) override;
+
+	virtual void resizeEvent(QResizeEvent* event) override;
+
+	virtual void changeEvent(QEvent* event) override;
+
+	virtual void keyPressEvent(QKeyEvent* event) override;
+
+	virtual void mousePressEvent(QMouseEvent* event) override;
+
+private:
+	/**
+	 * Recalculates the wrapping column and the visual row index.
+	 *
+	 * This only walks through the list of logical line offsets, never the
+	 * contents themselves.
+	 */
+	void relayout();
+
+	/**
+	 * Returns the number of visual rows taken up by a logical line.
+	 */
+	qsizetype rowsForLine(qsizetype line) const;
+
+	/**
+	 * Returns the length of a logical line, excluding its terminator.
+	 */
+	qsizetype lineLength(qsizetype line) const;
+
+	QString contents_;
+
+	/** Offset of the first character of each logical line. */
+	QList<qsizetype> lineStarts_;
+	/** Visual row index of the first row of each logical line. */
+	QList<qsizetype> rowStarts_;
+
+	qsizetype rowCount_;
+	int columns_;
+	bool allSelected_;
+};
@@ -20,7 +20,10 @@
 
 #include "recentfiles.hpp"
 
+#include <QSaveFile>
+
 #include <algorithm>
+#include <cstring>
 
 namespace MosConfig {
 
@@ -30,6 +33,82 @@ constexpr QSize MRU_THUMBNAIL_SIZE = { 72, 72 };
 
 constexpr QSize MRU_MINI_THUMBNAIL_SIZE = { 16, 16 };
 
+constexpr char THUMBNAIL_CACHE_MAGIC[4] = { 'W', 'S', 'P', 'T' };
+
+constexpr quint32 THUMBNAIL_CACHE_VERSION = 1;
+
+constexpr qsizetype THUMBNAIL_CACHE_HEADER_SIZE = 16;
+
+constexpr qsizetype THUMBNAIL_RECORD_HEADER_SIZE = 8;
+
+constexpr QImage::Format THUMBNAIL_FORMAT = QImage::Format_ARGB32_Premultiplied;
+
+template<typename T>
+T readNative(const uchar* data)
+{
+	T value;
+	std::memcpy(&value, data, sizeof(T));
+	return value;
+}
+
+template<typename T>
+void appendNative(QByteArray& data, T value)
+{
+	data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+qsizetype paddedLength(qsizetype length)
+{
+	return (length + 3) & ~qsizetype(3);
+}
+
+/**
+ * Halves an image's dimensions by averaging each 2x2 block of pixels.
+ *
+ * The result is always in premultiplied ARGB32 format. The source must be in
+ * that same format, or in plain ARGB32 if @a PremultiplySource is @a true, in
+ * which case each pixel is premultiplied as it is read. Odd trailing rows and
+ * columns are dropped.
+ */
+template<bool PremultiplySource>
+QImage halveImage(const QImage& source)
+{
+	const int width = source.width() / 2;
+	const int height = source.height() / 2;
+
+	QImage result{width, height, THUMBNAIL_FORMAT};
+
+	for (int y = 0; y < height; ++y)
+	{
+		auto* top = reinterpret_cast<const QRgb*>(source.constScanLine(y * 2));
+		auto* bottom = reinterpret_cast<const QRgb*>(source.constScanLine(y * 2 + 1));
+		auto* out = reinterpret_cast<QRgb*>(result.scanLine(y));
+
+		for (int x = 0; x < width; ++x)
+		{
+			QRgb p[4] = { top[x * 2], top[x * 2 + 1], bottom[x * 2], bottom[x * 2 + 1] };
+
+			if constexpr (PremultiplySource) {
+				for (auto& pixel : p)
+					pixel = qPremultiply(pixel);
+			}
+
+			// Sum two channels at a time, each in its own 16-bit lane
+			quint32 rb = 0x00020002U, ag = 0x00020002U;
+
+			for (auto pixel : p)
+			{
+				rb += pixel & 0x00FF00FFU;
+				ag += (pixel >> 8) & 0x00FF00FFU;
+			}
+
+			out[x] = ((rb >> 2) & 0x00FF00FFU) | (((ag >> 2) & 0x00FF00FFU) << 8);
+		}
+	}
+
+	return result;
+}
+
 } // end unnamed namespace
 
 const QSize& MruEntry::thumbnailSize()
@@ -42,36 +121,96 @@ const QSize& MruEntry::miniThumbnailSize()
 	return MRU_MINI_THUMBNAIL_SIZE;
 }
 
-MruEntry::MruEntry(const QString& filePath, const QString& thumbnailData)
+MruEntry::MruEntry(const QString& filePath, const ThumbnailLoader& thumbnailLoader)
 	: filePath_(filePath)
+	, thumbnailLoader_(thumbnailLoader)
 	, thumbnail_()
+	, miniThumbnail_()
 {
-	auto rawThumbnail = QByteArray::fromBase64(thumbnailData.toLatin1());
-	thumbnail_ = QImage::fromData(rawThumbnail);
-
-	if (thumbnail_.size() != MRU_THUMBNAIL_SIZE) {
-		thumbnail_ = thumbnail_.scaled(MRU_THUMBNAIL_SIZE,
-									   Qt::KeepAspectRatio,
-									   Qt::SmoothTransformation);
-	}
-
-	miniThumbnail_ = thumbnail_.scaled(MRU_MINI_THUMBNAIL_SIZE,
-									   Qt::KeepAspectRatio,
-									   Qt::FastTransformation);
 }
 
 MruEntry::MruEntry(const QString& filePath, const QImage& image)
 	: filePath_(filePath)
+	, thumbnailLoader_()
 	, thumbnail_()
+	, miniThumbnail_()
 {
-	if (!image.isNull()) {
-		thumbnail_ = image.scaled(MRU_THUMBNAIL_SIZE,
-								  Qt::KeepAspectRatio,
-								  Qt::SmoothTransformation);
-		miniThumbnail_ = image.scaled(MRU_MINI_THUMBNAIL_SIZE,
-									  Qt::KeepAspectRatio,
-									  Qt::FastTransformation);
+	assignThumbnail(image);
+}
+
+QImage MruEntry::generateThumbnail(const QImage& image)
+{
+	if (image.isNull())
+		return {};
+
+	const auto targetSize = image.size().scaled(MRU_THUMBNAIL_SIZE, Qt::KeepAspectRatio)
+								   .expandedTo({ 1, 1 });
+	const bool halve = image.width() / 2 >= targetSize.width() &&
+					   image.height() / 2 >= targetSize.height();
+	QImage thumbnail;
+
+	// Do the first pass straight from the source when possible, instead of
+	// making a premultiplied copy of the whole image first. Opaque RGB32
+	// pixels are already valid premultiplied values.
+	if (halve && image.format() == QImage::Format_ARGB32) {
+		thumbnail = halveImage<true>(image);
+	} else if (halve && (image.format() == THUMBNAIL_FORMAT ||
+						 image.format() == QImage::Format_RGB32)) {
+		thumbnail = halveImage<false>(image);
+	} else {
+		thumbnail = image.convertedTo(THUMBNAIL_FORMAT);
+	}
+
+	while (thumbnail.width() / 2 >= targetSize.width() &&
+		   thumbnail.height() / 2 >= targetSize.height())
+	{
+		thumbnail = halveImage<false>(thumbnail);
+	}
+
+	if (thumbnail.size() != targetSize) {
+		thumbnail = thumbnail.scaled(targetSize,
+									 Qt::IgnoreAspectRatio,
+									 Qt::SmoothTransformation);
 	}
+
+	return thumbnail;
+}
+
+void MruEntry::setThumbnail(const QImage& thumbnail)
+{
+	thumbnailLoader_ = nullptr;
+	assignThumbnail(thumbnail);
+}
+
+void MruEntry::runThumbnailLoader() const
+{
+	// Clear the loader first in case it ends up calling thumbnail()
+	auto loader = std::move(thumbnailLoader_);
+	thumbnailLoader_ = nullptr;
+
+	assignThumbnail(loader());
+}
+
+void MruEntry::assignThumbnail(const QImage& thumbnail) const
+{
+	if (thumbnail.isNull()) {
+		thumbnail_ = {};
+		miniThumbnail_ = {};
+		return;
+	}
+
+	if (thumbnail.width() > MRU_THUMBNAIL_SIZE.width() ||
+		thumbnail.height() > MRU_THUMBNAIL_SIZE.height() ||
+		(thumbnail.width() != MRU_THUMBNAIL_SIZE.width() &&
+		 thumbnail.height() != MRU_THUMBNAIL_SIZE.height())) {
+		thumbnail_ = generateThumbnail(thumbnail);
+	} else {
+		thumbnail_ = thumbnail.convertedTo(THUMBNAIL_FORMAT);
+	}
+
+	miniThumbnail_ = thumbnail_.scaled(MRU_MINI_THUMBNAIL_SIZE,
+									   Qt::KeepAspectRatio,
+									   Qt::FastTransformation);
 }
 
 void MruList::pushPrivate(MruEntry&& incoming)
@@ -101,4 +240,103 @@ void MruList::pushPrivate(MruEntry&& incoming)
 	Q_ASSERT(mru_.count() <= size_);
 }
 
+ThumbnailCache::ThumbnailCache(const QString& filePath)
+	: file_(filePath)
+	, data_(nullptr)
+	, size_(0)
+	, records_()
+{
+	if (!file_.open(QIODevice::ReadOnly))
+		return;
+
+	size_ = file_.size();
+
+	if (size_ < THUMBNAIL_CACHE_HEADER_SIZE ||
+		!(data_ = file_.map(0, size_))) {
+		size_ = 0;
+		return;
+	}
+
+	if (std::memcmp(data_, THUMBNAIL_CACHE_MAGIC, sizeof(THUMBNAIL_CACHE_MAGIC)) != 0 ||
+		readNative<quint32>(data_ + 4) != THUMBNAIL_CACHE_VERSION) {
+		return;
+	}
+
+	const auto count = readNative<quint32>(data_ + 8);
+	qsizetype offset = THUMBNAIL_CACHE_HEADER_SIZE;
+
+	for (quint32 i = 0; i < count; ++i)
+	{
+		if (size_ - offset < THUMBNAIL_RECORD_HEADER_SIZE)
+			break;
+
+		const qsizetype pathLength = readNative<quint32>(data_ + offset);
+		const int width = readNative<quint16>(data_ + offset + 4);
+		const int height = readNative<quint16>(data_ + offset + 6);
+		const auto pathOffset = offset + THUMBNAIL_RECORD_HEADER_SIZE;
+		const auto pixelsOffset = pathOffset + paddedLength(pathLength);
+		const auto pixelsLength = qsizetype(width) * height * 4;
+
+		if (pathLength > size_ || pixelsOffset > size_ ||
+			size_ - pixelsOffset < pixelsLength) {
+			break;
+		}
+
+		const auto path = QString::fromUtf8(reinterpret_cast<const char*>(data_ + pathOffset),
+											pathLength);
+
+		records_.insert(path, { pixelsOffset, { width, height } });
+
+		offset = pixelsOffset + pixelsLength;
+	}
+}
+
+QImage ThumbnailCache::thumbnail(const QString& filePath) const
+{
+	const auto it = records_.constFind(filePath);
+
+	if (it == records_.cend() || it->size.isEmpty())
+		return {};
+
+	// Copy the pixels out so that the image does not outlive the mapping
+	return QImage{data_ + it->offset,
+				  it->size.width(),
+				  it->size.height(),
+				  it->size.width() * 4,
+				  THUMBNAIL_FORMAT}.copy();
+}
+
+bool ThumbnailCache::save(const QString& filePath, const MruList& mru)
+{
+	QByteArray data;
+
+	data.append(THUMBNAIL_CACHE_MAGIC, sizeof(THUMBNAIL_CACHE_MAGIC));
+	appendNative<quint32>(data, THUMBNAIL_CACHE_VERSION);
+	appendNative<quint32>(data, quint32(mru.count()));
+	appendNative<quint32>(data, 0);
+
+	for (const auto& entry : mru)
+	{
+		const auto path = entry.filePath().toUtf8();
+		const auto thumbnail = entry.thumbnail().convertedTo(THUMBNAIL_FORMAT);
+
+		appendNative<quint32>(data, quint32(path.size()));
+		appendNative<quint16>(data, quint16(thumbnail.width()));
+		appendNative<quint16>(data, quint16(thumbnail.height()));
+
+		data.append(path);
+		data.append(paddedLength(path.size()) - path.size(), '\0');
+
+		for (int y = 0; y < thumbnail.height(); ++y)
+			data.append(reinterpret_cast<const char*>(thumbnail.constScanLine(y)),
+						thumbnail.width() * 4);
+	}
+
+	QSaveFile file{filePath};
+
+	return file.open(QIODevice::WriteOnly) &&
+		   file.write(data) == data.size() &&
+		   file.commit();
+}
+
 } // end namespace MosConfig
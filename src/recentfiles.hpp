@@ -20,8 +20,12 @@
 
 #pragma once
 
+#include <QFile>
+#include <QHash>
 #include <QImage>
 
+#include <functional>
+
 namespace MosConfig {
 
 class MruEntry
@@ -32,19 +36,28 @@ public:
 	 */
 	MruEntry()
 		: filePath_()
+		, thumbnailLoader_()
 		, thumbnail_()
 		, miniThumbnail_()
 	{
 	}
 
 	/**
-	 * Constructs a new MRU entry.
+	 * Function returning an MRU entry's thumbnail on demand.
+	 *
+	 * The returned image does not need to be of the standard thumbnail size.
+	 */
+	typedef std::function<QImage()> ThumbnailLoader;
+
+	/**
+	 * Constructs a new MRU entry with a lazily-loaded thumbnail.
 	 *
 	 * @param filePath         Path to the file.
-	 * @param thumbnailData    Thumbnail as base 64 data.
+	 * @param thumbnailLoader  Function called the first time the thumbnail
+	 *                         is requested.
 	 */
 	MruEntry(const QString& filePath,
-			 const QString& thumbnailData);
+			 const ThumbnailLoader& thumbnailLoader);
 
 	/**
 	 * Constructs a MRU entry with an automatically-generated thumbnail.
@@ -76,6 +89,7 @@ public:
 	 */
 	const QImage& thumbnail() const
 	{
+		loadThumbnail();
 		return thumbnail_;
 	}
 
@@ -84,17 +98,23 @@ public:
 	 */
 	const QImage& miniThumbnail() const
 	{
+		loadThumbnail();
 		return miniThumbnail_;
 	}
 
 	/**
-	 * Replaces the previously-set thumbnail.
+	 * Returns whether the thumbnail has not been loaded yet.
 	 */
-	void setThumbnail(const QImage& thumbnail)
+	bool thumbnailPending() const
 	{
-		thumbnail_ = thumbnail;
+		return bool(thumbnailLoader_);
 	}
 
+	/**
+	 * Replaces the previously-set thumbnail.
+	 */
+	void setThumbnail(const QImage& thumbnail);
+
 	/**
 	 * Returns the standard thumbnail size.
 	 */
@@ -105,17 +125,43 @@ public:
 	 */
 	static const QSize& miniThumbnailSize();
 
+	/**
+	 * Downscales an image to fit within the standard thumbnail size.
+	 *
+	 * Large images are first repeatedly halved using a 2x2 box filter, which
+	 * is much cheaper than a single smooth transformation from full size and
+	 * produces nearly identical results at thumbnail sizes. The first pass
+	 * reads 32-bit RGB and ARGB images directly, so those are never converted
+	 * at full size.
+	 *
+	 * This is safe to call from any thread.
+	 */
+	static QImage generateThumbnail(const QImage& image);
+
 private:
 	MruEntry(const QString& filePath)
 		: filePath_(filePath)
+		, thumbnailLoader_()
 		, thumbnail_()
 		, miniThumbnail_()
 	{
 	}
 
+	void loadThumbnail() const
+	{
+		if (thumbnailLoader_)
+			runThumbnailLoader();
+	}
+
+	void runThumbnailLoader() const;
+
+	void assignThumbnail(const QImage& thumbnail) const;
+
 	QString filePath_;
-	QImage thumbnail_;
-	QImage miniThumbnail_;
+	// These are only modified by const methods when loading the thumbnail
+	mutable ThumbnailLoader thumbnailLoader_;
+	mutable QImage thumbnail_;
+	mutable QImage miniThumbnail_;
 };
 
 class MruList
@@ -219,4 +265,72 @@ private:
 	qsizetype size_;
 };
 
+/**
+ * Binary on-disk store for MRU thumbnails.
+ *
+ * Thumbnails are kept as raw premultiplied ARGB32 pixels in a single file
+ * that is mapped into memory, so that retrieving one does not involve any
+ * decoding or rescaling. This replaces the Base64-encoded PNG files
+ * previously stored in the application settings.
+ *
+ * The file consists of a header followed by one record per thumbnail:
+ *
+ * @code
+ * header:  char magic[4] = "WSPT", quint32 version, quint32 count, quint32 0
+ * record:  quint32 pathLength, quint16 width, quint16 height,
+ *          UTF-8 path padded to a multiple of 4 bytes,
+ *          width * height * 4 bytes of pixel data
+ * @endcode
+ *
+ * All integers are in native byte order. Files written on a machine with a
+ * different byte order fail the version check and are ignored.
+ */
+class ThumbnailCache
+{
+public:
+	/**
+	 * Opens a thumbnail cache file.
+	 *
+	 * A missing or invalid file results in an empty cache.
+	 */
+	explicit ThumbnailCache(const QString& filePath);
+
+	ThumbnailCache(const ThumbnailCache&) = delete;
+	ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+	/**
+	 * Returns whether a thumbnail exists for the given file.
+	 */
+	bool contains(const QString& filePath) const
+	{
+		return records_.contains(filePath);
+	}
+
+	/**
+	 * Returns the thumbnail for the given file, or a null image.
+	 */
+	QImage thumbnail(const QString& filePath) const;
+
+	/**
+	 * Writes the thumbnails of the given MRU list to a cache file.
+	 *
+	 * This loads any pending thumbnails in the list. Any ThumbnailCache
+	 * instance using the same file must be destroyed first, since some
+	 * platforms do not allow replacing files that are mapped into memory.
+	 */
+	static bool save(const QString& filePath, const MruList& mru);
+
+private:
+	struct Record
+	{
+		qsizetype offset;
+		QSize size;
+	};
+
+	QFile file_;
+	const uchar* data_;
+	qsizetype size_;
+	QHash<QString, Record> records_;
+};
+
 } // end namespace MosConfig
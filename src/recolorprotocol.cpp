@@ -0,0 +1,288 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "recolorprotocol.hpp"
+
+#include "batchspec.hpp"
+
+#include <QCborArray>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QStringBuilder>
+#include <QtEndian>
+
+namespace MosBatch {
+
+namespace {
+
+// Maximum amount of decoded source image data kept in memory, in KiB
+constexpr int sourceCacheSize = 256 * 1024;
+
+// Maximum number of color maps kept in memory
+constexpr int colorMapCacheSize = 1024;
+
+QStringList toStringList(const QCborValue& value)
+{
+	QStringList res;
+
+	for (const auto& item : value.toArray())
+		res.emplaceBack(item.toString());
+
+	return res;
+}
+
+} // end unnamed namespace
+
+QString defaultServerName()
+{
+	auto user = qEnvironmentVariable("USER");
+
+	if (user.isEmpty())
+		user = qEnvironmentVariable("USERNAME");
+
+	return user.isEmpty()
+		   ? QStringLiteral("wespal-cli")
+		   : QStringLiteral("wespal-cli-") % user;
+}
+
+void writeMessage(QIODevice& device, const QCborMap& message)
+{
+	const auto& data = message.toCborValue().toCbor();
+	const auto size = qToBigEndian<quint32>(quint32(data.size()));
+
+	device.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	device.write(data);
+}
+
+bool takeMessage(QByteArray& buffer, QCborMap& message)
+{
+	constexpr qsizetype headerSize = sizeof(quint32);
+
+	if (buffer.size() < headerSize)
+		return false;
+
+	const qsizetype size = qFromBigEndian<quint32>(buffer.constData());
+
+	if (size > maxMessageSize || buffer.size() < headerSize + size)
+		return false;
+
+	message = QCborValue::fromCbor(buffer.mid(headerSize, size)).toMap();
+	buffer.remove(0, headerSize + size);
+
+	return true;
+}
+
+bool isMessageOversized(const QByteArray& buffer)
+{
+	constexpr qsizetype headerSize = sizeof(quint32);
+
+	return buffer.size() >= headerSize &&
+		   qsizetype(qFromBigEndian<quint32>(buffer.constData())) > maxMessageSize;
+}
+
+//
+// RecolorRequestHandler
+//
+
+RecolorRequestHandler::RecolorRequestHandler()
+	: sourceCacheMutex_()
+	, sourceCache_(sourceCacheSize)
+	, colorMapCacheMutex_()
+	, colorMapCache_(colorMapCacheSize)
+{
+}
+
+QCborMap RecolorRequestHandler::handleRequest(const QCborMap& request)
+{
+	QCborMap response;
+	QCborArray files;
+	QCborArray outputs;
+	QStringList failed;
+
+	response.insert(QStringLiteral("id"), request.value(QStringLiteral("id")));
+
+	try {
+		QString sourceName;
+		const auto& image = loadSource(request, sourceName);
+
+		const auto& keyPaletteSpec = request.value(QStringLiteral("keyPalette")).toString("magenta");
+		const auto& [keyPaletteId, keyPalette] = parsePalette(keyPaletteSpec);
+
+		const auto& transforms = parseTransforms(
+			toStringList(request.value(QStringLiteral("ranges"))),
+			toStringList(request.value(QStringLiteral("palettes"))),
+			toStringList(request.value(QStringLiteral("blends"))),
+			toStringList(request.value(QStringLiteral("shifts"))),
+			request.value(QStringLiteral("allRanges")).toBool(false));
+
+		const auto& output = request.value(QStringLiteral("output")).toString();
+		const auto& outputDir = request.value(QStringLiteral("outputDir")).toString();
+		const bool vanityPlate = request.value(QStringLiteral("vanityPlate")).toBool(true);
+
+		if (!output.isEmpty() && transforms.count() != 1)
+			throw spec_error{"An output file may only be specified for a single transform"};
+
+		if (!outputDir.isEmpty() && !QDir{}.mkpath(outputDir))
+			throw spec_error{QString{"Could not create output directory: %1"}.arg(outputDir)};
+
+		for (const auto& transform : transforms)
+		{
+			auto result = transform.apply(image, colorMap(transform, keyPalette));
+			const auto& fileName = outputFileName(sourceName, transform.fileNameSuffix(keyPaletteId));
+
+			if (output.isEmpty() && outputDir.isEmpty()) {
+				const auto& data = MosIO::writePngData(result, vanityPlate);
+
+				if (data.isEmpty()) {
+					failed.emplaceBack(fileName);
+					continue;
+				}
+
+				QCborMap item;
+
+				item.insert(QStringLiteral("name"), fileName);
+				item.insert(QStringLiteral("data"), data);
+
+				outputs.append(item);
+				continue;
+			}
+
+			const auto& filePath = output.isEmpty()
+								   ? QString{outputDir % '/' % fileName}
+								   : output;
+
+			if (MosIO::writePng(result, filePath, vanityPlate)) {
+				files.append(filePath);
+			} else {
+				failed.emplaceBack(filePath);
+			}
+		}
+
+		if (!failed.isEmpty())
+			throw spec_error{QString{"Could not write %1"}.arg(failed.join(", "))};
+	} catch (const spec_error& e) {
+		response.insert(QStringLiteral("ok"), false);
+		response.insert(QStringLiteral("error"), e.message);
+	}
+
+	if (!response.contains(QStringLiteral("ok")))
+		response.insert(QStringLiteral("ok"), true);
+
+	response.insert(QStringLiteral("files"), files);
+
+	if (!outputs.isEmpty())
+		response.insert(QStringLiteral("outputs"), outputs);
+
+	return response;
+}
+
+QImage RecolorRequestHandler::loadSource(const QCborMap& request, QString& sourceName)
+{
+	const auto& data = request.value(QStringLiteral("data"));
+	const auto& source = request.value(QStringLiteral("source"));
+
+	QString cacheKey;
+	QDateTime lastModified;
+	qint64 size = -1;
+
+	if (data.isByteArray()) {
+		sourceName = request.value(QStringLiteral("name")).toString("image.png");
+		cacheKey = "data:" % QString::fromLatin1(
+			QCryptographicHash::hash(data.toByteArray(), QCryptographicHash::Sha1).toHex());
+	} else if (source.isString()) {
+		const QFileInfo info{source.toString()};
+
+		if (!info.isFile())
+			throw spec_error{QString{"Source image not found: %1"}.arg(source.toString())};
+
+		sourceName = source.toString();
+		cacheKey = "file:" % info.absoluteFilePath();
+		lastModified = info.lastModified();
+		size = info.size();
+	} else {
+		throw spec_error{"No source image specified"};
+	}
+
+	{
+		QMutexLocker lock{&sourceCacheMutex_};
+
+		const auto* cached = sourceCache_.object(cacheKey);
+
+		if (cached && cached->lastModified == lastModified && cached->size == size)
+			return cached->image;
+	}
+
+	QImage image;
+
+	if (data.isByteArray()) {
+		image = QImage::fromData(data.toByteArray());
+	} else {
+		image.load(sourceName);
+	}
+
+	if (image.isNull())
+		throw spec_error{QString{"Could not read source image: %1"}.arg(sourceName)};
+
+	// We want to work on actual ARGB data
+	image.convertTo(QImage::Format_ARGB32);
+
+	QMutexLocker lock{&sourceCacheMutex_};
+
+	sourceCache_.insert(cacheKey,
+						new CachedSource{image, lastModified, size},
+						int(qMax<qsizetype>(1, image.sizeInBytes() / 1024)));
+
+	return image;
+}
+
+ColorMap RecolorRequestHandler::colorMap(const Transform& transform, const ColorList& keyPalette)
+{
+	if (transform.type() != Transform::ColorRangeType &&
+		transform.type() != Transform::PaletteSwapType)
+	{
+		return {};
+	}
+
+	QByteArray key;
+	QDataStream out{&key, QIODevice::WriteOnly};
+
+	out << keyPalette;
+	key.append(transform.stampData());
+
+	{
+		QMutexLocker lock{&colorMapCacheMutex_};
+
+		if (const auto* cached = colorMapCache_.object(key))
+			return *cached;
+	}
+
+	const auto& colorMap = transform.colorMap(keyPalette);
+
+	QMutexLocker lock{&colorMapCacheMutex_};
+
+	colorMapCache_.insert(key, new ColorMap{colorMap});
+
+	return colorMap;
+}
+
+} // end namespace MosBatch
@@ -0,0 +1,145 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include "batch.hpp"
+
+#include <QCache>
+#include <QCborMap>
+#include <QDateTime>
+#include <QMutex>
+
+class QIODevice;
+
+namespace MosBatch {
+
+//
+// Recolor service protocol.
+//
+// The service accepts recolor requests from local clients (e.g. build
+// systems) over a local socket, avoiding process startup costs for every
+// image and keeping decoded sources and color maps cached between requests.
+//
+// Messages in both directions are CBOR maps, each preceded by its length as
+// a 32-bit big-endian unsigned integer. Messages longer than maxMessageSize
+// are rejected.
+//
+// Requests may contain the following keys:
+//
+//   id            Arbitrary value copied into the response.
+//   source        Source image path.
+//   data          Source image contents, used instead of source.
+//   name          File name used for output naming when data is given.
+//   keyPalette    Key palette specification (default: magenta).
+//   ranges        Array of color range specifications.
+//   allRanges     Whether to apply all built-in color ranges.
+//   palettes      Array of palette swap specifications.
+//   blends        Array of color blend specifications.
+//   shifts        Array of color shift specifications.
+//   output        Output file path, only valid for a single transform.
+//   outputDir     Output directory, using Wespal's standard file names.
+//   vanityPlate   Whether to include the Wespal version in PNG files
+//                 (default: true).
+//
+// Specifications use the same syntax as wespal-cli's options. If neither
+// output nor outputDir are given, the generated PNG files are returned in the
+// response instead.
+//
+// Responses contain the following keys:
+//
+//   id            Copied from the request.
+//   ok            Whether every output was generated successfully.
+//   error         Error message if ok is false.
+//   files         Array of output paths written.
+//   outputs       Array of maps with name and data keys for inline output.
+//
+
+/** Maximum size of a single message, to protect against misbehaving clients. */
+constexpr qsizetype maxMessageSize = 512 * 1024 * 1024;
+
+/**
+ * Returns the default local server name for the recolor service.
+ */
+QString defaultServerName();
+
+/**
+ * Writes a framed message to a device.
+ */
+void writeMessage(QIODevice& device, const QCborMap& message);
+
+/**
+ * Extracts the first complete framed message from a buffer, if any.
+ *
+ * @param buffer       Data received so far. The message is removed from it.
+ * @param message      Receives the message.
+ *
+ * @return Whether a complete message was available. This is always false if
+ *         the next message is oversized, see isMessageOversized().
+ */
+bool takeMessage(QByteArray& buffer, QCborMap& message);
+
+/**
+ * Returns whether the next framed message in a buffer is declared to be
+ * longer than maxMessageSize.
+ *
+ * Such a message can never be taken from the buffer, so the connection it
+ * came from should be dropped.
+ */
+bool isMessageOversized(const QByteArray& buffer);
+
+/**
+ * Handles recolor service requests.
+ *
+ * Decoded source images and color maps are cached between requests. All
+ * members are safe to call from multiple threads at once.
+ */
+class RecolorRequestHandler
+{
+public:
+	RecolorRequestHandler();
+
+	RecolorRequestHandler(const RecolorRequestHandler&) = delete;
+	RecolorRequestHandler& operator=(const RecolorRequestHandler&) = delete;
+
+	/**
+	 * Handles a single request synchronously.
+	 */
+	QCborMap handleRequest(const QCborMap& request);
+
+private:
+	struct CachedSource
+	{
+		QImage image;
+		QDateTime lastModified;
+		qint64 size;
+	};
+
+	QImage loadSource(const QCborMap& request, QString& sourceName);
+	ColorMap colorMap(const Transform& transform, const ColorList& keyPalette);
+
+	QMutex sourceCacheMutex_;
+	QCache<QString, CachedSource> sourceCache_;
+
+	QMutex colorMapCacheMutex_;
+	QCache<QByteArray, ColorMap> colorMapCache_;
+};
+
+} // end namespace MosBatch
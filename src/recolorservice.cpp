@@ -0,0 +1,108 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "recolorservice.hpp"
+
+#include <QLocalSocket>
+#include <QPointer>
+
+namespace MosBatch {
+
+RecolorServer::RecolorServer(int threadCount, QObject* parent)
+	: QObject(parent)
+	, server_()
+	, buffers_()
+	, handler_()
+	, pool_(threadCount)
+{
+	server_.setSocketOptions(QLocalServer::UserAccessOption);
+
+	connect(&server_, &QLocalServer::newConnection, this, &RecolorServer::onNewConnection);
+}
+
+bool RecolorServer::listen(const QString& name)
+{
+	if (server_.listen(name))
+		return true;
+
+	if (server_.serverError() != QAbstractSocket::AddressInUseError)
+		return false;
+
+	// The socket may have been left behind by a server that crashed. Only
+	// remove it if there is nobody listening on the other end.
+	QLocalSocket probe;
+	probe.connectToServer(name);
+
+	if (probe.waitForConnected(1000))
+		return false;
+
+	QLocalServer::removeServer(name);
+
+	return server_.listen(name);
+}
+
+void RecolorServer::onNewConnection()
+{
+	while (server_.hasPendingConnections())
+	{
+		auto* socket = server_.nextPendingConnection();
+
+		buffers_.insert(socket, {});
+
+		connect(socket, &QLocalSocket::readyRead, this, [this, socket]() {
+			onReadyRead(socket);
+		});
+		connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+			buffers_.remove(socket);
+			socket->deleteLater();
+		});
+	}
+}
+
+void RecolorServer::onReadyRead(QLocalSocket* socket)
+{
+	auto& buffer = buffers_[socket];
+
+	buffer.append(socket->readAll());
+
+	QCborMap request;
+
+	while (takeMessage(buffer, request))
+	{
+		QPointer<QLocalSocket> target{socket};
+
+		pool_.submit([this, request, target]() {
+			const auto& response = handler_.handleRequest(request);
+
+			// Sockets may only be used from the thread they live in
+			QMetaObject::invokeMethod(this, [target, response]() {
+				if (target)
+					writeMessage(*target, response);
+			}, Qt::QueuedConnection);
+		});
+	}
+
+	if (isMessageOversized(buffer)) {
+		buffers_.remove(socket);
+		socket->abort();
+	}
+}
+
+} // end namespace MosBatch
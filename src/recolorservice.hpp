@@ -0,0 +1,92 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include "recolorprotocol.hpp"
+#include "threadpool.hpp"
+
+#include <QHash>
+#include <QLocalServer>
+
+class QLocalSocket;
+
+namespace MosBatch {
+
+/**
+ * Local recolor service.
+ *
+ * This serves requests as described in recolorprotocol.hpp over a
+ * QLocalServer socket.
+ *
+ * Each request is handled as a task on a work-stealing thread pool, so
+ * requests from multiple clients (or multiple requests pipelined on the same
+ * connection) are processed in parallel. Responses on a connection may thus
+ * arrive in a different order than their requests.
+ */
+class RecolorServer : public QObject
+{
+	Q_OBJECT
+
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param threadCount  Number of worker threads, or zero to use the
+	 *                     number of logical CPU cores.
+	 * @param parent       Parent object.
+	 */
+	explicit RecolorServer(int threadCount = 0, QObject* parent = nullptr);
+
+	/**
+	 * Starts listening for connections.
+	 */
+	bool listen(const QString& name);
+
+	QString errorString() const
+	{
+		return server_.errorString();
+	}
+
+	QString fullServerName() const
+	{
+		return server_.fullServerName();
+	}
+
+	int threadCount() const
+	{
+		return pool_.threadCount();
+	}
+
+private:
+	void onNewConnection();
+	void onReadyRead(QLocalSocket* socket);
+
+	QLocalServer server_;
+	QHash<QLocalSocket*, QByteArray> buffers_;
+
+	RecolorRequestHandler handler_;
+
+	// This must be destroyed first so that no tasks are left running that
+	// might still use the handler's caches.
+	WorkStealingPool pool_;
+};
+
+} // end namespace MosBatch
@@ -26,11 +26,13 @@
 #include "colorlistinputdialog.hpp"
 #include "defs.hpp"
 #include "paletteitem.hpp"
+#include "perfmetrics.hpp"
 #include "util.hpp"
 
 #include <QCloseEvent>
 #include <QColorDialog>
 #include <QFileDialog>
+#include <QLocale>
 #include <QMessageBox>
 #include <QMenu>
 #include <QStandardPaths>
@@ -124,6 +126,7 @@ void SettingsDialog::changeEvent(QEvent* event)
 void SettingsDialog::onDialogAccepted()
 {
 	auto& config = MosCurrentConfig();
+	MosConfig::Manager::Transaction transaction{config};
 
 	qreal defaultZoom = ui->defaultZoomList->currentData().toReal();
 
@@ -131,6 +134,7 @@ void SettingsDialog::onDialogAccepted()
 	config.setRememberImageViewMode(ui->rememberImageViewModeCheckbox->isChecked());
 	config.setDefaultZoom(defaultZoom);
 	config.setPngVanityPlate(ui->vanityPlateCheckbox->isChecked());
+	config.setImageMemoryBudget(ui->memoryBudgetSpin->value());
 	config.setCustomColorRanges(ranges_);
 	config.setCustomPalettes(palettes_);
 }
@@ -311,6 +315,11 @@ void SettingsDialog::initGeneralPage()
 	}
 
 	ui->vanityPlateCheckbox->setChecked(config.pngVanityPlate());
+
+	ui->memoryBudgetSpin->setValue(config.imageMemoryBudget());
+	ui->memoryUsageLabel->setText(
+		tr("Images currently use %1 of memory.")
+			.arg(QLocale{}.formattedDataSize(MosMetrics::totalMemoryUsage())));
 }
 
 //
@@ -0,0 +1,204 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "sourcewatcher.hpp"
+
+#include "batch.hpp"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSet>
+
+namespace MosBatch {
+
+SourceWatcher::SourceWatcher(QObject* parent)
+	: QObject(parent)
+	, watcher_()
+	, debounceTimer_()
+	, paths_()
+	, excludedDirPath_()
+	, outputSuffixes_()
+	, snapshot_()
+{
+	debounceTimer_.setSingleShot(true);
+	debounceTimer_.setInterval(defaultDebounceInterval);
+
+	connect(&debounceTimer_, &QTimer::timeout, this, &SourceWatcher::rescan);
+
+	// Restarting the timer on every notification coalesces bursts
+	connect(&watcher_, &QFileSystemWatcher::fileChanged,
+			&debounceTimer_, qOverload<>(&QTimer::start));
+	connect(&watcher_, &QFileSystemWatcher::directoryChanged,
+			&debounceTimer_, qOverload<>(&QTimer::start));
+}
+
+void SourceWatcher::setPaths(const QStringList& paths)
+{
+	debounceTimer_.stop();
+
+	const auto& watchedFiles = watcher_.files();
+	const auto& watchedDirs = watcher_.directories();
+
+	if (!watchedFiles.isEmpty())
+		watcher_.removePaths(watchedFiles);
+	if (!watchedDirs.isEmpty())
+		watcher_.removePaths(watchedDirs);
+
+	paths_.clear();
+
+	for (const auto& path : paths)
+		paths_.emplaceBack(QDir::cleanPath(QFileInfo{path}.absoluteFilePath()));
+
+	snapshot_.clear();
+
+	if (paths_.isEmpty())
+		return;
+
+	QStringList dirPaths;
+
+	snapshot_ = scan(dirPaths);
+
+	if (!dirPaths.isEmpty())
+		watcher_.addPaths(dirPaths);
+	if (!snapshot_.isEmpty())
+		watcher_.addPaths(snapshot_.keys());
+}
+
+void SourceWatcher::setExcludedDirectory(const QString& dirPath)
+{
+	excludedDirPath_ = dirPath.isEmpty()
+					   ? QString{}
+					   : QDir::cleanPath(QDir{dirPath}.absolutePath());
+}
+
+bool SourceWatcher::isExcluded(const QString& path, const QString& rootPath) const
+{
+	return !excludedDirPath_.isEmpty() &&
+		   isInsideDirectory(excludedDirPath_, rootPath) &&
+		   (path == excludedDirPath_ ||
+			isInsideDirectory(path, excludedDirPath_));
+}
+
+SourceWatcher::Snapshot SourceWatcher::scan(QStringList& dirPaths) const
+{
+	Snapshot snapshot;
+
+	const auto& nameFilters = imageFileNameFilters();
+
+	for (const auto& path : paths_)
+	{
+		const QFileInfo info{path};
+
+		if (!info.isDir()) {
+			// Many editors save by writing a new file and renaming it over
+			// the old one, which only the parent directory is notified of.
+			dirPaths.emplaceBack(info.absolutePath());
+
+			if (info.exists())
+				snapshot.insert(path, {info.lastModified(), info.size()});
+
+			continue;
+		}
+
+		dirPaths.emplaceBack(path);
+
+		QDirIterator dirs{path,
+						  QDir::Dirs | QDir::NoDotAndDotDot,
+						  QDirIterator::Subdirectories};
+
+		while (dirs.hasNext())
+		{
+			const auto& dirPath = dirs.next();
+
+			if (!isExcluded(dirPath, path))
+				dirPaths.emplaceBack(dirPath);
+		}
+
+		QDirIterator files{path,
+						   nameFilters,
+						   QDir::Files | QDir::Readable,
+						   QDirIterator::Subdirectories};
+
+		while (files.hasNext())
+		{
+			const auto& fileInfo = files.nextFileInfo();
+
+			if (isExcluded(fileInfo.absolutePath(), path) ||
+				isOutputFileName(fileInfo.fileName(), outputSuffixes_))
+			{
+				continue;
+			}
+
+			snapshot.insert(fileInfo.absoluteFilePath(),
+							{fileInfo.lastModified(), fileInfo.size()});
+		}
+	}
+
+	dirPaths.removeDuplicates();
+
+	return snapshot;
+}
+
+void SourceWatcher::rescan()
+{
+	QStringList dirPaths;
+	auto snapshot = scan(dirPaths);
+
+	QStringList changedFiles;
+
+	for (auto it = snapshot.constBegin(); it != snapshot.constEnd(); ++it)
+	{
+		if (snapshot_.value(it.key()) != it.value())
+			changedFiles.emplaceBack(it.key());
+	}
+
+	// Start watching directories and files that were just created, and
+	// re-add files that were replaced (which drops them from the watcher).
+	QStringList newPaths;
+	const auto& files = watcher_.files();
+	const auto& dirs = watcher_.directories();
+	const QSet<QString> watchedFiles{files.cbegin(), files.cend()};
+	const QSet<QString> watchedDirs{dirs.cbegin(), dirs.cend()};
+
+	for (const auto& dirPath : dirPaths)
+	{
+		if (!watchedDirs.contains(dirPath))
+			newPaths.emplaceBack(dirPath);
+	}
+
+	for (auto it = snapshot.constBegin(); it != snapshot.constEnd(); ++it)
+	{
+		if (!watchedFiles.contains(it.key()))
+			newPaths.emplaceBack(it.key());
+	}
+
+	if (!newPaths.isEmpty())
+		watcher_.addPaths(newPaths);
+
+	snapshot_ = std::move(snapshot);
+
+	if (!changedFiles.isEmpty()) {
+		changedFiles.sort();
+		emit changed(changedFiles);
+	}
+}
+
+} // end namespace MosBatch
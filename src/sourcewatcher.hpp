@@ -0,0 +1,146 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QStringList>
+#include <QTimer>
+
+namespace MosBatch {
+
+/**
+ * Monitors image files and directory trees for changes.
+ *
+ * File system notifications tend to arrive in bursts while an editor is
+ * writing a file (truncate, several writes, or a write to a temporary file
+ * followed by a rename). Notifications are therefore coalesced until none
+ * have arrived for a short interval, after which the watched paths are
+ * rescanned and files that are new or whose size or modification time
+ * changed are reported in a single changed() signal.
+ */
+class SourceWatcher : public QObject
+{
+	Q_OBJECT
+
+public:
+	/** Default debounce interval in milliseconds. */
+	static constexpr int defaultDebounceInterval = 100;
+
+	explicit SourceWatcher(QObject* parent = nullptr);
+
+	/**
+	 * Sets the files and directories to watch.
+	 *
+	 * Directories are watched recursively for files in any format supported
+	 * by QImageReader. Files that exist at this point are not reported as
+	 * changed until they are modified.
+	 */
+	void setPaths(const QStringList& paths);
+
+	const QStringList& paths() const
+	{
+		return paths_;
+	}
+
+	/**
+	 * Stops watching all paths.
+	 */
+	void clear()
+	{
+		setPaths({});
+	}
+
+	/**
+	 * Sets a directory whose contents are not reported, e.g. an output
+	 * directory located inside a watched directory.
+	 *
+	 * As with collectSources(), this only applies to watched directories
+	 * that contain it. Watched directories that are the excluded directory
+	 * itself or are located inside it are watched as usual.
+	 */
+	void setExcludedDirectory(const QString& dirPath);
+
+	/**
+	 * Sets output file name suffixes of files that are never reported.
+	 *
+	 * Files named like outputs of the current job (see isOutputFileName())
+	 * are ignored wherever they are, so that writing outputs into a watched
+	 * directory does not cause them to be processed as sources in turn.
+	 */
+	void setOutputSuffixes(const QStringList& suffixes)
+	{
+		outputSuffixes_ = suffixes;
+	}
+
+	void setDebounceInterval(int msec)
+	{
+		debounceTimer_.setInterval(msec);
+	}
+
+signals:
+	/**
+	 * Emitted when watched files are created or modified.
+	 *
+	 * @param filePaths    Absolute paths of the affected files.
+	 */
+	void changed(const QStringList& filePaths);
+
+private:
+	struct FileStamp
+	{
+		QDateTime lastModified;
+		qint64 size = -1;
+
+		bool operator==(const FileStamp& other) const
+		{
+			return lastModified == other.lastModified && size == other.size;
+		}
+
+		bool operator!=(const FileStamp& other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	using Snapshot = QHash<QString, FileStamp>;
+
+	void rescan();
+
+	/**
+	 * Scans all watched paths, returning the current state of every file and
+	 * the list of directories that need to be monitored.
+	 */
+	Snapshot scan(QStringList& dirPaths) const;
+
+	bool isExcluded(const QString& path, const QString& rootPath) const;
+
+	QFileSystemWatcher watcher_;
+	QTimer debounceTimer_;
+
+	QStringList paths_;
+	QString excludedDirPath_;
+	QStringList outputSuffixes_;
+	Snapshot snapshot_;
+};
+
+} // end namespace MosBatch
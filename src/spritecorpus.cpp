@@ -0,0 +1,182 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "spritecorpus.hpp"
+
+#include "defs.hpp"
+
+#include <QDir>
+#include <QPainter>
+#include <QPainterPath>
+
+#include <iterator>
+
+namespace MosBench {
+
+namespace {
+
+quint32 hash(int x, int y, int seed)
+{
+	auto h = quint32(x) * 0x8da6b343u ^ quint32(y) * 0xd8163841u ^ quint32(seed) * 0xcb1ab31fu;
+	h ^= h >> 13;
+	h *= 0x5bd1e995u;
+	h ^= h >> 15;
+	return h;
+}
+
+// Weighted towards 72x72, the size of most mainline unit sprites
+constexpr int spriteSizes[] = { 72, 72, 72, 72, 96, 108, 128, 144, 192, 256 };
+
+// Animation strip frame sizes
+constexpr int stripFrameSizes[] = { 72, 72, 96 };
+
+// Non-team colors: skin, leather, steel, cloth
+constexpr QRgb baseColors[] = {
+	0xFFC8946E, 0xFF7A5230, 0xFF8C96A0, 0xFF3C5A32, 0xFF5A3C28, 0xFFB4B4A0,
+};
+
+} // end unnamed namespace
+
+QImage syntheticSprite(int size, int seed, int phase)
+{
+	const auto& keyPalette = wesnoth::builtinPalettes["magenta"];
+
+	QImage image{size, size, QImage::Format_ARGB32_Premultiplied};
+	image.fill(Qt::transparent);
+
+	const auto h0 = hash(seed, phase, 0);
+	const qreal s = size;
+	const qreal bob = qreal(phase % 4 == 1 || phase % 4 == 2 ? 1 : 0) * s / 72.0;
+
+	const QRectF body{
+		s * (0.32 + 0.04 * (h0 & 3) / 3.0),
+		s * 0.30 + bob,
+		s * (0.30 + 0.06 * ((h0 >> 2) & 3) / 3.0),
+		s * 0.42,
+	};
+	const QRectF head{body.center().x() - s * 0.08, body.top() - s * 0.15, s * 0.16, s * 0.16};
+	const auto skin = QColor::fromRgb(baseColors[0]);
+	const auto gear = QColor::fromRgb(baseColors[1 + (h0 >> 4) % (std::size(baseColors) - 1)]);
+
+	{
+		QPainter p{&image};
+
+		p.setRenderHint(QPainter::Antialiasing);
+
+		// Drop shadow
+		p.setPen(Qt::NoPen);
+		p.setBrush(QColor{0, 0, 0, 60});
+		p.drawEllipse(QRectF{s * 0.25, s * 0.80, s * 0.50, s * 0.10});
+
+		// Legs, body and head with dark outlines
+		p.setPen(QPen{QColor{24, 18, 12}, qMax(1.0, s / 72.0)});
+		p.setBrush(gear.darker(130));
+		p.drawRect(QRectF{body.left() + body.width() * 0.15, body.bottom() - s * 0.02,
+						  body.width() * 0.25, s * 0.12});
+		p.drawRect(QRectF{body.right() - body.width() * 0.40, body.bottom() - s * 0.02,
+						  body.width() * 0.25, s * 0.12});
+		p.setBrush(gear);
+		p.drawRoundedRect(body, s * 0.06, s * 0.06);
+		p.setBrush(skin);
+		p.drawEllipse(head);
+
+		// Weapon
+		p.setPen(QPen{QColor::fromRgb(baseColors[2]), qMax(1.5, s / 40.0), Qt::SolidLine, Qt::RoundCap});
+		p.drawLine(QPointF{body.right(), body.center().y()},
+				   QPointF{body.right() + s * 0.15, body.top() - s * (0.05 + 0.02 * (phase % 3))});
+	}
+
+	// Team color tabard, using exact key palette colors without any
+	// antialiasing so that every pixel in it gets recolored
+	QPainterPath tabard;
+	tabard.moveTo(body.left() + body.width() * 0.2, body.top() + body.height() * 0.1);
+	tabard.lineTo(body.right() - body.width() * 0.2, body.top() + body.height() * 0.1);
+	tabard.lineTo(body.right() - body.width() * 0.1, body.bottom() - body.height() * 0.05);
+	tabard.lineTo(body.left() + body.width() * 0.1, body.bottom() - body.height() * 0.05);
+	tabard.closeSubpath();
+
+	const auto tabardBounds = tabard.boundingRect();
+	const auto top = int(tabardBounds.top());
+	const auto bottom = int(tabardBounds.bottom());
+
+	for (int y = qMax(0, top); y <= qMin(size - 1, bottom); ++y)
+	{
+		auto* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+
+		for (int x = 0; x < size; ++x)
+		{
+			if (!tabard.contains(QPointF{x + 0.5, y + 0.5}))
+				continue;
+
+			// Shade from light to dark, with some dithering
+			const auto shade = (y - top) * keyPalette.size() / qMax(1, bottom - top + 1);
+			const auto dither = hash(x, y, seed) % 3;
+			const auto index = qBound<qsizetype>(0, shade + dither - 1, keyPalette.size() - 1);
+
+			line[x] = keyPalette[index] | 0xFF000000U;
+		}
+	}
+
+	return image.convertToFormat(QImage::Format_ARGB32);
+}
+
+QList<SpriteFile> generateSpriteCorpus(const QString& dirPath,
+									   int spriteCount,
+									   int stripCount)
+{
+	QList<SpriteFile> corpus;
+	const QDir dir{dirPath};
+
+	for (int i = 0; i < spriteCount; ++i)
+	{
+		const auto size = spriteSizes[hash(i, 0, 1) % std::size(spriteSizes)];
+		const auto fileName = QString{"sprite-%1-%2.png"}.arg(i, 4, 10, QChar{'0'}).arg(size);
+		const auto path = dir.filePath(fileName);
+
+		if (syntheticSprite(size, i).save(path, "PNG"))
+			corpus.append({path, {size, size}, 1});
+	}
+
+	for (int i = 0; i < stripCount; ++i)
+	{
+		const auto size = stripFrameSizes[hash(i, 0, 2) % std::size(stripFrameSizes)];
+		const auto frames = 4 + int(hash(i, 0, 3) % 5);
+		const auto fileName = QString{"strip-%1-%2x%3.png"}.arg(i, 4, 10, QChar{'0'}).arg(size).arg(frames);
+		const auto path = dir.filePath(fileName);
+
+		QImage strip{size * frames, size, QImage::Format_ARGB32};
+		strip.fill(Qt::transparent);
+
+		{
+			QPainter p{&strip};
+			p.setCompositionMode(QPainter::CompositionMode_Source);
+
+			for (int frame = 0; frame < frames; ++frame)
+				p.drawImage(frame * size, 0, syntheticSprite(size, spriteCount + i, frame));
+		}
+
+		if (strip.save(path, "PNG"))
+			corpus.append({path, {size, size}, frames});
+	}
+
+	return corpus;
+}
+
+} // end namespace MosBench
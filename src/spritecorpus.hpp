@@ -0,0 +1,77 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QImage>
+#include <QList>
+#include <QSize>
+#include <QString>
+
+namespace MosBench {
+
+//
+// Synthetic sprite corpus resembling Wesnoth unit art.
+//
+// Sprites are mostly transparent, with an antialiased silhouette, a team
+// color region painted using the exact colors of the magenta key palette,
+// and darker outlines. Animation strips place several such frames side by
+// side. Generation is deterministic so that results are comparable between
+// runs and machines.
+//
+
+/**
+ * A generated sprite file.
+ */
+struct SpriteFile
+{
+	QString path;
+	/** Size of a single frame. */
+	QSize frameSize;
+	/** Number of frames, greater than one for animation strips. */
+	int frames;
+};
+
+/**
+ * Generates the sprite corpus.
+ *
+ * Sprite sizes range from 72x72 to 256x256 pixels, with 72x72 being the
+ * most common as in mainline. Animation strips use 72x72 or 96x96 frames.
+ *
+ * @param dirPath      Output directory, which must exist.
+ * @param spriteCount  Number of single-frame sprites.
+ * @param stripCount   Number of animation strips.
+ *
+ * @return The generated files. Files that could not be written are omitted.
+ */
+QList<SpriteFile> generateSpriteCorpus(const QString& dirPath,
+									   int spriteCount,
+									   int stripCount);
+
+/**
+ * Returns a synthetic unit sprite.
+ *
+ * @param size         Sprite width and height.
+ * @param seed         Selects the sprite's shape and colors.
+ * @param phase        Animation phase, which offsets the pose slightly.
+ */
+QImage syntheticSprite(int size, int seed, int phase = 0);
+
+} // end namespace MosBench
@@ -0,0 +1,146 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "startuptimeline.hpp"
+
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QList>
+#include <QTextStream>
+#include <QTimer>
+#include <QWidget>
+
+#include <cstring>
+
+namespace MosStartup {
+
+namespace {
+
+struct Phase
+{
+	QString name;
+	qint64 nsecs;
+};
+
+bool timelineEnabled = false;
+bool timelineReported = false;
+QElapsedTimer timer;
+QList<Phase> phases;
+qint64 lastPhaseNsecs = 0;
+
+void printPhase(QTextStream& stream, const Phase& phase, qint64 previousNsecs)
+{
+	stream << qSetFieldWidth(10) << Qt::right << Qt::fixed << qSetRealNumberPrecision(1)
+		   << phase.nsecs / 1e6 << qSetFieldWidth(0) << " ms  "
+		   << qSetFieldWidth(10) << (phase.nsecs - previousNsecs) / 1e6
+		   << qSetFieldWidth(0) << " ms  " << phase.name << Qt::endl;
+}
+
+/**
+ * Waits for the first frame of a window to be painted.
+ */
+class FirstFrameWatcher : public QObject
+{
+public:
+	explicit FirstFrameWatcher(QWidget* window)
+		: QObject(window)
+	{
+		window->installEventFilter(this);
+	}
+
+	virtual bool eventFilter(QObject* watched, QEvent* event) override
+	{
+		if (event->type() == QEvent::UpdateRequest) {
+			watched->removeEventFilter(this);
+
+			// The frame is painted after this event is handled
+			QTimer::singleShot(0, watched, []() {
+				mark("First frame painted");
+				report();
+			});
+
+			deleteLater();
+		}
+
+		return false;
+	}
+
+private:
+	static void report()
+	{
+		QTextStream stream{stderr};
+
+		stream << "Startup timeline (total, delta, phase):" << Qt::endl;
+
+		for (const auto& phase : phases)
+		{
+			printPhase(stream, phase, lastPhaseNsecs);
+			lastPhaseNsecs = phase.nsecs;
+		}
+
+		phases.clear();
+		timelineReported = true;
+	}
+};
+
+} // end unnamed namespace
+
+void start(int argc, char* argv[])
+{
+	timelineEnabled = qEnvironmentVariableIntValue("WESPAL_STARTUP_TIMELINE") != 0;
+
+	for (int i = 1; i < argc && !timelineEnabled; ++i)
+	{
+		if (std::strcmp(argv[i], timelineOption) == 0)
+			timelineEnabled = true;
+	}
+
+	if (timelineEnabled)
+		timer.start();
+}
+
+bool enabled()
+{
+	return timelineEnabled;
+}
+
+void mark(const QString& phase)
+{
+	if (!timelineEnabled)
+		return;
+
+	Phase entry{phase, timer.nsecsElapsed()};
+
+	if (timelineReported) {
+		entry.name += QStringLiteral(" (deferred)");
+		printPhase(entry, lastPhaseNsecs);
+		lastPhaseNsecs = entry.nsecs;
+	} else {
+		phases.append(entry);
+	}
+}
+
+void reportAfterFirstFrame(QWidget* window)
+{
+	if (timelineEnabled && !timelineReported)
+		new FirstFrameWatcher{window};
+}
+
+} // end namespace MosStartup
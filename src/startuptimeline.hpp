@@ -0,0 +1,67 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QString>
+
+class QWidget;
+
+/**
+ * Startup timeline for profiling purposes.
+ *
+ * When enabled via the WESPAL_STARTUP_TIMELINE environment variable or the
+ * --startup-timeline command line option, the time at which each startup
+ * phase completes is reported on stderr once the main window has finished
+ * painting its first frame. Work deferred until after startup is reported
+ * as it happens.
+ *
+ * All functions are no-ops if the timeline is not enabled.
+ */
+namespace MosStartup {
+
+/**
+ * Command line option enabling the startup timeline.
+ */
+inline constexpr char timelineOption[] = "--startup-timeline";
+
+/**
+ * Starts the startup timeline if enabled.
+ *
+ * This should be called as early as possible in main().
+ */
+void start(int argc, char* argv[]);
+
+/**
+ * Returns whether the startup timeline is enabled.
+ */
+bool enabled();
+
+/**
+ * Records the completion of a startup phase.
+ */
+void mark(const QString& phase);
+
+/**
+ * Reports the timeline after the first frame of @a window has been painted.
+ */
+void reportAfterFirstFrame(QWidget* window);
+
+} // end namespace MosStartup
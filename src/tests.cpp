@@ -22,15 +22,48 @@
 
 #include "tests.hpp"
 
+#include "batch.hpp"
+#include "batchspec.hpp"
+#include "appconfig.hpp"
 #include "defs.hpp"
+#include "psdconversion_p.h"
+#ifdef MOS_ENABLE_BUILTIN_IMAGE_PLUGINS
+#include "psd_p.h"
+#endif
 #include "recentfiles.hpp"
+#include "recolorprotocol.hpp"
+#include "sourcewatcher.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
 #include "wesnothrc.hpp"
 
+#include <QBuffer>
+#include <QCborArray>
 #include <QColorSpace>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QScopeGuard>
+#include <QSettings>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtEndian>
+
+#include <memory>
 
 QTEST_MAIN(TestMorningStar)
 ;
 
+void TestMorningStar::initTestCase()
+{
+	// Keep the config manager away from the user's actual settings
+	QStandardPaths::setTestModeEnabled(true);
+}
+
 namespace {
 
 constexpr unsigned SWATCH_SIZE = 19;
@@ -87,6 +120,97 @@ constexpr std::array<unsigned, SWATCH_SIZE> magentaSwatch{
 
 static_assert(magentaSwatch.size() == tcSwatches[0].size());
 
+/**
+ * Changes the current working directory for the duration of a test, as the
+ * command line tools' default output directory is relative to it.
+ */
+class CurrentDirectoryGuard
+{
+public:
+	explicit CurrentDirectoryGuard(const QString& path)
+		: previousPath_(QDir::currentPath())
+	{
+		QDir::setCurrent(path);
+	}
+
+	~CurrentDirectoryGuard()
+	{
+		QDir::setCurrent(previousPath_);
+	}
+
+	CurrentDirectoryGuard(const CurrentDirectoryGuard&) = delete;
+	CurrentDirectoryGuard& operator=(const CurrentDirectoryGuard&) = delete;
+
+private:
+	QString previousPath_;
+};
+
+/**
+ * Prepares an image for comparison against a decoder reference image.
+ *
+ * Pixels are premultiplied so that fully transparent pixels compare equal
+ * regardless of their color, which decoders are free to leave undefined.
+ */
+QImage comparableImage(QImage image)
+{
+	image.convertTo(QImage::Format_ARGB32_Premultiplied);
+	image.setColorSpace({});
+
+	return image;
+}
+
+/**
+ * Compares a decoded image with its reference image.
+ *
+ * @param name         Fixture name, for failure messages.
+ * @param image        Decoded image.
+ * @param reference    Reference image.
+ * @param tolerance    Largest difference allowed between channel values.
+ */
+void compareImages(const QString& name, const QImage& image, const QImage& reference, int tolerance = 0)
+{
+	QVERIFY2(!image.isNull(), qPrintable(name));
+
+	const auto& comparable = comparableImage(image);
+	const auto& comparableReference = comparableImage(reference);
+
+	QCOMPARE(comparable.size(), comparableReference.size());
+
+	int error = 0;
+
+	for (int y = 0; y < comparable.height(); ++y)
+	{
+		const auto* line = reinterpret_cast<const QRgb*>(comparable.constScanLine(y));
+		const auto* referenceLine = reinterpret_cast<const QRgb*>(comparableReference.constScanLine(y));
+
+		for (int x = 0; x < comparable.width(); ++x)
+		{
+			error = qMax(error, qAbs(qRed(line[x]) - qRed(referenceLine[x])));
+			error = qMax(error, qAbs(qGreen(line[x]) - qGreen(referenceLine[x])));
+			error = qMax(error, qAbs(qBlue(line[x]) - qBlue(referenceLine[x])));
+			error = qMax(error, qAbs(qAlpha(line[x]) - qAlpha(referenceLine[x])));
+		}
+	}
+
+	QVERIFY2(error <= tolerance, qPrintable(QString{"%1: channel error %2"}.arg(name).arg(error)));
+}
+
+/**
+ * Decodes a fixture from tests/ and compares it with its reference image.
+ *
+ * @param name         Fixture name, which is also the base name of its file.
+ * @param format       Format and extension of the fixture.
+ * @param tolerance    Largest difference allowed between channel values.
+ */
+void compareWithReference(const QString& name, const char* format, int tolerance = 0)
+{
+	const auto pathImage = QFINDTESTDATA(QString{"../tests/%1.%2"}.arg(name, QString{format}));
+	const auto pathReference = QFINDTESTDATA(QString{"../tests/%1-reference.png"}.arg(name));
+	QVERIFY2(!pathImage.isEmpty() && !pathReference.isEmpty(), qPrintable(name));
+
+	compareImages(name, QImage{pathImage, format}, QImage{pathReference, "PNG"}, tolerance);
+}
+
 } // end unnamed namespace
 
 void TestMorningStar::testBuiltinObjects()
@@ -389,6 +513,268 @@ void TestMorningStar::testMru()
 	QCOMPARE((subject.begin() + 1)->filePath(), QFINDTESTDATA(newMru[1]));
 }
 
+void TestMorningStar::testMruThumbnailCache()
+{
+	using namespace MosConfig;
+
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+
+	const auto cachePath = dir.filePath("thumbnails.cache");
+
+	const QString redPath = QFINDTESTDATA("../tests/magenta-palette-RC-magenta-1-red.png");
+	const QString bluePath = QFINDTESTDATA("../tests/magenta-palette-RC-magenta-2-blue.png");
+
+	MruList mru;
+
+	mru.push(redPath, QImage{redPath, "PNG"});
+	mru.push(bluePath, QImage{bluePath, "PNG"});
+
+	QVERIFY(ThumbnailCache::save(cachePath, mru));
+
+	// Thumbnails are not loaded until requested
+	bool loaded = false;
+	MruEntry entry{redPath, MruEntry::ThumbnailLoader{[&]() {
+		loaded = true;
+		return ThumbnailCache{cachePath}.thumbnail(redPath);
+	}}};
+
+	QVERIFY(entry.thumbnailPending());
+	QVERIFY(!loaded);
+
+	QCOMPARE(entry.thumbnail(), mru.back().thumbnail());
+	QVERIFY(loaded);
+	QVERIFY(!entry.thumbnailPending());
+	QCOMPARE(entry.miniThumbnail(), mru.back().miniThumbnail());
+
+	ThumbnailCache cache{cachePath};
+
+	QVERIFY(cache.contains(bluePath));
+	QCOMPARE(cache.thumbnail(bluePath), mru.front().thumbnail());
+	QVERIFY(!cache.contains("nonexistent.png"));
+	QVERIFY(cache.thumbnail("nonexistent.png").isNull());
+
+	// Invalid cache files are treated as empty
+	QFile garbage{dir.filePath("garbage.cache")};
+	QVERIFY(garbage.open(QIODevice::WriteOnly));
+	garbage.write("WSPT\xff\xff\xff\xff and then some");
+	garbage.close();
+
+	QVERIFY(!ThumbnailCache{garbage.fileName()}.contains(redPath));
+
+	// Box filter downscaling preserves aspect ratio and flat colors
+	QImage flat{1000, 500, QImage::Format_ARGB32};
+	flat.fill(qRgb(200, 100, 50));
+
+	const auto flatThumbnail = MruEntry::generateThumbnail(flat);
+
+	QCOMPARE(flatThumbnail.size(), QSize(72, 36));
+	QCOMPARE(flatThumbnail.convertedTo(QImage::Format_ARGB32).pixel(35, 17),
+			 flat.pixel(0, 0));
+
+	// Non-premultiplied sources are premultiplied on the fly, which must
+	// match converting them up front (save for rounding)
+	QImage gradient{300, 300, QImage::Format_ARGB32};
+
+	for (int y = 0; y < gradient.height(); ++y)
+	{
+		for (int x = 0; x < gradient.width(); ++x)
+			gradient.setPixel(x, y, qRgba(x % 256, y % 256, (x * y) % 256, (x + y) % 256));
+	}
+
+	const auto directThumbnail = MruEntry::generateThumbnail(gradient);
+	const auto convertedThumbnail = MruEntry::generateThumbnail(
+		gradient.convertedTo(QImage::Format_ARGB32_Premultiplied));
+
+	QCOMPARE(directThumbnail.format(), QImage::Format_ARGB32_Premultiplied);
+	QCOMPARE(directThumbnail.size(), convertedThumbnail.size());
+
+	for (int y = 0; y < directThumbnail.height(); ++y)
+	{
+		auto* direct = reinterpret_cast<const QRgb*>(directThumbnail.constScanLine(y));
+		auto* converted = reinterpret_cast<const QRgb*>(convertedThumbnail.constScanLine(y));
+
+		for (int x = 0; x < directThumbnail.width(); ++x)
+		{
+			for (int shift = 0; shift < 32; shift += 8)
+			{
+				const int a = int((direct[x] >> shift) & 0xFF);
+				const int b = int((converted[x] >> shift) & 0xFF);
+
+				QVERIFY2(qAbs(a - b) <= 1, qPrintable(QString{"Pixel %1,%2"}.arg(x).arg(y)));
+			}
+		}
+	}
+}
+
+void TestMorningStar::testRecentFileThumbnails()
+{
+	using namespace MosConfig;
+
+	auto& config = Manager::instance();
+
+	const QString redPath = QFINDTESTDATA("../tests/magenta-palette-RC-magenta-1-red.png");
+	const QString bluePath = QFINDTESTDATA("../tests/magenta-palette-RC-magenta-2-blue.png");
+	const QImage redImage{redPath, "PNG"};
+	const QImage blueImage{bluePath, "PNG"};
+
+	config.clearRecentFiles();
+
+	// The entry is added right away, but the thumbnail only arrives later in
+	// the main thread, so that one cannot be available yet
+	auto readyCount = std::make_shared<int>(0);
+
+	config.addRecentFile(redPath, redImage, [readyCount]() { ++*readyCount; });
+
+	QCOMPARE(config.recentFiles().count(), 1);
+	QCOMPARE(config.recentFiles().front().filePath(), redPath);
+	QVERIFY(config.recentFiles().front().thumbnail().isNull());
+
+	QTRY_COMPARE(*readyCount, 1);
+	QCOMPARE(config.recentFiles().front().thumbnail(),
+			 MruEntry::generateThumbnail(redImage));
+
+	// Re-adding a file moves it to the top, keeping its old thumbnail until
+	// the new one is ready
+	config.addRecentFile(bluePath, blueImage, [readyCount]() { ++*readyCount; });
+	config.addRecentFile(redPath, blueImage, [readyCount]() { ++*readyCount; });
+
+	QCOMPARE(config.recentFiles().count(), 2);
+	QCOMPARE(config.recentFiles().front().filePath(), redPath);
+	QCOMPARE(config.recentFiles().front().thumbnail(),
+			 MruEntry::generateThumbnail(redImage));
+
+	QTRY_COMPARE(*readyCount, 3);
+	QCOMPARE(config.recentFiles().front().thumbnail(),
+			 MruEntry::generateThumbnail(blueImage));
+	QCOMPARE(config.recentFiles().back().filePath(), bluePath);
+	QCOMPARE(config.recentFiles().back().thumbnail(),
+			 MruEntry::generateThumbnail(blueImage));
+
+	// Thumbnails for entries that went away in the meantime are dropped
+	config.addRecentFile(bluePath, blueImage, [readyCount]() { ++*readyCount; });
+	config.clearRecentFiles();
+
+	config.sync();
+	QTest::qWait(50);
+
+	QCOMPARE(*readyCount, 3);
+	QVERIFY(config.recentFiles().empty());
+}
+
+void TestMorningStar::testColorLibrary()
+{
+	using namespace MosConfig;
+
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+
+	const auto libraryPath = dir.filePath("config/color-library.dat");
+
+	QMap<QString, ColorRange> colorRanges;
+	QMap<QString, ColorList> palettes;
+
+	QCOMPARE(readColorLibrary(libraryPath, colorRanges, palettes), ColorLibraryMissing);
+
+	// Migration from the application settings used by 0.5.x and earlier
+	{
+		QSettings legacy{dir.filePath("legacy.ini"), QSettings::IniFormat};
+
+		legacy.beginWriteArray("color_ranges");
+		legacy.setArrayIndex(0);
+		legacy.setValue("id", "sunset");
+		legacy.setValue("avg", 0xFF8000U);
+		legacy.setValue("max", 0xFFFF00U);
+		legacy.setValue("min", 0x200000U);
+		legacy.setValue("rep", 0xFF4000U);
+		// Color ranges from before 0.5 have no representative color
+		legacy.setArrayIndex(1);
+		legacy.setValue("id", "ancient");
+		legacy.setValue("avg", 0x00FF00U);
+		legacy.setValue("max", 0xFFFFFFU);
+		legacy.setValue("min", 0x000000U);
+		legacy.endArray();
+
+		legacy.beginWriteArray("palettes");
+		legacy.setArrayIndex(0);
+		legacy.setValue("id", "fire");
+		legacy.setValue("values", "16711680,16744448,16776960");
+		legacy.endArray();
+
+		readLegacyColorLibrary(legacy, colorRanges, palettes);
+	}
+
+	const QMap<QString, ColorRange> expectedColorRanges{
+		{ "sunset", { 0xFF8000U, 0xFFFF00U, 0x200000U, 0xFF4000U } },
+		{ "ancient", { 0x00FF00U, 0xFFFFFFU, 0x000000U, 0x00FF00U } },
+	};
+	const QMap<QString, ColorList> expectedPalettes{
+		{ "fire", { 0xFF0000U, 0xFF8000U, 0xFFFF00U } },
+	};
+
+	QCOMPARE(colorRanges, expectedColorRanges);
+	QCOMPARE(palettes, expectedPalettes);
+
+	// Round trip
+	QVERIFY(writeColorLibrary(libraryPath, colorRanges, palettes));
+
+	colorRanges.clear();
+	palettes.clear();
+
+	QCOMPARE(readColorLibrary(libraryPath, colorRanges, palettes), ColorLibraryOk);
+	QCOMPARE(colorRanges, expectedColorRanges);
+	QCOMPARE(palettes, expectedPalettes);
+
+	// Damaged or unknown files are reported as such and leave the output
+	// untouched
+	QFile libraryFile{libraryPath};
+	QVERIFY(libraryFile.open(QIODevice::ReadOnly));
+	const auto contents = libraryFile.readAll();
+	libraryFile.close();
+
+	auto newerVersion = contents;
+	newerVersion[7] = 2;
+
+	const QList<QByteArray> unreadable{
+		contents.first(contents.size() - 3),
+		contents + "more",
+		newerVersion,
+		"garbage",
+		{},
+	};
+
+	const auto damagedPath = dir.filePath("damaged.dat");
+
+	for (const auto& data : unreadable)
+	{
+		QFile damaged{damagedPath};
+		QVERIFY(damaged.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		damaged.write(data);
+		damaged.close();
+
+		QCOMPARE(readColorLibrary(damagedPath, colorRanges, palettes), ColorLibraryUnreadable);
+		QCOMPARE(colorRanges, expectedColorRanges);
+		QCOMPARE(palettes, expectedPalettes);
+	}
+
+	// Backups copy the file once and never replace an existing one
+	const auto backupPath = backUpColorLibrary(damagedPath);
+
+	QCOMPARE(backupPath, damagedPath + ".bak");
+
+	QFile backup{backupPath};
+	QVERIFY(backup.open(QIODevice::ReadOnly));
+	QCOMPARE(backup.readAll(), unreadable.last());
+	backup.close();
+
+	QVERIFY(QFile::remove(damagedPath));
+	QVERIFY(QFile::copy(libraryPath, damagedPath));
+	QCOMPARE(backUpColorLibrary(damagedPath), backupPath);
+
+	QVERIFY(backup.open(QIODevice::ReadOnly));
+	QCOMPARE(backup.readAll(), unreadable.last());
+}
+
 void TestMorningStar::testUniqueColorsFromImage()
 {
 	using namespace wesnoth;
@@ -409,6 +795,247 @@ void TestMorningStar::testUniqueColorsFromImage()
 	QCOMPARE(result, reference);
 }
 
+void TestMorningStar::testXcfTransparentPixels()
+{
+	if (!QImageReader::supportedImageFormats().contains("xcf"))
+		QSKIP("XCF support is not available in this build");
+
+	// A white background under a Subtract (legacy) layer filled with opaque
+	// red, save for its first pixel, which is fully transparent. Subtract has
+	// no QPainter equivalent, so this goes through the span kernel, which must
+	// skip that pixel and carry on with the rest of the layer.
+	auto pathXcf = QFINDTESTDATA("../tests/xcf-subtract-transparent.xcf");
+	QVERIFY(!pathXcf.isEmpty());
+
+	QImage image{pathXcf, "xcf"};
+	QVERIFY(!image.isNull());
+	QCOMPARE(image.size(), QSize(8, 2));
+
+	image.convertTo(QImage::Format_ARGB32);
+
+	for (int y = 0; y < image.height(); ++y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+		{
+			const auto expected = x == 0 && y == 0 ? qRgb(255, 255, 255) : qRgb(0, 255, 255);
+
+			QCOMPARE(image.pixel(x, y), expected);
+		}
+	}
+}
+
+void TestMorningStar::testXcfLayerComposition()
+{
+	if (!QImageReader::supportedImageFormats().contains("xcf"))
+		QSKIP("XCF support is not available in this build");
+
+	// Generated using:
+	//   utils/make-decoder-fixtures
+	// which describes the layers of each file. Together these cover several
+	// rows of tiles with a short last one, masked layers in both the copy and
+	// merge paths, and layers at negative and positive offsets.
+	for (const auto& name : { "xcf-tile-rows", "xcf-masked-base" })
+	{
+		compareWithReference(name, "xcf");
+
+		if (QTest::currentTestFailed())
+			return;
+	}
+}
+
+void TestMorningStar::testXcfSkippedLayers()
+{
+	if (!QImageReader::supportedImageFormats().contains("xcf"))
+		QSKIP("XCF support is not available in this build");
+
+	// Generated using:
+	//   utils/make-decoder-fixtures
+	// These contain hidden, off-canvas and fully transparent layers, which
+	// are skipped without being decoded, and layers starting above and to
+	// the left of the canvas, whose first rows and columns of tiles are
+	// skipped. An off-canvas layer may still have to initialize the image.
+	for (const auto& name : { "xcf-skipped-layers", "xcf-hidden-base" })
+	{
+		compareWithReference(name, "xcf");
+
+		if (QTest::currentTestFailed())
+			return;
+	}
+}
+
+namespace {
+
+/**
+ * The PSD plugin's original double precision CMYK conversion, which the
+ * integer version must match exactly.
+ */
+template<class T>
+T cmykChannelReference(T ink, T key)
+{
+	const auto max = double(std::numeric_limits<T>::max());
+	const auto C = 1 - ink / max;
+	const auto K = 1 - key / max;
+
+	return T(std::min(max - (C * (1 - K) + K) * max + 0.5, max));
+}
+
+template<class T>
+void checkCmykConversion(const QList<T>& cmyk)
+{
+	const auto width = qint32(cmyk.size() / 4);
+	QList<T> rgba(cmyk.size());
+
+	cmykToRgb<T>(reinterpret_cast<uchar*>(rgba.data()), 4,
+				 reinterpret_cast<const char*>(cmyk.constData()), 4, width);
+
+	for (qint32 x = 0; x < width; ++x)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			const auto expected = cmykChannelReference<T>(cmyk[x * 4 + c], cmyk[x * 4 + 3]);
+
+			if (rgba[x * 4 + c] != expected) {
+				QFAIL(qPrintable(QString{"CMYK %1,%2,%3,%4 channel %5: got %6, expected %7"}
+								 .arg(cmyk[x * 4]).arg(cmyk[x * 4 + 1]).arg(cmyk[x * 4 + 2])
+								 .arg(cmyk[x * 4 + 3]).arg(c).arg(rgba[x * 4 + c]).arg(expected)));
+			}
+		}
+	}
+}
+
+/**
+ * Compares labToRgb() against labToRgbDouble(), returning the largest
+ * difference found in any channel.
+ */
+template<class T>
+int labConversionError(const QList<T>& lab)
+{
+	const auto width = qint32(lab.size() / 3);
+	QList<T> fast(width * 4);
+	QList<T> reference(width * 4);
+
+	labToRgb<T>(reinterpret_cast<uchar*>(fast.data()), 4,
+				reinterpret_cast<const char*>(lab.constData()), 3, width);
+	labToRgbDouble<T>(reinterpret_cast<uchar*>(reference.data()), 4,
+					  reinterpret_cast<const char*>(lab.constData()), 3, width);
+
+	int error = 0;
+
+	for (qsizetype i = 0; i < fast.size(); ++i)
+		error = qMax(error, qAbs(int(fast[i]) - int(reference[i])));
+
+	return error;
+}
+
+} // end unnamed namespace
+
+void TestMorningStar::testPsdCmykConversion()
+{
+	// 8-bit: every ink and key combination
+	QList<quint8> cmyk8;
+
+	for (int k = 0; k < 256; ++k)
+	{
+		for (int ink = 0; ink < 256; ++ink)
+			cmyk8 << quint8(ink) << quint8(255 - ink) << quint8(ink / 2) << quint8(k);
+	}
+
+	checkCmykConversion(cmyk8);
+
+	// 16-bit: the extremes, plus a deterministic random sample
+	QList<quint16> cmyk16{0, 65535, 32767, 0, 65535, 0, 32768, 65535, 1, 65534, 257, 32768};
+	QRandomGenerator random{1234};
+
+	for (int i = 0; i < 1 << 18; ++i)
+		cmyk16 << quint16(random.bounded(65536));
+
+	checkCmykConversion(cmyk16);
+}
+
+void TestMorningStar::testPsdLabConversion()
+{
+	// 8-bit: every possible input, one L* value at a time
+	QList<quint8> lab8;
+	lab8.reserve(3 * 256 * 256);
+
+	int error8 = 0;
+
+	for (int l = 0; l < 256; ++l)
+	{
+		lab8.clear();
+
+		for (int a = 0; a < 256; ++a)
+		{
+			for (int b = 0; b < 256; ++b)
+				lab8 << quint8(l) << quint8(a) << quint8(b);
+		}
+
+		error8 = qMax(error8, labConversionError(lab8));
+	}
+
+	QVERIFY2(error8 <= kLab8Tolerance, qPrintable(QString{"8-bit Lab error %1"}.arg(error8)));
+
+	// 16-bit inputs go straight to labToRgbDouble(), so there is nothing to
+	// compare for them
+}
+
+void TestMorningStar::testPsdPlanes()
+{
+	if (!QImageReader::supportedImageFormats().contains("psd"))
+		QSKIP("PSD support is not available in this build");
+
+	struct Fixture
+	{
+		QString name;
+		int tolerance;
+	};
+
+	// Generated using:
+	//   utils/make-decoder-fixtures
+	// These need all channels of a scanline at once to be converted, and
+	// their heights are not multiples of the bands decoded in parallel. The
+	// Lab reference uses the double precision conversion, which the plugin
+	// only approximates for 8-bit channels.
+	const QList<Fixture> fixtures{
+		{ "psd-rgba-packbits", 0 },
+		{ "psd-cmyk-packbits", 0 },
+		{ "psd-cmyk-raw", 0 },
+		{ "psd-lab-packbits", kLab8Tolerance },
+	};
+
+	for (const auto& [name, tolerance] : fixtures)
+	{
+		// From a file, whose channel planes are used in place
+		compareWithReference(name, "psd", tolerance);
+
+		if (QTest::currentTestFailed())
+			return;
+
+		QFile file{QFINDTESTDATA(QString{"../tests/%1.psd"}.arg(name))};
+		QVERIFY2(file.open(QIODevice::ReadOnly), qPrintable(name));
+
+		const auto data = file.readAll();
+		const QImage reference{QFINDTESTDATA(QString{"../tests/%1-reference.png"}.arg(name)), "PNG"};
+
+		// From a buffer, whose channel planes are read into memory at once
+		compareImages(name, QImage::fromData(data, "PSD"), reference, tolerance);
+
+		if (QTest::currentTestFailed())
+			return;
+
+#ifdef MOS_ENABLE_BUILTIN_IMAGE_PLUGINS
+		// From a buffer, one stride at a time as if the planes were too large
+		psdSetMaxPlanesSize(0);
+		const auto restoreMaxPlanesSize = qScopeGuard([] { psdSetMaxPlanesSize(-1); });
+
+		compareImages(name + " (strides)", QImage::fromData(data, "PSD"), reference, tolerance);
+
+		if (QTest::currentTestFailed())
+			return;
+#endif
+	}
+}
+
 void TestMorningStar::testWriteBase64()
 {
 	using namespace wesnoth;
@@ -426,3 +1053,629 @@ void TestMorningStar::testWriteBase64()
 
 	QCOMPARE(imgMagentaSwatch, imgDecoded);
 }
+
+void TestMorningStar::testBatchFileNames()
+{
+	using namespace MosBatch;
+
+	const QString sourcePath = "../tests/magenta-palette.png";
+
+	QCOMPARE(outputFileName(sourcePath, colorRangeSuffix("magenta", 7, "orange")),
+			 "magenta-palette-RC-magenta-7-orange.png");
+	QCOMPARE(outputFileName(sourcePath, paletteSwapSuffix("magenta", "flag_green")),
+			 "magenta-palette-PAL-magenta-flag_green.png");
+	QCOMPARE(outputFileName(sourcePath, colorBlendSuffix(QColor{127, 89, 32}, 0.5)),
+			 "magenta-palette-BLEND-7f5920-50.png");
+	QCOMPARE(outputFileName(sourcePath, colorShiftSuffix(-228, 90, 164)),
+			 "magenta-palette-CS--228-90-164.png");
+
+	// Transforms must agree with the reference test data naming
+	const auto& transform = Transform::colorRange("orange", 7, wesnoth::builtinColorRanges["orange"]);
+
+	QCOMPARE(outputFileName(sourcePath, transform.fileNameSuffix("magenta")),
+			 "magenta-palette-RC-magenta-7-orange.png");
+}
+
+void TestMorningStar::testBatchCollectSources()
+{
+	using namespace MosBatch;
+
+	QTemporaryDir baseDir;
+	QVERIFY(baseDir.isValid());
+
+	QImage image{8, 8, QImage::Format_ARGB32};
+	image.fill(Qt::magenta);
+
+	QVERIFY(QDir{baseDir.path()}.mkpath("units/human/out"));
+	QVERIFY(image.save(baseDir.filePath("top.png")));
+	QVERIFY(image.save(baseDir.filePath("units/human/spearman.png")));
+	QVERIFY(image.save(baseDir.filePath("units/human/out/spearman-RC-magenta-1-red.png")));
+
+	CurrentDirectoryGuard cwd{baseDir.path()};
+
+	auto sourcePaths = [](const QList<Source>& sources) {
+		QStringList paths;
+		for (const auto& source : sources)
+			paths.emplaceBack(QDir::current().relativeFilePath(source.path));
+		paths.sort();
+		return paths;
+	};
+
+	// The default output directory contains the inputs, so nothing is skipped
+	auto sources = collectSources({"units"}, ".");
+
+	QCOMPARE(sourcePaths(sources), QStringList({
+		"units/human/out/spearman-RC-magenta-1-red.png",
+		"units/human/spearman.png",
+	}));
+
+	for (const auto& source : sources)
+	{
+		if (source.path.endsWith("spearman.png"))
+			QCOMPARE(source.outputDir, "human");
+	}
+
+	QCOMPARE(collectSources({"."}, ".").count(), 3);
+	QCOMPARE(collectSources({"units/human"}, "units").count(), 2);
+
+	// Only an output directory inside an input directory is skipped
+	sources = collectSources({"units"}, "units/human/out");
+
+	QCOMPARE(sourcePaths(sources), QStringList({"units/human/spearman.png"}));
+	QCOMPARE(sources.first().outputDir, "units/human/out/human");
+
+	// Outputs of the current job are never sources, wherever they are
+	const QStringList suffixes{colorRangeSuffix("magenta", 1, "red")};
+
+	QVERIFY(isOutputFileName("spearman-RC-magenta-1-red.png", suffixes));
+	QVERIFY(!isOutputFileName("-RC-magenta-1-red.png", suffixes));
+	QVERIFY(!isOutputFileName("spearman-RC-magenta-1-red.png", {}));
+	QVERIFY(!isOutputFileName("spearman-RC-magenta-1-blue.png", suffixes));
+
+	QVERIFY(image.save(baseDir.filePath("units/human/spearman-RC-magenta-1-red.png")));
+
+	sources = collectSources({"units"}, ".", suffixes);
+
+	QCOMPARE(sourcePaths(sources), QStringList({"units/human/spearman.png"}));
+
+	// Output directory is the input directory
+	sources = collectSources({"units/human"}, "units/human", suffixes);
+
+	QCOMPARE(sourcePaths(sources), QStringList({"units/human/spearman.png"}));
+	QCOMPARE(sources.first().outputDir, "units/human");
+
+	// Other jobs' outputs are regular sources
+	QCOMPARE(collectSources({"units/human"}, "units/human",
+							{colorRangeSuffix("magenta", 2, "blue")}).count(), 3);
+}
+
+void TestMorningStar::testBatchSpecs()
+{
+	using namespace MosBatch;
+
+	QCOMPARE(parseColor("#FF00FF"), 0xFF00FFU);
+	QCOMPARE(parseColor("7f5920"), 0x7F5920U);
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseColor("FF00F"));
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseColor("0x1234"));
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseColor("+12345"));
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseColor("#12 345"));
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseColor("magenta"));
+
+	const auto& [paletteId, palette] = parsePalette("flag_green");
+
+	QCOMPARE(paletteId, "flag_green");
+	QCOMPARE(palette, wesnoth::builtinPalettes["flag_green"]);
+	QVERIFY_THROWS_EXCEPTION(spec_error, parsePalette("nonexistent"));
+
+	// Built-in ranges go first, then palettes, blends and shifts
+	const auto& transforms = parseTransforms({"teal", "custom=FF0000,FFFFFF,000000"},
+											 {"ellipse_red"},
+											 {"7f5920,0.5"},
+											 {"-228,90,164"});
+
+	QCOMPARE(transforms.count(), 5);
+	QCOMPARE(transforms[0].fileNameSuffix("magenta"), "RC-magenta-9-teal");
+	QCOMPARE(transforms[1].fileNameSuffix("magenta"),
+			 QString{"RC-magenta-%1-custom"}.arg(firstCustomRangeOrdinal() + 1));
+	QCOMPARE(transforms[2].fileNameSuffix("magenta"), "PAL-magenta-ellipse_red");
+	QCOMPARE(transforms[3].fileNameSuffix("magenta"), "BLEND-7f5920-50");
+	QCOMPARE(transforms[4].fileNameSuffix("magenta"), "CS--228-90-164");
+
+	// No transforms at all means all built-in color ranges
+	QCOMPARE(parseTransforms({}, {}, {}, {}).count(),
+			 wesnoth::builtinColorRanges.objectCount());
+
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseTransforms({"custom=FF0000"}, {}, {}, {}));
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseTransforms({}, {}, {"7f5920,2"}, {}));
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseTransforms({}, {}, {}, {"0,0,256"}));
+
+	// Overlapping selections only write each output once
+	QCOMPARE(parseTransforms({"red", "teal", "red"}, {}, {}, {}, true).count(),
+			 wesnoth::builtinColorRanges.objectCount());
+	QCOMPARE(parseTransforms({}, {"ellipse_red", "ellipse_red"},
+							 {"7f5920,0.5", "#7F5920,0.5"}, {"1,2,3", "1,2,3"}).count(), 3);
+
+	// ...but different transforms that would write the same outputs are
+	// refused
+	QVERIFY_THROWS_EXCEPTION(spec_error, parseTransforms({}, {"mine=FF0000", "mine=00FF00"}, {}, {}));
+}
+
+void TestMorningStar::testWorkStealingPool()
+{
+	using namespace MosBatch;
+
+	constexpr int outerTasks = 64;
+	constexpr int innerTasks = 16;
+
+	std::atomic<int> counter = 0;
+
+	WorkStealingPool pool{4};
+
+	QCOMPARE(pool.threadCount(), 4);
+
+	for (int i = 0; i < outerTasks; ++i)
+	{
+		pool.submit([&]() {
+			for (int j = 0; j < innerTasks; ++j)
+				pool.submit([&]() { ++counter; });
+			++counter;
+		});
+	}
+
+	pool.wait();
+
+	QCOMPARE(counter.load(), outerTasks * (innerTasks + 1));
+
+	// The pool must be reusable after a wait
+	pool.submit([&]() { ++counter; });
+	pool.wait();
+
+	QCOMPARE(counter.load(), outerTasks * (innerTasks + 1) + 1);
+}
+
+void TestMorningStar::testRecolorProtocolFraming()
+{
+	using namespace MosBatch;
+
+	QCborMap first;
+	first.insert(QStringLiteral("id"), 1);
+	first.insert(QStringLiteral("ranges"), QCborArray{"red", "blue"});
+
+	QCborMap second;
+	second.insert(QStringLiteral("id"), 2);
+
+	QByteArray stream;
+
+	{
+		QBuffer device{&stream};
+		QVERIFY(device.open(QIODevice::WriteOnly));
+		writeMessage(device, first);
+		writeMessage(device, second);
+	}
+
+	const auto firstSize = qsizetype(sizeof(quint32)) + first.toCborValue().toCbor().size();
+
+	QCOMPARE(stream.size(), firstSize + qsizetype(sizeof(quint32)) + second.toCborValue().toCbor().size());
+
+	// Partial frames (header, then part of the body) must be left alone
+	QCborMap message;
+
+	for (qsizetype size : {qsizetype(0), qsizetype(2), qsizetype(4), firstSize - 1})
+	{
+		auto buffer = stream.left(size);
+
+		QVERIFY(!takeMessage(buffer, message));
+		QCOMPARE(buffer.size(), size);
+		QVERIFY(!isMessageOversized(buffer));
+	}
+
+	// Complete frames are taken one at a time, leaving any remainder behind
+	auto buffer = stream.left(stream.size() - 1);
+
+	QVERIFY(takeMessage(buffer, message));
+	QCOMPARE(message, first);
+	QCOMPARE(buffer, stream.mid(firstSize, stream.size() - firstSize - 1));
+	QVERIFY(!takeMessage(buffer, message));
+
+	buffer.append(stream.back());
+
+	QVERIFY(takeMessage(buffer, message));
+	QCOMPARE(message, second);
+	QVERIFY(buffer.isEmpty());
+
+	// Oversized frames are detected from their header alone and never taken
+	const auto oversize = qToBigEndian<quint32>(quint32(maxMessageSize + 1));
+
+	buffer = QByteArray{reinterpret_cast<const char*>(&oversize), sizeof(oversize)};
+	buffer.append(16, '\0');
+
+	QVERIFY(isMessageOversized(buffer));
+	QVERIFY(!takeMessage(buffer, message));
+	QCOMPARE(buffer.size(), qsizetype(sizeof(oversize) + 16));
+}
+
+void TestMorningStar::testRecolorRequests()
+{
+	using namespace MosBatch;
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QVERIFY(!pathMagentaSwatch.isEmpty());
+
+	auto pathOrangeSwatch = QFINDTESTDATA("../tests/magenta-palette-RC-magenta-7-orange.png");
+	QVERIFY(!pathOrangeSwatch.isEmpty());
+
+	QImage reference{pathOrangeSwatch};
+	reference.convertTo(QImage::Format_ARGB32);
+
+	QFile sourceFile{pathMagentaSwatch};
+	QVERIFY(sourceFile.open(QIODevice::ReadOnly));
+
+	RecolorRequestHandler handler;
+
+	// Inline data in, inline data out
+	{
+		QCborMap request;
+		request.insert(QStringLiteral("id"), 42);
+		request.insert(QStringLiteral("data"), sourceFile.readAll());
+		request.insert(QStringLiteral("name"), QStringLiteral("magenta-palette.png"));
+		request.insert(QStringLiteral("ranges"), QCborArray{"orange"});
+
+		const auto& response = handler.handleRequest(request);
+
+		QCOMPARE(response.value(QStringLiteral("id")).toInteger(), qint64(42));
+		QVERIFY(response.value(QStringLiteral("ok")).toBool());
+		QVERIFY(response.value(QStringLiteral("files")).toArray().isEmpty());
+
+		const auto& outputs = response.value(QStringLiteral("outputs")).toArray();
+
+		QCOMPARE(outputs.size(), 1);
+
+		const auto& output = outputs.at(0).toMap();
+
+		QCOMPARE(output.value(QStringLiteral("name")).toString(),
+				 "magenta-palette-RC-magenta-7-orange.png");
+
+		auto image = QImage::fromData(output.value(QStringLiteral("data")).toByteArray(), "PNG");
+		image.convertTo(QImage::Format_ARGB32);
+
+		QCOMPARE(image, reference);
+	}
+
+	// Source path in, files written to an output directory
+	QTemporaryDir outputDir;
+	QVERIFY(outputDir.isValid());
+
+	{
+		QCborMap request;
+		request.insert(QStringLiteral("id"), QStringLiteral("abc"));
+		request.insert(QStringLiteral("source"), pathMagentaSwatch);
+		request.insert(QStringLiteral("outputDir"), outputDir.path());
+		request.insert(QStringLiteral("ranges"), QCborArray{"orange", "red"});
+
+		const auto& response = handler.handleRequest(request);
+
+		QCOMPARE(response.value(QStringLiteral("id")).toString(), "abc");
+		QVERIFY(response.value(QStringLiteral("ok")).toBool());
+		QVERIFY(!response.contains(QStringLiteral("outputs")));
+
+		const auto& files = response.value(QStringLiteral("files")).toArray();
+
+		QCOMPARE(files.size(), 2);
+		QCOMPARE(files.at(0).toString(),
+				 outputDir.filePath("magenta-palette-RC-magenta-7-orange.png"));
+
+		QImage image{files.at(0).toString()};
+		image.convertTo(QImage::Format_ARGB32);
+
+		QCOMPARE(image, reference);
+	}
+
+	// Errors are reported in the response
+	{
+		QCborMap request;
+		request.insert(QStringLiteral("id"), 7);
+		request.insert(QStringLiteral("output"), outputDir.filePath("single.png"));
+		request.insert(QStringLiteral("source"), pathMagentaSwatch);
+		request.insert(QStringLiteral("ranges"), QCborArray{"orange", "red"});
+
+		const auto& response = handler.handleRequest(request);
+
+		QCOMPARE(response.value(QStringLiteral("id")).toInteger(), qint64(7));
+		QVERIFY(!response.value(QStringLiteral("ok")).toBool());
+		QVERIFY(!response.value(QStringLiteral("error")).toString().isEmpty());
+	}
+
+	{
+		const auto& response = handler.handleRequest(QCborMap{});
+
+		QVERIFY(!response.value(QStringLiteral("ok")).toBool());
+	}
+}
+
+void TestMorningStar::testBatchIncremental()
+{
+	using namespace MosBatch;
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QVERIFY(!pathMagentaSwatch.isEmpty());
+
+	QTemporaryDir outputDir;
+	QVERIFY(outputDir.isValid());
+
+	const auto& orange = wesnoth::builtinColorRanges["orange"];
+
+	Options options;
+	options.keyPalette = wesnoth::builtinPalettes["magenta"];
+	options.incremental = true;
+	// The other transforms are identical to the first save for their names,
+	// and run concurrently with it, so that deduplication has to deal with
+	// identical outputs that are still being encoded.
+	options.transforms = {
+		Transform::colorRange("orange", 7, orange),
+		Transform::colorRange("copy", 16, orange),
+		Transform::colorRange("copy2", 17, orange),
+		Transform::colorRange("copy3", 18, orange),
+	};
+
+	const QList<Source> sources{ Source{pathMagentaSwatch, outputDir.path()} };
+
+	WorkStealingPool pool{4};
+
+	{
+		Processor processor{options};
+		const auto& result = processor.run(sources, pool);
+
+		QVERIFY(result.failed.isEmpty());
+		QCOMPARE(result.succeeded.count(), 4);
+		QCOMPARE(result.deduplicated.count(), 3);
+		QVERIFY(result.upToDate.isEmpty());
+		QVERIFY(QFileInfo::exists(outputDir.filePath(Manifest::fileName)));
+	}
+
+	{
+		Processor processor{options};
+		const auto& result = processor.run(sources, pool);
+
+		QVERIFY(result.failed.isEmpty());
+		QVERIFY(result.succeeded.isEmpty());
+		QCOMPARE(result.upToDate.count(), 4);
+	}
+
+	// Changing a transform's parameters must invalidate its stamp only
+	options.transforms[1] = Transform::colorRange("copy", 16, wesnoth::builtinColorRanges["teal"]);
+
+	{
+		Processor processor{options};
+		const auto& result = processor.run(sources, pool);
+
+		QVERIFY(result.failed.isEmpty());
+		QCOMPARE(result.succeeded.count(), 1);
+		QCOMPARE(result.upToDate.count(), 3);
+	}
+}
+
+void TestMorningStar::testSourceWatcher()
+{
+	using namespace MosBatch;
+
+	auto pathMagentaSwatch = QFINDTESTDATA("../tests/magenta-palette.png");
+	QVERIFY(!pathMagentaSwatch.isEmpty());
+
+	QTemporaryDir watchDir;
+	QVERIFY(watchDir.isValid());
+
+	const auto& filePath = QFileInfo{watchDir.filePath("unit.png")}.absoluteFilePath();
+	const auto& otherFilePath = QFileInfo{watchDir.filePath("other.png")}.absoluteFilePath();
+
+	QVERIFY(QFile::copy(pathMagentaSwatch, filePath));
+
+	SourceWatcher watcher;
+	QSignalSpy spy{&watcher, &SourceWatcher::changed};
+
+	watcher.setPaths({watchDir.path()});
+
+	// Rewrite the file with different contents, then create a new one
+	QImage image{filePath};
+	QVERIFY(image.save(filePath, "PNG", 0));
+	QVERIFY(QFile::copy(pathMagentaSwatch, otherFilePath));
+
+	QVERIFY(spy.wait(5000));
+
+	// Both changes are expected to be coalesced into a single notification,
+	// although slow file systems may deliver them separately.
+	QStringList changed;
+
+	for (const auto& args : spy)
+		changed += args.at(0).toStringList();
+
+	if (!changed.contains(otherFilePath) || !changed.contains(filePath)) {
+		QVERIFY(spy.wait(5000));
+		changed += spy.last().at(0).toStringList();
+	}
+
+	QVERIFY(changed.contains(filePath));
+	QVERIFY(changed.contains(otherFilePath));
+}
+
+void TestMorningStar::testSourceWatcherExclusion()
+{
+	using namespace MosBatch;
+
+	QTemporaryDir baseDir;
+	QVERIFY(baseDir.isValid());
+	QVERIFY(QDir{baseDir.path()}.mkpath("units/out"));
+
+	CurrentDirectoryGuard cwd{baseDir.path()};
+
+	QImage image{8, 8, QImage::Format_ARGB32};
+	image.fill(Qt::magenta);
+
+	const auto& filePath = QDir::current().absoluteFilePath("units/spearman.png");
+	const auto& outputPath = QDir::current().absoluteFilePath("units/out/spearman-RC-magenta-1-red.png");
+
+	{
+		// With wespal-cli's default output directory, which contains the
+		// watched directory, changes must still be reported.
+		SourceWatcher watcher;
+		QSignalSpy spy{&watcher, &SourceWatcher::changed};
+
+		watcher.setExcludedDirectory(".");
+		watcher.setPaths({"units"});
+
+		QVERIFY(image.save(filePath));
+		QVERIFY(spy.wait(5000));
+		QVERIFY(spy.last().at(0).toStringList().contains(filePath));
+	}
+
+	{
+		// An output directory inside the watched directory is excluded
+		SourceWatcher watcher;
+		QSignalSpy spy{&watcher, &SourceWatcher::changed};
+
+		watcher.setExcludedDirectory("units/out");
+		watcher.setPaths({"units"});
+
+		QVERIFY(image.save(outputPath));
+		QVERIFY(image.save(filePath, "PNG", 0));
+		QVERIFY(spy.wait(5000));
+
+		QStringList changed;
+
+		for (const auto& args : spy)
+			changed += args.at(0).toStringList();
+
+		QVERIFY(changed.contains(filePath));
+		QVERIFY(!changed.contains(outputPath));
+	}
+
+	{
+		// Outputs written into the watched directory itself (e.g. with
+		// -o units -w units) are never reported
+		const auto& sameDirOutputPath = QDir::current().absoluteFilePath("units/spearman-RC-magenta-1-red.png");
+
+		SourceWatcher watcher;
+		QSignalSpy spy{&watcher, &SourceWatcher::changed};
+
+		watcher.setExcludedDirectory("units");
+		watcher.setOutputSuffixes({colorRangeSuffix("magenta", 1, "red")});
+		watcher.setPaths({"units"});
+
+		QVERIFY(image.save(sameDirOutputPath));
+		QVERIFY(!spy.wait(500));
+
+		QVERIFY(image.save(filePath, "PNG", 100));
+		QVERIFY(spy.wait(5000));
+
+		QStringList changed;
+
+		for (const auto& args : spy)
+			changed += args.at(0).toStringList();
+
+		QVERIFY(changed.contains(filePath));
+		QVERIFY(!changed.contains(sameDirOutputPath));
+	}
+}
+
+void TestMorningStar::testTrace()
+{
+#ifndef MOS_ENABLE_TRACING
+	QSKIP("Tracing support is not enabled in this build");
+#else
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+
+	const auto tracePath = dir.filePath("trace.json");
+
+	qputenv(MosTrace::pathVariable, QFile::encodeName(tracePath));
+	QVERIFY(MosTrace::start());
+	qunsetenv(MosTrace::pathVariable);
+
+	{
+		MOS_TRACE_SPAN("test", "Main thread span");
+		MOS_TRACE_COUNTER("Test counter", 42);
+	}
+
+	{
+		MosBatch::WorkStealingPool pool{2};
+
+		for (int i = 0; i < 4; ++i)
+		{
+			pool.submit([]() {
+				MOS_TRACE_SPAN("test", "Worker span");
+			});
+		}
+
+		pool.wait();
+	}
+
+	// Threads only keep their most recent events
+	constexpr qsizetype overflow = 100;
+
+	std::unique_ptr<QThread> busyThread{QThread::create([]() {
+		for (qsizetype i = 0; i < MosTrace::maxThreadEvents + overflow; ++i)
+			MOS_TRACE_COUNTER("Busy counter", i);
+	})};
+
+	busyThread->start();
+	QVERIFY(busyThread->wait());
+
+	MosTrace::finish();
+	QVERIFY(!MosTrace::enabled());
+
+	// Spans recorded after finishing are dropped
+	{
+		MOS_TRACE_SPAN("test", "Late span");
+	}
+
+	QFile file{tracePath};
+	QVERIFY(file.open(QIODevice::ReadOnly));
+
+	QJsonParseError error;
+	const auto doc = QJsonDocument::fromJson(file.readAll(), &error);
+	QCOMPARE(error.error, QJsonParseError::NoError);
+
+	const auto events = doc.object().value("traceEvents").toArray();
+
+	int mainSpans = 0, workerSpans = 0, counters = 0;
+	QSet<int> workerThreads;
+	int mainThread = -1;
+	qsizetype busyCounters = 0;
+	qint64 nextBusyValue = overflow;
+
+	for (const auto& value : events)
+	{
+		const auto event = value.toObject();
+		const auto name = event.value("name").toString();
+		const auto phase = event.value("ph").toString();
+
+		QVERIFY(name != "Late span");
+
+		if (phase == "X") {
+			QVERIFY(event.value("dur").toDouble() >= 0);
+			QCOMPARE(event.value("cat").toString(), "test");
+
+			if (name == "Main thread span") {
+				++mainSpans;
+				mainThread = event.value("tid").toInt();
+			} else if (name == "Worker span") {
+				++workerSpans;
+				workerThreads.insert(event.value("tid").toInt());
+			}
+		} else if (phase == "C" && name == "Busy counter") {
+			QCOMPARE(event.value("args").toObject().value("value").toInteger(), nextBusyValue);
+			++nextBusyValue;
+			++busyCounters;
+		} else if (phase == "C") {
+			QCOMPARE(name, "Test counter");
+			QCOMPARE(event.value("args").toObject().value("value").toInteger(), 42);
+			++counters;
+		}
+	}
+
+	QCOMPARE(mainSpans, 1);
+	QCOMPARE(workerSpans, 4);
+	QCOMPARE(counters, 1);
+	QCOMPARE(busyCounters, MosTrace::maxThreadEvents);
+	QVERIFY(!workerThreads.contains(mainThread));
+#endif
+}
@@ -27,7 +27,11 @@ class TestMorningStar: public QObject
 	Q_OBJECT
 
 private slots:
+	void initTestCase();
 	void testMru();
+	void testMruThumbnailCache();
+	void testRecentFileThumbnails();
+	void testColorLibrary();
 	void testBuiltinObjects();
 	void testRecolorAlgorithm();
 	void testWesnothRcImage();
@@ -35,5 +39,21 @@ private slots:
 	void testColorShiftImage();
 	void testColorBlendImage();
 	void testUniqueColorsFromImage();
+	void testXcfTransparentPixels();
+	void testXcfLayerComposition();
+	void testXcfSkippedLayers();
+	void testPsdCmykConversion();
+	void testPsdLabConversion();
+	void testPsdPlanes();
 	void testWriteBase64();
+	void testBatchFileNames();
+	void testBatchCollectSources();
+	void testBatchSpecs();
+	void testWorkStealingPool();
+	void testRecolorProtocolFraming();
+	void testRecolorRequests();
+	void testBatchIncremental();
+	void testSourceWatcher();
+	void testSourceWatcherExclusion();
+	void testTrace();
 };
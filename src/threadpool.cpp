@@ -0,0 +1,184 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "threadpool.hpp"
+
+#include <QThread>
+
+namespace MosBatch {
+
+namespace {
+
+// Identifies the pool and worker index of the current thread, if any, so
+// that tasks spawned by tasks go to the spawning worker's own queue.
+thread_local const WorkStealingPool* currentPool = nullptr;
+thread_local int currentWorker = -1;
+
+} // end unnamed namespace
+
+WorkStealingPool::WorkStealingPool(int threadCount)
+	: workers_()
+	, threads_()
+	, sleepMutex_()
+	, wakeup_()
+	, done_()
+	, queued_(0)
+	, pending_(0)
+	, nextQueue_(0)
+	, quit_(false)
+{
+	if (threadCount <= 0)
+		threadCount = qMax(1, QThread::idealThreadCount());
+
+	workers_.reserve(threadCount);
+	threads_.reserve(threadCount);
+
+	for (int i = 0; i < threadCount; ++i)
+		workers_.emplace_back(std::make_unique<Worker>());
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		threads_.emplace_back(QThread::create([this, i]() { run(i); }));
+		threads_.back()->setObjectName(QString{"Pool worker %1"}.arg(i + 1));
+		threads_.back()->start();
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	wait();
+
+	{
+		QMutexLocker lock{&sleepMutex_};
+		quit_ = true;
+		wakeup_.wakeAll();
+	}
+
+	for (auto& thread : threads_)
+		thread->wait();
+}
+
+void WorkStealingPool::submit(TaskType task)
+{
+	const int target = currentPool == this
+					   ? currentWorker
+					   : int(nextQueue_++ % workers_.size());
+
+	++pending_;
+
+	{
+		auto& worker = *workers_[target];
+		QMutexLocker lock{&worker.mutex};
+		worker.tasks.emplace_front(std::move(task));
+	}
+
+	++queued_;
+
+	QMutexLocker lock{&sleepMutex_};
+	wakeup_.wakeOne();
+}
+
+void WorkStealingPool::wait()
+{
+	Q_ASSERT(currentPool != this);
+
+	QMutexLocker lock{&sleepMutex_};
+
+	while (pending_ > 0)
+		done_.wait(&sleepMutex_);
+}
+
+bool WorkStealingPool::popLocal(int index, TaskType& task)
+{
+	auto& worker = *workers_[index];
+	QMutexLocker lock{&worker.mutex};
+
+	if (worker.tasks.empty())
+		return false;
+
+	task = std::move(worker.tasks.front());
+	worker.tasks.pop_front();
+	--queued_;
+
+	return true;
+}
+
+bool WorkStealingPool::steal(int thief, TaskType& task)
+{
+	const int count = int(workers_.size());
+
+	for (int offset = 1; offset < count; ++offset)
+	{
+		auto& victim = *workers_[(thief + offset) % count];
+		QMutexLocker lock{&victim.mutex};
+
+		if (victim.tasks.empty())
+			continue;
+
+		task = std::move(victim.tasks.back());
+		victim.tasks.pop_back();
+		--queued_;
+
+		return true;
+	}
+
+	return false;
+}
+
+void WorkStealingPool::run(int index)
+{
+	currentPool = this;
+	currentWorker = index;
+
+	for (;;)
+	{
+		TaskType task;
+
+		if (popLocal(index, task) || steal(index, task)) {
+			try {
+				task();
+			} catch (...) {
+				// Tasks are expected to report their own errors; this only
+				// exists to keep the pending task count consistent.
+				Q_ASSERT(false);
+			}
+
+			if (--pending_ == 0) {
+				QMutexLocker lock{&sleepMutex_};
+				done_.wakeAll();
+			}
+
+			continue;
+		}
+
+		QMutexLocker lock{&sleepMutex_};
+
+		if (quit_)
+			break;
+
+		if (queued_ == 0)
+			wakeup_.wait(&sleepMutex_);
+	}
+
+	currentPool = nullptr;
+	currentWorker = -1;
+}
+
+} // end namespace MosBatch
@@ -0,0 +1,116 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class QThread;
+
+namespace MosBatch {
+
+/**
+ * Fixed-size thread pool with per-worker task queues and work stealing.
+ *
+ * Each worker owns a double-ended queue. Tasks submitted from a worker
+ * thread (e.g. the per-output steps of a per-source task) go to the front
+ * of that worker's own queue so they run while the source data is still
+ * hot in cache. Idle workers steal from the back of other workers' queues,
+ * which keeps all cores busy even when sources differ wildly in size.
+ *
+ * Tasks submitted from outside the pool are distributed round-robin.
+ */
+class WorkStealingPool
+{
+public:
+	typedef std::function<void()> TaskType;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param threadCount  Number of worker threads. If zero or negative, the
+	 *                     number of logical CPU cores is used instead.
+	 */
+	explicit WorkStealingPool(int threadCount = 0);
+
+	/**
+	 * Destructor. Waits for all pending tasks to complete first.
+	 */
+	~WorkStealingPool();
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	/**
+	 * Queues a task for execution.
+	 *
+	 * This may be called from any thread including the pool's own workers.
+	 */
+	void submit(TaskType task);
+
+	/**
+	 * Blocks until every submitted task (including tasks submitted by other
+	 * tasks) has completed.
+	 *
+	 * @note This must not be called from a worker thread.
+	 */
+	void wait();
+
+	/**
+	 * Returns the number of worker threads.
+	 */
+	int threadCount() const
+	{
+		return int(threads_.size());
+	}
+
+private:
+	struct Worker
+	{
+		QMutex mutex;
+		std::deque<TaskType> tasks;
+	};
+
+	void run(int index);
+
+	bool popLocal(int index, TaskType& task);
+	bool steal(int thief, TaskType& task);
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::unique_ptr<QThread>> threads_;
+
+	QMutex sleepMutex_;
+	QWaitCondition wakeup_;
+	QWaitCondition done_;
+
+	std::atomic<qsizetype> queued_;
+	std::atomic<qsizetype> pending_;
+	std::atomic<unsigned> nextQueue_;
+	bool quit_;
+};
+
+} // end namespace MosBatch
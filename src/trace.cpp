@@ -0,0 +1,275 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "trace.hpp"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace MosTrace {
+
+namespace detail {
+
+std::atomic<bool> active{false};
+
+} // end namespace detail
+
+namespace {
+
+struct Event
+{
+	const char* category;
+	const char* name;
+	qint64 timestamp;
+	/** Duration for spans, value for counters. */
+	qint64 value;
+	bool counter;
+};
+
+/**
+ * Per-thread ring buffer of events.
+ */
+struct ThreadBuffer
+{
+	QMutex mutex;
+	std::vector<Event> events;
+	/** Index of the oldest event once the buffer is full. */
+	std::size_t next = 0;
+	qint64 discarded = 0;
+	int id = 0;
+	QString name;
+
+	void append(const Event& event)
+	{
+		if (events.size() < std::size_t(maxThreadEvents)) {
+			events.push_back(event);
+			return;
+		}
+
+		events[next] = event;
+		next = (next + 1) % events.size();
+		++discarded;
+	}
+};
+
+struct Registry
+{
+	QMutex mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+	QElapsedTimer clock;
+	QString path;
+};
+
+Registry& registry()
+{
+	static Registry instance;
+	return instance;
+}
+
+thread_local ThreadBuffer* currentBuffer = nullptr;
+
+ThreadBuffer& threadBuffer()
+{
+	if (currentBuffer)
+		return *currentBuffer;
+
+	auto& reg = registry();
+	auto buffer = std::make_unique<ThreadBuffer>();
+	auto* app = QCoreApplication::instance();
+
+	buffer->events.reserve(4096);
+
+	QMutexLocker lock{&reg.mutex};
+
+	buffer->id = int(reg.buffers.size()) + 1;
+
+	if (!QThread::currentThread()->objectName().isEmpty()) {
+		buffer->name = QThread::currentThread()->objectName();
+	} else if (app && QThread::currentThread() == app->thread()) {
+		buffer->name = QStringLiteral("Main thread");
+	} else {
+		buffer->name = QStringLiteral("Thread %1").arg(buffer->id);
+	}
+
+	currentBuffer = buffer.get();
+	reg.buffers.emplace_back(std::move(buffer));
+
+	return *currentBuffer;
+}
+
+QString escaped(const QString& string)
+{
+	QString res;
+
+	res.reserve(string.size());
+
+	for (const auto c : string)
+	{
+		if (c == u'"' || c == u'\\')
+			res += u'\\';
+
+		if (c.unicode() < 0x20)
+			res += QStringLiteral("\\u%1").arg(c.unicode(), 4, 16, QChar{u'0'});
+		else
+			res += c;
+	}
+
+	return res;
+}
+
+void writeTrace(const QString& path)
+{
+	QFile file{path};
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+		qWarning("Could not write trace to %s", qPrintable(path));
+		return;
+	}
+
+	QTextStream out{&file};
+	const auto pid = QCoreApplication::applicationPid();
+	auto& reg = registry();
+	bool first = true;
+
+	// Timestamps are in microseconds
+	out.setRealNumberNotation(QTextStream::FixedNotation);
+	out.setRealNumberPrecision(3);
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	QMutexLocker regLock{&reg.mutex};
+
+	for (const auto& buffer : reg.buffers)
+	{
+		QMutexLocker lock{&buffer->mutex};
+
+		out << (first ? "" : ",\n")
+			<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+			<< ",\"tid\":" << buffer->id
+			<< ",\"args\":{\"name\":\"" << escaped(buffer->name) << "\"}}";
+
+		first = false;
+
+		if (buffer->discarded > 0) {
+			qWarning("Discarded the oldest %lld trace events for %s",
+					 buffer->discarded, qPrintable(buffer->name));
+		}
+
+		// Oldest events first
+		const auto count = buffer->events.size();
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const auto& event = buffer->events[(buffer->next + i) % count];
+
+			out << ",\n{\"name\":\"" << escaped(QString::fromUtf8(event.name))
+				<< "\",\"pid\":" << pid << ",\"tid\":" << buffer->id
+				<< ",\"ts\":" << double(event.timestamp) / 1000.0;
+
+			if (event.counter) {
+				out << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+			} else {
+				out << ",\"ph\":\"X\",\"cat\":\"" << escaped(QString::fromUtf8(event.category))
+					<< "\",\"dur\":" << double(event.value) / 1000.0 << '}';
+			}
+		}
+	}
+
+	out << "\n]}\n";
+}
+
+} // end unnamed namespace
+
+bool start()
+{
+#ifdef MOS_ENABLE_TRACING
+	if (enabled())
+		return true;
+
+	const auto path = qEnvironmentVariable(pathVariable);
+
+	if (path.isEmpty())
+		return false;
+
+	// The registry must be constructed before registering the exit handler
+	// so that it is still alive by the time the handler runs
+	auto& reg = registry();
+
+	reg.path = path;
+	reg.clock.start();
+
+	detail::active = true;
+
+	std::atexit(finish);
+
+	return true;
+#else
+	if (qEnvironmentVariableIsSet(pathVariable))
+		qWarning("%s is set but this build does not support tracing", pathVariable);
+
+	return false;
+#endif
+}
+
+void finish()
+{
+	if (!detail::active.exchange(false))
+		return;
+
+	writeTrace(registry().path);
+}
+
+qint64 now()
+{
+	return registry().clock.nsecsElapsed();
+}
+
+void recordSpan(const char* category, const char* name, qint64 start, qint64 end)
+{
+	if (!enabled())
+		return;
+
+	auto& buffer = threadBuffer();
+	QMutexLocker lock{&buffer.mutex};
+
+	buffer.append({category, name, start, end - start, false});
+}
+
+void recordCounter(const char* name, qint64 value)
+{
+	if (!enabled())
+		return;
+
+	const auto timestamp = now();
+	auto& buffer = threadBuffer();
+	QMutexLocker lock{&buffer.mutex};
+
+	buffer.append({nullptr, name, timestamp, value, true});
+}
+
+} // end namespace MosTrace
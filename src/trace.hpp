@@ -0,0 +1,166 @@
+/*
+ * Wespal (codename Morning Star) - Wesnoth assets recoloring tool
+ *
+ * Copyright (C) 2024 by Iris Morelle <iris@irydacea.me>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <QtGlobal>
+
+#include <atomic>
+
+/**
+ * Lightweight tracing support for profiling purposes.
+ *
+ * When Wespal is built with ENABLE_TRACING and the WESPAL_TRACE environment
+ * variable is set to a file path, scoped spans and counters recorded by any
+ * thread are collected in memory and written to that path on exit in the
+ * Chrome trace event JSON format, which can be loaded in Perfetto or
+ * chrome://tracing.
+ *
+ * Spans and counters should be recorded using the MOS_TRACE_SPAN and
+ * MOS_TRACE_COUNTER macros, which compile to nothing when tracing support
+ * is not built in. Otherwise, the cost of a span while tracing is not
+ * enabled at run time is a single relaxed atomic load.
+ *
+ * Span and counter names must be string literals (or otherwise outlive the
+ * program) since only their addresses are stored.
+ *
+ * Each thread keeps at most maxThreadEvents events, so that memory use stays
+ * bounded in long sessions (e.g. when watching files for changes). Once a
+ * thread reaches that limit, its oldest events are discarded to make room
+ * for new ones, and the number of discarded events is reported when the
+ * trace is written.
+ */
+namespace MosTrace {
+
+/**
+ * Environment variable holding the trace output file path.
+ */
+inline constexpr char pathVariable[] = "WESPAL_TRACE";
+
+/**
+ * Maximum number of events kept for each thread (about 2.5 MiB worth).
+ */
+inline constexpr qsizetype maxThreadEvents = 65536;
+
+namespace detail {
+
+extern std::atomic<bool> active;
+
+} // end namespace detail
+
+/**
+ * Starts tracing if requested through the environment.
+ *
+ * This should be called as early as possible in main(). The trace is
+ * written automatically on exit, or earlier by calling finish().
+ *
+ * @return Whether tracing is enabled.
+ */
+bool start();
+
+/**
+ * Stops tracing and writes the trace to disk.
+ *
+ * Does nothing if tracing is not enabled or was already finished.
+ */
+void finish();
+
+/**
+ * Returns whether tracing is currently enabled.
+ */
+inline bool enabled()
+{
+	return detail::active.load(std::memory_order_relaxed);
+}
+
+/**
+ * Returns the current trace timestamp in nanoseconds.
+ */
+qint64 now();
+
+/**
+ * Records a completed span for the current thread.
+ */
+void recordSpan(const char* category, const char* name, qint64 start, qint64 end);
+
+/**
+ * Records the value of a counter.
+ */
+void recordCounter(const char* name, qint64 value);
+
+/**
+ * Records a span covering the lifetime of this object.
+ */
+class Span
+{
+public:
+	Span(const char* category, const char* name)
+		: category_(category)
+		, name_(name)
+		, start_(enabled() ? now() : -1)
+	{
+	}
+
+	~Span()
+	{
+		if (start_ >= 0)
+			recordSpan(category_, name_, start_, now());
+	}
+
+	Span(const Span&) = delete;
+	Span& operator=(const Span&) = delete;
+
+private:
+	const char* category_;
+	const char* name_;
+	qint64 start_;
+};
+
+} // end namespace MosTrace
+
+#ifdef MOS_ENABLE_TRACING
+
+#define MOS_TRACE_CONCAT_IMPL(a, b) a##b
+#define MOS_TRACE_CONCAT(a, b) MOS_TRACE_CONCAT_IMPL(a, b)
+
+/**
+ * Records a span from this point to the end of the enclosing scope.
+ */
+#define MOS_TRACE_SPAN(category, name) \
+	const MosTrace::Span MOS_TRACE_CONCAT(mosTraceSpan_, __LINE__){category, name}
+
+/**
+ * Records the current value of a counter.
+ */
+#define MOS_TRACE_COUNTER(name, value) \
+	do { \
+		if (MosTrace::enabled()) \
+			MosTrace::recordCounter(name, value); \
+	} while (false)
+
+#else
+
+#define MOS_TRACE_SPAN(category, name) \
+	do {} while (false)
+
+#define MOS_TRACE_COUNTER(name, value) \
+	do {} while (false)
+
+#endif
@@ -26,6 +26,7 @@
 
 #include "wesnothrc.hpp"
 
+#include "trace.hpp"
 #include "version.hpp"
 
 #include <QBuffer>
@@ -224,6 +225,8 @@ ColorSet uniqueColorsFromImage(const QImage& input)
 QImage recolorImage(const QImage& input,
 					const ColorMap& colorMap)
 {
+	MOS_TRACE_SPAN("kernel", "recolorImage");
+
 	QImage output;
 
 	// Copy input to output first. We force ARGB32 since that's the only
@@ -261,6 +264,8 @@ QImage colorBlendImage(const QImage& input,
 					   const QColor& color,
 					   qreal blendFactor)
 {
+	MOS_TRACE_SPAN("kernel", "colorBlendImage");
+
 	QImage output;
 
 	// Copy input to output first. We force ARGB32 since that's the only
@@ -312,6 +317,8 @@ QImage colorShiftImage(const QImage& input,
 					   int greenShift,
 					   int blueShift)
 {
+	MOS_TRACE_SPAN("kernel", "colorShiftImage");
+
 	QImage output;
 
 	// Copy input to output first. We force ARGB32 since that's the only
@@ -353,6 +360,8 @@ static bool writeImageDeviceAgnostic(QImageWriter& out,
 									 QImage& input,
 									 bool vanityPlate = false)
 {
+	MOS_TRACE_SPAN("io", "PNG encode");
+
 	static QString stamp = QString{"Wespal v%1"}.arg(MOS_VERSION);
 
 	if (vanityPlate)
@@ -388,14 +397,24 @@ bool writePng(QImage& input, const QString& fileName, bool vanityPlate)
 	return writeImageDeviceAgnostic(out, input, vanityPlate);
 }
 
-QString writeBase64Png(QImage& input, bool dataUri)
+QByteArray writePngData(QImage& input, bool vanityPlate)
 {
-	QString res;
 	QByteArray data;
 	QBuffer buf{&data};
 	QImageWriter out{&buf, "PNG"};
 
-	if (writeImageDeviceAgnostic(out, input)) {
+	if (!writeImageDeviceAgnostic(out, input, vanityPlate))
+		return {};
+
+	return data;
+}
+
+QString writeBase64Png(QImage& input, bool dataUri)
+{
+	QString res;
+	const auto& data = writePngData(input, false);
+
+	if (!data.isEmpty()) {
 		if (dataUri)
 			res = "data:image/png;base64,";
 		res.append(data.toBase64());
@@ -302,6 +302,21 @@ namespace MosIO {
  */
 bool writePng(QImage& input, const QString& fileName, bool vanityPlate = true);
 
+/**
+ * Writes a QImage to a memory buffer as a PNG file.
+ *
+ * @param input        Input image (see notes).
+ * @param vanityPlate  Whether to include the Wespal version in the output.
+ *
+ * @return The PNG file's contents, or an empty buffer if encoding failed.
+ *
+ * @note @a input is assumed to be in ARGB32 format, although this is not
+ *       a particularly significant assumption anyway. More importantly, this
+ *       function may MODIFY its input to ensure that its color space
+ *       configuration is correct for the intended output format.
+ */
+QByteArray writePngData(QImage& input, bool vanityPlate = true);
+
 /**
  * Writes a QImage to a string as Base64 data containing a valid PNG file.
  *